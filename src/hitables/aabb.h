@@ -20,8 +20,43 @@ SOFTWARE.
 #pragma once
 
 #include "util/vec3.h"
+#include "util/vec4.h"
 #include "util/ray.h"
 
+// Ray data of the slab tests, computed once per ray.
+struct SlabRay
+{
+
+    CUDA_DEV SlabRay(const Ray& r) :
+                     origin(r.origin()),
+                     invDir(rcp(Vec4(r.direction(), 1.0f))),
+                     negative(lessThan(invDir, Vec4(0.0f)))
+    {
+
+    }
+
+    Vec4 origin;
+    Vec4 invDir;
+    Vec4 negative;      // lanes of the negative directions
+
+};
+
+// Slab test of the box from lo to hi in the x, y and z lanes, w is ignored.
+// Distances are swapped on the negative axes and NaN distances skipped like
+// in a test per axis, so both give the same result.
+inline CUDA_DEV bool slabTest(const Vec4& lo, const Vec4& hi, const SlabRay& ray,
+                              float tMin, float tMax)
+{
+
+    Vec4 t0 = (lo - ray.origin) * ray.invDir;
+    Vec4 t1 = (hi - ray.origin) * ray.invDir;
+    Vec4 tNear = select(ray.negative, t1, t0);
+    Vec4 tFar = select(ray.negative, t0, t1);
+
+    return !(hmin3(tFar, tMax) <= hmax3(tNear, tMin));
+
+}
+
 class AABB
 {
 
@@ -47,6 +82,18 @@ class AABB
             return aabbMax;
         }
 
+        CUDA_DEV Vec3 centroid() const
+        {
+            return 0.5f*(aabbMin + aabbMax);
+        }
+
+        // Surface area of the box, used by the surface area heuristic.
+        CUDA_DEV float surfaceArea() const
+        {
+            Vec3 d = aabbMax - aabbMin;
+            return 2.0f*(d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+        }
+
         CUDA_DEV bool hit(const Ray& r, float tMin, float tMax) const;
 
 };
@@ -54,27 +101,7 @@ class AABB
 inline CUDA_DEV bool AABB::hit(const Ray& r, float tMin, float tMax) const
 {
 
-    for (int a = 0; a < 3; a++)
-    {
-        float invD = 1.0f / r.direction()[a];
-        float t0 = (min()[a] - r.origin()[a]) * invD;
-        float t1 = (max()[a] - r.origin()[a]) * invD;
-
-        if (invD < 0.0f)
-        {
-            float aux = t0;
-            t0 = t1;
-            t1 = aux;
-        }
-
-        tMin = t0 > tMin ? t0 : tMin;
-        tMax = t1 < tMax ? t1 : tMax;
-
-        if (tMax <= tMin)
-            return false;
-    }
-
-    return true;
+    return slabTest(Vec4(aabbMin), Vec4(aabbMax), SlabRay(r), tMin, tMax);
 
 }
 
@@ -0,0 +1,215 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include "hitables/bvh.h"
+#include "hitables/compressedbvh.h"
+#include "hitables/grid.h"
+#include "hitables/kdtree.h"
+#include "hitables/linearbvh.h"
+#include "hitables/motionbvh.h"
+#include "hitables/packedbvh.h"
+#include "hitables/widebvh.h"
+
+// Builds the acceleration structure selected by params over the first n hitables of l.
+inline Hitable* buildAccelerator(Hitable **l, int n, float t0, float t1,
+                                 const BVHBuildParams& params = BVHBuildParams())
+{
+
+    switch (params.layout)
+    {
+        case BVH_LINEAR:
+            return sceneNew<LinearBVH>(l, n, t0, t1, params);
+        case BVH_BATCHED:
+        {
+            // One batch test costs about as much as two single primitives, so
+            // let the SAH make leaves that fill the batches.
+            BVHBuildParams batchParams = params;
+            batchParams.maxLeafSize = std::max(params.maxLeafSize, leafBatchWidth);
+            batchParams.intersectionCost = params.intersectionCost * 2.0f / leafBatchWidth;
+            return sceneNew<LinearBVH>(l, n, t0, t1, batchParams);
+        }
+        case BVH_WIDE4:
+            return sceneNew<WideBVH<4>>(l, n, t0, t1, params);
+        case BVH_WIDE8:
+            return sceneNew<WideBVH<8>>(l, n, t0, t1, params);
+        case BVH_MOTION:
+            return sceneNew<MotionBVH>(l, n, t0, t1, params);
+        case BVH_COMPRESSED8:
+            return sceneNew<CompressedBVH<uint8_t>>(l, n, t0, t1, params);
+        case BVH_COMPRESSED16:
+            return sceneNew<CompressedBVH<uint16_t>>(l, n, t0, t1, params);
+        case UNIFORM_GRID:
+            return sceneNew<UniformGrid>(l, n, t0, t1, params);
+        case KD_TREE:
+            return sceneNew<KdTree>(l, n, t0, t1, params);
+        case BVH_POINTER_TREE:
+        default:
+            if (params.nodeOrder != BVH_ORDER_ALLOCATION)
+            {
+                // The pointer tree is only copied from and deleted, keep it
+                // out of the scene arena.
+                BVHNode* root;
+                {
+                    SceneArena::Scope heap(nullptr);
+                    root = new BVHNode(l, n, t0, t1, params);
+                }
+                return sceneNew<PackedBVH>(root, params.nodeOrder);
+            }
+            return sceneNew<BVHNode>(l, n, t0, t1, params);
+    }
+
+}
+
+// Acceleration structure for frame sequences in which the primitives move
+// but the primitive list stays the same. update() refits the tree to the
+// new positions and only rebuilds it once the SAH cost of the refitted
+// tree has grown by more than rebuildThreshold over the freshly built one.
+// The compressed BVHs, the grid and the kd-tree can't be refitted and are
+// rebuilt on every update.
+class DynamicAccelerator : public Hitable
+{
+
+    public:
+
+        DynamicAccelerator(Hitable **l, int n, float t0, float t1,
+                           const BVHBuildParams& params = BVHBuildParams(),
+                           float rebuildThreshold = 0.3f) :
+                           refitCount(0),
+                           buildCount(0),
+                           lastUpdateMs(0.0),
+                           list(l, l + n),
+                           params(params),
+                           rebuildThreshold(rebuildThreshold),
+                           accelerator(nullptr),
+                           growth(1.0f)
+        {
+            rebuild(t0, t1);
+        }
+
+        // Call after moving the primitives. Returns true if the tree was rebuilt.
+        bool update(float t0, float t1)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+
+            bool rebuilt = true;
+            if (canRefit())
+            {
+                float refittedCost = refit(t0, t1);
+                refitCount++;
+                growth = builtCost > 0.0f ? refittedCost / builtCost : 1.0f;
+                rebuilt = growth > 1.0f + rebuildThreshold;
+            }
+            if (rebuilt)
+                rebuild(t0, t1);
+
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            lastUpdateMs = elapsed.count();
+
+            return rebuilt;
+        }
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override
+        {
+            return accelerator->hit(r, tMin, tMax, rec);
+        }
+
+        bool occluded(const Ray& r, float tMin, float tMax) const override
+        {
+            return accelerator->occluded(r, tMin, tMax);
+        }
+
+        bool boundingBox(float t0, float t1, AABB& box) const override
+        {
+            return accelerator->boundingBox(t0, t1, box);
+        }
+
+        // The ids stay with the primitives over rebuilds.
+        void bindMaterials(MaterialTable& table) override
+        {
+            for (Hitable* primitive : list)
+                primitive->bindMaterials(table);
+        }
+
+        // SAH cost of the tree refitted by the last update() relative to
+        // the cost after the last build, before a possible rebuild.
+        float sahGrowth() const
+        {
+            return growth;
+        }
+
+        int refitCount;
+        int buildCount;             // including the initial build
+        double lastUpdateMs;
+
+    private:
+
+        // Every tree lives in its own arena, so a rebuild frees all of its
+        // nodes and leaf lists at once, whatever the layout.
+        void rebuild(float t0, float t1)
+        {
+            trees.clear();
+            SceneArena::Scope scope(&trees);
+            accelerator = buildAccelerator(list.data(), static_cast<int>(list.size()), t0, t1, params);
+            buildCount++;
+
+            // Measured with the refit so both costs use the same metric.
+            builtCost = canRefit() ? refit(t0, t1) : 0.0f;
+        }
+
+        bool canRefit() const
+        {
+            return params.layout != BVH_COMPRESSED8 && params.layout != BVH_COMPRESSED16 &&
+                   params.layout != UNIFORM_GRID && params.layout != KD_TREE;
+        }
+
+        float refit(float t0, float t1)
+        {
+            switch (params.layout)
+            {
+                case BVH_LINEAR:
+                case BVH_BATCHED:
+                    return static_cast<LinearBVH*>(accelerator)->refit(t0, t1, params);
+                case BVH_WIDE4:
+                    return static_cast<WideBVH<4>*>(accelerator)->refit(t0, t1, params);
+                case BVH_WIDE8:
+                    return static_cast<WideBVH<8>*>(accelerator)->refit(t0, t1, params);
+                case BVH_MOTION:
+                    return static_cast<MotionBVH*>(accelerator)->refit(t0, t1, params);
+                case BVH_POINTER_TREE:
+                default:
+                    if (params.nodeOrder != BVH_ORDER_ALLOCATION)
+                        return static_cast<PackedBVH*>(accelerator)->refit(t0, t1, params);
+                    return static_cast<BVHNode*>(accelerator)->refit(t0, t1, params);
+            }
+        }
+
+        std::vector<Hitable*> list;
+        BVHBuildParams params;
+        float rebuildThreshold;
+        SceneArena trees;
+        Hitable* accelerator;
+        float builtCost;
+        float growth;
+
+};
@@ -19,8 +19,137 @@ SOFTWARE.
 
 #pragma once
 
+#include <vector>
+#include <algorithm>
+#include <float.h>
+#include <stdint.h>
+
 #include "hitable.h"
+#include "hitablelist.h"
+#include "morton.h"
+#include "movingsphere.h"
+#include "sphere.h"
+#include "util/arena.h"
 #include "util/randomgenerator.h"
+#include "util/stats.h"
+
+// Strategy used to split the primitives of a BVH node.
+enum BVHBuilder
+{
+    MEDIAN_SPLIT,       // sort along one axis and split at n/2
+    SAH_BINNED,         // binned surface area heuristic
+    MORTON_LBVH         // sort by Morton code and split at the highest differing bit, see morton.h
+};
+
+// Memory layout of the built tree. The last entries select the acceleration
+// structures that are not BVHs, they ignore the builder.
+enum BVHLayout
+{
+    BVH_POINTER_TREE,   // separately allocated BVHNodes
+    BVH_LINEAR,         // flattened depth-first node array, see linearbvh.h
+    BVH_BATCHED,        // linear BVH with sphere and triangle leaves packed into 8 wide batches, see leafbatch.h
+    BVH_WIDE4,          // 4 children per node with SIMD box tests, see widebvh.h
+    BVH_WIDE8,          // 8 children per node
+    BVH_MOTION,         // linear motion bounds interpolated to the ray time, see motionbvh.h
+    BVH_COMPRESSED8,    // child bounds quantized to 8 bits, see compressedbvh.h
+    BVH_COMPRESSED16,   // child bounds quantized to 16 bits
+    UNIFORM_GRID,       // uniform or hashed grid traversed with 3D-DDA, see grid.h
+    KD_TREE             // SAH kd-tree, see kdtree.h
+};
+
+// Order of the BVH_POINTER_TREE nodes in memory, see packedbvh.h.
+enum BVHNodeOrder
+{
+    BVH_ORDER_ALLOCATION,       // wherever new put the nodes during the build
+    BVH_ORDER_DEPTH_FIRST,      // one array in depth-first order
+    BVH_ORDER_TREELET,          // page sized treelets of the most likely visited nodes
+    BVH_ORDER_VAN_EMDE_BOAS     // recursive halving of the tree height
+};
+
+struct BVHBuildParams
+{
+
+    BVHBuilder builder;
+    BVHLayout layout;
+    int binCount;               // number of centroid bins per axis
+    int maxLeafSize;            // nodes with more primitives are always split
+    float traversalCost;        // cost of one box test
+    float intersectionCost;     // cost of one primitive test
+    bool orderedTraversal;      // visit the nearer child first and cull with the closest hit
+    int mortonBits;             // 30 or 63 bit Morton codes for MORTON_LBVH
+    bool treeletOptimization;   // restructure treelets of the linear BVH for a lower SAH cost
+    float gridDensity;          // grid cells per primitive for UNIFORM_GRID
+    bool hashedGrid;            // hash the grid cells into a table sized by the primitive count
+    float emptyBonus;           // cost reduction of kd-tree splits with an empty side
+    BVHNodeOrder nodeOrder;     // memory order of the pointer tree nodes
+
+    CUDA_HOSTDEV BVHBuildParams(BVHBuilder builder = SAH_BINNED,
+                                BVHLayout layout = BVH_LINEAR,
+                                int binCount = 16,
+                                int maxLeafSize = 4,
+                                float traversalCost = 1.0f,
+                                float intersectionCost = 1.0f,
+                                bool orderedTraversal = true,
+                                int mortonBits = 30,
+                                bool treeletOptimization = false,
+                                float gridDensity = 4.0f,
+                                bool hashedGrid = false,
+                                float emptyBonus = 0.5f,
+                                BVHNodeOrder nodeOrder = BVH_ORDER_ALLOCATION) :
+                                builder(builder),
+                                layout(layout),
+                                binCount(binCount),
+                                maxLeafSize(maxLeafSize),
+                                traversalCost(traversalCost),
+                                intersectionCost(intersectionCost),
+                                orderedTraversal(orderedTraversal),
+                                mortonBits(mortonBits),
+                                treeletOptimization(treeletOptimization),
+                                gridDensity(gridDensity),
+                                hashedGrid(hashedGrid),
+                                emptyBonus(emptyBonus),
+                                nodeOrder(nodeOrder)
+    {
+
+    }
+
+};
+
+// SAH cost of a node over the boxes and costs of its two children.
+inline CUDA_DEV float sahNodeCost(const AABB& box, const AABB& boxLeft, const AABB& boxRight,
+                                  float leftCost, float rightCost,
+                                  const BVHBuildParams& params)
+{
+
+    float area = box.surfaceArea();
+    if (area > 0.0f)
+        return params.traversalCost +
+               (boxLeft.surfaceArea()*leftCost + boxRight.surfaceArea()*rightCost) / area;
+
+    return params.traversalCost + leftCost + rightCost;
+
+}
+
+// Primitive data cached once per build, so the SAH builder does not
+// have to call boundingBox() on every level of the tree.
+struct BVHPrimitiveInfo
+{
+
+    Hitable* hitable;
+    AABB box;
+    Vec3 centroid;
+
+};
+
+struct BVHSplit
+{
+
+    int axis;                   // -1 if the centroids can't be separated
+    int bin;                    // last bin of the left side
+    float cost;
+    AABB centroidBounds;
+
+};
 
 class BVHNode : public Hitable
 {
@@ -29,30 +158,182 @@ class BVHNode : public Hitable
 
         CUDA_DEV BVHNode() {}
         CUDA_DEV BVHNode(Hitable **l, int n, float t0, float t1);
+        BVHNode(Hitable **l, int n, float t0, float t1, const BVHBuildParams& params);
         CUDA_DEV virtual bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        CUDA_DEV virtual bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        CUDA_DEV virtual bool occluded(const Ray& r, float tMin, float tMax) const override;
         CUDA_DEV virtual bool boundingBox(float t0, float t1, AABB& box) const override;
 
+        CUDA_DEV HitableType hitableType() const override
+        {
+            return HITABLE_BVH_NODE;
+        }
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            if (!left)
+                return;
+            left->bindMaterials(table);
+            if (right != left)
+                right->bindMaterials(table);
+        }
+
+        // Expected cost of a ray traversing this subtree according to the SAH.
+        CUDA_DEV float sahCost() const
+        {
+            return cost;
+        }
+
+        // Bytes taken by the nodes of this subtree, without the primitives.
+        size_t memoryBytes() const
+        {
+            size_t bytes = sizeof(*this);
+            if (BVHNode* node = dynamic_cast<BVHNode*>(left))
+                bytes += node->memoryBytes();
+            if (right != left)
+                if (BVHNode* node = dynamic_cast<BVHNode*>(right))
+                    bytes += node->memoryBytes();
+            return bytes;
+        }
+
+        // Recomputes the boxes bottom-up for the current primitive positions
+        // while keeping the topology. Returns the new SAH cost.
+        float refit(float t0, float t1, const BVHBuildParams& params = BVHBuildParams());
+
         Hitable *left;
         Hitable *right;
+        uint8_t leftType;       // HitableType of the children
+        uint8_t rightType;
         AABB box;
+        float cost;
+        int axis;               // split axis, decides which child is nearer
+        bool ordered;
         RandomGenerator rng;
 
+    private:
+
+        // Intersect a child, calling the common types directly.
+        CUDA_DEV static bool intersectChild(const Hitable* child, uint8_t type,
+                                            const Ray& r, float tMin, float tMax, HitRecord& rec);
+        CUDA_DEV static bool occludedChild(const Hitable* child, uint8_t type,
+                                           const Ray& r, float tMin, float tMax);
+
+        CUDA_DEV void setChildTypes()
+        {
+            leftType = static_cast<uint8_t>(left->hitableType());
+            rightType = static_cast<uint8_t>(right->hitableType());
+        }
+
+        CUDA_DEV void buildMedian(Hitable **l, int n, float t0, float t1, bool orderedTraversal);
+
+        void buildSAH(BVHPrimitiveInfo* prims, Hitable **l, int n, float t0, float t1,
+                      const BVHBuildParams& params, const BVHSplit& split);
+
+        static Hitable* buildSAHSubtree(BVHPrimitiveInfo* prims, Hitable **l, int n, float t0, float t1,
+                                        const BVHBuildParams& params, float& subtreeCost);
+
+        void buildMorton(const MortonPrimitive* keys, Hitable **l, int n, float t0, float t1,
+                         const BVHBuildParams& params);
+
+        static Hitable* buildMortonSubtree(const MortonPrimitive* keys, Hitable **l, int n, float t0, float t1,
+                                           const BVHBuildParams& params, float& subtreeCost);
+
+        CUDA_DEV void computeCost(const AABB& boxLeft, const AABB& boxRight,
+                                  float leftCost, float rightCost,
+                                  const BVHBuildParams& params);
+
+        void refitSubtree(float t0, float t1, const BVHBuildParams& params, int depth);
+
+        static float refitChild(Hitable* child, float t0, float t1,
+                                const BVHBuildParams& params, int depth, AABB& childBox);
+
 };
 
+template <> struct SceneArenaDestroys<BVHNode> : std::false_type {};
+
 inline CUDA_DEV bool BVHNode::boundingBox(float t0, float t1, AABB& b) const
 {
     b = box;
-    return true;
+    return left != nullptr;
+}
+
+inline CUDA_DEV bool BVHNode::intersectChild(const Hitable* child, uint8_t type,
+                                             const Ray& r, float tMin, float tMax, HitRecord& rec)
+{
+
+    switch (type)
+    {
+        case HITABLE_BVH_NODE:
+            return static_cast<const BVHNode*>(child)->BVHNode::intersect(r, tMin, tMax, rec);
+        case HITABLE_SPHERE:
+            return static_cast<const Sphere*>(child)->Sphere::intersect(r, tMin, tMax, rec);
+        case HITABLE_MOVING_SPHERE:
+            return static_cast<const MovingSphere*>(child)->MovingSphere::intersect(r, tMin, tMax, rec);
+        default:
+            return child->intersect(r, tMin, tMax, rec);
+    }
+
+}
+
+inline CUDA_DEV bool BVHNode::occludedChild(const Hitable* child, uint8_t type,
+                                            const Ray& r, float tMin, float tMax)
+{
+
+    switch (type)
+    {
+        case HITABLE_BVH_NODE:
+            return static_cast<const BVHNode*>(child)->BVHNode::occluded(r, tMin, tMax);
+        case HITABLE_SPHERE:
+            return static_cast<const Sphere*>(child)->Sphere::occluded(r, tMin, tMax);
+        case HITABLE_MOVING_SPHERE:
+            return static_cast<const MovingSphere*>(child)->MovingSphere::occluded(r, tMin, tMax);
+        default:
+            return child->occluded(r, tMin, tMax);
+    }
+
 }
 
 inline CUDA_DEV bool BVHNode::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
 {
 
-    if (box.hit(r, tMin, tMax))
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+// The subtrees only report the distances, the closest hit is finalized once
+// by hit() at the root.
+inline CUDA_DEV bool BVHNode::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    STATS_ADD(bvhNodeVisits, 1);
+    STATS_TOUCH(bvhNodeCache, this);
+
+    if (!box.hit(r, tMin, tMax))
+        return false;
+
+    if (ordered)
+    {
+        // Visit the child on the near side of the split first, then shrink the
+        // interval to its closest hit so the far child can be culled early.
+        bool leftFirst = r.direction()[axis] >= 0.0f;
+        const Hitable* first = leftFirst ? left : right;
+        const Hitable* second = leftFirst ? right : left;
+        uint8_t firstType = leftFirst ? leftType : rightType;
+        uint8_t secondType = leftFirst ? rightType : leftType;
+
+        bool hitFirst = intersectChild(first, firstType, r, tMin, tMax, rec);
+        bool hitSecond = intersectChild(second, secondType, r, tMin, hitFirst ? rec.time : tMax, rec);
+
+        return hitFirst || hitSecond;
+    }
+    else
     {
         HitRecord leftRec, rightRec;
-        bool hitLeft = left->hit(r, tMin, tMax, leftRec);
-        bool hitRight = right->hit(r, tMin, tMax, rightRec);
+        bool hitLeft = intersectChild(left, leftType, r, tMin, tMax, leftRec);
+        bool hitRight = intersectChild(right, rightType, r, tMin, tMax, rightRec);
         if (hitLeft && hitRight)
         {
             if (leftRec.time < rightRec.time)
@@ -75,7 +356,27 @@ inline CUDA_DEV bool BVHNode::hit(const Ray& r, float tMin, float tMax, HitRecor
             return false;
     }
 
-    return false;
+}
+
+// Returns at the first intersection found, the child order only matters
+// for how soon that happens.
+inline CUDA_DEV bool BVHNode::occluded(const Ray& r, float tMin, float tMax) const
+{
+
+    STATS_ADD(bvhNodeVisits, 1);
+    STATS_TOUCH(bvhNodeCache, this);
+
+    if (!box.hit(r, tMin, tMax))
+        return false;
+
+    bool leftFirst = !ordered || r.direction()[axis] >= 0.0f;
+    const Hitable* first = leftFirst ? left : right;
+    const Hitable* second = leftFirst ? right : left;
+    uint8_t firstType = leftFirst ? leftType : rightType;
+    uint8_t secondType = leftFirst ? rightType : leftType;
+
+    return occludedChild(first, firstType, r, tMin, tMax) ||
+           occludedChild(second, secondType, r, tMin, tMax);
 
 }
 
@@ -145,8 +446,14 @@ inline CUDA_DEV int boxCompareZ(const void* a, const void* b)
 
 inline CUDA_DEV BVHNode::BVHNode(Hitable **l, int n, float t0, float t1)
 {
+    buildMedian(l, n, t0, t1, true);
+}
 
-    int axis = int(3*rng.get1f());
+inline CUDA_DEV void BVHNode::buildMedian(Hitable **l, int n, float t0, float t1, bool orderedTraversal)
+{
+
+    axis = int(3*rng.get1f());
+    ordered = orderedTraversal;
 
     if (axis == 0)
        qsort(l, n, sizeof(Hitable *), boxCompareX);
@@ -163,9 +470,14 @@ inline CUDA_DEV BVHNode::BVHNode(Hitable **l, int n, float t0, float t1)
     }
     else
     {
-        left = new BVHNode(l, n/2, t0, t1);
-        right = new BVHNode(l + n/2, n - n/2, t0, t1);
+        BVHNode* leftNode = sceneNew<BVHNode>();
+        BVHNode* rightNode = sceneNew<BVHNode>();
+        leftNode->buildMedian(l, n/2, t0, t1, orderedTraversal);
+        rightNode->buildMedian(l + n/2, n - n/2, t0, t1, orderedTraversal);
+        left = leftNode;
+        right = rightNode;
     }
+    setChildTypes();
 
     AABB boxLeft, boxRight;
     #ifndef CUDA_ENABLED
@@ -174,4 +486,447 @@ inline CUDA_DEV BVHNode::BVHNode(Hitable **l, int n, float t0, float t1)
     #endif
     box = surroundingBox(boxLeft, boxRight);
 
+    // Only the primitives of the two-element leaves are unknown to the cost model.
+    BVHBuildParams defaultParams;
+    float leftCost = n > 2 ? static_cast<BVHNode*>(left)->cost : defaultParams.intersectionCost;
+    float rightCost = n > 2 ? static_cast<BVHNode*>(right)->cost : defaultParams.intersectionCost;
+    computeCost(boxLeft, boxRight, leftCost, rightCost, defaultParams);
+
+}
+
+inline CUDA_DEV void BVHNode::computeCost(const AABB& boxLeft, const AABB& boxRight,
+                                          float leftCost, float rightCost,
+                                          const BVHBuildParams& params)
+{
+    cost = sahNodeCost(box, boxLeft, boxRight, leftCost, rightCost, params);
+}
+
+inline float BVHNode::refit(float t0, float t1, const BVHBuildParams& params)
+{
+
+    if (!left)
+        return cost;
+
+    #pragma omp parallel
+    #pragma omp single
+    refitSubtree(t0, t1, params, 0);
+
+    return cost;
+
+}
+
+inline void BVHNode::refitSubtree(float t0, float t1, const BVHBuildParams& params, int depth)
+{
+
+    // The upper levels of the tree are refitted in parallel.
+    float leftCost, rightCost;
+    AABB boxLeft, boxRight;
+    #pragma omp task if (depth < 8) shared(leftCost, boxLeft)
+    leftCost = refitChild(left, t0, t1, params, depth + 1, boxLeft);
+    if (right != left)
+        rightCost = refitChild(right, t0, t1, params, depth + 1, boxRight);
+    #pragma omp taskwait
+
+    if (right == left)
+    {
+        rightCost = leftCost;
+        boxRight = boxLeft;
+    }
+
+    box = surroundingBox(boxLeft, boxRight);
+    computeCost(boxLeft, boxRight, leftCost, rightCost, params);
+
+}
+
+inline float BVHNode::refitChild(Hitable* child, float t0, float t1,
+                                 const BVHBuildParams& params, int depth, AABB& childBox)
+{
+
+    if (BVHNode* node = dynamic_cast<BVHNode*>(child))
+    {
+        node->refitSubtree(t0, t1, params, depth);
+        childBox = node->box;
+        return node->cost;
+    }
+
+    child->boundingBox(t0, t1, childBox);
+    if (HitableList* leaf = dynamic_cast<HitableList*>(child))
+        return params.intersectionCost * leaf->listSize;
+
+    return params.intersectionCost;
+
+}
+
+struct BVHBin
+{
+
+    AABB box;
+    int count;
+
+};
+
+// Bounds of the primitive boxes and of their centroids.
+struct BVHRangeBounds
+{
+
+    AABB bounds;
+    Vec3 centroidMin;
+    Vec3 centroidMax;
+
+};
+
+inline BVHRangeBounds computeRangeBounds(const BVHPrimitiveInfo* prims, int n)
+{
+
+    BVHRangeBounds rb;
+    rb.bounds = prims[0].box;
+    rb.centroidMin = prims[0].centroid;
+    rb.centroidMax = prims[0].centroid;
+    for (int i = 1; i < n; i++)
+    {
+        rb.bounds = surroundingBox(rb.bounds, prims[i].box);
+        for (int a = 0; a < 3; a++)
+        {
+            rb.centroidMin[a] = fminf(rb.centroidMin[a], prims[i].centroid[a]);
+            rb.centroidMax[a] = fmaxf(rb.centroidMax[a], prims[i].centroid[a]);
+        }
+    }
+
+    return rb;
+
+}
+
+inline BVHRangeBounds mergeRangeBounds(const BVHRangeBounds& a, const BVHRangeBounds& b)
+{
+
+    BVHRangeBounds rb;
+    rb.bounds = surroundingBox(a.bounds, b.bounds);
+    for (int i = 0; i < 3; i++)
+    {
+        rb.centroidMin[i] = fminf(a.centroidMin[i], b.centroidMin[i]);
+        rb.centroidMax[i] = fmaxf(a.centroidMax[i], b.centroidMax[i]);
+    }
+
+    return rb;
+
+}
+
+inline int sahBinCount(const BVHBuildParams& params)
+{
+    return params.binCount < 2 ? 2 : params.binCount;
+}
+
+// Adds the primitives to the bins of all three axes, bins holds 3*binCount entries.
+inline void binPrimitives(const BVHPrimitiveInfo* prims, int n, const BVHRangeBounds& rb,
+                          int binCount, BVHBin* bins)
+{
+
+    for (int a = 0; a < 3; a++)
+    {
+        float extent = rb.centroidMax[a] - rb.centroidMin[a];
+        if (extent <= 0.0f)
+            continue;
+
+        BVHBin* axisBins = bins + a*binCount;
+        float scale = binCount / extent;
+        for (int i = 0; i < n; i++)
+        {
+            int b = std::min(binCount - 1, static_cast<int>((prims[i].centroid[a] - rb.centroidMin[a]) * scale));
+            axisBins[b].box = axisBins[b].count ? surroundingBox(axisBins[b].box, prims[i].box) : prims[i].box;
+            axisBins[b].count++;
+        }
+    }
+
+}
+
+inline void mergeBins(BVHBin* bins, const BVHBin* other, int count)
+{
+
+    for (int b = 0; b < count; b++)
+    {
+        if (!other[b].count)
+            continue;
+        bins[b].box = bins[b].count ? surroundingBox(bins[b].box, other[b].box) : other[b].box;
+        bins[b].count += other[b].count;
+    }
+
+}
+
+// Sweeps the bins of every axis and returns the cheapest split.
+inline BVHSplit evaluateBins(const BVHBin* bins, int n, const BVHRangeBounds& rb,
+                             const BVHBuildParams& params)
+{
+
+    BVHSplit split;
+    split.axis = -1;
+    split.bin = 0;
+    split.cost = FLT_MAX;
+    split.centroidBounds = AABB(rb.centroidMin, rb.centroidMax);
+
+    float area = rb.bounds.surfaceArea();
+    int binCount = sahBinCount(params);
+    std::vector<float> leftArea(static_cast<size_t>(binCount));
+    std::vector<int> leftCount(static_cast<size_t>(binCount));
+
+    for (int a = 0; a < 3; a++)
+    {
+        if (rb.centroidMax[a] - rb.centroidMin[a] <= 0.0f)
+            continue;
+
+        // Sweep from the left, then from the right and evaluate every bin boundary.
+        const BVHBin* axisBins = bins + a*binCount;
+        AABB acc;
+        int count = 0;
+        for (int b = 0; b < binCount - 1; b++)
+        {
+            if (axisBins[b].count)
+            {
+                acc = count ? surroundingBox(acc, axisBins[b].box) : axisBins[b].box;
+                count += axisBins[b].count;
+            }
+            leftArea[b] = count ? acc.surfaceArea() : 0.0f;
+            leftCount[b] = count;
+        }
+
+        count = 0;
+        for (int b = binCount - 1; b > 0; b--)
+        {
+            if (axisBins[b].count)
+            {
+                acc = count ? surroundingBox(acc, axisBins[b].box) : axisBins[b].box;
+                count += axisBins[b].count;
+            }
+            if (!count || !leftCount[b-1])
+                continue;
+
+            float sah = leftArea[b-1]*leftCount[b-1] + acc.surfaceArea()*count;
+            float c = params.traversalCost + params.intersectionCost * (area > 0.0f ? sah / area : n);
+            if (c < split.cost)
+            {
+                split.axis = a;
+                split.bin = b - 1;
+                split.cost = c;
+            }
+        }
+    }
+
+    return split;
+
+}
+
+// Evaluates the binned SAH on every axis and returns the cheapest split.
+inline BVHSplit findSAHSplit(const BVHPrimitiveInfo* prims, int n, const BVHBuildParams& params)
+{
+
+    BVHRangeBounds rb = computeRangeBounds(prims, n);
+
+    int binCount = sahBinCount(params);
+    std::vector<BVHBin> bins(static_cast<size_t>(3*binCount));
+    for (auto& bin : bins)
+        bin.count = 0;
+    binPrimitives(prims, n, rb, binCount, bins.data());
+
+    return evaluateBins(bins.data(), n, rb, params);
+
+}
+
+// Returns true if the primitive falls left of the split.
+inline bool isLeftOfSplit(const BVHPrimitiveInfo& p, const BVHSplit& split, int binCount)
+{
+
+    int a = split.axis;
+    float cMin = split.centroidBounds.min()[a];
+    float scale = binCount / (split.centroidBounds.max()[a] - cMin);
+
+    return std::min(binCount - 1, static_cast<int>((p.centroid[a] - cMin) * scale)) <= split.bin;
+
+}
+
+// Moves the primitives left of the split to the front and returns their count.
+// Falls back to splitting in the middle if the centroids can't be separated.
+// The partition is stable like the parallel scatter in LinearBVH::buildTop,
+// so the tree doesn't depend on the thread count.
+inline int partitionSAH(BVHPrimitiveInfo* prims, int n, const BVHBuildParams& params, const BVHSplit& split)
+{
+
+    int mid = n/2;
+    if (split.axis >= 0)
+    {
+        int binCount = sahBinCount(params);
+        BVHPrimitiveInfo* middle = std::stable_partition(prims, prims + n,
+            [&](const BVHPrimitiveInfo& p)
+            {
+                return isLeftOfSplit(p, split, binCount);
+            });
+        mid = static_cast<int>(middle - prims);
+        if (mid == 0 || mid == n)
+            mid = n/2;
+    }
+
+    return mid;
+
+}
+
+inline BVHNode::BVHNode(Hitable **l, int n, float t0, float t1, const BVHBuildParams& params)
+{
+
+    // An empty scene gets a node without children whose inverted box no
+    // ray hits.
+    if (n == 0)
+    {
+        left = right = nullptr;
+        leftType = rightType = HITABLE_VIRTUAL;
+        box = AABB(Vec3(FLT_MAX, FLT_MAX, FLT_MAX), Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+        cost = 0.0f;
+        axis = 0;
+        ordered = params.orderedTraversal;
+        return;
+    }
+
+    if (params.builder == MEDIAN_SPLIT)
+    {
+        buildMedian(l, n, t0, t1, params.orderedTraversal);
+        return;
+    }
+
+    std::vector<BVHPrimitiveInfo> prims(static_cast<size_t>(n));
+    for (int i = 0; i < n; i++)
+    {
+        prims[i].hitable = l[i];
+        #ifndef CUDA_ENABLED
+            if (!l[i]->boundingBox(t0, t1, prims[i].box))
+                std::cerr << "No bounding box in bvhNode constructor" << std::endl;
+        #endif
+        prims[i].centroid = prims[i].box.centroid();
+    }
+
+    if (params.builder == MORTON_LBVH)
+    {
+        std::vector<MortonPrimitive> keys = sortByMortonCode(n,
+            [&prims](int i) { return prims[i].centroid; }, params.mortonBits);
+        for (int i = 0; i < n; i++)
+            l[i] = prims[keys[i].index].hitable;
+        buildMorton(keys.data(), l, n, t0, t1, params);
+        return;
+    }
+
+    buildSAH(prims.data(), l, n, t0, t1, params, findSAHSplit(prims.data(), n, params));
+
+}
+
+// Builds the node over primitives sorted by Morton code, l is in the same order as keys.
+inline void BVHNode::buildMorton(const MortonPrimitive* keys, Hitable **l, int n, float t0, float t1,
+                                 const BVHBuildParams& params)
+{
+
+    float leftCost, rightCost;
+
+    ordered = params.orderedTraversal;
+
+    if (n == 1)
+    {
+        axis = 0;
+        left = right = l[0];
+        leftCost = rightCost = params.intersectionCost;
+    }
+    else
+    {
+        int mid = mortonSplit(keys, n, axis);
+        left = buildMortonSubtree(keys, l, mid, t0, t1, params, leftCost);
+        right = buildMortonSubtree(keys + mid, l + mid, n - mid, t0, t1, params, rightCost);
+    }
+    setChildTypes();
+
+    AABB boxLeft, boxRight;
+    left->boundingBox(t0, t1, boxLeft);
+    right->boundingBox(t0, t1, boxRight);
+    box = surroundingBox(boxLeft, boxRight);
+
+    computeCost(boxLeft, boxRight, leftCost, rightCost, params);
+
+}
+
+inline Hitable* BVHNode::buildMortonSubtree(const MortonPrimitive* keys, Hitable **l, int n, float t0, float t1,
+                                            const BVHBuildParams& params, float& subtreeCost)
+{
+
+    if (n == 1)
+    {
+        subtreeCost = params.intersectionCost;
+        return l[0];
+    }
+
+    if (n <= params.maxLeafSize)
+    {
+        subtreeCost = params.intersectionCost * n;
+        return sceneNew<HitableList>(l, n);
+    }
+
+    BVHNode* node = sceneNew<BVHNode>();
+    node->buildMorton(keys, l, n, t0, t1, params);
+    subtreeCost = node->cost;
+    return node;
+
+}
+
+inline void BVHNode::buildSAH(BVHPrimitiveInfo* prims, Hitable **l, int n, float t0, float t1,
+                              const BVHBuildParams& params, const BVHSplit& split)
+{
+
+    float leftCost, rightCost;
+
+    axis = split.axis >= 0 ? split.axis : 0;
+    ordered = params.orderedTraversal;
+
+    if (n == 1)
+    {
+        l[0] = prims[0].hitable;
+        left = right = l[0];
+        leftCost = rightCost = params.intersectionCost;
+    }
+    else
+    {
+        int mid = partitionSAH(prims, n, params, split);
+        left = buildSAHSubtree(prims, l, mid, t0, t1, params, leftCost);
+        right = buildSAHSubtree(prims + mid, l + mid, n - mid, t0, t1, params, rightCost);
+    }
+    setChildTypes();
+
+    AABB boxLeft, boxRight;
+    left->boundingBox(t0, t1, boxLeft);
+    right->boundingBox(t0, t1, boxRight);
+    box = surroundingBox(boxLeft, boxRight);
+
+    computeCost(boxLeft, boxRight, leftCost, rightCost, params);
+
+}
+
+inline Hitable* BVHNode::buildSAHSubtree(BVHPrimitiveInfo* prims, Hitable **l, int n, float t0, float t1,
+                                         const BVHBuildParams& params, float& subtreeCost)
+{
+
+    if (n == 1)
+    {
+        l[0] = prims[0].hitable;
+        subtreeCost = params.intersectionCost;
+        return l[0];
+    }
+
+    BVHSplit split = findSAHSplit(prims, n, params);
+
+    // Make a leaf if splitting doesn't pay off.
+    float leafCost = params.intersectionCost * n;
+    if (n <= params.maxLeafSize && leafCost <= split.cost)
+    {
+        for (int i = 0; i < n; i++)
+            l[i] = prims[i].hitable;
+        subtreeCost = leafCost;
+        return sceneNew<HitableList>(l, n);
+    }
+
+    BVHNode* node = sceneNew<BVHNode>();
+    node->buildSAH(prims, l, n, t0, t1, params, split);
+    subtreeCost = node->cost;
+    return node;
+
 }
@@ -0,0 +1,384 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <math.h>
+#include <stdint.h>
+
+#include "hitables/linearbvh.h"
+
+// Interior node of a CompressedBVH. It stores the boxes of both children
+// quantized to Q relative to its own box, which is itself only known after
+// decoding it from the parent. Leaves have no node of their own, they are
+// encoded in the child reference of their parent.
+template<typename Q>
+struct CompressedBVHNode
+{
+
+    Q bounds[2][6];             // per child: lower x, y, z and upper x, y, z
+    uint32_t child[2];          // node index, or a leaf if compressedLeafFlag is set
+
+};
+
+static_assert(sizeof(CompressedBVHNode<uint8_t>) == 20, "8 bit CompressedBVHNode should be 20 bytes");
+static_assert(sizeof(CompressedBVHNode<uint16_t>) == 32, "16 bit CompressedBVHNode should be 32 bytes");
+
+// Leaf references hold the first primitive in bits 4-30 and the primitive
+// count minus one in bits 0-3.
+const uint32_t compressedLeafFlag = 0x80000000u;
+const int compressedMaxLeafSize = 16;
+
+// The lower bound is decoded from the lower end of the parent box and the
+// upper bound from its upper end, so the extreme codes reproduce the parent
+// box exactly. The build uses the same functions to round conservatively.
+inline float decodeLower(float parentMin, float scale, int q)
+{
+    return parentMin + static_cast<float>(q) * scale;
+}
+
+inline float decodeUpper(float parentMax, float scale, int q, int qMax)
+{
+    return parentMax - static_cast<float>(qMax - q) * scale;
+}
+
+// BVH with quantized child bounds. Only the root box is kept in floats, every
+// other box costs 6 bytes (8 bit) or 12 bytes (16 bit) and is decoded during
+// the traversal. The decoded boxes always contain the exact ones, at most one
+// quantization step larger on each side. The topology comes from LinearBVH.
+template<typename Q>
+class CompressedBVH : public Hitable
+{
+
+    public:
+
+        CompressedBVH(Hitable **l, int n, float t0, float t1,
+                      const BVHBuildParams& params = BVHBuildParams());
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+
+        float sahCost() const
+        {
+            return cost;
+        }
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            for (Hitable* primitive : primitives)
+                primitive->bindMaterials(table);
+        }
+
+        size_t memoryBytes() const
+        {
+            return sizeof(*this) + nodes.size() * sizeof(nodes[0]) +
+                   primitives.size() * sizeof(Hitable*);
+        }
+
+        std::vector<CompressedBVHNode<Q> > nodes;
+        std::vector<Hitable*> primitives;
+
+    private:
+
+        enum { qMax = std::numeric_limits<Q>::max() };
+
+        static Vec3 quantizationStep(const Vec3& parentMin, const Vec3& parentMax)
+        {
+            return (parentMax - parentMin) * (1.0f / qMax);
+        }
+
+        uint32_t encode(const LinearBVH& bvh, int index, int first, int count,
+                        const AABB& box, float t0, float t1);
+        void quantize(const AABB& parent, const AABB& child, Q* q) const;
+        void decode(const Vec3& parentMin, const Vec3& parentMax, const Vec3& step, const Q* q,
+                    Vec3& childMin, Vec3& childMax) const;
+
+        AABB rootBox;
+        uint32_t root;
+        float cost;
+
+};
+
+template<typename Q>
+CompressedBVH<Q>::CompressedBVH(Hitable **l, int n, float t0, float t1, const BVHBuildParams& params)
+{
+
+    LinearBVH bvh(l, n, t0, t1, params);
+    cost = bvh.sahCost();
+    root = 0;
+    if (bvh.nodes.empty())
+        return;
+
+    primitives.reserve(bvh.primitives.size());
+    rootBox = AABB(bvh.nodes[0].boundsMin, bvh.nodes[0].boundsMax);
+    root = encode(bvh, 0, 0, 0, rootBox, t0, t1);
+
+}
+
+template<typename Q>
+void CompressedBVH<Q>::quantize(const AABB& parent, const AABB& child, Q* q) const
+{
+
+    Vec3 step = quantizationStep(parent.min(), parent.max());
+    for (int a = 0; a < 3; a++)
+    {
+        float scale = step[a];
+        int lo = 0;
+        int hi = qMax;
+        if (scale > 0.0f)
+        {
+            lo = static_cast<int>(floorf((child.min()[a] - parent.min()[a]) / scale));
+            hi = qMax - static_cast<int>(floorf((parent.max()[a] - child.max()[a]) / scale));
+            lo = std::min(std::max(lo, 0), int(qMax));
+            hi = std::min(std::max(hi, lo), int(qMax));
+
+            // Step outwards until the decoded box contains the child, the
+            // division above can be off by one in either direction.
+            while (lo > 0 && decodeLower(parent.min()[a], scale, lo) > child.min()[a])
+                lo--;
+            while (hi < qMax && decodeUpper(parent.max()[a], scale, hi, qMax) < child.max()[a])
+                hi++;
+        }
+        q[a] = static_cast<Q>(lo);
+        q[a + 3] = static_cast<Q>(hi);
+    }
+
+}
+
+template<typename Q>
+void CompressedBVH<Q>::decode(const Vec3& parentMin, const Vec3& parentMax, const Vec3& step, const Q* q,
+                              Vec3& childMin, Vec3& childMax) const
+{
+
+    for (int a = 0; a < 3; a++)
+    {
+        childMin[a] = decodeLower(parentMin[a], step[a], q[a]);
+        childMax[a] = decodeUpper(parentMax[a], step[a], q[a + 3], qMax);
+    }
+
+}
+
+// Encodes node index of bvh, or with index -1 the primitives [first,
+// first + count) of bvh, and returns the reference to it. box is the
+// decoded box the parent stores for it. Leaves with more primitives than a
+// reference holds are split in halves.
+template<typename Q>
+uint32_t CompressedBVH<Q>::encode(const LinearBVH& bvh, int index, int first, int count,
+                                  const AABB& box, float t0, float t1)
+{
+
+    if (index >= 0 && bvh.nodes[index].primitiveCount > 0)
+    {
+        first = bvh.nodes[index].offset;
+        count = bvh.nodes[index].primitiveCount;
+        index = -1;
+    }
+
+    if (index < 0 && count <= compressedMaxLeafSize)
+    {
+        uint32_t offset = static_cast<uint32_t>(primitives.size());
+        primitives.insert(primitives.end(), bvh.primitives.begin() + first, bvh.primitives.begin() + first + count);
+        return compressedLeafFlag | (offset << 4) | static_cast<uint32_t>(count - 1);
+    }
+
+    int childIndex[2] = { -1, -1 };
+    int childFirst[2] = { first, first + count/2 };
+    int childCount[2] = { count/2, count - count/2 };
+    AABB childBox[2];
+    if (index >= 0)
+    {
+        childIndex[0] = index + 1;
+        childIndex[1] = bvh.nodes[index].offset;
+        for (int c = 0; c < 2; c++)
+            childBox[c] = AABB(bvh.nodes[childIndex[c]].boundsMin, bvh.nodes[childIndex[c]].boundsMax);
+    }
+    else
+    {
+        for (int c = 0; c < 2; c++)
+        {
+            AABB primitiveBox;
+            bvh.primitives[childFirst[c]]->boundingBox(t0, t1, childBox[c]);
+            for (int i = 1; i < childCount[c]; i++)
+            {
+                bvh.primitives[childFirst[c] + i]->boundingBox(t0, t1, primitiveBox);
+                childBox[c] = surroundingBox(childBox[c], primitiveBox);
+            }
+        }
+    }
+
+    int current = static_cast<int>(nodes.size());
+    nodes.push_back(CompressedBVHNode<Q>());
+    for (int c = 0; c < 2; c++)
+    {
+        Q q[6];
+        quantize(box, childBox[c], q);
+        for (int k = 0; k < 6; k++)
+            nodes[current].bounds[c][k] = q[k];
+
+        Vec3 decodedMin, decodedMax;
+        decode(box.min(), box.max(), quantizationStep(box.min(), box.max()), q, decodedMin, decodedMax);
+        uint32_t reference = encode(bvh, childIndex[c], childFirst[c], childCount[c],
+                                    AABB(decodedMin, decodedMax), t0, t1);
+        nodes[current].child[c] = reference;
+    }
+
+    return static_cast<uint32_t>(current);
+
+}
+
+template<typename Q>
+bool CompressedBVH<Q>::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+template<typename Q>
+bool CompressedBVH<Q>::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (primitives.empty())
+        return false;
+
+    Vec3 origin = r.origin();
+    Vec3 direction = r.direction();
+    Vec3 invDir(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
+
+    // Slab test returning the entry distance.
+    auto boxHit = [&](const Vec3& boxMin, const Vec3& boxMax, float tFar, float& tNear)
+    {
+        float t0 = tMin;
+        float t1 = tFar;
+        for (int a = 0; a < 3; a++)
+        {
+            float tA = (boxMin[a] - origin[a]) * invDir[a];
+            float tB = (boxMax[a] - origin[a]) * invDir[a];
+            if (invDir[a] < 0.0f)
+                std::swap(tA, tB);
+            t0 = tA > t0 ? tA : t0;
+            t1 = tB < t1 ? tB : t1;
+            if (t1 < t0)
+                return false;
+        }
+        tNear = t0;
+        return true;
+    };
+
+    // The decoded box travels with every reference on the stack.
+    struct ToVisit
+    {
+        uint32_t reference;
+        float tNear;
+        Vec3 boxMin;
+        Vec3 boxMax;
+    };
+    ToVisit stack[linearBVHStackSize];
+    int toVisit = 0;
+
+    HitRecord tempRec;
+    bool hitAnything = false;
+    float closestSoFar = tMax;
+
+    uint32_t current = root;
+    Vec3 boxMin = rootBox.min();
+    Vec3 boxMax = rootBox.max();
+    float tNear;
+    if (!boxHit(boxMin, boxMax, closestSoFar, tNear))
+        return false;
+
+    while (true)
+    {
+        if (current & compressedLeafFlag)
+        {
+            int first = static_cast<int>((current & ~compressedLeafFlag) >> 4);
+            int count = static_cast<int>(current & 15u) + 1;
+            for (int i = 0; i < count; i++)
+            {
+                if (primitives[first + i]->intersect(r, tMin, closestSoFar, tempRec))
+                {
+                    hitAnything = true;
+                    closestSoFar = tempRec.time;
+                    rec = tempRec;
+                }
+            }
+        }
+        else
+        {
+            const CompressedBVHNode<Q>& node = nodes[current];
+            STATS_ADD(bvhNodeVisits, 1);
+
+            Vec3 step = quantizationStep(boxMin, boxMax);
+            Vec3 childMin[2], childMax[2];
+            float childNear[2];
+            bool childHit[2];
+            for (int c = 0; c < 2; c++)
+            {
+                decode(boxMin, boxMax, step, node.bounds[c], childMin[c], childMax[c]);
+                childHit[c] = boxHit(childMin[c], childMax[c], closestSoFar, childNear[c]);
+            }
+
+            if (childHit[0] || childHit[1])
+            {
+                // Descend into the nearer child and keep the other one.
+                int nearer = childHit[0] && (!childHit[1] || childNear[0] <= childNear[1]) ? 0 : 1;
+                int other = 1 - nearer;
+                if (childHit[other])
+                    stack[toVisit++] = { node.child[other], childNear[other], childMin[other], childMax[other] };
+                current = node.child[nearer];
+                boxMin = childMin[nearer];
+                boxMax = childMax[nearer];
+                continue;
+            }
+        }
+
+        // Skip the entries that are farther than the closest hit by now.
+        do
+        {
+            if (toVisit == 0)
+                return hitAnything;
+            toVisit--;
+        }
+        while (stack[toVisit].tNear > closestSoFar);
+
+        current = stack[toVisit].reference;
+        boxMin = stack[toVisit].boxMin;
+        boxMax = stack[toVisit].boxMax;
+    }
+
+}
+
+template<typename Q>
+bool CompressedBVH<Q>::boundingBox(float t0, float t1, AABB& box) const
+{
+
+    if (primitives.empty())
+        return false;
+
+    box = rootBox;
+
+    return true;
+
+}
@@ -0,0 +1,361 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+
+#include "hitables/bvh.h"
+
+// Caps on the grid size. Primitives that overlap many cells, in the worst
+// case a pile of coincident ones that each cover the whole grid, would
+// otherwise multiply the references.
+const long long uniformGridMaxCells = 1 << 24;
+const long long uniformGridMaxReferences = 64;      // per primitive
+
+// Uniform grid over the primitive bounds, traversed cell by cell with a
+// 3D-DDA. It suits dense fields of similarly sized primitives, where the
+// cells can be sized to hold a few primitives each.
+//
+// With params.hashedGrid the cells are hashed into a table with two entries
+// per primitive instead of being stored densely, so the memory does not grow
+// with the empty cells. Cells sharing an entry test each other's primitives.
+//
+// Primitives much larger than the typical one (like a ground sphere) would
+// stretch the grid over empty space. They are kept in a separate list and
+// tested with every ray.
+class UniformGrid : public Hitable
+{
+
+    public:
+
+        UniformGrid(Hitable **l, int n, float t0, float t1,
+                    const BVHBuildParams& params = BVHBuildParams());
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            for (Hitable* primitive : large)
+                primitive->bindMaterials(table);
+            for (Hitable* primitive : references)
+                primitive->bindMaterials(table);
+        }
+
+        size_t memoryBytes() const
+        {
+            return sizeof(*this) + cellStart.size() * sizeof(int) +
+                   references.size() * sizeof(Hitable*) + large.size() * sizeof(Hitable*);
+        }
+
+        int resolution[3];
+        std::vector<int> cellStart;         // references of cell i are [cellStart[i], cellStart[i+1])
+        std::vector<Hitable*> references;
+        std::vector<Hitable*> large;        // primitives tested with every ray
+
+    private:
+
+        int cellIndex(int x, int y, int z) const
+        {
+            if (hashed)
+                return static_cast<int>((static_cast<uint32_t>(x) * 73856093u ^
+                                         static_cast<uint32_t>(y) * 19349663u ^
+                                         static_cast<uint32_t>(z) * 83492791u) & hashMask);
+            return (z * resolution[1] + y) * resolution[0] + x;
+        }
+
+        int cellCoordinate(float p, int axis) const
+        {
+            int c = static_cast<int>((p - gridMin[axis]) * invCellSize[axis]);
+            return std::min(std::max(c, 0), resolution[axis] - 1);
+        }
+
+        Vec3 gridMin;
+        Vec3 gridMax;
+        Vec3 cellSize;
+        Vec3 invCellSize;
+        AABB bounds;
+        bool hasBounds;             // false if a primitive has no bounding box
+        bool hashed;
+        uint32_t hashMask;
+
+};
+
+inline UniformGrid::UniformGrid(Hitable **l, int n, float t0, float t1, const BVHBuildParams& params)
+{
+
+    hasBounds = n > 0;
+    hashed = params.hashedGrid;
+    hashMask = 0;
+    resolution[0] = resolution[1] = resolution[2] = 1;
+
+    std::vector<AABB> boxes(static_cast<size_t>(n));
+    std::vector<float> extent(static_cast<size_t>(n));
+    std::vector<char> bounded(static_cast<size_t>(n));
+
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++)
+    {
+        bounded[i] = l[i]->boundingBox(t0, t1, boxes[i]);
+        Vec3 d = boxes[i].max() - boxes[i].min();
+        extent[i] = bounded[i] ? std::max(d.x(), std::max(d.y(), d.z())) : FLT_MAX;
+    }
+
+    // Anything larger than 64 times the median extent goes to the large list.
+    std::vector<float> sorted(extent);
+    float limit = FLT_MAX;
+    if (n > 0)
+    {
+        std::nth_element(sorted.begin(), sorted.begin() + n/2, sorted.end());
+        limit = 64.0f * sorted[n/2];
+    }
+
+    std::vector<int> gridded;
+    for (int i = 0; i < n; i++)
+    {
+        hasBounds = hasBounds && bounded[i];
+        if (hasBounds)
+            bounds = i == 0 ? boxes[i] : surroundingBox(bounds, boxes[i]);
+        if (bounded[i] && extent[i] <= limit)
+        {
+            gridMin = gridded.empty() ? boxes[i].min() : Vec3(fminf(gridMin.x(), boxes[i].min().x()),
+                                                              fminf(gridMin.y(), boxes[i].min().y()),
+                                                              fminf(gridMin.z(), boxes[i].min().z()));
+            gridMax = gridded.empty() ? boxes[i].max() : Vec3(fmaxf(gridMax.x(), boxes[i].max().x()),
+                                                              fmaxf(gridMax.y(), boxes[i].max().y()),
+                                                              fmaxf(gridMax.z(), boxes[i].max().z()));
+            gridded.push_back(i);
+        }
+        else
+            large.push_back(l[i]);
+    }
+
+    int count = static_cast<int>(gridded.size());
+    if (count == 0)
+        return;
+
+    // Cubic cells sized to give gridDensity cells per primitive. Flat axes
+    // get a minimal thickness so the volume stays positive.
+    Vec3 size = gridMax - gridMin;
+    float minSize = 1e-3f * std::max(size.x(), std::max(size.y(), size.z())) + 1e-6f;
+    size = Vec3(std::max(size.x(), minSize), std::max(size.y(), minSize), std::max(size.z(), minSize));
+    gridMax = gridMin + size;
+    float cellEdge = cbrtf(size.x() * size.y() * size.z() / (params.gridDensity * count));
+    for (int a = 0; a < 3; a++)
+    {
+        float cells = ceilf(size[a] / cellEdge);
+        resolution[a] = static_cast<int>(std::min(std::max(cells, 1.0f), 1024.0f));
+    }
+
+    // Halve the resolution until the cells and the references fit the caps.
+    while (true)
+    {
+        cellSize = Vec3(size.x() / resolution[0], size.y() / resolution[1], size.z() / resolution[2]);
+        invCellSize = Vec3(1.0f / cellSize.x(), 1.0f / cellSize.y(), 1.0f / cellSize.z());
+
+        long long cells = static_cast<long long>(resolution[0]) * resolution[1] * resolution[2];
+        long long referenceCount = 0;
+        if (cells <= uniformGridMaxCells)
+        {
+            for (int i : gridded)
+            {
+                long long covered = 1;
+                for (int a = 0; a < 3; a++)
+                    covered *= cellCoordinate(boxes[i].max()[a], a) - cellCoordinate(boxes[i].min()[a], a) + 1;
+                referenceCount += covered;
+            }
+        }
+
+        if (cells == 1 ||
+            (cells <= uniformGridMaxCells && referenceCount <= uniformGridMaxReferences * count))
+            break;
+        for (int a = 0; a < 3; a++)
+            resolution[a] = (resolution[a] + 1) / 2;
+    }
+
+    int cellCount = resolution[0] * resolution[1] * resolution[2];
+    if (hashed)
+    {
+        uint32_t tableSize = 1;
+        while (tableSize < 2u * static_cast<uint32_t>(count))
+            tableSize <<= 1;
+        hashMask = tableSize - 1;
+        cellCount = static_cast<int>(tableSize);
+    }
+
+    // Count the references per cell, then fill them in at the prefix sums.
+    cellStart.assign(static_cast<size_t>(cellCount) + 1, 0);
+    for (int i : gridded)
+    {
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; a++)
+        {
+            lo[a] = cellCoordinate(boxes[i].min()[a], a);
+            hi[a] = cellCoordinate(boxes[i].max()[a], a);
+        }
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    cellStart[cellIndex(x, y, z) + 1]++;
+    }
+    for (int c = 0; c < cellCount; c++)
+        cellStart[c + 1] += cellStart[c];
+
+    references.resize(static_cast<size_t>(cellStart[cellCount]));
+    std::vector<int> next(cellStart.begin(), cellStart.end() - 1);
+    for (int i : gridded)
+    {
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; a++)
+        {
+            lo[a] = cellCoordinate(boxes[i].min()[a], a);
+            hi[a] = cellCoordinate(boxes[i].max()[a], a);
+        }
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++)
+                    references[next[cellIndex(x, y, z)]++] = l[i];
+    }
+
+}
+
+inline bool UniformGrid::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+inline bool UniformGrid::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    HitRecord tempRec;
+    bool hitAnything = false;
+    float closestSoFar = tMax;
+
+    for (Hitable* primitive : large)
+    {
+        if (primitive->intersect(r, tMin, closestSoFar, tempRec))
+        {
+            hitAnything = true;
+            closestSoFar = tempRec.time;
+            rec = tempRec;
+        }
+    }
+
+    if (references.empty())
+        return hitAnything;
+
+    // Clip the ray to the grid.
+    Vec3 origin = r.origin();
+    Vec3 direction = r.direction();
+    Vec3 invDir(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
+    float tEnter = tMin;
+    float tExit = closestSoFar;
+    for (int a = 0; a < 3; a++)
+    {
+        float t0 = (gridMin[a] - origin[a]) * invDir[a];
+        float t1 = (gridMax[a] - origin[a]) * invDir[a];
+        if (invDir[a] < 0.0f)
+            std::swap(t0, t1);
+        tEnter = t0 > tEnter ? t0 : tEnter;
+        tExit = t1 < tExit ? t1 : tExit;
+        if (tExit <= tEnter)
+            return hitAnything;
+    }
+
+    // Set up the DDA in the cell containing the entry point.
+    int cell[3], step[3], stop[3];
+    float tNext[3], tDelta[3];
+    for (int a = 0; a < 3; a++)
+    {
+        cell[a] = cellCoordinate(origin[a] + tEnter * direction[a], a);
+        if (direction[a] > 0.0f)
+        {
+            tNext[a] = (gridMin[a] + (cell[a] + 1) * cellSize[a] - origin[a]) * invDir[a];
+            tDelta[a] = cellSize[a] * invDir[a];
+            step[a] = 1;
+            stop[a] = resolution[a];
+        }
+        else if (direction[a] < 0.0f)
+        {
+            tNext[a] = (gridMin[a] + cell[a] * cellSize[a] - origin[a]) * invDir[a];
+            tDelta[a] = -cellSize[a] * invDir[a];
+            step[a] = -1;
+            stop[a] = -1;
+        }
+        else
+        {
+            tNext[a] = FLT_MAX;
+            tDelta[a] = FLT_MAX;
+            step[a] = 0;
+            stop[a] = -1;
+        }
+    }
+
+    while (true)
+    {
+        STATS_ADD(bvhNodeVisits, 1);
+        int c = cellIndex(cell[0], cell[1], cell[2]);
+        for (int k = cellStart[c]; k < cellStart[c + 1]; k++)
+        {
+            if (references[k]->intersect(r, tMin, closestSoFar, tempRec))
+            {
+                hitAnything = true;
+                closestSoFar = tempRec.time;
+                rec = tempRec;
+            }
+        }
+
+        // A primitive spanning several cells can be hit beyond the current
+        // cell, so only hits inside it end the traversal.
+        int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2)
+                                       : (tNext[1] < tNext[2] ? 1 : 2);
+        if (closestSoFar <= tNext[axis] || tNext[axis] > tExit)
+            break;
+        cell[axis] += step[axis];
+        if (cell[axis] == stop[axis])
+            break;
+        tNext[axis] += tDelta[axis];
+    }
+
+    return hitAnything;
+
+}
+
+inline bool UniformGrid::boundingBox(float t0, float t1, AABB& box) const
+{
+
+    if (!hasBounds)
+        return false;
+
+    box = bounds;
+
+    return true;
+
+}
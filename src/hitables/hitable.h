@@ -19,10 +19,19 @@ SOFTWARE.
 
 #pragma once
 
+#include <stdint.h>
+
+#include "util/arena.h"
 #include "util/ray.h"
+#include "util/raypacket.h"
 #include "aabb.h"
 
+class Hitable;
 class Material;
+class MaterialTable;
+
+// HitRecord::materialId of materials that are not in a MaterialTable.
+const uint32_t invalidMaterialId = 0xffffffffu;
 
 struct HitRecord
 {
@@ -33,7 +42,24 @@ struct HitRecord
     Vec3 point;
     Vec3 normal;
     Material* matPtr;
+    uint32_t materialId;          // matPtr in the bound MaterialTable, or invalidMaterialId
+    const Hitable* primitive;     // finalizes the record of intersect(), nullptr if complete
+
+};
 
+// Concrete type of a hitable. The acceleration structures store it next to
+// their children and call the intersection of these types directly, which
+// saves the indirect call and lets the compiler inline it. Everything else is
+// HITABLE_VIRTUAL and goes through the vtable.
+enum HitableType
+{
+    HITABLE_VIRTUAL,
+    HITABLE_SPHERE,
+    HITABLE_MOVING_SPHERE,
+    HITABLE_TRIANGLE,
+    HITABLE_SPHERE_BATCH,
+    HITABLE_TRIANGLE_BATCH,
+    HITABLE_BVH_NODE
 };
 
 class Hitable
@@ -49,6 +75,80 @@ class Hitable
 
         CUDA_DEV virtual bool boundingBox(float t0, float t1, AABB& box) const = 0;
 
+        // Any-hit query for shadow and occlusion rays: true if anything is hit
+        // with tMin < t < tMax. It may stop at the first intersection and
+        // doesn't compute a hit record. Falls back to hit() by default.
+        CUDA_DEV virtual bool occluded(const Ray& r, float tMin, float tMax) const
+        {
+            HitRecord rec;
+            return hit(r, tMin, tMax, rec);
+        }
+
+        // Closest hit in two steps for the acceleration structures, which
+        // test many candidates but only shade the closest one. intersect()
+        // only has to set rec.time and rec.primitive, it may keep its own
+        // data in rec.u and rec.v. finalizeHit() of rec.primitive then fills
+        // in the rest of the record once. The defaults make a complete
+        // record right away.
+        CUDA_DEV virtual bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+        {
+            if (!hit(r, tMin, tMax, rec))
+                return false;
+            rec.primitive = nullptr;
+            return true;
+        }
+
+        CUDA_DEV virtual void finalizeHit(const Ray& r, HitRecord& rec) const
+        {
+
+        }
+
+        CUDA_DEV virtual HitableType hitableType() const
+        {
+            return HITABLE_VIRTUAL;
+        }
+
+        // hit() for the active rays of a packet, the complete records go to
+        // recs[lane]. Returns the mask of the lanes that hit something. The
+        // acceleration structures traverse the packet together, the default
+        // traces one ray after another.
+        virtual int hitPacket(const RayPacket& packet, float tMin, float tMax, HitRecord* recs) const
+        {
+            int mask = 0;
+            for (int k = 0; k < rayPacketSize; k++)
+                if ((packet.active >> k & 1) && hit(packet.rays[k], tMin, tMax, recs[k]))
+                    mask |= 1 << k;
+            return mask;
+        }
+
+        // Adds the materials to table and keeps their ids for the hit
+        // records. Containers pass the table on to their children.
+        virtual void bindMaterials(MaterialTable& table)
+        {
+
+        }
+
         CUDA_DEV virtual ~Hitable() {}
 
 };
+
+// Completes a record returned by intersect().
+inline CUDA_DEV void finalizeHitRecord(const Ray& r, HitRecord& rec)
+{
+
+    if (rec.primitive)
+        rec.primitive->finalizeHit(r, rec);
+
+}
+
+// Completes the records of the lanes in hits of a packet.
+inline void finalizePacketHits(const RayPacket& packet, int hits, HitRecord* recs)
+{
+
+    for (; hits; hits &= hits - 1)
+    {
+        int k = __builtin_ctz(hits);
+        finalizeHitRecord(packet.rays[k], recs[k]);
+    }
+
+}
@@ -36,11 +36,32 @@ class HitableList: public Hitable
         }
 
         CUDA_DEV bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        CUDA_DEV bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        CUDA_DEV bool occluded(const Ray& r, float tMin, float tMax) const override;
         CUDA_DEV bool boundingBox(float t0, float t1, AABB& box) const override;
 
+        void bindMaterials(MaterialTable& table) override
+        {
+            for (int i = 0; i < listSize; i++)
+                list[i]->bindMaterials(table);
+        }
+
 };
 
+template <> struct SceneArenaDestroys<HitableList> : std::false_type {};
+
 inline CUDA_DEV bool HitableList::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+// Only the closest item finalizes its hit.
+inline CUDA_DEV bool HitableList::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
 {
 
     HitRecord tempRec;
@@ -50,7 +71,7 @@ inline CUDA_DEV bool HitableList::hit(const Ray& r, float tMin, float tMax, HitR
     for (int i = 0; i < listSize; i++)
     {
         // if the list item was hit
-        if (list[i]->hit(r, tMin, closestSoFar, tempRec))
+        if (list[i]->intersect(r, tMin, closestSoFar, tempRec))
         {
             hitAnything = true;
             closestSoFar = tempRec.time;
@@ -62,6 +83,17 @@ inline CUDA_DEV bool HitableList::hit(const Ray& r, float tMin, float tMax, HitR
 
 }
 
+inline CUDA_DEV bool HitableList::occluded(const Ray& r, float tMin, float tMax) const
+{
+
+    for (int i = 0; i < listSize; i++)
+        if (list[i]->occluded(r, tMin, tMax))
+            return true;
+
+    return false;
+
+}
+
 inline CUDA_DEV bool HitableList::boundingBox(float t0, float t1, AABB& box) const
 {
 
@@ -76,7 +108,7 @@ inline CUDA_DEV bool HitableList::boundingBox(float t0, float t1, AABB& box) con
         box = tempBox;
     for (int i = 1; i < listSize; i++)
     {
-        if(list[0]->boundingBox(t0, t1, tempBox))
+        if(list[i]->boundingBox(t0, t1, tempBox))
         {
             box = surroundingBox(box, tempBox);
         }
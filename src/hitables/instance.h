@@ -0,0 +1,225 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "hitables/accelerator.h"
+#include "util/transform.h"
+
+// Placement of a shared bottom-level structure in the world. Rays are
+// transformed into object space, so any number of instances can reference
+// the same geometry.
+class Instance : public Hitable
+{
+
+    public:
+
+        Instance(const Hitable* object, const Transform& objectToWorld,
+                 Material* materialOverride = nullptr) :
+                 object(object),
+                 materialOverride(materialOverride),
+                 materialOverrideId(invalidMaterialId)
+        {
+            setTransform(objectToWorld);
+        }
+
+        void setTransform(const Transform& objectToWorld)
+        {
+            toWorld = objectToWorld;
+            toObject = objectToWorld.inverse();
+        }
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool occluded(const Ray& r, float tMin, float tMax) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+
+        // The object is only const for the traversal.
+        void bindMaterials(MaterialTable& table) override
+        {
+            const_cast<Hitable*>(object)->bindMaterials(table);
+            materialOverrideId = table.add(materialOverride);
+        }
+
+        const Hitable* object;
+        Material* materialOverride;     // replaces the materials of the object if set
+        uint32_t materialOverrideId;
+
+    private:
+
+        Transform toWorld;
+        Transform toObject;
+
+};
+
+inline bool Instance::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    // The direction is not normalized, so t is the same in both spaces.
+    Ray objectRay(toObject.point(r.origin()), toObject.vector(r.direction()), r.time());
+    if (!object->hit(objectRay, tMin, tMax, rec))
+        return false;
+
+    rec.point = r.pointAtParameter(rec.time);
+    rec.normal = unitVector(toObject.normal(rec.normal));
+    if (materialOverride)
+    {
+        rec.matPtr = materialOverride;
+        rec.materialId = materialOverrideId;
+    }
+
+    return true;
+
+}
+
+inline bool Instance::occluded(const Ray& r, float tMin, float tMax) const
+{
+
+    Ray objectRay(toObject.point(r.origin()), toObject.vector(r.direction()), r.time());
+    return object->occluded(objectRay, tMin, tMax);
+
+}
+
+inline bool Instance::boundingBox(float t0, float t1, AABB& box) const
+{
+
+    AABB objectBox;
+    if (!object->boundingBox(t0, t1, objectBox))
+        return false;
+
+    Vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX);
+    Vec3 hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int corner = 0; corner < 8; corner++)
+    {
+        Vec3 p((corner & 1) ? objectBox.max().x() : objectBox.min().x(),
+               (corner & 2) ? objectBox.max().y() : objectBox.min().y(),
+               (corner & 4) ? objectBox.max().z() : objectBox.min().z());
+        p = toWorld.point(p);
+        for (int a = 0; a < 3; a++)
+        {
+            lo[a] = fminf(lo[a], p[a]);
+            hi[a] = fmaxf(hi[a], p[a]);
+        }
+    }
+    box = AABB(lo, hi);
+
+    return true;
+
+}
+
+// Two-level acceleration structure: bottom-level structures are built once
+// per unique geometry with addGeometry(), instances place them with a
+// transform, and the top-level tree over the instances is the only part
+// rebuilt when instances move. The scene keeps the structures in arenas
+// of its own, so a top-level rebuild frees the whole previous tree.
+class InstancedScene : public Hitable
+{
+
+    public:
+
+        InstancedScene(const BVHBuildParams& params = BVHBuildParams()) :
+                       params(params),
+                       topLevel(nullptr)
+        {
+
+        }
+
+        ~InstancedScene()
+        {
+            for (auto instance : instances)
+                delete instance;
+        }
+
+        // Builds the bottom-level structure over the first n hitables of l
+        // and returns its geometry index.
+        int addGeometry(Hitable **l, int n, float t0, float t1)
+        {
+            SceneArena::Scope scope(&geometryArena);
+            geometries.push_back(buildAccelerator(l, n, t0, t1, params));
+            return static_cast<int>(geometries.size()) - 1;
+        }
+
+        int addInstance(int geometry, const Transform& objectToWorld,
+                        Material* materialOverride = nullptr)
+        {
+            instances.push_back(new Instance(geometries[geometry], objectToWorld, materialOverride));
+            return static_cast<int>(instances.size()) - 1;
+        }
+
+        void setTransform(int instance, const Transform& objectToWorld)
+        {
+            instances[instance]->setTransform(objectToWorld);
+        }
+
+        // Rebuilds the top-level tree, call after adding or moving instances.
+        void build(float t0, float t1)
+        {
+            topLevelArena.clear();
+            SceneArena::Scope scope(&topLevelArena);
+            topLevelList.assign(instances.begin(), instances.end());
+            topLevel = buildAccelerator(topLevelList.data(), static_cast<int>(topLevelList.size()),
+                                        t0, t1, params);
+        }
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override
+        {
+            return topLevel->hit(r, tMin, tMax, rec);
+        }
+
+        bool occluded(const Ray& r, float tMin, float tMax) const override
+        {
+            return topLevel->occluded(r, tMin, tMax);
+        }
+
+        bool boundingBox(float t0, float t1, AABB& box) const override
+        {
+            return topLevel->boundingBox(t0, t1, box);
+        }
+
+        // Binds every geometry once, not once per instance.
+        void bindMaterials(MaterialTable& table) override
+        {
+            for (auto geometry : geometries)
+                geometry->bindMaterials(table);
+            for (auto instance : instances)
+                instance->materialOverrideId = table.add(instance->materialOverride);
+        }
+
+        int geometryCount() const
+        {
+            return static_cast<int>(geometries.size());
+        }
+
+        int instanceCount() const
+        {
+            return static_cast<int>(instances.size());
+        }
+
+    private:
+
+        BVHBuildParams params;
+        SceneArena geometryArena;
+        SceneArena topLevelArena;
+        std::vector<Hitable*> geometries;
+        std::vector<Instance*> instances;
+        std::vector<Hitable*> topLevelList;     // leaves of the pointer tree point into it
+        Hitable* topLevel;
+
+};
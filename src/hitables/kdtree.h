@@ -0,0 +1,381 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+
+#include "hitables/bvh.h"
+
+// 8 byte kd-tree node. The below child follows the node directly in memory.
+struct KdTreeNode
+{
+
+    union
+    {
+        float split;            // interior nodes
+        int primitiveOffset;    // leaves
+    };
+    uint32_t flags;             // axis or 3 for leaves in the low 2 bits, above child or primitive count above
+
+    bool isLeaf() const
+    {
+        return (flags & 3) == 3;
+    }
+
+    int axis() const
+    {
+        return flags & 3;
+    }
+
+    int aboveChild() const
+    {
+        return flags >> 2;
+    }
+
+    int primitiveCount() const
+    {
+        return flags >> 2;
+    }
+
+};
+
+static_assert(sizeof(KdTreeNode) == 8, "KdTreeNode should be 8 bytes");
+
+// Kd-tree built with the surface area heuristic over the primitive box
+// edges. Unlike a BVH the children don't overlap, so the traversal can stop
+// at the first leaf with a hit inside it, but primitives crossing a split
+// plane are referenced on both sides.
+class KdTree : public Hitable
+{
+
+    public:
+
+        KdTree(Hitable **l, int n, float t0, float t1,
+               const BVHBuildParams& params = BVHBuildParams());
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            for (Hitable* primitive : references)
+                primitive->bindMaterials(table);
+        }
+
+        size_t memoryBytes() const
+        {
+            return sizeof(*this) + nodes.size() * sizeof(KdTreeNode) +
+                   references.size() * sizeof(Hitable*);
+        }
+
+        std::vector<KdTreeNode> nodes;
+        std::vector<Hitable*> references;
+
+    private:
+
+        struct BoundEdge
+        {
+            float t;
+            int primitive;
+            bool start;
+
+            bool operator<(const BoundEdge& e) const
+            {
+                if (t == e.t)
+                    return start && !e.start;
+                return t < e.t;
+            }
+        };
+
+        void build(const AABB& nodeBounds, std::vector<int>& primitives, int depth, int badRefines,
+                   const std::vector<AABB>& boxes, Hitable **l, const BVHBuildParams& params);
+        void makeLeaf(const std::vector<int>& primitives, Hitable **l);
+
+        AABB bounds;
+        bool hasBounds;
+
+};
+
+// Stack depth of the traversal, the build stops splitting before it.
+const int kdTreeMaxDepth = 60;
+
+inline KdTree::KdTree(Hitable **l, int n, float t0, float t1, const BVHBuildParams& params)
+{
+
+    std::vector<AABB> boxes(static_cast<size_t>(n));
+    std::vector<char> bounded(static_cast<size_t>(n));
+
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++)
+        bounded[i] = l[i]->boundingBox(t0, t1, boxes[i]);
+
+    hasBounds = n > 0;
+    for (int i = 0; i < n && hasBounds; i++)
+    {
+        hasBounds = bounded[i] != 0;
+        bounds = i == 0 ? boxes[i] : surroundingBox(bounds, boxes[i]);
+    }
+
+    // Every primitive needs a box to be placed in the tree.
+    if (!hasBounds)
+    {
+        KdTreeNode root;
+        root.primitiveOffset = 0;
+        root.flags = 3 | (static_cast<uint32_t>(n) << 2);
+        nodes.push_back(root);
+        references.assign(l, l + n);
+        return;
+    }
+
+    int maxDepth = std::min(static_cast<int>(8.0f + 1.3f * log2f(float(std::max(n, 1)))), kdTreeMaxDepth);
+    std::vector<int> primitives(static_cast<size_t>(n));
+    for (int i = 0; i < n; i++)
+        primitives[i] = i;
+    build(bounds, primitives, maxDepth, 0, boxes, l, params);
+
+}
+
+inline void KdTree::makeLeaf(const std::vector<int>& primitives, Hitable **l)
+{
+
+    KdTreeNode leaf;
+    leaf.primitiveOffset = static_cast<int>(references.size());
+    leaf.flags = 3 | (static_cast<uint32_t>(primitives.size()) << 2);
+    nodes.push_back(leaf);
+    for (int i : primitives)
+        references.push_back(l[i]);
+
+}
+
+inline void KdTree::build(const AABB& nodeBounds, std::vector<int>& primitives, int depth, int badRefines,
+                          const std::vector<AABB>& boxes, Hitable **l, const BVHBuildParams& params)
+{
+
+    int n = static_cast<int>(primitives.size());
+    if (n <= params.maxLeafSize || depth == 0)
+    {
+        makeLeaf(primitives, l);
+        return;
+    }
+
+    // Sweep the sorted box edges of every axis and keep the cheapest plane.
+    Vec3 d = nodeBounds.max() - nodeBounds.min();
+    float invArea = 1.0f / nodeBounds.surfaceArea();
+    float leafCost = params.intersectionCost * n;
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    float bestSplit = 0.0f;
+
+    std::vector<BoundEdge> edges(static_cast<size_t>(2 * n));
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            const AABB& box = boxes[primitives[i]];
+            edges[2*i] = { box.min()[axis], primitives[i], true };
+            edges[2*i + 1] = { box.max()[axis], primitives[i], false };
+        }
+        std::sort(edges.begin(), edges.end());
+
+        int other0 = (axis + 1) % 3;
+        int other1 = (axis + 2) % 3;
+        int below = 0;
+        int above = n;
+        for (int i = 0; i < 2 * n; i++)
+        {
+            if (!edges[i].start)
+                above--;
+            float t = edges[i].t;
+            if (t > nodeBounds.min()[axis] && t < nodeBounds.max()[axis])
+            {
+                float belowArea = 2.0f * (d[other0] * d[other1] + (t - nodeBounds.min()[axis]) * (d[other0] + d[other1]));
+                float aboveArea = 2.0f * (d[other0] * d[other1] + (nodeBounds.max()[axis] - t) * (d[other0] + d[other1]));
+                float bonus = (below == 0 || above == 0) ? params.emptyBonus : 0.0f;
+                float cost = params.traversalCost +
+                             params.intersectionCost * (1.0f - bonus) * (belowArea * below + aboveArea * above) * invArea;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = t;
+                }
+            }
+            if (edges[i].start)
+                below++;
+        }
+    }
+
+    if (bestCost > leafCost)
+        badRefines++;
+    if (bestAxis == -1 || (bestCost > 4.0f * leafCost && n < 16) || badRefines == 3)
+    {
+        makeLeaf(primitives, l);
+        return;
+    }
+
+    // Primitives lying in the plane go to the side they extend into, the
+    // ones crossing it go to both.
+    std::vector<int> belowPrimitives, abovePrimitives;
+    for (int i : primitives)
+    {
+        if (boxes[i].min()[bestAxis] < bestSplit)
+            belowPrimitives.push_back(i);
+        if (boxes[i].max()[bestAxis] > bestSplit)
+            abovePrimitives.push_back(i);
+        if (boxes[i].min()[bestAxis] == bestSplit && boxes[i].max()[bestAxis] == bestSplit)
+            belowPrimitives.push_back(i);
+    }
+    std::vector<int>().swap(primitives);
+
+    Vec3 belowMax = nodeBounds.max();
+    Vec3 aboveMin = nodeBounds.min();
+    belowMax[bestAxis] = bestSplit;
+    aboveMin[bestAxis] = bestSplit;
+    AABB belowBounds(nodeBounds.min(), belowMax);
+    AABB aboveBounds(aboveMin, nodeBounds.max());
+
+    int index = static_cast<int>(nodes.size());
+    KdTreeNode node;
+    node.split = bestSplit;
+    node.flags = static_cast<uint32_t>(bestAxis);
+    nodes.push_back(node);
+
+    build(belowBounds, belowPrimitives, depth - 1, badRefines, boxes, l, params);
+    nodes[index].flags |= static_cast<uint32_t>(nodes.size()) << 2;
+    build(aboveBounds, abovePrimitives, depth - 1, badRefines, boxes, l, params);
+
+}
+
+inline bool KdTree::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+inline bool KdTree::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    Vec3 origin = r.origin();
+    Vec3 direction = r.direction();
+    Vec3 invDir(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
+
+    // Without bounds the root is a leaf holding everything.
+    float tNear = tMin;
+    float tFar = tMax;
+    if (hasBounds)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            float t0 = (bounds.min()[a] - origin[a]) * invDir[a];
+            float t1 = (bounds.max()[a] - origin[a]) * invDir[a];
+            if (invDir[a] < 0.0f)
+                std::swap(t0, t1);
+            tNear = t0 > tNear ? t0 : tNear;
+            tFar = t1 < tFar ? t1 : tFar;
+            if (tFar < tNear)
+                return false;
+        }
+    }
+
+    struct ToVisit
+    {
+        int node;
+        float tNear;
+        float tFar;
+    };
+    ToVisit stack[kdTreeMaxDepth + 4];
+    int toVisit = 0;
+    int current = 0;
+
+    HitRecord tempRec;
+    bool hitAnything = false;
+    float closestSoFar = tMax;
+
+    while (true)
+    {
+        if (closestSoFar < tNear)
+            break;
+
+        const KdTreeNode& node = nodes[current];
+        STATS_ADD(bvhNodeVisits, 1);
+        if (!node.isLeaf())
+        {
+            int axis = node.axis();
+            float tPlane = (node.split - origin[axis]) * invDir[axis];
+            bool belowFirst = origin[axis] < node.split ||
+                              (origin[axis] == node.split && direction[axis] <= 0.0f);
+            int first = belowFirst ? current + 1 : node.aboveChild();
+            int second = belowFirst ? node.aboveChild() : current + 1;
+
+            if (tPlane > tFar || tPlane <= 0.0f)
+                current = first;
+            else if (tPlane < tNear)
+                current = second;
+            else
+            {
+                stack[toVisit++] = { second, tPlane, tFar };
+                current = first;
+                tFar = tPlane;
+            }
+        }
+        else
+        {
+            for (int i = 0; i < node.primitiveCount(); i++)
+            {
+                if (references[node.primitiveOffset + i]->intersect(r, tMin, closestSoFar, tempRec))
+                {
+                    hitAnything = true;
+                    closestSoFar = tempRec.time;
+                    rec = tempRec;
+                }
+            }
+            if (toVisit == 0)
+                break;
+            toVisit--;
+            current = stack[toVisit].node;
+            tNear = stack[toVisit].tNear;
+            tFar = stack[toVisit].tFar;
+        }
+    }
+
+    return hitAnything;
+
+}
+
+inline bool KdTree::boundingBox(float t0, float t1, AABB& box) const
+{
+
+    if (!hasBounds)
+        return false;
+
+    box = bounds;
+
+    return true;
+
+}
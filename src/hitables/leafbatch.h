@@ -0,0 +1,50 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif // __AVX2__
+
+// Primitives of one BVH leaf intersected together, one per AVX2 lane. See
+// spherebatch.h and trianglemesh.h.
+const int leafBatchWidth = 8;
+
+// Lane with the smallest tHit among the lanes set in mask. The lanes that
+// were missed hold FLT_MAX.
+inline int nearestLane(const float* tHit, int mask)
+{
+
+#ifdef __AVX2__
+    __m256 t = _mm256_loadu_ps(tHit);
+    __m256 m = _mm256_min_ps(t, _mm256_permute2f128_ps(t, t, 1));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return __builtin_ctz(_mm256_movemask_ps(_mm256_cmp_ps(t, m, _CMP_EQ_OQ)) & mask);
+#else
+    int nearest = __builtin_ctz(mask);
+    for (int i = nearest + 1; i < leafBatchWidth; i++)
+        if ((mask & (1 << i)) && tHit[i] < tHit[nearest])
+            nearest = i;
+    return nearest;
+#endif // __AVX2__
+
+}
@@ -0,0 +1,1516 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <stdint.h>
+#include <omp.h>
+
+#include "hitables/bvh.h"
+#include "hitables/spherebatch.h"
+#include "hitables/trianglemesh.h"
+
+// 32 byte node of the flattened BVH. Interior nodes store the index of their
+// second child, the first child follows the node directly in memory.
+// Leaves store the offset of their first primitive.
+struct LinearBVHNode
+{
+
+    Vec3 boundsMin;
+    int offset;                 // primitive offset (leaf) or second child (interior)
+    Vec3 boundsMax;
+    uint16_t primitiveCount;    // 0 for interior nodes
+    uint8_t axis;               // split axis of interior nodes
+    uint8_t leafType;           // HitableType of all primitives of a leaf, HITABLE_VIRTUAL if mixed
+
+    // The bounds are loaded with one load each, w would be the offset and
+    // the counts behind them and is cleared.
+    inline bool hit(const SlabRay& ray, float tMin, float tMax) const
+    {
+        return slabTest(Vec4::load3(reinterpret_cast<const float*>(&boundsMin)),
+                        Vec4::load3(reinterpret_cast<const float*>(&boundsMax)),
+                        ray, tMin, tMax);
+    }
+
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be 32 bytes");
+
+// Depth of the traversal stack, the builder keeps the tree shallower than this.
+const int linearBVHStackSize = 64;
+
+// HitableType shared by the count primitives of a leaf, HITABLE_VIRTUAL if
+// they differ.
+inline uint8_t leafHitableType(Hitable* const* primitives, int count)
+{
+
+    HitableType type = primitives[0]->hitableType();
+    for (int i = 1; i < count; i++)
+        if (primitives[i]->hitableType() != type)
+            return HITABLE_VIRTUAL;
+    return static_cast<uint8_t>(type);
+
+}
+
+// Node indices grouped by depth, deepest level first, so that every level
+// can be refitted in parallel once the level below it is done.
+struct RefitLevels
+{
+
+    std::vector<int> order;
+    std::vector<int> levelStart;
+
+};
+
+// Groups the nodes with depth >= 0 by decreasing depth.
+inline RefitLevels groupByDepth(const std::vector<int>& depth)
+{
+
+    int maxDepth = -1;
+    for (int d : depth)
+        maxDepth = std::max(maxDepth, d);
+
+    RefitLevels levels;
+    levels.levelStart.assign(static_cast<size_t>(maxDepth + 2), 0);
+    for (int d : depth)
+        if (d >= 0)
+            levels.levelStart[maxDepth - d + 1]++;
+    for (int l = 1; l <= maxDepth + 1; l++)
+        levels.levelStart[l] += levels.levelStart[l-1];
+
+    std::vector<int> next(levels.levelStart.begin(), levels.levelStart.end() - 1);
+    levels.order.resize(static_cast<size_t>(levels.levelStart.back()));
+    for (int i = 0; i < static_cast<int>(depth.size()); i++)
+        if (depth[i] >= 0)
+            levels.order[next[maxDepth - depth[i]]++] = i;
+
+    return levels;
+
+}
+
+// Leaves of the treelets rearranged by the treelet optimization.
+const int maxTreeletLeaves = 5;
+
+// Timings of the last build in milliseconds.
+struct BVHBuildStats
+{
+
+    double setupMs;             // primitive bounds and centroids
+    double sortMs;              // Morton codes and radix sort
+    double topMs;               // data parallel splits of the large nodes
+    double subtreeMs;           // subtrees built in parallel
+    double flattenMs;           // concatenation of the subtrees in depth-first order
+    double treeletMs;           // treelet restructuring
+    double totalMs;
+    int subtreeCount;
+    int threadCount;
+
+};
+
+// BVH stored as a contiguous depth-first array of nodes with the primitives
+// reordered to match the leaf order. The traversal is iterative and only
+// calls the virtual hit() of the primitives in the leaves.
+class LinearBVH : public Hitable
+{
+
+    public:
+
+        LinearBVH(Hitable **l, int n, float t0, float t1,
+                  const BVHBuildParams& params = BVHBuildParams());
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool occluded(const Ray& r, float tMin, float tMax) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+        int hitPacket(const RayPacket& packet, float tMin, float tMax, HitRecord* recs) const override;
+
+        float sahCost() const
+        {
+            return cost;
+        }
+
+        bool orderedTraversal() const
+        {
+            return ordered;
+        }
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            for (Hitable* primitive : primitives)
+                primitive->bindMaterials(table);
+        }
+
+        size_t memoryBytes() const
+        {
+            return sizeof(*this) + nodes.size() * sizeof(nodes[0]) +
+                   primitives.size() * sizeof(Hitable*) +
+                   sphereBatches.size() * sizeof(SphereBatch) +
+                   triangleBatches.size() * sizeof(TriangleBatch);
+        }
+
+        // Recomputes the bounds bottom-up for the current primitive positions
+        // while keeping the topology. Returns the new SAH cost.
+        float refit(float t0, float t1, const BVHBuildParams& params = BVHBuildParams());
+
+        std::vector<LinearBVHNode> nodes;
+        std::vector<Hitable*> primitives;
+        std::vector<SphereBatch> sphereBatches;       // leaves packed for BVH_BATCHED
+        std::vector<TriangleBatch> triangleBatches;
+        BVHBuildStats buildStats;
+
+    private:
+
+        // Node of the top of the tree, split with all threads. A negative
+        // child is the bitwise complement of a subtree index.
+        struct TopNode
+        {
+            int child[2];
+            int axis;
+        };
+
+        // Subtree built by one thread into its own node array.
+        struct Subtree
+        {
+            int start;
+            int n;
+            int depth;
+            float cost;
+            std::vector<LinearBVHNode> nodes;
+        };
+
+        // bins is the scratch for the SAH binning of the whole subtree,
+        // 3*sahBinCount(params) entries.
+        int build(std::vector<LinearBVHNode>& out, BVHPrimitiveInfo* prims, BVHBin* bins,
+                  int start, int n, int depth,
+                  const BVHBuildParams& params, float& subtreeCost);
+
+        int buildMorton(std::vector<LinearBVHNode>& out, const BVHPrimitiveInfo* prims,
+                        const MortonPrimitive* keys, int start, int n, int depth,
+                        const BVHBuildParams& params, float& subtreeCost);
+
+        int buildTop(std::vector<TopNode>& top, std::vector<Subtree>& subtrees,
+                     BVHPrimitiveInfo* prims, BVHPrimitiveInfo* scratch,
+                     const MortonPrimitive* keys, int start, int n, int depth,
+                     int subtreeSize, const BVHBuildParams& params);
+
+        int flatten(const std::vector<TopNode>& top, std::vector<Subtree>& subtrees,
+                    int ref, const BVHBuildParams& params,
+                    AABB& subtreeBounds, float& subtreeCost);
+
+        // Binary tree node used while restructuring treelets. Leaves keep
+        // the index of their node in the flattened array.
+        struct TreeletNode
+        {
+            AABB bounds;
+            int child[2];
+            int leaf;           // -1 for interior nodes
+            int count;          // primitives in the subtree
+            bool collapse;      // emit the subtree as one leaf
+            float cost;         // SAH cost scaled by the surface area
+        };
+
+        // Optimal topology of one treelet for every subset of its leaves.
+        struct TreeletSolution
+        {
+            int leaves[maxTreeletLeaves];
+            int interior[maxTreeletLeaves - 1];
+            AABB bounds[1 << maxTreeletLeaves];
+            float cost[1 << maxTreeletLeaves];
+            int count[1 << maxTreeletLeaves];
+            int partition[1 << maxTreeletLeaves];       // 0 if the subset is collapsed into a leaf
+        };
+
+        void optimizeTreelets(const BVHBuildParams& params);
+
+        // Replaces the primitives of every leaf that holds only spheres or
+        // only triangles with one SphereBatch or TriangleBatch.
+        void packLeaves();
+        void classifyLeaves();
+
+        static void restructureTreelets(TreeletNode* tree, int root, int depth,
+                                        const BVHBuildParams& params);
+
+        static int assignTreelet(TreeletNode* tree, const TreeletSolution& solution,
+                                 int subset, int& nextInterior);
+
+        int emitTreelets(const TreeletNode* tree, int index, int depth,
+                         std::vector<LinearBVHNode>& out, std::vector<Hitable*>& outPrimitives,
+                         int& maxDepth) const;
+
+        void gatherPrimitives(const TreeletNode* tree, int index,
+                              std::vector<Hitable*>& outPrimitives) const;
+
+        float cost;
+        bool ordered;
+        RefitLevels refitLevels;    // interior nodes, filled by the first refit
+
+};
+
+inline double elapsedMs(std::chrono::high_resolution_clock::time_point& since)
+{
+
+    auto now = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> elapsed = now - since;
+    since = now;
+
+    return elapsed.count();
+
+}
+
+// Picks the axis with the largest centroid extent and moves the lower half
+// of the primitives to the front.
+inline int splitMedian(BVHPrimitiveInfo* range, int n, const BVHRangeBounds& rb)
+{
+
+    Vec3 extent = rb.centroidMax - rb.centroidMin;
+    int axis = 0;
+    if (extent.y() > extent[axis])
+        axis = 1;
+    if (extent.z() > extent[axis])
+        axis = 2;
+
+    std::nth_element(range, range + n/2, range + n,
+        [axis](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b)
+        {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+
+    return axis;
+
+}
+
+inline LinearBVH::LinearBVH(Hitable **l, int n, float t0, float t1, const BVHBuildParams& params)
+{
+
+    auto totalStart = std::chrono::high_resolution_clock::now();
+    auto phaseStart = totalStart;
+
+    std::vector<BVHPrimitiveInfo> prims(static_cast<size_t>(n));
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++)
+    {
+        prims[i].hitable = l[i];
+        if (!l[i]->boundingBox(t0, t1, prims[i].box))
+            std::cerr << "No bounding box in LinearBVH constructor" << std::endl;
+        prims[i].centroid = prims[i].box.centroid();
+    }
+
+    ordered = params.orderedTraversal;
+    primitives.resize(static_cast<size_t>(n));
+
+    buildStats = BVHBuildStats();
+    buildStats.threadCount = omp_get_max_threads();
+    buildStats.setupMs = elapsedMs(phaseStart);
+
+    // An empty scene has no nodes, the traversal and boundingBox check for it.
+    if (n == 0)
+    {
+        cost = 0.0f;
+        buildStats.totalMs = buildStats.setupMs;
+        return;
+    }
+
+    std::vector<MortonPrimitive> keys;
+    if (params.builder == MORTON_LBVH)
+    {
+        keys = sortByMortonCode(n,
+            [&prims](int i) { return prims[i].centroid; }, params.mortonBits);
+
+        std::vector<BVHPrimitiveInfo> sorted(static_cast<size_t>(n));
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+            sorted[i] = prims[keys[i].index];
+        prims.swap(sorted);
+
+        buildStats.sortMs = elapsedMs(phaseStart);
+    }
+
+    // Nodes above subtreeSize primitives are split with all threads working
+    // on the binning and partitioning, the subtrees below are built in parallel.
+    int subtreeSize = buildStats.threadCount > 1 ?
+                      std::max(4096, n / (8 * buildStats.threadCount)) : n;
+
+    if (n <= subtreeSize)
+    {
+        nodes.reserve(static_cast<size_t>(2*n));
+        std::vector<BVHBin> bins(static_cast<size_t>(3 * sahBinCount(params)));
+        if (keys.empty())
+            build(nodes, prims.data(), bins.data(), 0, n, 0, params, cost);
+        else
+            buildMorton(nodes, prims.data(), keys.data(), 0, n, 0, params, cost);
+        buildStats.subtreeMs = elapsedMs(phaseStart);
+        buildStats.subtreeCount = 1;
+    }
+    else
+    {
+        std::vector<TopNode> top;
+        std::vector<Subtree> subtrees;
+        std::vector<BVHPrimitiveInfo> scratch(static_cast<size_t>(n));
+        if (!keys.empty())
+            std::vector<BVHPrimitiveInfo>().swap(scratch);
+        int root = buildTop(top, subtrees, prims.data(), scratch.data(),
+                            keys.empty() ? nullptr : keys.data(), 0, n, 0, subtreeSize, params);
+        buildStats.topMs = elapsedMs(phaseStart);
+
+        int subtreeCount = static_cast<int>(subtrees.size());
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int i = 0; i < subtreeCount; i++)
+        {
+            Subtree& subtree = subtrees[i];
+            subtree.nodes.reserve(static_cast<size_t>(2*subtree.n));
+            if (keys.empty())
+            {
+                std::vector<BVHBin> bins(static_cast<size_t>(3 * sahBinCount(params)));
+                build(subtree.nodes, prims.data(), bins.data(), subtree.start, subtree.n,
+                      subtree.depth, params, subtree.cost);
+            }
+            else
+                buildMorton(subtree.nodes, prims.data(), keys.data(), subtree.start, subtree.n,
+                            subtree.depth, params, subtree.cost);
+        }
+        buildStats.subtreeMs = elapsedMs(phaseStart);
+        buildStats.subtreeCount = subtreeCount;
+
+        size_t nodeCount = top.size();
+        for (const auto& subtree : subtrees)
+            nodeCount += subtree.nodes.size();
+        nodes.reserve(nodeCount);
+
+        AABB bounds;
+        flatten(top, subtrees, root, params, bounds, cost);
+        buildStats.flattenMs = elapsedMs(phaseStart);
+    }
+
+    if (params.treeletOptimization && n > 2)
+    {
+        optimizeTreelets(params);
+        buildStats.treeletMs = elapsedMs(phaseStart);
+    }
+
+    if (params.layout == BVH_BATCHED)
+        packLeaves();
+    classifyLeaves();
+
+    std::chrono::duration<double, std::milli> total = std::chrono::high_resolution_clock::now() - totalStart;
+    buildStats.totalMs = total.count();
+
+}
+
+inline int LinearBVH::buildTop(std::vector<TopNode>& top, std::vector<Subtree>& subtrees,
+                               BVHPrimitiveInfo* prims, BVHPrimitiveInfo* scratch,
+                               const MortonPrimitive* keys, int start, int n, int depth,
+                               int subtreeSize, const BVHBuildParams& params)
+{
+
+    if (n <= subtreeSize)
+    {
+        Subtree subtree;
+        subtree.start = start;
+        subtree.n = n;
+        subtree.depth = depth;
+        subtree.cost = 0.0f;
+        subtrees.push_back(subtree);
+        return ~static_cast<int>(subtrees.size() - 1);
+    }
+
+    if (keys)
+    {
+        // The primitives are already in Morton order, so splitting is a binary search.
+        int nodeIndex = static_cast<int>(top.size());
+        top.push_back(TopNode());
+        int mid = mortonSplit(keys + start, n, top[nodeIndex].axis);
+
+        int leftRef = buildTop(top, subtrees, prims, scratch, keys, start, mid, depth + 1, subtreeSize, params);
+        int rightRef = buildTop(top, subtrees, prims, scratch, keys, start + mid, n - mid, depth + 1, subtreeSize, params);
+        top[nodeIndex].child[0] = leftRef;
+        top[nodeIndex].child[1] = rightRef;
+
+        return nodeIndex;
+    }
+
+    BVHPrimitiveInfo* range = prims + start;
+    int binCount = sahBinCount(params);
+    int maxThreads = omp_get_max_threads();
+    std::vector<BVHRangeBounds> threadBounds(static_cast<size_t>(maxThreads));
+    std::vector<BVHBin> threadBins(static_cast<size_t>(maxThreads * 3 * binCount));
+    std::vector<int> threadLeft(static_cast<size_t>(maxThreads + 1));
+    for (auto& bin : threadBins)
+        bin.count = 0;
+
+    BVHRangeBounds rb;
+    BVHSplit split;
+    split.axis = -1;
+    int teamSize = 1;
+
+    // Every thread works on the same contiguous chunk in all passes.
+    #pragma omp parallel
+    {
+        int threadCount = omp_get_num_threads();
+        int t = omp_get_thread_num();
+        int chunkStart = static_cast<int>(static_cast<long long>(n) * t / threadCount);
+        int chunkEnd = static_cast<int>(static_cast<long long>(n) * (t + 1) / threadCount);
+        int chunkSize = chunkEnd - chunkStart;
+
+        if (chunkSize > 0)
+            threadBounds[t] = computeRangeBounds(range + chunkStart, chunkSize);
+        #pragma omp barrier
+        #pragma omp single
+        {
+            teamSize = threadCount;
+            rb = threadBounds[0];
+            for (int i = 1; i < threadCount; i++)
+                if (static_cast<long long>(n) * (i + 1) / threadCount > static_cast<long long>(n) * i / threadCount)
+                    rb = mergeRangeBounds(rb, threadBounds[i]);
+        }
+
+        if (params.builder == SAH_BINNED && depth <= linearBVHStackSize/2)
+        {
+            binPrimitives(range + chunkStart, chunkSize, rb, binCount, &threadBins[t * 3 * binCount]);
+            #pragma omp barrier
+            #pragma omp single
+            {
+                for (int i = 1; i < threadCount; i++)
+                    mergeBins(threadBins.data(), &threadBins[i * 3 * binCount], 3 * binCount);
+                split = evaluateBins(threadBins.data(), n, rb, params);
+            }
+
+            if (split.axis >= 0)
+            {
+                // Count, then scatter both sides into the scratch buffer.
+                int left = 0;
+                for (int i = chunkStart; i < chunkEnd; i++)
+                    left += isLeftOfSplit(range[i], split, binCount);
+                threadLeft[t + 1] = left;
+                #pragma omp barrier
+                #pragma omp single
+                {
+                    threadLeft[0] = 0;
+                    for (int i = 1; i <= threadCount; i++)
+                        threadLeft[i] += threadLeft[i-1];
+                }
+
+                int leftPos = threadLeft[t];
+                int rightPos = threadLeft[threadCount] + chunkStart - threadLeft[t];
+                BVHPrimitiveInfo* out = scratch + start;
+                for (int i = chunkStart; i < chunkEnd; i++)
+                {
+                    if (isLeftOfSplit(range[i], split, binCount))
+                        out[leftPos++] = range[i];
+                    else
+                        out[rightPos++] = range[i];
+                }
+                #pragma omp barrier
+                std::copy(out + chunkStart, out + chunkEnd, range + chunkStart);
+            }
+        }
+    }
+
+    int mid = split.axis >= 0 ? threadLeft[teamSize] : 0;
+    if (mid == 0 || mid == n)
+    {
+        split.axis = splitMedian(range, n, rb);
+        mid = n/2;
+    }
+
+    int nodeIndex = static_cast<int>(top.size());
+    top.push_back(TopNode());
+    top[nodeIndex].axis = split.axis;
+
+    int leftRef = buildTop(top, subtrees, prims, scratch, keys, start, mid, depth + 1, subtreeSize, params);
+    int rightRef = buildTop(top, subtrees, prims, scratch, keys, start + mid, n - mid, depth + 1, subtreeSize, params);
+    top[nodeIndex].child[0] = leftRef;
+    top[nodeIndex].child[1] = rightRef;
+
+    return nodeIndex;
+
+}
+
+inline int LinearBVH::flatten(const std::vector<TopNode>& top, std::vector<Subtree>& subtrees,
+                              int ref, const BVHBuildParams& params,
+                              AABB& subtreeBounds, float& subtreeCost)
+{
+
+    int nodeIndex = static_cast<int>(nodes.size());
+
+    if (ref < 0)
+    {
+        // Append the subtree and rebase its interior child offsets.
+        Subtree& subtree = subtrees[~ref];
+        for (auto node : subtree.nodes)
+        {
+            if (node.primitiveCount == 0)
+                node.offset += nodeIndex;
+            nodes.push_back(node);
+        }
+        std::vector<LinearBVHNode>().swap(subtree.nodes);
+
+        subtreeBounds = AABB(nodes[nodeIndex].boundsMin, nodes[nodeIndex].boundsMax);
+        subtreeCost = subtree.cost;
+        return nodeIndex;
+    }
+
+    const TopNode& topNode = top[ref];
+    nodes.push_back(LinearBVHNode());
+    nodes[nodeIndex].primitiveCount = 0;
+    nodes[nodeIndex].axis = static_cast<uint8_t>(topNode.axis);
+
+    AABB leftBounds, rightBounds;
+    float leftCost, rightCost;
+    flatten(top, subtrees, topNode.child[0], params, leftBounds, leftCost);
+    nodes[nodeIndex].offset = flatten(top, subtrees, topNode.child[1], params, rightBounds, rightCost);
+
+    subtreeBounds = surroundingBox(leftBounds, rightBounds);
+    nodes[nodeIndex].boundsMin = subtreeBounds.min();
+    nodes[nodeIndex].boundsMax = subtreeBounds.max();
+
+    subtreeCost = sahNodeCost(subtreeBounds, leftBounds, rightBounds, leftCost, rightCost, params);
+
+    return nodeIndex;
+
+}
+
+// Emits the subtree over primitives sorted by Morton code. Bounds are
+// gathered bottom-up, so the build is linear apart from the split searches.
+inline int LinearBVH::buildMorton(std::vector<LinearBVHNode>& out, const BVHPrimitiveInfo* prims,
+                                  const MortonPrimitive* keys, int start, int n, int depth,
+                                  const BVHBuildParams& params, float& subtreeCost)
+{
+
+    int nodeIndex = static_cast<int>(out.size());
+    out.push_back(LinearBVHNode());
+
+    // With treelet optimization every primitive starts in its own leaf and
+    // the restructuring decides which ones to merge.
+    int leafSize = params.treeletOptimization ? 1 : params.maxLeafSize;
+    if (n <= leafSize)
+    {
+        AABB bounds = prims[start].box;
+        for (int i = 0; i < n; i++)
+        {
+            bounds = surroundingBox(bounds, prims[start + i].box);
+            primitives[start + i] = prims[start + i].hitable;
+        }
+        out[nodeIndex].boundsMin = bounds.min();
+        out[nodeIndex].boundsMax = bounds.max();
+        out[nodeIndex].offset = start;
+        out[nodeIndex].primitiveCount = static_cast<uint16_t>(n);
+        out[nodeIndex].axis = 0;
+        subtreeCost = params.intersectionCost * n;
+        return nodeIndex;
+    }
+
+    // Past half of the stack depth only split in the middle, as in build().
+    int axis;
+    int mid = mortonSplit(keys + start, n, axis);
+    if (depth > linearBVHStackSize/2)
+        mid = n/2;
+
+    float leftCost, rightCost;
+    int leftIndex = buildMorton(out, prims, keys, start, mid, depth + 1, params, leftCost);
+    int rightIndex = buildMorton(out, prims, keys, start + mid, n - mid, depth + 1, params, rightCost);
+
+    AABB leftBounds(out[leftIndex].boundsMin, out[leftIndex].boundsMax);
+    AABB rightBounds(out[rightIndex].boundsMin, out[rightIndex].boundsMax);
+    AABB bounds = surroundingBox(leftBounds, rightBounds);
+    out[nodeIndex].boundsMin = bounds.min();
+    out[nodeIndex].boundsMax = bounds.max();
+    out[nodeIndex].offset = rightIndex;
+    out[nodeIndex].primitiveCount = 0;
+    out[nodeIndex].axis = static_cast<uint8_t>(axis);
+
+    subtreeCost = sahNodeCost(bounds, leftBounds, rightBounds, leftCost, rightCost, params);
+
+    return nodeIndex;
+
+}
+
+inline int LinearBVH::build(std::vector<LinearBVHNode>& out, BVHPrimitiveInfo* prims, BVHBin* bins,
+                            int start, int n, int depth,
+                            const BVHBuildParams& params, float& subtreeCost)
+{
+
+    int nodeIndex = static_cast<int>(out.size());
+    out.push_back(LinearBVHNode());
+
+    BVHPrimitiveInfo* range = prims + start;
+    BVHRangeBounds rb = computeRangeBounds(range, n);
+    AABB bounds = rb.bounds;
+    out[nodeIndex].boundsMin = bounds.min();
+    out[nodeIndex].boundsMax = bounds.max();
+
+    BVHSplit split;
+    split.axis = -1;
+    split.cost = FLT_MAX;
+    if (n > 1 && params.builder == SAH_BINNED)
+    {
+        int binCount = sahBinCount(params);
+        for (int i = 0; i < 3 * binCount; i++)
+            bins[i].count = 0;
+        binPrimitives(range, n, rb, binCount, bins);
+        split = evaluateBins(bins, n, rb, params);
+    }
+
+    // Past half of the stack depth only split in the middle, so the
+    // remaining depth stays logarithmic.
+    if (depth > linearBVHStackSize/2)
+        split.axis = -1;
+
+    float leafCost = params.intersectionCost * n;
+    bool makeLeaf = n == 1 ||
+                    (n <= params.maxLeafSize &&
+                     (params.builder == MEDIAN_SPLIT || leafCost <= split.cost));
+
+    if (makeLeaf)
+    {
+        for (int i = 0; i < n; i++)
+            primitives[start + i] = range[i].hitable;
+        out[nodeIndex].offset = start;
+        out[nodeIndex].primitiveCount = static_cast<uint16_t>(n);
+        out[nodeIndex].axis = 0;
+        subtreeCost = leafCost;
+        return nodeIndex;
+    }
+
+    int mid;
+    if (params.builder == MEDIAN_SPLIT || split.axis < 0)
+    {
+        split.axis = splitMedian(range, n, rb);
+        mid = n/2;
+    }
+    else
+        mid = partitionSAH(range, n, params, split);
+
+    float leftCost, rightCost;
+    int leftIndex = build(out, prims, bins, start, mid, depth + 1, params, leftCost);
+    int rightIndex = build(out, prims, bins, start + mid, n - mid, depth + 1, params, rightCost);
+
+    out[nodeIndex].offset = rightIndex;
+    out[nodeIndex].primitiveCount = 0;
+    out[nodeIndex].axis = static_cast<uint8_t>(split.axis);
+
+    subtreeCost = sahNodeCost(bounds,
+                              AABB(out[leftIndex].boundsMin, out[leftIndex].boundsMax),
+                              AABB(out[rightIndex].boundsMin, out[rightIndex].boundsMax),
+                              leftCost, rightCost, params);
+
+    return nodeIndex;
+
+}
+
+// Treelet restructuring after Karras and Aila: for every node, bottom-up,
+// the treelet of up to maxTreeletLeaves subtrees below it is rearranged
+// into the topology with the lowest SAH cost found by dynamic programming
+// over the subsets of its leaves.
+inline void LinearBVH::optimizeTreelets(const BVHBuildParams& params)
+{
+
+    // Node i of the depth-first array has its children at i+1 and offset,
+    // so the tree can use the same indices.
+    int nodeCount = static_cast<int>(nodes.size());
+    std::vector<TreeletNode> tree(static_cast<size_t>(nodeCount));
+    for (int i = nodeCount - 1; i >= 0; i--)
+    {
+        const LinearBVHNode& node = nodes[i];
+        TreeletNode& t = tree[i];
+        t.bounds = AABB(node.boundsMin, node.boundsMax);
+        float area = t.bounds.surfaceArea();
+        t.collapse = false;
+        if (node.primitiveCount > 0)
+        {
+            t.child[0] = t.child[1] = -1;
+            t.leaf = i;
+            t.count = node.primitiveCount;
+            t.cost = params.intersectionCost * node.primitiveCount * area;
+        }
+        else
+        {
+            t.child[0] = i + 1;
+            t.child[1] = node.offset;
+            t.leaf = -1;
+            t.count = tree[i + 1].count + tree[node.offset].count;
+            t.cost = params.traversalCost * area + tree[i + 1].cost + tree[node.offset].cost;
+        }
+    }
+
+    #pragma omp parallel
+    #pragma omp single
+    restructureTreelets(tree.data(), 0, 0, params);
+
+    // Restructuring can deepen the tree, keep the old one if the stack
+    // would overflow.
+    std::vector<LinearBVHNode> optimized;
+    std::vector<Hitable*> optimizedPrimitives;
+    optimized.reserve(nodes.size());
+    optimizedPrimitives.reserve(primitives.size());
+    int maxDepth = 0;
+    emitTreelets(tree.data(), 0, 0, optimized, optimizedPrimitives, maxDepth);
+    if (maxDepth >= linearBVHStackSize)
+        return;
+
+    nodes.swap(optimized);
+    primitives.swap(optimizedPrimitives);
+    float area = tree[0].bounds.surfaceArea();
+    if (area > 0.0f)
+        cost = tree[0].cost / area;
+
+}
+
+inline void LinearBVH::restructureTreelets(TreeletNode* tree, int root, int depth,
+                                           const BVHBuildParams& params)
+{
+
+    if (tree[root].leaf >= 0)
+        return;
+
+    // The children are optimized first, the upper levels of the tree in parallel.
+    #pragma omp task if (depth < 8)
+    restructureTreelets(tree, tree[root].child[0], depth + 1, params);
+    restructureTreelets(tree, tree[root].child[1], depth + 1, params);
+    #pragma omp taskwait
+
+    // Grow the treelet by opening the leaf with the largest surface area.
+    TreeletSolution solution;
+    int leafCount = 2;
+    int interiorCount = 1;
+    solution.leaves[0] = tree[root].child[0];
+    solution.leaves[1] = tree[root].child[1];
+    solution.interior[0] = root;
+    while (leafCount < maxTreeletLeaves)
+    {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int i = 0; i < leafCount; i++)
+        {
+            const TreeletNode& t = tree[solution.leaves[i]];
+            float area = t.bounds.surfaceArea();
+            if (t.leaf < 0 && area > largestArea)
+            {
+                largest = i;
+                largestArea = area;
+            }
+        }
+        if (largest < 0)
+            break;
+
+        int opened = solution.leaves[largest];
+        solution.interior[interiorCount++] = opened;
+        solution.leaves[largest] = tree[opened].child[0];
+        solution.leaves[leafCount++] = tree[opened].child[1];
+    }
+
+    // Subsets are visited in increasing order, so all of their proper
+    // subsets are already solved.
+    int full = (1 << leafCount) - 1;
+    for (int subset = 1; subset <= full; subset++)
+    {
+        int lowest = subset & -subset;
+        const TreeletNode& lowestLeaf = tree[solution.leaves[__builtin_ctz(static_cast<unsigned int>(subset))]];
+        if (subset == lowest)
+        {
+            solution.bounds[subset] = lowestLeaf.bounds;
+            solution.cost[subset] = lowestLeaf.cost;
+            solution.count[subset] = lowestLeaf.count;
+            continue;
+        }
+
+        solution.bounds[subset] = surroundingBox(solution.bounds[subset & (subset - 1)], lowestLeaf.bounds);
+        solution.count[subset] = solution.count[subset & (subset - 1)] + lowestLeaf.count;
+        float area = solution.bounds[subset].surfaceArea();
+
+        float best = FLT_MAX;
+        for (int part = (subset - 1) & subset; part > 0; part = (part - 1) & subset)
+        {
+            if (!(part & lowest))
+                continue;
+            float c = solution.cost[part] + solution.cost[subset ^ part];
+            if (c < best)
+            {
+                best = c;
+                solution.partition[subset] = part;
+            }
+        }
+        solution.cost[subset] = params.traversalCost * area + best;
+
+        // Small subsets may be cheaper as a single leaf.
+        float leafCost = params.intersectionCost * solution.count[subset] * area;
+        if (solution.count[subset] <= params.maxLeafSize && leafCost <= solution.cost[subset])
+        {
+            solution.cost[subset] = leafCost;
+            solution.partition[subset] = 0;
+        }
+    }
+
+    if (solution.cost[full] < tree[root].cost)
+    {
+        int nextInterior = 0;
+        assignTreelet(tree, solution, full, nextInterior);
+    }
+
+}
+
+// Rebuilds the treelet over the leaves in subset, reusing its interior nodes.
+inline int LinearBVH::assignTreelet(TreeletNode* tree, const TreeletSolution& solution,
+                                    int subset, int& nextInterior)
+{
+
+    if ((subset & (subset - 1)) == 0)
+        return solution.leaves[__builtin_ctz(static_cast<unsigned int>(subset))];
+
+    // Collapsed subsets keep an arbitrary topology below them.
+    int index = solution.interior[nextInterior++];
+    int part = solution.partition[subset];
+    bool collapse = part == 0;
+    if (collapse)
+        part = subset & -subset;
+    tree[index].child[0] = assignTreelet(tree, solution, part, nextInterior);
+    tree[index].child[1] = assignTreelet(tree, solution, subset ^ part, nextInterior);
+    tree[index].bounds = solution.bounds[subset];
+    tree[index].count = solution.count[subset];
+    tree[index].collapse = collapse;
+    tree[index].cost = solution.cost[subset];
+
+    return index;
+
+}
+
+inline int LinearBVH::emitTreelets(const TreeletNode* tree, int index, int depth,
+                                   std::vector<LinearBVHNode>& out, std::vector<Hitable*>& outPrimitives,
+                                   int& maxDepth) const
+{
+
+    int nodeIndex = static_cast<int>(out.size());
+    maxDepth = std::max(maxDepth, depth);
+
+    const TreeletNode& t = tree[index];
+    if (t.leaf >= 0 || t.collapse)
+    {
+        out.push_back(LinearBVHNode());
+        out[nodeIndex].boundsMin = t.bounds.min();
+        out[nodeIndex].boundsMax = t.bounds.max();
+        out[nodeIndex].offset = static_cast<int>(outPrimitives.size());
+        out[nodeIndex].primitiveCount = static_cast<uint16_t>(t.count);
+        out[nodeIndex].axis = 0;
+        gatherPrimitives(tree, index, outPrimitives);
+        return nodeIndex;
+    }
+
+    // The split axis is the one along which the children are furthest
+    // apart, the lower child goes first for the ordered traversal.
+    Vec3 separation = tree[t.child[1]].bounds.centroid() - tree[t.child[0]].bounds.centroid();
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (fabsf(separation[a]) > fabsf(separation[axis]))
+            axis = a;
+    int first = separation[axis] < 0.0f ? 1 : 0;
+
+    out.push_back(LinearBVHNode());
+    out[nodeIndex].boundsMin = t.bounds.min();
+    out[nodeIndex].boundsMax = t.bounds.max();
+    out[nodeIndex].primitiveCount = 0;
+    out[nodeIndex].axis = static_cast<uint8_t>(axis);
+
+    emitTreelets(tree, t.child[first], depth + 1, out, outPrimitives, maxDepth);
+    out[nodeIndex].offset = emitTreelets(tree, t.child[1 - first], depth + 1, out, outPrimitives, maxDepth);
+
+    return nodeIndex;
+
+}
+
+inline void LinearBVH::gatherPrimitives(const TreeletNode* tree, int index,
+                                        std::vector<Hitable*>& outPrimitives) const
+{
+
+    const TreeletNode& t = tree[index];
+    if (t.leaf >= 0)
+    {
+        const LinearBVHNode& node = nodes[t.leaf];
+        outPrimitives.insert(outPrimitives.end(), primitives.begin() + node.offset,
+                             primitives.begin() + node.offset + node.primitiveCount);
+        return;
+    }
+
+    gatherPrimitives(tree, t.child[0], outPrimitives);
+    gatherPrimitives(tree, t.child[1], outPrimitives);
+
+}
+
+inline void LinearBVH::packLeaves()
+{
+
+    // Kind of batch a leaf can be packed into.
+    enum { UNPACKED, SPHERES, TRIANGLES };
+    auto batchType = [this](const LinearBVHNode& node)
+    {
+        if (node.primitiveCount < 2 || node.primitiveCount > leafBatchWidth)
+            return int(UNPACKED);
+        bool spheres = true, triangles = true;
+        for (int k = 0; k < node.primitiveCount; k++)
+        {
+            const Hitable* primitive = primitives[node.offset + k];
+            spheres = spheres && dynamic_cast<const Sphere*>(primitive);
+            triangles = triangles && dynamic_cast<const Triangle*>(primitive);
+        }
+        return spheres ? int(SPHERES) : triangles ? int(TRIANGLES) : int(UNPACKED);
+    };
+
+    // The leaves point into the batch vectors, so they must not grow after this.
+    std::vector<int> types(nodes.size(), UNPACKED);
+    size_t sphereBatchCount = 0, triangleBatchCount = 0;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i].primitiveCount == 0)
+            continue;
+        types[i] = batchType(nodes[i]);
+        sphereBatchCount += types[i] == SPHERES;
+        triangleBatchCount += types[i] == TRIANGLES;
+    }
+    sphereBatches.reserve(sphereBatchCount);
+    triangleBatches.reserve(triangleBatchCount);
+
+    std::vector<Hitable*> packed;
+    packed.reserve(primitives.size());
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        LinearBVHNode& node = nodes[i];
+        if (node.primitiveCount == 0)
+            continue;
+
+        int offset = static_cast<int>(packed.size());
+        if (types[i] == SPHERES)
+        {
+            sphereBatches.push_back(SphereBatch(&primitives[node.offset], node.primitiveCount));
+            packed.push_back(&sphereBatches.back());
+            node.primitiveCount = 1;
+        }
+        else if (types[i] == TRIANGLES)
+        {
+            triangleBatches.push_back(TriangleBatch(&primitives[node.offset], node.primitiveCount));
+            packed.push_back(&triangleBatches.back());
+            node.primitiveCount = 1;
+        }
+        else
+        {
+            for (int k = 0; k < node.primitiveCount; k++)
+                packed.push_back(primitives[node.offset + k]);
+        }
+        node.offset = offset;
+    }
+
+    primitives.swap(packed);
+
+}
+
+inline void LinearBVH::classifyLeaves()
+{
+
+    for (LinearBVHNode& node : nodes)
+        if (node.primitiveCount > 0)
+            node.leafType = leafHitableType(&primitives[node.offset], node.primitiveCount);
+
+}
+
+inline float LinearBVH::refit(float t0, float t1, const BVHBuildParams& params)
+{
+
+    int nodeCount = static_cast<int>(nodes.size());
+    if (nodeCount == 0)
+        return 0.0f;
+
+    #pragma omp parallel for
+    for (int i = 0; i < static_cast<int>(sphereBatches.size()); i++)
+        sphereBatches[i].update();
+    #pragma omp parallel for
+    for (int i = 0; i < static_cast<int>(triangleBatches.size()); i++)
+        triangleBatches[i].update();
+
+    if (refitLevels.levelStart.empty())
+    {
+        std::vector<int> depth(static_cast<size_t>(nodeCount), -1);
+        depth[0] = 0;
+        for (int i = 0; i < nodeCount; i++)
+            if (nodes[i].primitiveCount == 0)
+                depth[i + 1] = depth[nodes[i].offset] = depth[i] + 1;
+        for (int i = 0; i < nodeCount; i++)
+            if (nodes[i].primitiveCount > 0)
+                depth[i] = -1;
+        refitLevels = groupByDepth(depth);
+    }
+
+    std::vector<float> nodeCost(static_cast<size_t>(nodeCount));
+
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < nodeCount; i++)
+    {
+        LinearBVHNode& node = nodes[i];
+        if (node.primitiveCount == 0)
+            continue;
+
+        AABB bounds, box;
+        primitives[node.offset]->boundingBox(t0, t1, bounds);
+        for (int k = 1; k < node.primitiveCount; k++)
+        {
+            primitives[node.offset + k]->boundingBox(t0, t1, box);
+            bounds = surroundingBox(bounds, box);
+        }
+        node.boundsMin = bounds.min();
+        node.boundsMax = bounds.max();
+        nodeCost[i] = params.intersectionCost * node.primitiveCount;
+    }
+
+    int levelCount = static_cast<int>(refitLevels.levelStart.size()) - 1;
+    for (int level = 0; level < levelCount; level++)
+    {
+        int begin = refitLevels.levelStart[level];
+        int end = refitLevels.levelStart[level + 1];
+
+        #pragma omp parallel for if (end - begin > 1024)
+        for (int k = begin; k < end; k++)
+        {
+            int i = refitLevels.order[k];
+            LinearBVHNode& node = nodes[i];
+            AABB leftBounds(nodes[i + 1].boundsMin, nodes[i + 1].boundsMax);
+            AABB rightBounds(nodes[node.offset].boundsMin, nodes[node.offset].boundsMax);
+            AABB bounds = surroundingBox(leftBounds, rightBounds);
+            node.boundsMin = bounds.min();
+            node.boundsMax = bounds.max();
+            nodeCost[i] = sahNodeCost(bounds, leftBounds, rightBounds,
+                                      nodeCost[i + 1], nodeCost[node.offset], params);
+        }
+    }
+
+    cost = nodeCost[0];
+
+    return cost;
+
+}
+
+// Direct, inlinable calls for primitives known to be of type T. Hitable
+// itself goes through the vtable.
+template <typename T>
+inline bool intersectAs(const Hitable* primitive, const Ray& r, float tMin, float tMax, HitRecord& rec)
+{
+    return static_cast<const T*>(primitive)->T::intersect(r, tMin, tMax, rec);
+}
+
+template <>
+inline bool intersectAs<Hitable>(const Hitable* primitive, const Ray& r, float tMin, float tMax, HitRecord& rec)
+{
+    return primitive->intersect(r, tMin, tMax, rec);
+}
+
+template <typename T>
+inline bool occludedAs(const Hitable* primitive, const Ray& r, float tMin, float tMax)
+{
+    return static_cast<const T*>(primitive)->T::occluded(r, tMin, tMax);
+}
+
+template <>
+inline bool occludedAs<Hitable>(const Hitable* primitive, const Ray& r, float tMin, float tMax)
+{
+    return primitive->occluded(r, tMin, tMax);
+}
+
+template <typename T>
+inline bool intersectLeafAs(Hitable* const* primitives, int count, const Ray& r,
+                            float tMin, float& closestSoFar, HitRecord& rec)
+{
+
+    HitRecord tempRec;
+    bool hitAnything = false;
+    for (int i = 0; i < count; i++)
+    {
+        if (intersectAs<T>(primitives[i], r, tMin, closestSoFar, tempRec))
+        {
+            hitAnything = true;
+            closestSoFar = tempRec.time;
+            rec = tempRec;
+        }
+    }
+    return hitAnything;
+
+}
+
+template <typename T>
+inline bool occludedLeafAs(Hitable* const* primitives, int count, const Ray& r, float tMin, float tMax)
+{
+
+    for (int i = 0; i < count; i++)
+        if (occludedAs<T>(primitives[i], r, tMin, tMax))
+            return true;
+    return false;
+
+}
+
+// Closest intersect() among the primitives of a leaf, dispatched once per
+// leaf on its leafType. Shrinks closestSoFar to the hit.
+inline bool intersectLeaf(const LinearBVHNode& node, Hitable* const* primitives, const Ray& r,
+                          float tMin, float& closestSoFar, HitRecord& rec)
+{
+
+    Hitable* const* leaf = primitives + node.offset;
+    int n = node.primitiveCount;
+    switch (node.leafType)
+    {
+        case HITABLE_SPHERE:
+            return intersectLeafAs<Sphere>(leaf, n, r, tMin, closestSoFar, rec);
+        case HITABLE_MOVING_SPHERE:
+            return intersectLeafAs<MovingSphere>(leaf, n, r, tMin, closestSoFar, rec);
+        case HITABLE_TRIANGLE:
+            return intersectLeafAs<Triangle>(leaf, n, r, tMin, closestSoFar, rec);
+        case HITABLE_SPHERE_BATCH:
+            return intersectLeafAs<SphereBatch>(leaf, n, r, tMin, closestSoFar, rec);
+        case HITABLE_TRIANGLE_BATCH:
+            return intersectLeafAs<TriangleBatch>(leaf, n, r, tMin, closestSoFar, rec);
+        default:
+            return intersectLeafAs<Hitable>(leaf, n, r, tMin, closestSoFar, rec);
+    }
+
+}
+
+inline bool occludedLeaf(const LinearBVHNode& node, Hitable* const* primitives, const Ray& r,
+                         float tMin, float tMax)
+{
+
+    Hitable* const* leaf = primitives + node.offset;
+    int n = node.primitiveCount;
+    switch (node.leafType)
+    {
+        case HITABLE_SPHERE:
+            return occludedLeafAs<Sphere>(leaf, n, r, tMin, tMax);
+        case HITABLE_MOVING_SPHERE:
+            return occludedLeafAs<MovingSphere>(leaf, n, r, tMin, tMax);
+        case HITABLE_TRIANGLE:
+            return occludedLeafAs<Triangle>(leaf, n, r, tMin, tMax);
+        case HITABLE_SPHERE_BATCH:
+            return occludedLeafAs<SphereBatch>(leaf, n, r, tMin, tMax);
+        case HITABLE_TRIANGLE_BATCH:
+            return occludedLeafAs<TriangleBatch>(leaf, n, r, tMin, tMax);
+        default:
+            return occludedLeafAs<Hitable>(leaf, n, r, tMin, tMax);
+    }
+
+}
+
+// Closest hit traversal of a depth-first node array, shared by LinearBVH
+// and the node arrays of a mapped SceneCache. Leaves the record to
+// finalizeHitRecord().
+inline bool intersectLinearBVH(const LinearBVHNode* nodes, Hitable* const* primitives, bool ordered,
+                               const Ray& r, float tMin, float tMax, HitRecord& rec)
+{
+
+    SlabRay slabRay(r);
+    int dirIsNeg = signMask(slabRay.negative);
+
+    int stack[linearBVHStackSize];
+    int toVisit = 0;
+    int current = 0;
+
+    bool hitAnything = false;
+    float closestSoFar = tMax;
+
+    while (true)
+    {
+        const LinearBVHNode& node = nodes[current];
+        STATS_ADD(bvhNodeVisits, 1);
+        STATS_TOUCH(bvhNodeCache, &node);
+        if (node.hit(slabRay, tMin, closestSoFar))
+        {
+            if (node.primitiveCount > 0)
+            {
+                if (intersectLeaf(node, primitives, r, tMin, closestSoFar, rec))
+                    hitAnything = true;
+                if (toVisit == 0)
+                    break;
+                current = stack[--toVisit];
+            }
+            else if (ordered && (dirIsNeg >> node.axis & 1))
+            {
+                // The second child is nearer, the first one is visited later.
+                stack[toVisit++] = current + 1;
+                current = node.offset;
+            }
+            else
+            {
+                stack[toVisit++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (toVisit == 0)
+                break;
+            current = stack[--toVisit];
+        }
+    }
+
+    return hitAnything;
+
+}
+
+// Like intersectLinearBVH(), but returns at the first primitive hit. The interval
+// never shrinks, so there is nothing to gain from visiting the nearer child
+// first.
+inline bool occludedLinearBVH(const LinearBVHNode* nodes, Hitable* const* primitives,
+                              const Ray& r, float tMin, float tMax)
+{
+
+    SlabRay slabRay(r);
+
+    int stack[linearBVHStackSize];
+    int toVisit = 0;
+    int current = 0;
+
+    while (true)
+    {
+        const LinearBVHNode& node = nodes[current];
+        STATS_ADD(bvhNodeVisits, 1);
+        STATS_TOUCH(bvhNodeCache, &node);
+        if (node.hit(slabRay, tMin, tMax))
+        {
+            if (node.primitiveCount > 0)
+            {
+                if (occludedLeaf(node, primitives, r, tMin, tMax))
+                    return true;
+                if (toVisit == 0)
+                    break;
+                current = stack[--toVisit];
+            }
+            else
+            {
+                stack[toVisit++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (toVisit == 0)
+                break;
+            current = stack[--toVisit];
+        }
+    }
+
+    return false;
+
+}
+
+// Slab test of a node against every lane of a packet, lane k within
+// (tMin, tMax[k]). Returns the mask of the lanes that hit the bounds. The
+// AVX2 test takes the same steps as LinearBVHNode::hit() on 8 lanes, so
+// packets enter the same nodes as single rays.
+inline int packetHitsNode(const LinearBVHNode& node, const RayPacket& packet,
+                          float tMin, const float* tMax)
+{
+
+#ifdef __AVX2__
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 ix = _mm256_loadu_ps(packet.invDirX);
+    const __m256 iy = _mm256_loadu_ps(packet.invDirY);
+    const __m256 iz = _mm256_loadu_ps(packet.invDirZ);
+
+    __m256 ox = _mm256_loadu_ps(packet.originX);
+    __m256 oy = _mm256_loadu_ps(packet.originY);
+    __m256 oz = _mm256_loadu_ps(packet.originZ);
+    __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.x()), ox), ix);
+    __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.x()), ox), ix);
+    __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.y()), oy), iy);
+    __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.y()), oy), iy);
+    __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.z()), oz), iz);
+    __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.z()), oz), iz);
+
+    __m256 negX = _mm256_cmp_ps(ix, zero, _CMP_LT_OQ);
+    __m256 negY = _mm256_cmp_ps(iy, zero, _CMP_LT_OQ);
+    __m256 negZ = _mm256_cmp_ps(iz, zero, _CMP_LT_OQ);
+
+    // x, y and z in the order of hmax3() and hmin3(), NaN lanes are skipped.
+    __m256 tNear = _mm256_max_ps(_mm256_blendv_ps(t0x, t1x, negX), _mm256_set1_ps(tMin));
+    tNear = _mm256_max_ps(_mm256_blendv_ps(t0y, t1y, negY), tNear);
+    tNear = _mm256_max_ps(_mm256_blendv_ps(t0z, t1z, negZ), tNear);
+    __m256 tFar = _mm256_min_ps(_mm256_blendv_ps(t1x, t0x, negX), _mm256_loadu_ps(tMax));
+    tFar = _mm256_min_ps(_mm256_blendv_ps(t1y, t0y, negY), tFar);
+    tFar = _mm256_min_ps(_mm256_blendv_ps(t1z, t0z, negZ), tFar);
+
+    return ~_mm256_movemask_ps(_mm256_cmp_ps(tFar, tNear, _CMP_LE_OQ)) & packet.active;
+#else
+    int lanes = 0;
+    for (int k = 0; k < rayPacketSize; k++)
+        if ((packet.active >> k & 1) && node.hit(SlabRay(packet.rays[k]), tMin, tMax[k]))
+            lanes |= 1 << k;
+    return lanes;
+#endif // __AVX2__
+
+}
+
+// intersectLeaf() for the lanes of a packet. Sphere leaves are intersected
+// with all lanes at once, the other leaves one lane after another.
+inline int intersectLeafPacket(const LinearBVHNode& node, Hitable* const* primitives,
+                               const RayPacket& packet, int lanes,
+                               float tMin, float* closestSoFar, HitRecord* recs)
+{
+
+    int hits = 0;
+    if (node.leafType == HITABLE_SPHERE)
+    {
+        Hitable* const* leaf = primitives + node.offset;
+        float tHit[rayPacketSize];
+        for (int i = 0; i < node.primitiveCount; i++)
+        {
+            const Sphere* sphere = static_cast<const Sphere*>(leaf[i]);
+            int sphereHits = intersectSpherePacket(*sphere, packet, lanes, tMin, closestSoFar, tHit);
+            hits |= sphereHits;
+            for (; sphereHits; sphereHits &= sphereHits - 1)
+            {
+                int k = __builtin_ctz(sphereHits);
+                closestSoFar[k] = tHit[k];
+                recs[k].time = tHit[k];
+                recs[k].primitive = sphere;
+            }
+        }
+        return hits;
+    }
+
+    for (; lanes; lanes &= lanes - 1)
+    {
+        int k = __builtin_ctz(lanes);
+        if (intersectLeaf(node, primitives, packet.rays[k], tMin, closestSoFar[k], recs[k]))
+            hits |= 1 << k;
+    }
+    return hits;
+
+}
+
+// Closest hits of the active lanes of a packet in one traversal. A node is
+// entered if any lane hits its bounds, and only those lanes are intersected
+// with a leaf. The nearer child is the one of the first active lane, which
+// for coherent rays is the nearer one of the others too. Returns the mask of
+// the lanes that hit and leaves their records to finalizeHitRecord().
+inline int intersectLinearBVHPacket(const LinearBVHNode* nodes, Hitable* const* primitives, bool ordered,
+                                    const RayPacket& packet, float tMin, float tMax, HitRecord* recs)
+{
+
+    if (packet.active == 0)
+        return 0;
+
+    int dirIsNeg = signMask(SlabRay(packet.rays[__builtin_ctz(packet.active)]).negative);
+
+    float closestSoFar[rayPacketSize];
+    for (int k = 0; k < rayPacketSize; k++)
+        closestSoFar[k] = tMax;
+
+    int stack[linearBVHStackSize];
+    int toVisit = 0;
+    int current = 0;
+    int hits = 0;
+
+    while (true)
+    {
+        const LinearBVHNode& node = nodes[current];
+        STATS_ADD(bvhNodeVisits, 1);
+        STATS_TOUCH(bvhNodeCache, &node);
+        int lanes = packetHitsNode(node, packet, tMin, closestSoFar);
+        STATS_ADD(packetNodeVisits, 1);
+        STATS_ADD(packetActiveLanes, __builtin_popcount(lanes));
+        if (lanes)
+        {
+            if (node.primitiveCount > 0)
+            {
+                hits |= intersectLeafPacket(node, primitives, packet, lanes, tMin, closestSoFar, recs);
+                if (toVisit == 0)
+                    break;
+                current = stack[--toVisit];
+            }
+            else if (ordered && (dirIsNeg >> node.axis & 1))
+            {
+                stack[toVisit++] = current + 1;
+                current = node.offset;
+            }
+            else
+            {
+                stack[toVisit++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (toVisit == 0)
+                break;
+            current = stack[--toVisit];
+        }
+    }
+
+    return hits;
+
+}
+
+inline bool LinearBVH::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (nodes.empty())
+        return false;
+
+    if (!intersectLinearBVH(nodes.data(), primitives.data(), ordered, r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+inline bool LinearBVH::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (nodes.empty())
+        return false;
+
+    return intersectLinearBVH(nodes.data(), primitives.data(), ordered, r, tMin, tMax, rec);
+
+}
+
+inline bool LinearBVH::occluded(const Ray& r, float tMin, float tMax) const
+{
+
+    if (nodes.empty())
+        return false;
+
+    return occludedLinearBVH(nodes.data(), primitives.data(), r, tMin, tMax);
+
+}
+
+inline int LinearBVH::hitPacket(const RayPacket& packet, float tMin, float tMax, HitRecord* recs) const
+{
+
+    if (nodes.empty())
+        return 0;
+
+    int hits = intersectLinearBVHPacket(nodes.data(), primitives.data(), ordered, packet, tMin, tMax, recs);
+    finalizePacketHits(packet, hits, recs);
+    return hits;
+
+}
+
+inline bool LinearBVH::boundingBox(float t0, float t1, AABB& box) const
+{
+
+    if (nodes.empty())
+        return false;
+    box = AABB(nodes[0].boundsMin, nodes[0].boundsMax);
+
+    return true;
+
+}
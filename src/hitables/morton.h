@@ -0,0 +1,232 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <omp.h>
+
+#include "hitables/aabb.h"
+
+// Primitive index keyed by the Morton code of its centroid. Sorting by the
+// code places primitives that are close in space next to each other.
+struct MortonPrimitive
+{
+
+    uint64_t code;
+    int index;
+
+};
+
+// Spreads the lowest 10 bits of v so there are two zero bits between each.
+inline uint64_t expandBits10(uint64_t v)
+{
+
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x30000ff;
+    v = (v | (v <<  8)) & 0x300f00f;
+    v = (v | (v <<  4)) & 0x30c30c3;
+    v = (v | (v <<  2)) & 0x9249249;
+
+    return v;
+
+}
+
+// Spreads the lowest 21 bits of v so there are two zero bits between each.
+inline uint64_t expandBits21(uint64_t v)
+{
+
+    v &= 0x1fffff;
+    v = (v | (v << 32)) & 0x1f00000000ffffULL;
+    v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+    v = (v | (v <<  8)) & 0x100f00f00f00f00fULL;
+    v = (v | (v <<  4)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v <<  2)) & 0x1249249249249249ULL;
+
+    return v;
+
+}
+
+// Interleaves the quantized coordinates of p, given in [0, 1], into a 30 or
+// 63 bit code. Bit 3k+2 belongs to x, 3k+1 to y and 3k to z.
+inline uint64_t mortonCode(const Vec3& p, int bits)
+{
+
+    int axisBits = bits / 3;
+    float scale = float(1 << axisBits);
+    uint64_t q[3];
+    for (int a = 0; a < 3; a++)
+    {
+        float v = p[a] * scale;
+        v = v < 0.0f ? 0.0f : (v > scale - 1.0f ? scale - 1.0f : v);
+        q[a] = static_cast<uint64_t>(v);
+    }
+
+    if (axisBits <= 10)
+        return (expandBits10(q[0]) << 2) | (expandBits10(q[1]) << 1) | expandBits10(q[2]);
+
+    return (expandBits21(q[0]) << 2) | (expandBits21(q[1]) << 1) | expandBits21(q[2]);
+
+}
+
+// Least significant digit radix sort of the keys by their lowest bits,
+// 8 bits per pass. Every thread histograms and scatters its own chunk.
+inline void radixSortMorton(std::vector<MortonPrimitive>& keys, int bits)
+{
+
+    int n = static_cast<int>(keys.size());
+    std::vector<MortonPrimitive> sorted(keys.size());
+    std::vector<int> offsets(static_cast<size_t>(omp_get_max_threads() * 256));
+
+    for (int shift = 0; shift < bits; shift += 8)
+    {
+        bool skipPass = false;
+
+        #pragma omp parallel
+        {
+            int threadCount = omp_get_num_threads();
+            int t = omp_get_thread_num();
+            int chunkStart = static_cast<int>(static_cast<long long>(n) * t / threadCount);
+            int chunkEnd = static_cast<int>(static_cast<long long>(n) * (t + 1) / threadCount);
+
+            int* histogram = &offsets[t * 256];
+            for (int d = 0; d < 256; d++)
+                histogram[d] = 0;
+            for (int i = chunkStart; i < chunkEnd; i++)
+                histogram[(keys[i].code >> shift) & 0xff]++;
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                // Buckets in digit order, threads in chunk order within a bucket.
+                int sum = 0;
+                for (int d = 0; d < 256; d++)
+                {
+                    int bucket = 0;
+                    for (int i = 0; i < threadCount; i++)
+                    {
+                        int count = offsets[i * 256 + d];
+                        offsets[i * 256 + d] = sum;
+                        sum += count;
+                        bucket += count;
+                    }
+                    if (bucket == n)
+                        skipPass = true;
+                }
+            }
+
+            if (!skipPass)
+            {
+                for (int i = chunkStart; i < chunkEnd; i++)
+                    sorted[histogram[(keys[i].code >> shift) & 0xff]++] = keys[i];
+            }
+        }
+
+        if (!skipPass)
+            keys.swap(sorted);
+    }
+
+}
+
+// Computes the Morton codes of n centroids, returned by centroid(i), and
+// sorts them. bits is 30 or 63.
+template<typename CentroidFunc>
+std::vector<MortonPrimitive> sortByMortonCode(int n, CentroidFunc centroid, int bits)
+{
+
+    std::vector<MortonPrimitive> keys(static_cast<size_t>(n));
+    if (n == 0)
+        return keys;
+
+    Vec3 cMin = centroid(0);
+    Vec3 cMax = cMin;
+    #pragma omp parallel
+    {
+        Vec3 threadMin = cMin;
+        Vec3 threadMax = cMax;
+        #pragma omp for nowait
+        for (int i = 0; i < n; i++)
+        {
+            Vec3 c = centroid(i);
+            for (int a = 0; a < 3; a++)
+            {
+                threadMin[a] = fminf(threadMin[a], c[a]);
+                threadMax[a] = fmaxf(threadMax[a], c[a]);
+            }
+        }
+        #pragma omp critical
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                cMin[a] = fminf(cMin[a], threadMin[a]);
+                cMax[a] = fmaxf(cMax[a], threadMax[a]);
+            }
+        }
+    }
+
+    Vec3 scale;
+    for (int a = 0; a < 3; a++)
+        scale[a] = cMax[a] > cMin[a] ? 1.0f / (cMax[a] - cMin[a]) : 0.0f;
+
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++)
+    {
+        keys[i].code = mortonCode((centroid(i) - cMin) * scale, bits);
+        keys[i].index = i;
+    }
+
+    radixSortMorton(keys, bits);
+
+    return keys;
+
+}
+
+// Returns the size of the left half of n sorted codes, split where the
+// highest differing bit flips, and the axis of that bit. Ranges of equal
+// codes are split in the middle.
+inline int mortonSplit(const MortonPrimitive* keys, int n, int& axis)
+{
+
+    uint64_t first = keys[0].code;
+    uint64_t last = keys[n - 1].code;
+    if (first == last)
+    {
+        axis = 0;
+        return n/2;
+    }
+
+    int prefix = __builtin_clzll(first ^ last);
+    axis = 2 - (63 - prefix) % 3;
+
+    // Binary search for the last code sharing more than prefix bits with the first.
+    int split = 0;
+    int step = n - 1;
+    do
+    {
+        step = (step + 1) >> 1;
+        int candidate = split + step;
+        if (candidate < n - 1 && __builtin_clzll(first ^ keys[candidate].code) > prefix)
+            split = candidate;
+    }
+    while (step > 1);
+
+    return split + 1;
+
+}
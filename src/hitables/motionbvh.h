@@ -0,0 +1,309 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "hitables/linearbvh.h"
+
+// Node of a MotionBVH with its bounds at the start and the end of the
+// shutter interval. The bounds at a time in between are interpolated.
+struct MotionBVHNode
+{
+
+    Vec3 min0;
+    int offset;                 // first primitive for leaves, second child for interior nodes
+    Vec3 max0;
+    uint16_t primitiveCount;    // 0 for interior nodes
+    uint8_t axis;
+    uint8_t pad;
+    Vec3 min1;
+    Vec3 max1;
+    int pad2[2];
+
+    // Slab test against the bounds interpolated to s in [0, 1].
+    bool hit(const Vec3& origin, const Vec3& invDir, float s, float tMin, float tMax) const
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            float lo = min0[a] + s * (min1[a] - min0[a]);
+            float hi = max0[a] + s * (max1[a] - max0[a]);
+            float t0 = (lo - origin[a]) * invDir[a];
+            float t1 = (hi - origin[a]) * invDir[a];
+            if (invDir[a] < 0.0f)
+                std::swap(t0, t1);
+            tMin = t0 > tMin ? t0 : tMin;
+            tMax = t1 < tMax ? t1 : tMax;
+            if (tMax <= tMin)
+                return false;
+        }
+
+        return true;
+    }
+
+};
+
+static_assert(sizeof(MotionBVHNode) == 64, "MotionBVHNode should be 64 bytes");
+
+// BVH with linear motion bounds. The primitives are bounded at the shutter
+// open and close times and every ray tests the boxes interpolated to its
+// own time, instead of the boxes swept over the whole interval. This is
+// exact for primitives moving linearly, like MovingSphere.
+class MotionBVH : public Hitable
+{
+
+    public:
+
+        MotionBVH(Hitable **l, int n, float t0, float t1,
+                  const BVHBuildParams& params = BVHBuildParams());
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+
+        float sahCost() const
+        {
+            return cost;
+        }
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            for (Hitable* primitive : primitives)
+                primitive->bindMaterials(table);
+        }
+
+        size_t memoryBytes() const
+        {
+            return sizeof(*this) + nodes.size() * sizeof(nodes[0]) +
+                   primitives.size() * sizeof(Hitable*);
+        }
+
+        // Recomputes the motion bounds for the current primitive positions
+        // while keeping the topology. Returns the SAH cost at mid shutter.
+        float refit(float t0, float t1, const BVHBuildParams& params = BVHBuildParams());
+
+        std::vector<MotionBVHNode> nodes;
+        std::vector<Hitable*> primitives;
+
+    private:
+
+        float time0;
+        float time1;
+        float cost;
+        bool ordered;
+        RefitLevels refitLevels;
+
+};
+
+inline MotionBVH::MotionBVH(Hitable **l, int n, float t0, float t1, const BVHBuildParams& params)
+{
+
+    // The topology is built over the boxes at mid shutter, where the
+    // interpolated boxes are on average.
+    float tMid = 0.5f * (t0 + t1);
+    LinearBVH binary(l, n, tMid, tMid, params);
+
+    primitives = binary.primitives;
+    nodes.resize(binary.nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        nodes[i].offset = binary.nodes[i].offset;
+        nodes[i].primitiveCount = binary.nodes[i].primitiveCount;
+        nodes[i].axis = binary.nodes[i].axis;
+        nodes[i].pad = 0;
+    }
+
+    ordered = params.orderedTraversal;
+    refit(t0, t1, params);
+
+}
+
+inline float MotionBVH::refit(float t0, float t1, const BVHBuildParams& params)
+{
+
+    time0 = t0;
+    time1 = t1;
+
+    int nodeCount = static_cast<int>(nodes.size());
+    if (nodeCount == 0)
+        return 0.0f;
+
+    if (refitLevels.levelStart.empty())
+    {
+        std::vector<int> depth(static_cast<size_t>(nodeCount), -1);
+        depth[0] = 0;
+        for (int i = 0; i < nodeCount; i++)
+            if (nodes[i].primitiveCount == 0)
+                depth[i + 1] = depth[nodes[i].offset] = depth[i] + 1;
+        for (int i = 0; i < nodeCount; i++)
+            if (nodes[i].primitiveCount > 0)
+                depth[i] = -1;
+        refitLevels = groupByDepth(depth);
+    }
+
+    std::vector<float> nodeCost(static_cast<size_t>(nodeCount));
+
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < nodeCount; i++)
+    {
+        MotionBVHNode& node = nodes[i];
+        if (node.primitiveCount == 0)
+            continue;
+
+        AABB bounds0, bounds1, box;
+        primitives[node.offset]->boundingBox(t0, t0, bounds0);
+        primitives[node.offset]->boundingBox(t1, t1, bounds1);
+        for (int k = 1; k < node.primitiveCount; k++)
+        {
+            primitives[node.offset + k]->boundingBox(t0, t0, box);
+            bounds0 = surroundingBox(bounds0, box);
+            primitives[node.offset + k]->boundingBox(t1, t1, box);
+            bounds1 = surroundingBox(bounds1, box);
+        }
+        node.min0 = bounds0.min();
+        node.max0 = bounds0.max();
+        node.min1 = bounds1.min();
+        node.max1 = bounds1.max();
+        nodeCost[i] = params.intersectionCost * node.primitiveCount;
+    }
+
+    int levelCount = static_cast<int>(refitLevels.levelStart.size()) - 1;
+    for (int level = 0; level < levelCount; level++)
+    {
+        int begin = refitLevels.levelStart[level];
+        int end = refitLevels.levelStart[level + 1];
+
+        #pragma omp parallel for if (end - begin > 1024)
+        for (int k = begin; k < end; k++)
+        {
+            int i = refitLevels.order[k];
+            MotionBVHNode& node = nodes[i];
+            const MotionBVHNode& left = nodes[i + 1];
+            const MotionBVHNode& right = nodes[node.offset];
+            AABB bounds0 = surroundingBox(AABB(left.min0, left.max0), AABB(right.min0, right.max0));
+            AABB bounds1 = surroundingBox(AABB(left.min1, left.max1), AABB(right.min1, right.max1));
+            node.min0 = bounds0.min();
+            node.max0 = bounds0.max();
+            node.min1 = bounds1.min();
+            node.max1 = bounds1.max();
+
+            AABB leftMid(0.5f * (left.min0 + left.min1), 0.5f * (left.max0 + left.max1));
+            AABB rightMid(0.5f * (right.min0 + right.min1), 0.5f * (right.max0 + right.max1));
+            nodeCost[i] = sahNodeCost(surroundingBox(leftMid, rightMid), leftMid, rightMid,
+                                      nodeCost[i + 1], nodeCost[node.offset], params);
+        }
+    }
+
+    cost = nodeCost[0];
+
+    return cost;
+
+}
+
+inline bool MotionBVH::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+inline bool MotionBVH::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (nodes.empty())
+        return false;
+
+    Vec3 origin = r.origin();
+    Vec3 direction = r.direction();
+    Vec3 invDir(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
+    bool dirIsNeg[3] = { invDir.x() < 0.0f, invDir.y() < 0.0f, invDir.z() < 0.0f };
+
+    float s = time1 > time0 ? (r.time() - time0) / (time1 - time0) : 0.0f;
+    s = s < 0.0f ? 0.0f : (s > 1.0f ? 1.0f : s);
+
+    int stack[linearBVHStackSize];
+    int toVisit = 0;
+    int current = 0;
+
+    HitRecord tempRec;
+    bool hitAnything = false;
+    float closestSoFar = tMax;
+
+    while (true)
+    {
+        const MotionBVHNode& node = nodes[current];
+        STATS_ADD(bvhNodeVisits, 1);
+        if (node.hit(origin, invDir, s, tMin, closestSoFar))
+        {
+            if (node.primitiveCount > 0)
+            {
+                for (int i = 0; i < node.primitiveCount; i++)
+                {
+                    if (primitives[node.offset + i]->intersect(r, tMin, closestSoFar, tempRec))
+                    {
+                        hitAnything = true;
+                        closestSoFar = tempRec.time;
+                        rec = tempRec;
+                    }
+                }
+                if (toVisit == 0)
+                    break;
+                current = stack[--toVisit];
+            }
+            else if (ordered && dirIsNeg[node.axis])
+            {
+                stack[toVisit++] = current + 1;
+                current = node.offset;
+            }
+            else
+            {
+                stack[toVisit++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (toVisit == 0)
+                break;
+            current = stack[--toVisit];
+        }
+    }
+
+    return hitAnything;
+
+}
+
+inline bool MotionBVH::boundingBox(float t0, float t1, AABB& box) const
+{
+
+    if (nodes.empty())
+        return false;
+
+    // The boxes move linearly, so the union of the ends covers the interval.
+    const MotionBVHNode& root = nodes[0];
+    box = surroundingBox(AABB(root.min0, root.max0), AABB(root.min1, root.max1));
+
+    return true;
+
+}
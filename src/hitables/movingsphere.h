@@ -20,6 +20,7 @@ SOFTWARE.
 #pragma once
 
 #include "hitables/hitable.h"
+#include "materials/materialtable.h"
 
 class MovingSphere: public Hitable
 {
@@ -29,21 +30,47 @@ class MovingSphere: public Hitable
         float time0, time1;
         float radius;
         Material *matPtr;
+        uint32_t materialId;
 
-        CUDA_DEV MovingSphere() {}
+        CUDA_DEV MovingSphere() : materialId(invalidMaterialId) {}
         CUDA_DEV MovingSphere(Vec3 cen0, Vec3 cen1,
             float t0, float t1, float r, Material *m) :
             center0(cen0), center1(cen1),
             time0(t0), time1(t1),
-            radius(r), matPtr(m) {}
+            radius(r), matPtr(m), materialId(invalidMaterialId) {}
 
         CUDA_DEV bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        CUDA_DEV bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        CUDA_DEV void finalizeHit(const Ray& r, HitRecord& rec) const override;
+        CUDA_DEV bool occluded(const Ray& r, float tMin, float tMax) const override;
         CUDA_DEV Vec3 center(float time) const;
         CUDA_DEV bool boundingBox(float t0, float t1, AABB& box) const override;
 
+        CUDA_DEV HitableType hitableType() const override
+        {
+            return HITABLE_MOVING_SPHERE;
+        }
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            materialId = table.add(matPtr);
+        }
+
 };
 
+template <> struct SceneArenaDestroys<MovingSphere> : std::false_type {};
+
 inline CUDA_DEV bool MovingSphere::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHit(r, rec);
+    return true;
+
+}
+
+inline CUDA_DEV bool MovingSphere::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
 {
 
     Vec3 oc = r.origin() - center(r.time());
@@ -54,31 +81,56 @@ inline CUDA_DEV bool MovingSphere::hit(const Ray& r, float tMin, float tMax, Hit
 
     if (discriminant > 0)
     {
-        float temp = (-b - static_cast<float>(sqrt(static_cast<double>(discriminant))))/a;
+        float root = static_cast<float>(sqrt(static_cast<double>(discriminant)));
+        float temp = (-b - root)/a;
+        if (!(temp < tMax && temp > tMin))
+            temp = (-b + root)/a;
         if (temp < tMax && temp > tMin)
         {
             rec.time = temp;
-            rec.point = r.pointAtParameter(rec.time);
-            rec.normal = (rec.point - center(r.time())) / radius;
-            rec.matPtr = matPtr;
+            rec.primitive = this;
             return true;
         }
-        temp = (-b + static_cast<float>(sqrt(static_cast<double>(discriminant))))/a;
+    }
+
+    return false;
+
+}
+
+inline CUDA_DEV void MovingSphere::finalizeHit(const Ray& r, HitRecord& rec) const
+{
+
+    rec.point = r.pointAtParameter(rec.time);
+    rec.normal = (rec.point - center(r.time())) / radius;
+    rec.matPtr = matPtr;
+    rec.materialId = materialId;
+
+}
+
+inline CUDA_DEV bool MovingSphere::occluded(const Ray& r, float tMin, float tMax) const
+{
+
+    Vec3 oc = r.origin() - center(r.time());
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+
+    if (discriminant > 0)
+    {
+        float root = static_cast<float>(sqrt(static_cast<double>(discriminant)));
+        float temp = (-b - root)/a;
+        if (temp < tMax && temp > tMin)
+            return true;
+        temp = (-b + root)/a;
         if (temp < tMax && temp > tMin)
-        {
-            rec.time = temp;
-            rec.point = r.pointAtParameter(rec.time);
-            rec.normal = (rec.point - center(r.time())) / radius;
-            rec.matPtr = matPtr;
             return true;
-        }
     }
 
     return false;
 
 }
 
-
 inline CUDA_DEV Vec3 MovingSphere::center(float time) const
 {
     return center0 + ((time - time0) / (time1 - time0))*(center1 - center0);
@@ -0,0 +1,283 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <new>
+#include <stdint.h>
+
+#include "hitables/bvh.h"
+
+// Size of a treelet of BVH_ORDER_TREELET, one page so that a ray stays
+// within few TLB entries and the prefetcher finds the next nodes nearby.
+const int bvhTreeletBytes = 4096;
+
+// Copies the nodes of a pointer tree built by BVHNode into one cache line
+// aligned array in the order selected by params.nodeOrder and relinks the
+// children. BVHNode::hit keeps working unchanged on the copies, only the
+// addresses it touches become more local. The PackedBVH takes over the heap
+// allocated tree: the original nodes are deleted, and the HitableList leaves
+// the builder made are deleted with the PackedBVH.
+class PackedBVH : public Hitable
+{
+
+    public:
+
+        PackedBVH(BVHNode* root, BVHNodeOrder order);
+        ~PackedBVH();
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override
+        {
+            return nodes[0].hit(r, tMin, tMax, rec);
+        }
+
+        bool occluded(const Ray& r, float tMin, float tMax) const override
+        {
+            return nodes[0].occluded(r, tMin, tMax);
+        }
+
+        bool boundingBox(float t0, float t1, AABB& box) const override
+        {
+            return nodes[0].boundingBox(t0, t1, box);
+        }
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            nodes[0].bindMaterials(table);
+        }
+
+        float sahCost() const
+        {
+            return nodes[0].sahCost();
+        }
+
+        float refit(float t0, float t1, const BVHBuildParams& params = BVHBuildParams())
+        {
+            return nodes[0].refit(t0, t1, params);
+        }
+
+        size_t memoryBytes() const
+        {
+            return sizeof(*this) + nodeCount * sizeof(BVHNode);
+        }
+
+        BVHNode* nodes;
+        int nodeCount;
+
+    private:
+
+        static BVHNode* childNode(const BVHNode* node, int c)
+        {
+            return dynamic_cast<BVHNode*>(c == 0 ? node->left : node->right);
+        }
+
+        // Children that are nodes, counting a shared left and right child once.
+        static int childNodes(const BVHNode* node, BVHNode* children[2])
+        {
+            int count = 0;
+            for (int c = 0; c < 2; c++)
+            {
+                BVHNode* child = childNode(node, c);
+                if (child && !(c == 1 && node->left == node->right))
+                    children[count++] = child;
+            }
+            return count;
+        }
+
+        static int height(BVHNode* node);
+        static void orderDepthFirst(BVHNode* node, std::vector<BVHNode*>& order);
+        static void orderTreelets(BVHNode* root, std::vector<BVHNode*>& order);
+        static void orderVanEmdeBoas(BVHNode* node, int levels, std::vector<BVHNode*>& order);
+        static void collectAtDepth(BVHNode* node, int depth, std::vector<BVHNode*>& out);
+
+        unsigned char* storage;
+        std::vector<HitableList*> leaves;
+
+};
+
+inline PackedBVH::PackedBVH(BVHNode* root, BVHNodeOrder order)
+{
+
+    std::vector<BVHNode*> ordered;
+    switch (order)
+    {
+        case BVH_ORDER_TREELET:
+            orderTreelets(root, ordered);
+            break;
+        case BVH_ORDER_VAN_EMDE_BOAS:
+            orderVanEmdeBoas(root, height(root), ordered);
+            break;
+        case BVH_ORDER_DEPTH_FIRST:
+        case BVH_ORDER_ALLOCATION:
+        default:
+            orderDepthFirst(root, ordered);
+            break;
+    }
+
+    nodeCount = static_cast<int>(ordered.size());
+    storage = new unsigned char[nodeCount * sizeof(BVHNode) + 64];
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(storage) + 63) & ~static_cast<uintptr_t>(63);
+    nodes = reinterpret_cast<BVHNode*>(aligned);
+
+    std::unordered_map<const BVHNode*, BVHNode*> moved;
+    moved.reserve(ordered.size());
+    for (int i = 0; i < nodeCount; i++)
+    {
+        new (&nodes[i]) BVHNode(*ordered[i]);
+        moved[ordered[i]] = &nodes[i];
+    }
+    for (int i = 0; i < nodeCount; i++)
+    {
+        bool shared = nodes[i].left == nodes[i].right;
+        if (HitableList* leaf = dynamic_cast<HitableList*>(nodes[i].left))
+            leaves.push_back(leaf);
+        if (!shared)
+            if (HitableList* leaf = dynamic_cast<HitableList*>(nodes[i].right))
+                leaves.push_back(leaf);
+        if (BVHNode* left = dynamic_cast<BVHNode*>(nodes[i].left))
+            nodes[i].left = moved[left];
+        if (shared)
+            nodes[i].right = nodes[i].left;
+        else if (BVHNode* right = dynamic_cast<BVHNode*>(nodes[i].right))
+            nodes[i].right = moved[right];
+    }
+
+    for (BVHNode* node : ordered)
+        delete node;
+
+}
+
+inline PackedBVH::~PackedBVH()
+{
+
+    for (int i = 0; i < nodeCount; i++)
+        nodes[i].~BVHNode();
+    delete[] storage;
+    for (HitableList* leaf : leaves)
+        delete leaf;
+
+}
+
+inline int PackedBVH::height(BVHNode* node)
+{
+
+    BVHNode* children[2];
+    int count = childNodes(node, children);
+    int h = 0;
+    for (int c = 0; c < count; c++)
+        h = std::max(h, height(children[c]));
+
+    return h + 1;
+
+}
+
+inline void PackedBVH::orderDepthFirst(BVHNode* node, std::vector<BVHNode*>& order)
+{
+
+    order.push_back(node);
+    BVHNode* children[2];
+    int count = childNodes(node, children);
+    for (int c = 0; c < count; c++)
+        orderDepthFirst(children[c], order);
+
+}
+
+// Grows each treelet from its root by always adding the frontier node with
+// the largest surface area, which the SAH treats as the most likely to be
+// visited. The frontier left over when the treelet is full roots the next
+// treelets.
+inline void PackedBVH::orderTreelets(BVHNode* root, std::vector<BVHNode*>& order)
+{
+
+    const int treeletNodes = std::max(1, bvhTreeletBytes / static_cast<int>(sizeof(BVHNode)));
+
+    auto smaller = [](const BVHNode* a, const BVHNode* b)
+    {
+        return a->box.surfaceArea() < b->box.surfaceArea();
+    };
+
+    std::queue<BVHNode*> roots;
+    roots.push(root);
+    while (!roots.empty())
+    {
+        std::priority_queue<BVHNode*, std::vector<BVHNode*>, decltype(smaller)> frontier(smaller);
+        frontier.push(roots.front());
+        roots.pop();
+
+        for (int added = 0; added < treeletNodes && !frontier.empty(); added++)
+        {
+            BVHNode* node = frontier.top();
+            frontier.pop();
+            order.push_back(node);
+
+            BVHNode* children[2];
+            int count = childNodes(node, children);
+            for (int c = 0; c < count; c++)
+                frontier.push(children[c]);
+        }
+
+        while (!frontier.empty())
+        {
+            roots.push(frontier.top());
+            frontier.pop();
+        }
+    }
+
+}
+
+inline void PackedBVH::collectAtDepth(BVHNode* node, int depth, std::vector<BVHNode*>& out)
+{
+
+    if (depth == 0)
+    {
+        out.push_back(node);
+        return;
+    }
+
+    BVHNode* children[2];
+    int count = childNodes(node, children);
+    for (int c = 0; c < count; c++)
+        collectAtDepth(children[c], depth - 1, out);
+
+}
+
+// Lays out the top half of the levels first, then each subtree hanging
+// below it, both recursively. Any path of the tree then crosses a block of
+// nodes every time its length doubles, whatever the cache line size.
+inline void PackedBVH::orderVanEmdeBoas(BVHNode* node, int levels, std::vector<BVHNode*>& order)
+{
+
+    if (levels == 1)
+    {
+        order.push_back(node);
+        return;
+    }
+
+    int top = levels / 2;
+    orderVanEmdeBoas(node, top, order);
+
+    std::vector<BVHNode*> bottom;
+    collectAtDepth(node, top, bottom);
+    for (BVHNode* subtree : bottom)
+        orderVanEmdeBoas(subtree, levels - top, order);
+
+}
@@ -19,7 +19,13 @@ SOFTWARE.
 
 #pragma once
 
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif // __AVX2__
+
 #include "hitables/hitable.h"
+#include "materials/materialtable.h"
+#include "util/stats.h"
 
 inline CUDA_DEV void getSphereUV(const Vec3& p, float& u, float& v)
 {
@@ -38,16 +44,43 @@ class Sphere: public Hitable
         Vec3 center;
         float radius;
         Material *matPtr;
+        uint32_t materialId;
 
-        CUDA_DEV Sphere() {}
-        CUDA_DEV Sphere(Vec3 cen, float r, Material *m) : center(cen), radius(r), matPtr(m) {}
+        CUDA_DEV Sphere() : materialId(invalidMaterialId) {}
+        CUDA_DEV Sphere(Vec3 cen, float r, Material *m) : center(cen), radius(r), matPtr(m), materialId(invalidMaterialId) {}
 
         CUDA_DEV bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        CUDA_DEV bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        CUDA_DEV void finalizeHit(const Ray& r, HitRecord& rec) const override;
+        CUDA_DEV bool occluded(const Ray& r, float tMin, float tMax) const override;
         CUDA_DEV bool boundingBox(float t0, float t1, AABB& box) const override;
 
+        CUDA_DEV HitableType hitableType() const override
+        {
+            return HITABLE_SPHERE;
+        }
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            materialId = table.add(matPtr);
+        }
+
 };
 
+template <> struct SceneArenaDestroys<Sphere> : std::false_type {};
+
 inline CUDA_DEV bool Sphere::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHit(r, rec);
+    return true;
+
+}
+
+// Only the distance, the uv with its atan2 and asin is left to finalizeHit().
+inline CUDA_DEV bool Sphere::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
 {
 
     Vec3 oc = r.origin() - center;
@@ -58,26 +91,54 @@ inline CUDA_DEV bool Sphere::hit(const Ray& r, float tMin, float tMax, HitRecord
 
     if (discriminant > 0)
     {
-        float temp = (-b - static_cast<float>(sqrt(static_cast<double>(discriminant))))/a;
+        float root = static_cast<float>(sqrt(static_cast<double>(discriminant)));
+        float temp = (-b - root)/a;
+        if (!(temp < tMax && temp > tMin))
+            temp = (-b + root)/a;
         if (temp < tMax && temp > tMin)
         {
+            STATS_ADD(sphereHitCandidates, 1);
             rec.time = temp;
-            rec.point = r.pointAtParameter(rec.time);
-            getSphereUV((rec.point-center)/radius, rec.u, rec.v);
-            rec.normal = (rec.point - center) / radius;
-            rec.matPtr = matPtr;
+            rec.primitive = this;
             return true;
         }
-        temp = (-b + static_cast<float>(sqrt(static_cast<double>(discriminant))))/a;
+    }
+
+    return false;
+
+}
+
+inline CUDA_DEV void Sphere::finalizeHit(const Ray& r, HitRecord& rec) const
+{
+
+    STATS_ADD(sphereUVEvaluations, 1);
+    rec.point = r.pointAtParameter(rec.time);
+    rec.normal = (rec.point - center) / radius;
+    getSphereUV(rec.normal, rec.u, rec.v);
+    rec.matPtr = matPtr;
+    rec.materialId = materialId;
+
+}
+
+// Same roots as hit() but without the hit point, normal and uv.
+inline CUDA_DEV bool Sphere::occluded(const Ray& r, float tMin, float tMax) const
+{
+
+    Vec3 oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+
+    if (discriminant > 0)
+    {
+        float root = static_cast<float>(sqrt(static_cast<double>(discriminant)));
+        float temp = (-b - root)/a;
+        if (temp < tMax && temp > tMin)
+            return true;
+        temp = (-b + root)/a;
         if (temp < tMax && temp > tMin)
-        {
-            rec.time = temp;
-            rec.point = r.pointAtParameter(rec.time);
-            getSphereUV((rec.point-center)/radius, rec.u, rec.v);
-            rec.normal = (rec.point - center) / radius;
-            rec.matPtr = matPtr;
             return true;
-        }
     }
 
     return false;
@@ -94,3 +155,63 @@ inline CUDA_DEV bool Sphere::boundingBox(float t0, float t1, AABB& box) const
     return true;
 
 }
+
+// Sphere::intersect() for the lanes of mask of a packet, lane k within
+// (tMin, tMax[k]). Returns the mask of the lanes that hit and writes their
+// distance to tHit. The AVX2 kernel rounds like the scalar one, so both find
+// the same hits.
+inline int intersectSpherePacket(const Sphere& sphere, const RayPacket& packet, int mask,
+                                 float tMin, const float* tMax, float* tHit)
+{
+
+#ifdef __AVX2__
+    const __m256 dx = _mm256_loadu_ps(packet.directionX);
+    const __m256 dy = _mm256_loadu_ps(packet.directionY);
+    const __m256 dz = _mm256_loadu_ps(packet.directionZ);
+    const __m256 vMin = _mm256_set1_ps(tMin);
+    const __m256 vMax = _mm256_loadu_ps(tMax);
+
+    __m256 ocx = _mm256_sub_ps(_mm256_loadu_ps(packet.originX), _mm256_set1_ps(sphere.center.x()));
+    __m256 ocy = _mm256_sub_ps(_mm256_loadu_ps(packet.originY), _mm256_set1_ps(sphere.center.y()));
+    __m256 ocz = _mm256_sub_ps(_mm256_loadu_ps(packet.originZ), _mm256_set1_ps(sphere.center.z()));
+
+    __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                             _mm256_mul_ps(dz, dz));
+    __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)),
+                             _mm256_mul_ps(ocz, dz));
+    __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+                                           _mm256_mul_ps(ocz, ocz)),
+                             _mm256_set1_ps(sphere.radius * sphere.radius));
+    __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(a, c));
+    __m256 valid = _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GT_OQ);
+
+    __m256 root = _mm256_sqrt_ps(discriminant);
+    __m256 minusB = _mm256_xor_ps(b, _mm256_set1_ps(-0.0f));
+    __m256 tNear = _mm256_div_ps(_mm256_sub_ps(minusB, root), a);
+    __m256 tFar = _mm256_div_ps(_mm256_add_ps(minusB, root), a);
+    __m256 nearInside = _mm256_and_ps(_mm256_cmp_ps(tNear, vMax, _CMP_LT_OQ),
+                                      _mm256_cmp_ps(tNear, vMin, _CMP_GT_OQ));
+    __m256 farInside = _mm256_and_ps(_mm256_cmp_ps(tFar, vMax, _CMP_LT_OQ),
+                                     _mm256_cmp_ps(tFar, vMin, _CMP_GT_OQ));
+    __m256 inside = _mm256_and_ps(valid, _mm256_or_ps(nearInside, farInside));
+
+    _mm256_storeu_ps(tHit, _mm256_blendv_ps(tFar, tNear, nearInside));
+
+    int hits = _mm256_movemask_ps(inside) & mask;
+    STATS_ADD(sphereHitCandidates, __builtin_popcount(hits));
+    return hits;
+#else
+    int hits = 0;
+    for (int k = 0; k < rayPacketSize; k++)
+    {
+        HitRecord rec;
+        if ((mask >> k & 1) && sphere.Sphere::intersect(packet.rays[k], tMin, tMax[k], rec))
+        {
+            tHit[k] = rec.time;
+            hits |= 1 << k;
+        }
+    }
+    return hits;
+#endif // __AVX2__
+
+}
@@ -0,0 +1,229 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <float.h>
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif // __AVX2__
+
+#include "hitables/leafbatch.h"
+#include "hitables/sphere.h"
+
+// Up to leafBatchWidth spheres stored as structure of arrays, so one ray
+// can be intersected with all of them in a single AVX2 kernel. The batch
+// copies the geometry of the spheres it was made from, update() copies it
+// again after they moved.
+class SphereBatch : public Hitable
+{
+
+    public:
+
+        SphereBatch() : count(0) {}
+
+        SphereBatch(Hitable* const* l, int n) : count(n)
+        {
+            for (int i = 0; i < leafBatchWidth; i++)
+                spheres[i] = i < n ? static_cast<const Sphere*>(l[i]) : nullptr;
+            update();
+        }
+
+        void update()
+        {
+            for (int i = 0; i < leafBatchWidth; i++)
+            {
+                // The unused lanes are zeroed, the kernel masks them out.
+                const Sphere* s = spheres[i];
+                centerX[i] = s ? s->center.x() : 0.0f;
+                centerY[i] = s ? s->center.y() : 0.0f;
+                centerZ[i] = s ? s->center.z() : 0.0f;
+                radius[i] = s ? s->radius : 0.0f;
+                matPtr[i] = s ? s->matPtr : nullptr;
+            }
+        }
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool occluded(const Ray& r, float tMin, float tMax) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+
+        HitableType hitableType() const override
+        {
+            return HITABLE_SPHERE_BATCH;
+        }
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            // The spheres are only const for the traversal.
+            for (int k = 0; k < count; k++)
+                const_cast<Sphere*>(spheres[k])->bindMaterials(table);
+        }
+
+        float centerX[leafBatchWidth];
+        float centerY[leafBatchWidth];
+        float centerZ[leafBatchWidth];
+        float radius[leafBatchWidth];
+        Material* matPtr[leafBatchWidth];
+        const Sphere* spheres[leafBatchWidth];
+        int count;
+
+};
+
+// Intersects a ray with every sphere of the batch. Returns a bit mask of the
+// spheres hit within (tMin, tMax) and writes their nearest root to tHit,
+// FLT_MAX for the spheres that were missed.
+inline int intersectSpheres(const SphereBatch& batch, const Ray& r,
+                            float tMin, float tMax, float* tHit)
+{
+
+    const Vec3& origin = r.origin();
+    const Vec3& direction = r.direction();
+    float a = dot(direction, direction);
+    float invA = 1.0f / a;
+
+#ifdef __AVX2__
+    const __m256 dx = _mm256_set1_ps(direction.x());
+    const __m256 dy = _mm256_set1_ps(direction.y());
+    const __m256 dz = _mm256_set1_ps(direction.z());
+    const __m256 vMin = _mm256_set1_ps(tMin);
+    const __m256 vMax = _mm256_set1_ps(tMax);
+
+    __m256 ocx = _mm256_sub_ps(_mm256_set1_ps(origin.x()), _mm256_loadu_ps(batch.centerX));
+    __m256 ocy = _mm256_sub_ps(_mm256_set1_ps(origin.y()), _mm256_loadu_ps(batch.centerY));
+    __m256 ocz = _mm256_sub_ps(_mm256_set1_ps(origin.z()), _mm256_loadu_ps(batch.centerZ));
+    __m256 radius = _mm256_loadu_ps(batch.radius);
+
+    __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)),
+                             _mm256_mul_ps(ocz, dz));
+    __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+                                           _mm256_mul_ps(ocz, ocz)),
+                             _mm256_mul_ps(radius, radius));
+    __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(_mm256_set1_ps(a), c));
+    __m256 valid = _mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GT_OQ);
+
+    // The root of a negative discriminant is NaN and fails every compare.
+    __m256 root = _mm256_sqrt_ps(discriminant);
+    __m256 minusB = _mm256_sub_ps(_mm256_setzero_ps(), b);
+    __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(minusB, root), _mm256_set1_ps(invA));
+    __m256 tFar = _mm256_mul_ps(_mm256_add_ps(minusB, root), _mm256_set1_ps(invA));
+    __m256 nearInside = _mm256_and_ps(_mm256_cmp_ps(tNear, vMin, _CMP_GT_OQ),
+                                      _mm256_cmp_ps(tNear, vMax, _CMP_LT_OQ));
+    __m256 farInside = _mm256_and_ps(_mm256_cmp_ps(tFar, vMin, _CMP_GT_OQ),
+                                     _mm256_cmp_ps(tFar, vMax, _CMP_LT_OQ));
+    __m256 inside = _mm256_and_ps(valid, _mm256_or_ps(nearInside, farInside));
+
+    __m256 t = _mm256_blendv_ps(tFar, tNear, nearInside);
+    _mm256_storeu_ps(tHit, _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t, inside));
+
+    return _mm256_movemask_ps(inside) & ((1 << batch.count) - 1);
+#else
+    int mask = 0;
+    for (int i = 0; i < leafBatchWidth; i++)
+    {
+        tHit[i] = FLT_MAX;
+        if (i >= batch.count)
+            continue;
+
+        float ocx = origin.x() - batch.centerX[i];
+        float ocy = origin.y() - batch.centerY[i];
+        float ocz = origin.z() - batch.centerZ[i];
+        float b = ocx*direction.x() + ocy*direction.y() + ocz*direction.z();
+        float c = ocx*ocx + ocy*ocy + ocz*ocz - batch.radius[i]*batch.radius[i];
+        float discriminant = b*b - a*c;
+        if (discriminant <= 0.0f)
+            continue;
+
+        float root = sqrtf(discriminant);
+        float t = (-b - root) * invA;
+        if (!(t < tMax && t > tMin))
+            t = (-b + root) * invA;
+        if (t < tMax && t > tMin)
+        {
+            tHit[i] = t;
+            mask |= 1 << i;
+        }
+    }
+
+    return mask;
+#endif // __AVX2__
+
+}
+
+inline bool SphereBatch::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+// The nearest sphere of the batch finalizes the hit.
+inline bool SphereBatch::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    float tHit[leafBatchWidth];
+    int mask = intersectSpheres(*this, r, tMin, tMax, tHit);
+    if (mask == 0)
+        return false;
+
+    int nearest = nearestLane(tHit, mask);
+
+    STATS_ADD(sphereHitCandidates, 1);
+    rec.time = tHit[nearest];
+    rec.primitive = spheres[nearest];
+
+    return true;
+
+}
+
+inline bool SphereBatch::occluded(const Ray& r, float tMin, float tMax) const
+{
+
+    float tHit[leafBatchWidth];
+    return intersectSpheres(*this, r, tMin, tMax, tHit) != 0;
+
+}
+
+inline bool SphereBatch::boundingBox(float t0, float t1, AABB& box) const
+{
+
+    if (count == 0)
+        return false;
+
+    Vec3 lower(FLT_MAX, FLT_MAX, FLT_MAX);
+    Vec3 upper(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int i = 0; i < count; i++)
+    {
+        lower = Vec3(fminf(lower.x(), centerX[i] - radius[i]),
+                     fminf(lower.y(), centerY[i] - radius[i]),
+                     fminf(lower.z(), centerZ[i] - radius[i]));
+        upper = Vec3(fmaxf(upper.x(), centerX[i] + radius[i]),
+                     fmaxf(upper.y(), centerY[i] + radius[i]),
+                     fmaxf(upper.z(), centerZ[i] + radius[i]));
+    }
+    box = AABB(lower, upper);
+
+    return true;
+
+}
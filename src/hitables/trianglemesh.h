@@ -0,0 +1,499 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <vector>
+#include <float.h>
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif // __AVX2__
+
+#include "hitables/hitable.h"
+#include "hitables/leafbatch.h"
+#include "materials/materialtable.h"
+
+// Indices of one triangle corner into the buffers of its mesh, -1 where the
+// mesh has no normals or uvs for it.
+struct MeshCorner
+{
+
+    int position;
+    int normal;
+    int uv;
+
+};
+
+class TriangleMesh;
+
+// One face of a TriangleMesh. It only stores its index, the vertices stay
+// in the shared buffers of the mesh.
+class Triangle : public Hitable
+{
+
+    public:
+
+        Triangle() : mesh(nullptr), index(0) {}
+        Triangle(const TriangleMesh* mesh, int index) : mesh(mesh), index(index) {}
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        void finalizeHit(const Ray& r, HitRecord& rec) const override;
+        bool occluded(const Ray& r, float tMin, float tMax) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+
+        HitableType hitableType() const override
+        {
+            return HITABLE_TRIANGLE;
+        }
+
+        void bindMaterials(MaterialTable& table) override;
+
+        const TriangleMesh* mesh;
+        int index;
+
+};
+
+// Indexed triangle mesh with shared position, normal and uv buffers. The
+// Triangles made by createTriangles() are owned by the mesh and go into the
+// acceleration structures like any other hitable. The triangles read the
+// buffers through plain pointers, so they can also live in a mapped
+// SceneCache instead of the vectors.
+class TriangleMesh
+{
+
+    public:
+
+        TriangleMesh(Material* material = nullptr) :
+                     material(material),
+                     materialId(invalidMaterialId),
+                     positionData(nullptr),
+                     normalData(nullptr),
+                     uvData(nullptr),
+                     cornerData(nullptr),
+                     faceCount(0)
+        {
+
+        }
+
+        // The triangles point back to the mesh.
+        TriangleMesh(const TriangleMesh&) = delete;
+        TriangleMesh& operator=(const TriangleMesh&) = delete;
+
+        int triangleCount() const
+        {
+            return corners.empty() ? faceCount : static_cast<int>(corners.size() / 3);
+        }
+
+        // Points the triangles at buffers owned by someone else.
+        void setBuffers(const Vec3* positions, const Vec3* normals, const float* uvs,
+                        const MeshCorner* corners, int triangleCount)
+        {
+            positionData = positions;
+            normalData = normals;
+            uvData = uvs;
+            cornerData = corners;
+            faceCount = triangleCount;
+        }
+
+        // Makes one Triangle per face and returns a new[] list of them for
+        // buildAccelerator. The list belongs to the caller, the triangles
+        // to the mesh. The vectors must not change afterwards.
+        Hitable** createTriangles()
+        {
+            if (!corners.empty())
+                setBuffers(positions.data(), normals.data(), uvs.data(), corners.data(),
+                           static_cast<int>(corners.size() / 3));
+
+            int n = triangleCount();
+            triangles.resize(static_cast<size_t>(n));
+            Hitable** list = new Hitable*[n];
+            for (int i = 0; i < n; i++)
+            {
+                triangles[i] = Triangle(this, i);
+                list[i] = &triangles[i];
+            }
+            return list;
+        }
+
+        const Vec3& vertex(int triangle, int corner) const
+        {
+            return positionData[cornerData[3*triangle + corner].position];
+        }
+
+        // Fills rec for a hit at distance t and barycentric coordinates
+        // (b1, b2) of triangle i. Interpolates the vertex normals and uvs
+        // where the mesh has them, else uses the face normal and (b1, b2).
+        void finalizeHit(int i, const Ray& r, float t, float b1, float b2, HitRecord& rec) const;
+
+        size_t memoryBytes() const
+        {
+            return sizeof(*this) + positions.size() * sizeof(Vec3) + normals.size() * sizeof(Vec3) +
+                   uvs.size() * sizeof(float) + corners.size() * sizeof(MeshCorner) +
+                   triangles.size() * sizeof(Triangle);
+        }
+
+        std::vector<Vec3> positions;
+        std::vector<Vec3> normals;
+        std::vector<float> uvs;             // u, v pairs
+        std::vector<MeshCorner> corners;    // three per triangle
+        std::vector<Triangle> triangles;
+        Material* material;
+        uint32_t materialId;
+
+        const Vec3* positionData;
+        const Vec3* normalData;
+        const float* uvData;
+        const MeshCorner* cornerData;
+        int faceCount;
+
+};
+
+inline void TriangleMesh::finalizeHit(int i, const Ray& r, float t, float b1, float b2, HitRecord& rec) const
+{
+
+    const MeshCorner* c = &cornerData[3*i];
+    float b0 = 1.0f - b1 - b2;
+
+    rec.time = t;
+    rec.point = r.pointAtParameter(t);
+
+    if (c[0].normal >= 0 && c[1].normal >= 0 && c[2].normal >= 0)
+        rec.normal = unitVector(b0*normalData[c[0].normal] + b1*normalData[c[1].normal] + b2*normalData[c[2].normal]);
+    else
+    {
+        const Vec3& p0 = positionData[c[0].position];
+        rec.normal = unitVector(cross(positionData[c[1].position] - p0, positionData[c[2].position] - p0));
+    }
+
+    if (c[0].uv >= 0 && c[1].uv >= 0 && c[2].uv >= 0)
+    {
+        rec.u = b0*uvData[2*c[0].uv] + b1*uvData[2*c[1].uv] + b2*uvData[2*c[2].uv];
+        rec.v = b0*uvData[2*c[0].uv + 1] + b1*uvData[2*c[1].uv + 1] + b2*uvData[2*c[2].uv + 1];
+    }
+    else
+    {
+        rec.u = b1;
+        rec.v = b2;
+    }
+
+    rec.matPtr = material;
+    rec.materialId = materialId;
+
+}
+
+// Möller-Trumbore ray triangle test. Writes the distance and the
+// barycentric coordinates of the hit.
+inline bool intersectTriangle(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Ray& r,
+                              float tMin, float tMax, float& t, float& b1, float& b2)
+{
+
+    Vec3 e1 = p1 - p0;
+    Vec3 e2 = p2 - p0;
+    Vec3 pvec = cross(r.direction(), e2);
+    float det = dot(e1, pvec);
+    if (det == 0.0f)
+        return false;
+
+    float invDet = 1.0f / det;
+    Vec3 tvec = r.origin() - p0;
+    b1 = dot(tvec, pvec) * invDet;
+    if (b1 < 0.0f || b1 > 1.0f)
+        return false;
+
+    Vec3 qvec = cross(tvec, e1);
+    b2 = dot(r.direction(), qvec) * invDet;
+    if (b2 < 0.0f || b1 + b2 > 1.0f)
+        return false;
+
+    t = dot(e2, qvec) * invDet;
+    return t > tMin && t < tMax;
+
+}
+
+inline bool Triangle::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHit(r, rec);
+    return true;
+
+}
+
+// Keeps the barycentric coordinates in rec.u and rec.v for finalizeHit().
+inline bool Triangle::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    float t, b1, b2;
+    if (!intersectTriangle(mesh->vertex(index, 0), mesh->vertex(index, 1), mesh->vertex(index, 2),
+                           r, tMin, tMax, t, b1, b2))
+        return false;
+
+    rec.time = t;
+    rec.u = b1;
+    rec.v = b2;
+    rec.primitive = this;
+    return true;
+
+}
+
+inline void Triangle::finalizeHit(const Ray& r, HitRecord& rec) const
+{
+
+    mesh->finalizeHit(index, r, rec.time, rec.u, rec.v, rec);
+
+}
+
+inline bool Triangle::occluded(const Ray& r, float tMin, float tMax) const
+{
+
+    float t, b1, b2;
+    return intersectTriangle(mesh->vertex(index, 0), mesh->vertex(index, 1), mesh->vertex(index, 2),
+                             r, tMin, tMax, t, b1, b2);
+
+}
+
+inline bool Triangle::boundingBox(float t0, float t1, AABB& box) const
+{
+
+    const Vec3& p0 = mesh->vertex(index, 0);
+    const Vec3& p1 = mesh->vertex(index, 1);
+    const Vec3& p2 = mesh->vertex(index, 2);
+
+    // Axis aligned triangles get a thin box, the slab test misses flat ones.
+    const float pad = 1.0e-4f;
+    Vec3 lower(fminf(fminf(p0.x(), p1.x()), p2.x()) - pad,
+               fminf(fminf(p0.y(), p1.y()), p2.y()) - pad,
+               fminf(fminf(p0.z(), p1.z()), p2.z()) - pad);
+    Vec3 upper(fmaxf(fmaxf(p0.x(), p1.x()), p2.x()) + pad,
+               fmaxf(fmaxf(p0.y(), p1.y()), p2.y()) + pad,
+               fmaxf(fmaxf(p0.z(), p1.z()), p2.z()) + pad);
+    box = AABB(lower, upper);
+
+    return true;
+
+}
+
+// The triangles share the material of their mesh, which they only read.
+inline void Triangle::bindMaterials(MaterialTable& table)
+{
+
+    const_cast<TriangleMesh*>(mesh)->materialId = table.add(mesh->material);
+
+}
+
+// Up to leafBatchWidth triangles of one BVH leaf stored as structure of
+// arrays of their first vertex and edges, intersected with one ray in a
+// single AVX2 Möller-Trumbore kernel. update() copies the vertices again
+// after the mesh changed.
+class TriangleBatch : public Hitable
+{
+
+    public:
+
+        TriangleBatch() : count(0) {}
+
+        TriangleBatch(Hitable* const* l, int n) : count(n)
+        {
+            for (int i = 0; i < leafBatchWidth; i++)
+                triangles[i] = i < n ? static_cast<const Triangle*>(l[i]) : nullptr;
+            update();
+        }
+
+        void update()
+        {
+            for (int i = 0; i < leafBatchWidth; i++)
+            {
+                // The unused lanes are zeroed, the kernel masks them out.
+                const Triangle* tri = triangles[i];
+                Vec3 p0 = tri ? tri->mesh->vertex(tri->index, 0) : Vec3(0.0f, 0.0f, 0.0f);
+                Vec3 e1 = tri ? tri->mesh->vertex(tri->index, 1) - p0 : Vec3(0.0f, 0.0f, 0.0f);
+                Vec3 e2 = tri ? tri->mesh->vertex(tri->index, 2) - p0 : Vec3(0.0f, 0.0f, 0.0f);
+                for (int a = 0; a < 3; a++)
+                {
+                    vertex[a][i] = p0[a];
+                    edge1[a][i] = e1[a];
+                    edge2[a][i] = e2[a];
+                }
+            }
+        }
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool occluded(const Ray& r, float tMin, float tMax) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+
+        HitableType hitableType() const override
+        {
+            return HITABLE_TRIANGLE_BATCH;
+        }
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            // The triangles are only const for the traversal.
+            for (int k = 0; k < count; k++)
+                const_cast<Triangle*>(triangles[k])->bindMaterials(table);
+        }
+
+        float vertex[3][leafBatchWidth];    // first vertex, x, y and z rows
+        float edge1[3][leafBatchWidth];
+        float edge2[3][leafBatchWidth];
+        const Triangle* triangles[leafBatchWidth];
+        int count;
+
+};
+
+// Intersects a ray with every triangle of the batch. Returns a bit mask of
+// the triangles hit within (tMin, tMax) and writes their distance and
+// barycentric coordinates, FLT_MAX distances for the ones that were missed.
+inline int intersectTriangles(const TriangleBatch& batch, const Ray& r, float tMin, float tMax,
+                              float* tHit, float* b1, float* b2)
+{
+
+#ifdef __AVX2__
+    const __m256 dx = _mm256_set1_ps(r.direction().x());
+    const __m256 dy = _mm256_set1_ps(r.direction().y());
+    const __m256 dz = _mm256_set1_ps(r.direction().z());
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    __m256 e1x = _mm256_loadu_ps(batch.edge1[0]);
+    __m256 e1y = _mm256_loadu_ps(batch.edge1[1]);
+    __m256 e1z = _mm256_loadu_ps(batch.edge1[2]);
+    __m256 e2x = _mm256_loadu_ps(batch.edge2[0]);
+    __m256 e2y = _mm256_loadu_ps(batch.edge2[1]);
+    __m256 e2z = _mm256_loadu_ps(batch.edge2[2]);
+
+    // pvec = d x e2
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)),
+                               _mm256_mul_ps(e1z, pz));
+    __m256 invDet = _mm256_div_ps(one, det);
+
+    __m256 tx = _mm256_sub_ps(_mm256_set1_ps(r.origin().x()), _mm256_loadu_ps(batch.vertex[0]));
+    __m256 ty = _mm256_sub_ps(_mm256_set1_ps(r.origin().y()), _mm256_loadu_ps(batch.vertex[1]));
+    __m256 tz = _mm256_sub_ps(_mm256_set1_ps(r.origin().z()), _mm256_loadu_ps(batch.vertex[2]));
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)),
+                                           _mm256_mul_ps(tz, pz)), invDet);
+
+    // qvec = tvec x e1
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)),
+                                           _mm256_mul_ps(dz, qz)), invDet);
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+                                           _mm256_mul_ps(e2z, qz)), invDet);
+
+    // A zero determinant gives inf or NaN, which fail the compares.
+    __m256 inside = _mm256_and_ps(_mm256_cmp_ps(det, zero, _CMP_NEQ_OQ),
+                                  _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GT_OQ));
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+
+    _mm256_storeu_ps(tHit, _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t, inside));
+    _mm256_storeu_ps(b1, u);
+    _mm256_storeu_ps(b2, v);
+
+    return _mm256_movemask_ps(inside) & ((1 << batch.count) - 1);
+#else
+    int mask = 0;
+    for (int i = 0; i < leafBatchWidth; i++)
+    {
+        tHit[i] = FLT_MAX;
+        if (i >= batch.count)
+            continue;
+
+        Vec3 p0(batch.vertex[0][i], batch.vertex[1][i], batch.vertex[2][i]);
+        Vec3 p1 = p0 + Vec3(batch.edge1[0][i], batch.edge1[1][i], batch.edge1[2][i]);
+        Vec3 p2 = p0 + Vec3(batch.edge2[0][i], batch.edge2[1][i], batch.edge2[2][i]);
+        float t;
+        if (intersectTriangle(p0, p1, p2, r, tMin, tMax, t, b1[i], b2[i]))
+        {
+            tHit[i] = t;
+            mask |= 1 << i;
+        }
+    }
+
+    return mask;
+#endif // __AVX2__
+
+}
+
+inline bool TriangleBatch::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+// The nearest triangle of the batch finalizes the hit, as in Triangle.
+inline bool TriangleBatch::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    float tHit[leafBatchWidth], b1[leafBatchWidth], b2[leafBatchWidth];
+    int mask = intersectTriangles(*this, r, tMin, tMax, tHit, b1, b2);
+    if (mask == 0)
+        return false;
+
+    int nearest = nearestLane(tHit, mask);
+    rec.time = tHit[nearest];
+    rec.u = b1[nearest];
+    rec.v = b2[nearest];
+    rec.primitive = triangles[nearest];
+
+    return true;
+
+}
+
+inline bool TriangleBatch::occluded(const Ray& r, float tMin, float tMax) const
+{
+
+    float tHit[leafBatchWidth], b1[leafBatchWidth], b2[leafBatchWidth];
+    return intersectTriangles(*this, r, tMin, tMax, tHit, b1, b2) != 0;
+
+}
+
+inline bool TriangleBatch::boundingBox(float t0, float t1, AABB& box) const
+{
+
+    if (count == 0)
+        return false;
+
+    triangles[0]->boundingBox(t0, t1, box);
+    for (int i = 1; i < count; i++)
+    {
+        AABB triangleBox;
+        triangles[i]->boundingBox(t0, t1, triangleBox);
+        box = surroundingBox(box, triangleBox);
+    }
+
+    return true;
+
+}
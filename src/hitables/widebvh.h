@@ -0,0 +1,465 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif // __AVX2__
+
+#include "hitables/linearbvh.h"
+
+// Node of a BVH with up to Width children. The child bounds are stored as
+// structure of arrays so one ray can be tested against all of them at once.
+template <int Width>
+struct WideBVHNode
+{
+
+    float minX[Width];
+    float minY[Width];
+    float minZ[Width];
+    float maxX[Width];
+    float maxY[Width];
+    float maxZ[Width];
+    int child[Width];               // node index (interior) or primitive offset (leaf)
+    uint16_t count[Width];          // primitive count, 0 for interior children
+    uint8_t childCount;
+
+};
+
+// Ray data shared by all box tests of one traversal.
+struct WideRay
+{
+
+    Vec3 origin;
+    Vec3 invDir;
+
+};
+
+// Slab test of a ray against all children of a node. Returns a bit mask of
+// the children that were hit and writes their entry distances to tNear.
+template <int Width>
+inline int intersectChildren(const WideBVHNode<Width>& node, const WideRay& ray,
+                             float tMin, float tMax, float* tNear)
+{
+
+    int mask = 0;
+    for (int i = 0; i < node.childCount; i++)
+    {
+        float t0x = (node.minX[i] - ray.origin.x()) * ray.invDir.x();
+        float t1x = (node.maxX[i] - ray.origin.x()) * ray.invDir.x();
+        float t0y = (node.minY[i] - ray.origin.y()) * ray.invDir.y();
+        float t1y = (node.maxY[i] - ray.origin.y()) * ray.invDir.y();
+        float t0z = (node.minZ[i] - ray.origin.z()) * ray.invDir.z();
+        float t1z = (node.maxZ[i] - ray.origin.z()) * ray.invDir.z();
+
+        float tEnter = fmaxf(fmaxf(fminf(t0x, t1x), fminf(t0y, t1y)), fmaxf(fminf(t0z, t1z), tMin));
+        float tExit = fminf(fminf(fmaxf(t0x, t1x), fmaxf(t0y, t1y)), fminf(fmaxf(t0z, t1z), tMax));
+
+        tNear[i] = tEnter;
+        if (tEnter < tExit)
+            mask |= 1 << i;
+    }
+
+    return mask;
+
+}
+
+// Four children fill the lanes of a Vec4.
+template <>
+inline int intersectChildren<4>(const WideBVHNode<4>& node, const WideRay& ray,
+                                float tMin, float tMax, float* tNear)
+{
+
+    const Vec4 ox(ray.origin.x());
+    const Vec4 oy(ray.origin.y());
+    const Vec4 oz(ray.origin.z());
+    const Vec4 ix(ray.invDir.x());
+    const Vec4 iy(ray.invDir.y());
+    const Vec4 iz(ray.invDir.z());
+
+    Vec4 t0x = (Vec4::load(node.minX) - ox) * ix;
+    Vec4 t1x = (Vec4::load(node.maxX) - ox) * ix;
+    Vec4 t0y = (Vec4::load(node.minY) - oy) * iy;
+    Vec4 t1y = (Vec4::load(node.maxY) - oy) * iy;
+    Vec4 t0z = (Vec4::load(node.minZ) - oz) * iz;
+    Vec4 t1z = (Vec4::load(node.maxZ) - oz) * iz;
+
+    Vec4 tEnter = vmax(vmax(vmin(t0x, t1x), vmin(t0y, t1y)), vmax(vmin(t0z, t1z), Vec4(tMin)));
+    Vec4 tExit = vmin(vmin(vmax(t0x, t1x), vmax(t0y, t1y)), vmin(vmax(t0z, t1z), Vec4(tMax)));
+
+    tEnter.store(tNear);
+    int mask = signMask(lessThan(tEnter, tExit));
+
+    return mask & ((1 << node.childCount) - 1);
+
+}
+
+#ifdef __AVX2__
+
+template <>
+inline int intersectChildren<8>(const WideBVHNode<8>& node, const WideRay& ray,
+                                float tMin, float tMax, float* tNear)
+{
+
+    const __m256 ox = _mm256_set1_ps(ray.origin.x());
+    const __m256 oy = _mm256_set1_ps(ray.origin.y());
+    const __m256 oz = _mm256_set1_ps(ray.origin.z());
+    const __m256 ix = _mm256_set1_ps(ray.invDir.x());
+    const __m256 iy = _mm256_set1_ps(ray.invDir.y());
+    const __m256 iz = _mm256_set1_ps(ray.invDir.z());
+
+    __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minX), ox), ix);
+    __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxX), ox), ix);
+    __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minY), oy), iy);
+    __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxY), oy), iy);
+    __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minZ), oz), iz);
+    __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxZ), oz), iz);
+
+    __m256 tEnter = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)),
+                                  _mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_set1_ps(tMin)));
+    __m256 tExit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)),
+                                 _mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_set1_ps(tMax)));
+
+    _mm256_storeu_ps(tNear, tEnter);
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(tEnter, tExit, _CMP_LT_OQ));
+
+    return mask & ((1 << node.childCount) - 1);
+
+}
+
+#endif // __AVX2__
+
+// BVH with 4 or 8 children per node, collapsed from a binary LinearBVH.
+// All children of a node are tested with one SIMD slab test.
+template <int Width>
+class WideBVH : public Hitable
+{
+
+    // Stack entry of the traversal: a child reference and its entry distance.
+    struct StackEntry
+    {
+        int child;
+        int count;
+        float tNear;
+    };
+
+    public:
+
+        WideBVH(Hitable **l, int n, float t0, float t1,
+                const BVHBuildParams& params = BVHBuildParams());
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+
+        float sahCost() const
+        {
+            return cost;
+        }
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            for (Hitable* primitive : primitives)
+                primitive->bindMaterials(table);
+        }
+
+        size_t memoryBytes() const
+        {
+            return sizeof(*this) + nodes.size() * sizeof(nodes[0]) +
+                   primitives.size() * sizeof(Hitable*);
+        }
+
+        // Recomputes the child bounds bottom-up for the current primitive
+        // positions. Returns the SAH cost of the wide tree, which counts one
+        // traversal step per node and is not comparable to sahCost().
+        float refit(float t0, float t1, const BVHBuildParams& params = BVHBuildParams());
+
+        std::vector<WideBVHNode<Width> > nodes;
+        std::vector<Hitable*> primitives;
+
+    private:
+
+        int collapse(const LinearBVH& binary, int binaryIndex);
+
+        AABB bounds;
+        float cost;
+        RefitLevels refitLevels;
+
+};
+
+template <int Width>
+inline WideBVH<Width>::WideBVH(Hitable **l, int n, float t0, float t1, const BVHBuildParams& params)
+{
+
+    LinearBVH binary(l, n, t0, t1, params);
+
+    primitives = binary.primitives;
+    cost = binary.sahCost();
+    if (binary.boundingBox(t0, t1, bounds))
+        collapse(binary, 0);
+
+}
+
+template <int Width>
+inline int WideBVH<Width>::collapse(const LinearBVH& binary, int binaryIndex)
+{
+
+    int nodeIndex = static_cast<int>(nodes.size());
+    nodes.push_back(WideBVHNode<Width>());
+
+    // Open the largest interior child until the node is full.
+    int candidates[Width];
+    int candidateCount = 0;
+    const LinearBVHNode& root = binary.nodes[binaryIndex];
+    if (root.primitiveCount > 0)
+        candidates[candidateCount++] = binaryIndex;
+    else
+    {
+        candidates[candidateCount++] = binaryIndex + 1;
+        candidates[candidateCount++] = root.offset;
+    }
+
+    while (candidateCount < Width)
+    {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int i = 0; i < candidateCount; i++)
+        {
+            const LinearBVHNode& c = binary.nodes[candidates[i]];
+            float area = AABB(c.boundsMin, c.boundsMax).surfaceArea();
+            if (c.primitiveCount == 0 && area > largestArea)
+            {
+                largest = i;
+                largestArea = area;
+            }
+        }
+        if (largest < 0)
+            break;
+
+        int opened = candidates[largest];
+        candidates[largest] = opened + 1;
+        candidates[candidateCount++] = binary.nodes[opened].offset;
+    }
+
+    int child[Width];
+    for (int i = 0; i < candidateCount; i++)
+    {
+        const LinearBVHNode& c = binary.nodes[candidates[i]];
+        child[i] = c.primitiveCount > 0 ? c.offset : collapse(binary, candidates[i]);
+    }
+
+    WideBVHNode<Width>& node = nodes[nodeIndex];
+    node.childCount = static_cast<uint8_t>(candidateCount);
+    for (int i = 0; i < Width; i++)
+    {
+        bool used = i < candidateCount;
+        const LinearBVHNode& c = binary.nodes[used ? candidates[i] : candidates[0]];
+        node.minX[i] = c.boundsMin.x();
+        node.minY[i] = c.boundsMin.y();
+        node.minZ[i] = c.boundsMin.z();
+        node.maxX[i] = c.boundsMax.x();
+        node.maxY[i] = c.boundsMax.y();
+        node.maxZ[i] = c.boundsMax.z();
+        node.child[i] = used ? child[i] : 0;
+        node.count[i] = used ? c.primitiveCount : 0;
+    }
+
+    return nodeIndex;
+
+}
+
+template <int Width>
+inline float WideBVH<Width>::refit(float t0, float t1, const BVHBuildParams& params)
+{
+
+    int nodeCount = static_cast<int>(nodes.size());
+    if (nodeCount == 0)
+        return 0.0f;
+
+    if (refitLevels.levelStart.empty())
+    {
+        std::vector<int> depth(static_cast<size_t>(nodeCount), 0);
+        for (int i = 0; i < nodeCount; i++)
+            for (int c = 0; c < nodes[i].childCount; c++)
+                if (nodes[i].count[c] == 0)
+                    depth[nodes[i].child[c]] = depth[i] + 1;
+        refitLevels = groupByDepth(depth);
+    }
+
+    std::vector<float> nodeCost(static_cast<size_t>(nodeCount));
+
+    int levelCount = static_cast<int>(refitLevels.levelStart.size()) - 1;
+    for (int level = 0; level < levelCount; level++)
+    {
+        int begin = refitLevels.levelStart[level];
+        int end = refitLevels.levelStart[level + 1];
+
+        #pragma omp parallel for schedule(dynamic, 64) if (end - begin > 256)
+        for (int k = begin; k < end; k++)
+        {
+            int i = refitLevels.order[k];
+            WideBVHNode<Width>& node = nodes[i];
+
+            AABB childBounds[Width];
+            float childCost[Width];
+            for (int c = 0; c < node.childCount; c++)
+            {
+                AABB box;
+                if (node.count[c] > 0)
+                {
+                    primitives[node.child[c]]->boundingBox(t0, t1, childBounds[c]);
+                    for (int p = 1; p < node.count[c]; p++)
+                    {
+                        primitives[node.child[c] + p]->boundingBox(t0, t1, box);
+                        childBounds[c] = surroundingBox(childBounds[c], box);
+                    }
+                    childCost[c] = params.intersectionCost * node.count[c];
+                }
+                else
+                {
+                    const WideBVHNode<Width>& child = nodes[node.child[c]];
+                    childBounds[c] = AABB(Vec3(child.minX[0], child.minY[0], child.minZ[0]),
+                                          Vec3(child.maxX[0], child.maxY[0], child.maxZ[0]));
+                    for (int g = 1; g < child.childCount; g++)
+                    {
+                        box = AABB(Vec3(child.minX[g], child.minY[g], child.minZ[g]),
+                                   Vec3(child.maxX[g], child.maxY[g], child.maxZ[g]));
+                        childBounds[c] = surroundingBox(childBounds[c], box);
+                    }
+                    childCost[c] = nodeCost[node.child[c]];
+                }
+            }
+
+            // Unused slots repeat the first child, as after the build.
+            AABB nodeBounds = childBounds[0];
+            for (int c = 1; c < node.childCount; c++)
+                nodeBounds = surroundingBox(nodeBounds, childBounds[c]);
+            for (int c = 0; c < Width; c++)
+            {
+                const AABB& b = childBounds[c < node.childCount ? c : 0];
+                node.minX[c] = b.min().x();
+                node.minY[c] = b.min().y();
+                node.minZ[c] = b.min().z();
+                node.maxX[c] = b.max().x();
+                node.maxY[c] = b.max().y();
+                node.maxZ[c] = b.max().z();
+            }
+
+            float area = nodeBounds.surfaceArea();
+            nodeCost[i] = params.traversalCost;
+            for (int c = 0; c < node.childCount; c++)
+                nodeCost[i] += area > 0.0f ? childBounds[c].surfaceArea() / area * childCost[c] : childCost[c];
+            if (i == 0)
+                bounds = nodeBounds;
+        }
+    }
+
+    return nodeCount > 0 ? nodeCost[0] : 0.0f;
+
+}
+
+template <int Width>
+inline bool WideBVH<Width>::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersect(r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+template <int Width>
+inline bool WideBVH<Width>::intersect(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (nodes.empty())
+        return false;
+
+    WideRay ray;
+    ray.origin = r.origin();
+    Vec3 direction = r.direction();
+    ray.invDir = Vec3(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
+
+    StackEntry stack[linearBVHStackSize * Width];
+    int toVisit = 0;
+    stack[toVisit++] = { 0, 0, tMin };
+
+    HitRecord tempRec;
+    bool hitAnything = false;
+    float closestSoFar = tMax;
+
+    while (toVisit > 0)
+    {
+        StackEntry entry = stack[--toVisit];
+        if (entry.tNear >= closestSoFar)
+            continue;
+
+        if (entry.count > 0)
+        {
+            for (int i = 0; i < entry.count; i++)
+            {
+                if (primitives[entry.child + i]->intersect(r, tMin, closestSoFar, tempRec))
+                {
+                    hitAnything = true;
+                    closestSoFar = tempRec.time;
+                    rec = tempRec;
+                }
+            }
+            continue;
+        }
+
+        const WideBVHNode<Width>& node = nodes[entry.child];
+        STATS_ADD(bvhNodeVisits, 1);
+
+        float tNear[Width];
+        int mask = intersectChildren<Width>(node, ray, tMin, closestSoFar, tNear);
+
+        // Push the hit children far to near, so the nearest one is popped first.
+        int first = toVisit;
+        while (mask)
+        {
+            int i = __builtin_ctz(static_cast<unsigned int>(mask));
+            mask &= mask - 1;
+
+            StackEntry child = { node.child[i], node.count[i], tNear[i] };
+            int j = toVisit++;
+            while (j > first && stack[j-1].tNear < child.tNear)
+            {
+                stack[j] = stack[j-1];
+                j--;
+            }
+            stack[j] = child;
+        }
+    }
+
+    return hitAnything;
+
+}
+
+template <int Width>
+inline bool WideBVH<Width>::boundingBox(float t0, float t1, AABB& box) const
+{
+    box = bounds;
+    return !nodes.empty();
+}
@@ -19,6 +19,7 @@ SOFTWARE.
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <float.h>
 #include <random>
 #include <chrono>
@@ -37,7 +38,10 @@ SOFTWARE.
 #include "util/common.h"
 #include "util/globals.h"
 #include "util/scene.h"
+#include "util/scenecache.h"
 #include "util/params.h"
+#include "util/benchmark.h"
+#include "util/selfcheck.h"
 
 // STB IMAGE FOR WRITING IMAGE FILES
 #ifndef STB_IMAGE_IMPLEMENTATION
@@ -74,9 +78,35 @@ void initializeWorld(LParams& lParams,
                                  distToFocus, aperture));
     rParams.renderer.reset(new Renderer(lParams.showWindow,
                                         lParams.writeImagePPM,
-                                        lParams.writeImagePNG));
-
-    rParams.world.reset(surfaceTexture());
+                                        lParams.writeImagePNG,
+                                        lParams.renderMode));
+    rParams.renderer->packets = lParams.packetTracing;
+    rParams.renderer->wavefront = lParams.wavefront;
+    rParams.renderer->reorderBatch = lParams.reorderBatch;
+    rParams.renderer->tiles = lParams.tiles;
+    rParams.renderer->tileWidth = rParams.renderer->tileHeight = lParams.tileSize;
+    rParams.renderer->tileOrder = lParams.tileOrder;
+
+    // Map the cached scene if there is one, otherwise generate the scene
+    // and write the cache for the next start.
+    auto start = std::chrono::high_resolution_clock::now();
+    Hitable* world = lParams.sceneCache.empty() ? nullptr : loadSceneCache(lParams.sceneCache);
+    bool cached = world != nullptr;
+    if (!cached)
+    {
+        rParams.arena.reset(new SceneArena());
+        SceneArena::Scope scope(rParams.arena.get());
+        world = surfaceTexture();
+        if (!lParams.sceneCache.empty())
+            saveSceneCache(lParams.sceneCache, world);
+    }
+    rParams.world.reset(world);
+    rParams.materials.reset(new MaterialTable());
+    world->bindMaterials(*rParams.materials);
+    rParams.renderer->materials = rParams.materials.get();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "World ready in " << elapsed.count() << " ms"
+              << (cached ? " (scene cache)" : "") << std::endl;
 
     if (lParams.showWindow)
     {
@@ -163,8 +193,8 @@ void invokeRenderer(LParams& lParams,
     }
     else
     {
-        for (int i = 0; i < numberOfIterations; i++)
-            rParams.renderer->traceRays(rParams, i+1);
+        // All passes at once, so that the tiles render them back to back.
+        rParams.renderer->traceRays(rParams, 1, numberOfIterations);
         std::cout << "Done." << std::endl;
     }
 
@@ -204,12 +234,23 @@ int main(int argc, char **argv)
 {
 
     bool runBenchmark = false;
+    bool runBVHBenchmark = false;
+    std::string bvhBenchmark = "bvh";   // one of the benchmarkByName() names, or "all"
+    bool runSelfCheck = false;          // run the regression checks, exit with 1 if one fails
 
     bool showWindow = true;
     bool writeImagePPM = true;
     bool writeImagePNG = true;
     bool writeEveryImageToFile = true;
     bool moveCamera = false;
+    bool previewAO = false;             // start in the ambient occlusion preview
+    std::string sceneCache = "";        // e.g. "scene.cache", written on the first run
+    bool packetTracing = false;         // trace the primary rays in 8 ray packets
+    bool wavefront = false;             // trace the paths in stages, sorted by material
+    int reorderBatch = 0;               // sort the secondary rays of the wavefront per this many paths
+    bool tiles = true;                  // render in tiles on a work-stealing scheduler
+    int tileSize = 16;
+    TileOrder tileOrder = TILE_ORDER_HILBERT;
 
     // Run benchmark.
     if (runBenchmark)
@@ -240,11 +281,34 @@ int main(int argc, char **argv)
 
         }
     }
+#ifndef CUDA_ENABLED
+    // Compare the BVH builders on every scene, or run another benchmark.
+    else if (runBVHBenchmark)
+    {
+        std::ostringstream report;
+        if (!benchmarkByName(bvhBenchmark, report))
+            return 1;
+        std::cout << report.str();
+
+        std::ofstream benchmarkStream("../benchmark/bvhBenchmarkResult.txt", std::ios_base::app);
+        benchmarkStream << report.str();
+        benchmarkStream.close();
+    }
+    // Check the edge cases, the exit status tells if one failed.
+    else if (runSelfCheck)
+    {
+        if (!selfCheck(std::cout))
+            return 1;
+    }
+#endif // CUDA_ENABLED
     // Run code without benchmarking.
     else
     {
         // Invoke renderer.
-        LParams lParams(showWindow, writeImagePPM, writeImagePNG, writeEveryImageToFile, moveCamera);
+        LParams lParams(showWindow, writeImagePPM, writeImagePNG, writeEveryImageToFile, moveCamera,
+                        previewAO ? AMBIENT_OCCLUSION : PATH_TRACING, sceneCache,
+                        packetTracing, wavefront, reorderBatch,
+                        tiles, tileSize, tileOrder);
         raytrace(lParams);
     }
 
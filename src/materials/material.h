@@ -46,6 +46,16 @@ class Material
 
 };
 
+// The scatter functions hold the math of the materials, shared by the
+// classes and the entries of a MaterialTable.
+
+// diffuse matrials randomly scatter the rays
+CUDA_DEV inline void scatterLambertian(RandomGenerator& rng, const Ray& rIn, const HitRecord& rec, Ray& scattered)
+{
+    Vec3 target = rec.point + rec.normal + rng.randomInUnitSphere();
+    scattered = Ray(rec.point, target - rec.point, rIn.time());
+}
+
 // lambertian (diffuse)
 // it can either scatter always and attenuate by its reflectance R
 // or it can scatter with no attenuation but absorb the fraction 1-R of the rays
@@ -55,21 +65,24 @@ class Lambertian : public Material
 
     Texture* albedo; // the proportion of the incident light or radiation that is reflected by a surface
 
+    friend class SceneCacheWriter;
+    friend class MaterialTable;
+
     public:
 
         CUDA_DEV Lambertian(Texture* a) : albedo(a) {}
 
-        // diffuse matrials randomly scatter the rays
         CUDA_DEV virtual bool scatter(RandomGenerator& rng, const Ray& rIn, const HitRecord& rec, Vec3& attenuation, Ray& scattered) const
         {
-            Vec3 target = rec.point + rec.normal + rng.randomInUnitSphere();
-            scattered = Ray(rec.point, target - rec.point, rIn.time());
+            scatterLambertian(rng, rIn, rec, scattered);
             attenuation = albedo->value(rec.u, rec.v, rec.point);
             return true;
         }
 
 };
 
+template <> struct SceneArenaDestroys<Lambertian> : std::false_type {};
+
 // for smooth metals the ray won't be randomly scattered
 // because v points in, we will need a minus sign before the dot product
 CUDA_DEV inline Vec3 reflect(const Vec3& v, const Vec3& n)
@@ -77,12 +90,26 @@ CUDA_DEV inline Vec3 reflect(const Vec3& v, const Vec3& n)
     return v - 2.0f*dot(v,n)*n;
 }
 
+// metals don't randomly scatter -> they reflect
+CUDA_DEV inline bool scatterMetal(RandomGenerator& rng, const Ray& rIn, const HitRecord& rec, float fuzz, Ray& scattered)
+{
+
+    Vec3 reflected = reflect(unitVector(rIn.direction()), rec.normal);
+    scattered = Ray(rec.point, reflected + fuzz*rng.randomInUnitSphere(), rIn.time());
+
+    return (dot(scattered.direction(), rec.normal) > 0.0f);
+
+}
+
 class Metal: public Material
 {
 
     Vec3 albedo;
     float fuzz;
 
+    friend class SceneCacheWriter;
+    friend class MaterialTable;
+
     public:
 
         CUDA_DEV Metal(const Vec3& a, float f = 0.0f) : albedo(a) {if (f < 1.0f) fuzz = f; else fuzz = 1.0f;}
@@ -90,15 +117,13 @@ class Metal: public Material
 
 };
 
-// metals don't randomly scatter -> they reflect
+template <> struct SceneArenaDestroys<Metal> : std::false_type {};
+
 CUDA_DEV inline bool Metal::scatter(RandomGenerator& rng, const Ray& rIn, const HitRecord& rec, Vec3& attenuation, Ray& scattered) const
 {
 
-    Vec3 reflected = reflect(unitVector(rIn.direction()), rec.normal);
-    scattered = Ray(rec.point, reflected + fuzz*rng.randomInUnitSphere(), rIn.time());
     attenuation = albedo;
-
-    return (dot(scattered.direction(), rec.normal) > 0.0f);
+    return scatterMetal(rng, rIn, rec, fuzz, scattered);
 
 }
 
@@ -133,6 +158,9 @@ class Dielectric: public Material
 
     float refIndex;
 
+    friend class SceneCacheWriter;
+    friend class MaterialTable;
+
     public:
 
         CUDA_DEV Dielectric(float ri) : refIndex(ri) {}
@@ -140,6 +168,8 @@ class Dielectric: public Material
 
 };
 
+template <> struct SceneArenaDestroys<Dielectric> : std::false_type {};
+
 // real glass has reflectivity that varies with angle
 // Christophe Schlick's simple qeuation:
 CUDA_DEV inline float schlick(float cosine, float refIndex)
@@ -152,15 +182,13 @@ CUDA_DEV inline float schlick(float cosine, float refIndex)
 
 }
 
-CUDA_DEV inline bool Dielectric::scatter(RandomGenerator& rng, const Ray& rIn, const HitRecord& rec, Vec3& attenuation, Ray& scattered) const
+// the glass surface absorbs nothing => attenuation = 1
+CUDA_DEV inline bool scatterDielectric(RandomGenerator& rng, const Ray& rIn, const HitRecord& rec, float refIndex, Ray& scattered)
 {
 
     Vec3 outWardNormal;
     Vec3 reflected = reflect(rIn.direction(), rec.normal);
     float niOverNt;
-    // the glass surface absorbs nothing => attenuation = 1
-    // erase the blue channel 
-    attenuation = Vec3(1.0f, 1.0f, 1.0f);
     Vec3 refracted;
     float reflectProbability;
     float cosine;
@@ -194,3 +222,12 @@ CUDA_DEV inline bool Dielectric::scatter(RandomGenerator& rng, const Ray& rIn, c
     return true;
 
 }
+
+CUDA_DEV inline bool Dielectric::scatter(RandomGenerator& rng, const Ray& rIn, const HitRecord& rec, Vec3& attenuation, Ray& scattered) const
+{
+
+    // erase the blue channel
+    attenuation = Vec3(1.0f, 1.0f, 1.0f);
+    return scatterDielectric(rng, rIn, rec, refIndex, scattered);
+
+}
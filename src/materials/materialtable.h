@@ -0,0 +1,335 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "materials/material.h"
+#include "materials/texture.h"
+
+enum MaterialType : uint32_t
+{
+    MATERIAL_LAMBERTIAN,
+    MATERIAL_METAL,
+    MATERIAL_DIELECTRIC
+};
+
+enum TextureType : uint32_t
+{
+    TEXTURE_CONSTANT,
+    TEXTURE_CHECKER,
+    TEXTURE_NOISE,
+    TEXTURE_IMAGE
+};
+
+// MaterialEntry::texture of lambertians with a constant albedo.
+const uint32_t noTexture = 0xffffffffu;
+
+struct MaterialEntry
+{
+
+    uint32_t type;
+    uint32_t texture;       // albedo of MATERIAL_LAMBERTIAN, noTexture if it is color
+    Vec3 color;             // albedo of MATERIAL_LAMBERTIAN and MATERIAL_METAL
+    float parameter;        // fuzz of MATERIAL_METAL, refractive index of MATERIAL_DIELECTRIC
+
+};
+
+struct TextureEntry
+{
+
+    uint32_t type;
+    uint32_t even;          // TEXTURE_CHECKER
+    uint32_t odd;
+    float scale;            // TEXTURE_NOISE
+    Vec3 color;             // TEXTURE_CONSTANT
+    int nx, ny;             // TEXTURE_IMAGE
+    const unsigned char* data;
+
+};
+
+// Flat copies of the materials and textures of a scene, referenced by 32 bit
+// ids instead of pointers. Shading an entry is a switch over its type and
+// reads one or two small records, where Material::scatter goes through the
+// material, its vtable, the texture and the vtable of the texture. The
+// hitables store the ids of their materials when the scene is bound with
+// Hitable::bindMaterials() and copy them to HitRecord::materialId. Image
+// entries point at the pixels of their ImageTexture.
+class MaterialTable
+{
+
+    public:
+
+        MaterialTable() : materialData(nullptr), textureData(nullptr) {}
+
+        MaterialTable(const MaterialTable&) = delete;
+        MaterialTable& operator=(const MaterialTable&) = delete;
+
+        // Copies the material and its textures into the table once and
+        // returns its id. invalidMaterialId for null and for the material
+        // and texture classes the table has no entry type for, their hits
+        // keep being shaded through matPtr.
+        uint32_t add(const Material* material);
+
+        CUDA_DEV bool scatter(uint32_t id, RandomGenerator& rng, const Ray& rIn, const HitRecord& rec,
+                              Vec3& attenuation, Ray& scattered) const;
+
+        CUDA_DEV Vec3 textureValue(uint32_t id, float u, float v, const Vec3& p) const;
+
+        CUDA_DEV const MaterialEntry& material(uint32_t id) const
+        {
+            return materialData[id];
+        }
+
+        int materialCount() const
+        {
+            return static_cast<int>(materials.size());
+        }
+
+        int textureCount() const
+        {
+            return static_cast<int>(textures.size());
+        }
+
+        size_t memoryBytes() const
+        {
+            return sizeof(*this) + materials.size() * sizeof(MaterialEntry) +
+                   textures.size() * sizeof(TextureEntry);
+        }
+
+    private:
+
+        uint32_t addTexture(const Texture* texture);
+
+        std::vector<MaterialEntry> materials;
+        std::vector<TextureEntry> textures;
+        std::unordered_map<const Material*, uint32_t> materialIds;
+        std::unordered_map<const Texture*, uint32_t> textureIds;
+
+        // The lookups go through plain pointers, they are device code.
+        const MaterialEntry* materialData;
+        const TextureEntry* textureData;
+
+        Perlin noise;
+
+};
+
+// Static interface of the shading of one MaterialType. The kernels implement
+// scatterEntry(), MaterialKernel adds the table lookup. Code that knows the
+// type of its hits at compile time, e.g. a queue of hits sorted by material,
+// calls Kernel::scatter() and gets it inlined without the switch.
+template <typename Kernel>
+struct MaterialKernel
+{
+
+    CUDA_DEV static bool scatter(const MaterialTable& table, uint32_t id, RandomGenerator& rng,
+                                 const Ray& rIn, const HitRecord& rec, Vec3& attenuation, Ray& scattered)
+    {
+        return Kernel::scatterEntry(table, table.material(id), rng, rIn, rec, attenuation, scattered);
+    }
+
+};
+
+struct LambertianKernel : MaterialKernel<LambertianKernel>
+{
+
+    static const MaterialType type = MATERIAL_LAMBERTIAN;
+
+    CUDA_DEV static bool scatterEntry(const MaterialTable& table, const MaterialEntry& m, RandomGenerator& rng,
+                                      const Ray& rIn, const HitRecord& rec, Vec3& attenuation, Ray& scattered)
+    {
+        scatterLambertian(rng, rIn, rec, scattered);
+        attenuation = m.texture == noTexture ? m.color : table.textureValue(m.texture, rec.u, rec.v, rec.point);
+        return true;
+    }
+
+};
+
+struct MetalKernel : MaterialKernel<MetalKernel>
+{
+
+    static const MaterialType type = MATERIAL_METAL;
+
+    CUDA_DEV static bool scatterEntry(const MaterialTable& table, const MaterialEntry& m, RandomGenerator& rng,
+                                      const Ray& rIn, const HitRecord& rec, Vec3& attenuation, Ray& scattered)
+    {
+        attenuation = m.color;
+        return scatterMetal(rng, rIn, rec, m.parameter, scattered);
+    }
+
+};
+
+struct DielectricKernel : MaterialKernel<DielectricKernel>
+{
+
+    static const MaterialType type = MATERIAL_DIELECTRIC;
+
+    CUDA_DEV static bool scatterEntry(const MaterialTable& table, const MaterialEntry& m, RandomGenerator& rng,
+                                      const Ray& rIn, const HitRecord& rec, Vec3& attenuation, Ray& scattered)
+    {
+        attenuation = Vec3(1.0f, 1.0f, 1.0f);
+        return scatterDielectric(rng, rIn, rec, m.parameter, scattered);
+    }
+
+};
+
+inline CUDA_DEV bool MaterialTable::scatter(uint32_t id, RandomGenerator& rng, const Ray& rIn, const HitRecord& rec,
+                                            Vec3& attenuation, Ray& scattered) const
+{
+
+    const MaterialEntry& m = materialData[id];
+    switch (m.type)
+    {
+        case MATERIAL_LAMBERTIAN:
+            return LambertianKernel::scatterEntry(*this, m, rng, rIn, rec, attenuation, scattered);
+        case MATERIAL_METAL:
+            return MetalKernel::scatterEntry(*this, m, rng, rIn, rec, attenuation, scattered);
+        case MATERIAL_DIELECTRIC:
+        default:
+            return DielectricKernel::scatterEntry(*this, m, rng, rIn, rec, attenuation, scattered);
+    }
+
+}
+
+inline CUDA_DEV Vec3 MaterialTable::textureValue(uint32_t id, float u, float v, const Vec3& p) const
+{
+
+    // Checkers only pick one of their textures, follow them down without
+    // recursion.
+    const TextureEntry* t = &textureData[id];
+    while (t->type == TEXTURE_CHECKER)
+        t = &textureData[checkerOdd(p) ? t->odd : t->even];
+
+    switch (t->type)
+    {
+        case TEXTURE_NOISE:
+            return noiseTextureValue(noise, t->scale, p);
+        case TEXTURE_IMAGE:
+            return imageTextureValue(t->data, t->nx, t->ny, u, v);
+        case TEXTURE_CONSTANT:
+        default:
+            return t->color;
+    }
+
+}
+
+inline uint32_t MaterialTable::add(const Material* material)
+{
+
+    if (!material)
+        return invalidMaterialId;
+
+    auto found = materialIds.find(material);
+    if (found != materialIds.end())
+        return found->second;
+
+    MaterialEntry entry = {};
+    entry.texture = noTexture;
+    bool supported = true;
+    if (const Lambertian* lambertian = dynamic_cast<const Lambertian*>(material))
+    {
+        entry.type = MATERIAL_LAMBERTIAN;
+        // Most albedos are constant, they are kept in the entry itself.
+        if (const ConstantTexture* constant = dynamic_cast<const ConstantTexture*>(lambertian->albedo))
+            entry.color = constant->color;
+        else
+        {
+            entry.texture = addTexture(lambertian->albedo);
+            supported = entry.texture != noTexture;
+        }
+    }
+    else if (const Metal* metal = dynamic_cast<const Metal*>(material))
+    {
+        entry.type = MATERIAL_METAL;
+        entry.color = metal->albedo;
+        entry.parameter = metal->fuzz;
+    }
+    else if (const Dielectric* dielectric = dynamic_cast<const Dielectric*>(material))
+    {
+        entry.type = MATERIAL_DIELECTRIC;
+        entry.parameter = dielectric->refIndex;
+    }
+    else
+        supported = false;
+
+    uint32_t id = invalidMaterialId;
+    if (supported)
+    {
+        id = static_cast<uint32_t>(materials.size());
+        materials.push_back(entry);
+        materialData = materials.data();
+    }
+    materialIds[material] = id;
+    return id;
+
+}
+
+inline uint32_t MaterialTable::addTexture(const Texture* texture)
+{
+
+    if (!texture)
+        return noTexture;
+
+    auto found = textureIds.find(texture);
+    if (found != textureIds.end())
+        return found->second;
+
+    TextureEntry entry = {};
+    bool supported = true;
+    if (const ConstantTexture* constant = dynamic_cast<const ConstantTexture*>(texture))
+    {
+        entry.type = TEXTURE_CONSTANT;
+        entry.color = constant->color;
+    }
+    else if (const CheckerTexture* checker = dynamic_cast<const CheckerTexture*>(texture))
+    {
+        entry.type = TEXTURE_CHECKER;
+        entry.even = addTexture(checker->even);
+        entry.odd = addTexture(checker->odd);
+        supported = entry.even != noTexture && entry.odd != noTexture;
+    }
+    else if (const NoiseTexture* noiseTexture = dynamic_cast<const NoiseTexture*>(texture))
+    {
+        entry.type = TEXTURE_NOISE;
+        entry.scale = noiseTexture->scale;
+    }
+    else if (const ImageTexture* image = dynamic_cast<const ImageTexture*>(texture))
+    {
+        entry.type = TEXTURE_IMAGE;
+        entry.data = image->data;
+        entry.nx = image->nx;
+        entry.ny = image->ny;
+    }
+    else
+        supported = false;
+
+    uint32_t id = noTexture;
+    if (supported)
+    {
+        id = static_cast<uint32_t>(textures.size());
+        textures.push_back(entry);
+        textureData = textures.data();
+    }
+    textureIds[texture] = id;
+    return id;
+
+}
@@ -19,6 +19,7 @@ SOFTWARE.
 
 #pragma once
 
+#include "util/arena.h"
 #include "util/vec3.h"
 #include "materials/perlin.h"
 
@@ -28,6 +29,7 @@ class Texture
     public:
 
         CUDA_DEV virtual Vec3 value(float u, float v, const Vec3& p) const = 0;
+        CUDA_DEV virtual ~Texture() {}
 
 };
 
@@ -48,6 +50,15 @@ class ConstantTexture : public Texture
 
 };
 
+template <> struct SceneArenaDestroys<ConstantTexture> : std::false_type {};
+
+// Side of the 3D checker pattern p lies on, shared with MaterialTable.
+CUDA_DEV inline bool checkerOdd(const Vec3& p)
+{
+    float sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
+    return sines < 0;
+}
+
 class CheckerTexture : public Texture
 {
 
@@ -58,8 +69,7 @@ class CheckerTexture : public Texture
 
         CUDA_DEV virtual Vec3 value(float u, float v, const Vec3& p) const
         {
-            float sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
-            if (sines < 0)
+            if (checkerOdd(p))
                 return odd->value(u, v, p);
             else
                 return even->value(u, v, p);
@@ -70,6 +80,14 @@ class CheckerTexture : public Texture
 
 };
 
+template <> struct SceneArenaDestroys<CheckerTexture> : std::false_type {};
+
+// Marble like stripes of turbulence, shared with MaterialTable.
+CUDA_DEV inline Vec3 noiseTextureValue(const Perlin& noise, float scale, const Vec3& p)
+{
+    return Vec3(1,1,1)*0.5*(1 + sin(scale*p.x() + 5*noise.turb(scale*p)));
+}
+
 class NoiseTexture : public Texture
 {
 
@@ -80,7 +98,7 @@ class NoiseTexture : public Texture
 
         CUDA_DEV virtual Vec3 value(float u, float v, const Vec3& p) const
         {
-            return Vec3(1,1,1)*0.5*(1 + sin(scale*p.x() + 5*noise.turb(scale*p)));
+            return noiseTextureValue(noise, scale, p);
         }
 
         Perlin noise;
@@ -93,9 +111,9 @@ class ImageTexture : public Texture
 
     public:
 
-        CUDA_DEV ImageTexture() {}
-        CUDA_DEV ImageTexture(unsigned char *pixels, int A, int B) :
-            data(pixels), nx(A), ny(B)
+        CUDA_DEV ImageTexture() : fileName(nullptr) {}
+        CUDA_DEV ImageTexture(unsigned char *pixels, int A, int B, const char* file = nullptr) :
+            data(pixels), nx(A), ny(B), fileName(file)
         {
 
         }
@@ -104,10 +122,12 @@ class ImageTexture : public Texture
 
         unsigned char *data;
         int nx, ny;
+        const char* fileName;   // image the pixels were loaded from, if any
 
 };
 
-inline Vec3 ImageTexture::value(float u, float v, const Vec3& p) const
+// Nearest texel of an RGB image at (u, v), shared with MaterialTable.
+CUDA_DEV inline Vec3 imageTextureValue(const unsigned char* data, int nx, int ny, float u, float v)
 {
      int i = u*nx;
      int j = (1 - v) * ny - 0.001f;
@@ -125,3 +145,7 @@ inline Vec3 ImageTexture::value(float u, float v, const Vec3& p) const
      return Vec3(r, g, b);
 }
 
+inline Vec3 ImageTexture::value(float u, float v, const Vec3& p) const
+{
+    return imageTextureValue(data, nx, ny, u, v);
+}
@@ -0,0 +1,233 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "util/common.h"
+
+// Sizes of the first and the largest regular block of a SceneArena, the
+// blocks double in between so that small scenes stay small. Larger objects
+// get a block of their own.
+const size_t sceneArenaFirstBlockBytes = 64 << 10;
+const size_t sceneArenaBlockBytes = 1 << 20;
+
+// Whether a SceneArena has to run the destructor of T. Classes with virtual
+// functions never have a trivial destructor, so the hitables, materials and
+// textures that own nothing specialize this to false next to their class,
+// which saves a destructor record for each of them.
+template <typename T>
+struct SceneArenaDestroys : std::integral_constant<bool, !std::is_trivially_destructible<T>::value>
+{
+
+};
+
+// Owns every object of a generated scene: the primitives, materials,
+// textures, hitable lists and BVH nodes. The objects are placed one after
+// another in the order they are made, so that a primitive ends up next to
+// its material and texture, without the per allocation header of the heap.
+// Destroying the arena runs the destructors in reverse order and frees the
+// blocks at once. Objects made in an arena must not be deleted.
+//
+// The scene functions and the BVH builders make their objects with
+// sceneNew(), which allocates from the arena of the innermost Scope on the
+// calling thread, or from the heap without one.
+class SceneArena
+{
+
+    public:
+
+        // Makes arena the one sceneNew() allocates from on this thread until
+        // the scope ends. A nullptr arena switches back to the heap.
+        class Scope
+        {
+
+            public:
+
+                explicit Scope(SceneArena* arena) : previous(current())
+                {
+                    current() = arena;
+                }
+
+                ~Scope()
+                {
+                    current() = previous;
+                }
+
+            private:
+
+                SceneArena* previous;
+
+        };
+
+        SceneArena() : cursor(nullptr), end(nullptr), used(0), reserved(0)
+        {
+
+        }
+
+        SceneArena(const SceneArena&) = delete;
+        SceneArena& operator=(const SceneArena&) = delete;
+
+        ~SceneArena()
+        {
+            clear();
+        }
+
+        static SceneArena*& current()
+        {
+            static thread_local SceneArena* arena = nullptr;
+            return arena;
+        }
+
+        void* allocate(size_t bytes, size_t alignment)
+        {
+            uintptr_t address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1);
+            if (!cursor || address + bytes > reinterpret_cast<uintptr_t>(end))
+            {
+                addBlock(bytes + alignment);
+                address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1);
+            }
+            cursor = reinterpret_cast<unsigned char*>(address + bytes);
+            used += bytes;
+            return reinterpret_cast<void*>(address);
+        }
+
+        template <typename T, typename... Args>
+        T* create(Args&&... args)
+        {
+            T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            if (SceneArenaDestroys<T>::value)
+                destructors.push_back(Destructor{ &destroy<T>, object });
+            return object;
+        }
+
+        // Value initialized array of n elements, like the hitable lists.
+        template <typename T>
+        T* createArray(size_t n)
+        {
+            static_assert(std::is_trivially_destructible<T>::value,
+                          "arena arrays are freed without destructors");
+            T* array = static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+            for (size_t i = 0; i < n; i++)
+                new (&array[i]) T();
+            return array;
+        }
+
+        // Destroys the objects and frees the blocks.
+        void clear()
+        {
+            for (auto d = destructors.rbegin(); d != destructors.rend(); ++d)
+                d->destroy(d->object);
+            for (unsigned char* block : blocks)
+                delete[] block;
+            destructors.clear();
+            blocks.clear();
+            cursor = end = nullptr;
+            used = reserved = 0;
+        }
+
+        // Bytes of the objects, including their alignment.
+        size_t bytesUsed() const
+        {
+            return used;
+        }
+
+        // Bytes of the blocks and of the destructor records.
+        size_t bytesReserved() const
+        {
+            return reserved + destructors.capacity() * sizeof(Destructor);
+        }
+
+        size_t objectCount() const
+        {
+            return destructors.size();
+        }
+
+    private:
+
+        struct Destructor
+        {
+            void (*destroy)(void*);
+            void* object;
+        };
+
+        template <typename T>
+        static void destroy(void* object)
+        {
+            static_cast<T*>(object)->~T();
+        }
+
+        // The rest of the current block is given up, it is rarely large
+        // since only big objects don't fit.
+        void addBlock(size_t minBytes)
+        {
+            size_t regular = std::min(sceneArenaFirstBlockBytes << std::min(blocks.size(), size_t(8)),
+                                      sceneArenaBlockBytes);
+            size_t bytes = std::max(minBytes, regular);
+            blocks.push_back(new unsigned char[bytes]);
+            cursor = blocks.back();
+            end = cursor + bytes;
+            reserved += bytes;
+        }
+
+        std::vector<unsigned char*> blocks;
+        std::vector<Destructor> destructors;
+        unsigned char* cursor;
+        unsigned char* end;
+        size_t used;
+        size_t reserved;
+
+};
+
+// new T(args) in the current SceneArena, or on the heap without one.
+#ifdef CUDA_ENABLED
+template <typename T, typename... Args>
+CUDA_HOSTDEV inline T* sceneNew(Args&&... args)
+{
+    return new T(static_cast<Args&&>(args)...);
+}
+
+template <typename T>
+CUDA_HOSTDEV inline T* sceneNewArray(size_t n)
+{
+    return new T[n];
+}
+#else
+template <typename T, typename... Args>
+inline T* sceneNew(Args&&... args)
+{
+    SceneArena* arena = SceneArena::current();
+    return arena ? arena->create<T>(std::forward<Args>(args)...) : new T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+inline T* sceneNewArray(size_t n)
+{
+    SceneArena* arena = SceneArena::current();
+    return arena ? arena->createArray<T>(n) : new T[n];
+}
+#endif // CUDA_ENABLED
@@ -0,0 +1,2320 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <omp.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "util/benchmark.h"
+#include "util/camera.h"
+#include "util/globals.h"
+#include "util/objloader.h"
+#include "util/params.h"
+#include "util/perfcounter.h"
+#include "util/renderer.h"
+#include "util/scene.h"
+#include "util/scenecache.h"
+#include "util/wavefront.h"
+
+#ifndef CUDA_ENABLED
+
+struct BenchmarkScene
+{
+
+    const char* name;
+    Hitable* (*create)(const BVHBuildParams& params);
+
+};
+
+struct BenchmarkBuilder
+{
+
+    const char* name;
+    BVHBuildParams params;
+
+};
+
+static const BenchmarkScene scenes[] =
+{
+    { "simpleScene",        simpleScene },
+    { "simpleScene2",       simpleScene2 },
+    { "randomScene",        randomScene },
+    { "randomSceneTexture", randomSceneTexture },
+    { "randomSceneMoving",  randomSceneWithMovingSpheres },
+    { "twoPerlinSpheres",   twoPerlinSpheres },
+    { "instancedScene",     instancedScene },
+    { "meshScene",          meshScene },
+    { "surfaceTexture",     [](const BVHBuildParams&) { return surfaceTexture(); } }
+};
+
+static float sahCost(Hitable* world)
+{
+
+    if (BVHNode* node = dynamic_cast<BVHNode*>(world))
+        return node->sahCost();
+    if (PackedBVH* packed = dynamic_cast<PackedBVH*>(world))
+        return packed->sahCost();
+    if (LinearBVH* linear = dynamic_cast<LinearBVH*>(world))
+        return linear->sahCost();
+    if (WideBVH<4>* wide4 = dynamic_cast<WideBVH<4>*>(world))
+        return wide4->sahCost();
+    if (WideBVH<8>* wide8 = dynamic_cast<WideBVH<8>*>(world))
+        return wide8->sahCost();
+    if (MotionBVH* motion = dynamic_cast<MotionBVH*>(world))
+        return motion->sahCost();
+    if (CompressedBVH<uint8_t>* compressed8 = dynamic_cast<CompressedBVH<uint8_t>*>(world))
+        return compressed8->sahCost();
+    if (CompressedBVH<uint16_t>* compressed16 = dynamic_cast<CompressedBVH<uint16_t>*>(world))
+        return compressed16->sahCost();
+
+    return 1.0f;
+
+}
+
+// BVHNode doesn't delete its children, since its leaves are the primitives.
+static void deleteBVHNodes(BVHNode* node)
+{
+
+    BVHNode* left = dynamic_cast<BVHNode*>(node->left);
+    BVHNode* right = dynamic_cast<BVHNode*>(node->right);
+    if (left)
+        deleteBVHNodes(left);
+    if (right && right != left)
+        deleteBVHNodes(right);
+    delete node;
+
+}
+
+// Clears the type tags of the BVH, so that it calls every child and
+// primitive through the vtable again.
+static void forceVirtualDispatch(Hitable* world)
+{
+
+    if (LinearBVH* bvh = dynamic_cast<LinearBVH*>(world))
+    {
+        for (auto& node : bvh->nodes)
+            node.leafType = HITABLE_VIRTUAL;
+    }
+    else if (BVHNode* node = dynamic_cast<BVHNode*>(world))
+    {
+        node->leftType = node->rightType = HITABLE_VIRTUAL;
+        forceVirtualDispatch(node->left);
+        if (node->right != node->left)
+            forceVirtualDispatch(node->right);
+    }
+
+}
+
+// Bytes taken by the acceleration structure, 0 if world is none of them
+// (like the instanced scene, which nests several).
+static size_t acceleratorMemory(Hitable* world)
+{
+
+    if (BVHNode* node = dynamic_cast<BVHNode*>(world))
+        return node->memoryBytes();
+    if (PackedBVH* packed = dynamic_cast<PackedBVH*>(world))
+        return packed->memoryBytes();
+    if (LinearBVH* linear = dynamic_cast<LinearBVH*>(world))
+        return linear->memoryBytes();
+    if (WideBVH<4>* wide4 = dynamic_cast<WideBVH<4>*>(world))
+        return wide4->memoryBytes();
+    if (WideBVH<8>* wide8 = dynamic_cast<WideBVH<8>*>(world))
+        return wide8->memoryBytes();
+    if (MotionBVH* motion = dynamic_cast<MotionBVH*>(world))
+        return motion->memoryBytes();
+    if (CompressedBVH<uint8_t>* compressed8 = dynamic_cast<CompressedBVH<uint8_t>*>(world))
+        return compressed8->memoryBytes();
+    if (CompressedBVH<uint16_t>* compressed16 = dynamic_cast<CompressedBVH<uint16_t>*>(world))
+        return compressed16->memoryBytes();
+    if (UniformGrid* grid = dynamic_cast<UniformGrid*>(world))
+        return grid->memoryBytes();
+    if (KdTree* kdTree = dynamic_cast<KdTree*>(world))
+        return kdTree->memoryBytes();
+
+    return 0;
+
+}
+
+TraceResult traceBenchmark(Hitable* world, int width, int height, int samples,
+                           RenderMode mode, const MaterialTable* materials, bool packets)
+{
+
+    Camera cam(lookFrom, lookAt, vup, 20.0f, float(width)/float(height),
+               distToFocus, aperture);
+    Renderer renderer(false, false, false, mode);
+    renderer.materials = materials;
+    RayCounter counter(world);
+    bvhNodeVisits.reset();
+    bvhNodeCache.reset();
+    sphereHitCandidates.reset();
+    sphereUVEvaluations.reset();
+    packetNodeVisits.reset();
+    packetActiveLanes.reset();
+    PerfCounter cacheMisses(PerfCounter::CACHE_MISSES);
+    cacheMisses.start();
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (packets)
+    {
+        #pragma omp parallel for collapse(2) schedule(dynamic, 4)
+        for (int j = 0; j < height; j += packetTileHeight)
+        {
+            for (int i = 0; i < width; i += packetTileWidth)
+            {
+                for (int s = 0; s < samples; s++)
+                {
+                    RayPacket packet;
+                    RandomGenerator rngs[rayPacketSize];
+                    for (int k = 0; k < rayPacketSize; k++)
+                    {
+                        int x = i + k % packetTileWidth;
+                        int y = j + k / packetTileWidth;
+                        if (x >= width || y >= height)
+                            continue;
+                        rngs[k] = RandomGenerator(s, y*width + x);
+                        float u = float(x + rngs[k].get1f()) / float(width);
+                        float v = float(y + rngs[k].get1f()) / float(height);
+                        packet.set(k, cam.getRay(rngs[k], u, v));
+                    }
+                    Vec3 colors[rayPacketSize];
+                    renderer.shadePacket(rngs, packet, &counter, colors);
+                }
+            }
+        }
+    }
+    else
+    {
+        #pragma omp parallel for collapse(2) schedule(dynamic, 16)
+        for (int j = 0; j < height; j++)
+        {
+            for (int i = 0; i < width; i++)
+            {
+                int pixelIndex = j*width + i;
+                for (int s = 0; s < samples; s++)
+                {
+                    RandomGenerator rng(s, pixelIndex);
+                    float u = float(i + rng.get1f()) / float(width);
+                    float v = float(j + rng.get1f()) / float(height);
+                    Ray r = cam.getRay(rng, u, v);
+                    renderer.shade(rng, r, &counter);
+                }
+            }
+        }
+    }
+
+    auto finish = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = finish - start;
+    cacheMisses.stop();
+
+    TraceResult result;
+    result.rays = counter.total();
+    result.nodeVisits = bvhNodeVisits.total();
+    result.simulatedMisses = bvhNodeCache.misses();
+    result.cacheMisses = cacheMisses.available() ? cacheMisses.value() : -1;
+    result.sphereHitCandidates = sphereHitCandidates.total();
+    result.sphereUVEvaluations = sphereUVEvaluations.total();
+    result.packetNodeVisits = packetNodeVisits.total();
+    result.packetActiveLanes = packetActiveLanes.total();
+    result.seconds = elapsed.count();
+    return result;
+
+}
+
+void benchmarkBVH(std::ostream& out)
+{
+
+    const BenchmarkBuilder builders[] =
+    {
+        { "median", BVHBuildParams(MEDIAN_SPLIT, BVH_POINTER_TREE) },
+        { "sah",    BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE) },
+        { "linear", BVHBuildParams(SAH_BINNED, BVH_LINEAR) },
+        { "batch",  BVHBuildParams(SAH_BINNED, BVH_BATCHED) },
+        { "wide4",  BVHBuildParams(SAH_BINNED, BVH_WIDE4) },
+        { "wide8",  BVHBuildParams(SAH_BINNED, BVH_WIDE8) },
+        { "lbvh",   BVHBuildParams(MORTON_LBVH, BVH_LINEAR) },
+        { "lbvh63", BVHBuildParams(MORTON_LBVH, BVH_LINEAR, 16, 4, 1.0f, 1.0f, true, 63) },
+        { "lbvh-tl", BVHBuildParams(MORTON_LBVH, BVH_LINEAR, 16, 4, 1.0f, 1.0f, true, 30, true) },
+        { "motion", BVHBuildParams(SAH_BINNED, BVH_MOTION) },
+        { "quant16", BVHBuildParams(SAH_BINNED, BVH_COMPRESSED16) },
+        { "quant8", BVHBuildParams(SAH_BINNED, BVH_COMPRESSED8) }
+    };
+
+    out << std::left << std::setw(20) << "scene"
+        << std::setw(10) << "builder"
+        << std::right << std::setw(12) << "build ms"
+        << std::setw(12) << "trace ms"
+        << std::setw(12) << "SAH cost"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(10) << "speedup" << "\n";
+
+    for (const auto& scene : scenes)
+    {
+        double baseline = 0.0;
+        for (const auto& builder : builders)
+        {
+            // Every world lives in an arena that is dropped after its trace.
+            std::unique_ptr<SceneArena> arena(new SceneArena());
+            auto start = std::chrono::high_resolution_clock::now();
+            Hitable* world;
+            {
+                SceneArena::Scope scope(arena.get());
+                world = scene.create(builder.params);
+            }
+            auto finish = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double, std::milli> buildTime = finish - start;
+
+            TraceResult result = traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs);
+            if (baseline == 0.0)
+                baseline = result.raysPerSecond();
+
+            out << std::left << std::setw(20) << scene.name
+                << std::setw(10) << builder.name
+                << std::right << std::fixed << std::setprecision(2)
+                << std::setw(12) << buildTime.count()
+                << std::setw(12) << result.seconds * 1000.0
+                << std::setw(12) << sahCost(world)
+                << std::setw(12) << result.raysPerSecond() / 1.0e6
+                << std::setw(10) << result.raysPerSecond() / baseline << "\n";
+        }
+    }
+
+}
+
+struct NamedBenchmark
+{
+    const char* name;
+    void (*run)(std::ostream& out);
+};
+
+static const NamedBenchmark namedBenchmarks[] =
+{
+    { "bvh",            benchmarkBVH },
+    { "traversal",      benchmarkTraversalOrder },
+    { "scaling",        benchmarkBuildScaling },
+    { "buildvstrace",   benchmarkBuildVsTrace },
+    { "refit",          benchmarkRefit },
+    { "motionblur",     benchmarkMotionBlur },
+    { "accelerators",   benchmarkAccelerators },
+    { "compressed",     benchmarkCompressedBVH },
+    { "nodeorder",      benchmarkNodeOrder },
+    { "ao",             benchmarkAmbientOcclusion },
+    { "spherebatch",    benchmarkSphereBatch },
+    { "mesh",           benchmarkTriangleMesh },
+    { "scenecache",     benchmarkSceneCache },
+    { "dispatch",       benchmarkDispatch },
+    { "deferred",       benchmarkDeferredHits },
+    { "materials",      benchmarkMaterials },
+    { "vec4",           benchmarkVec4 },
+    { "packets",        benchmarkPackets },
+    { "wavefront",      benchmarkWavefront },
+    { "reorder",        benchmarkReorder },
+    { "arena",          benchmarkSceneArena },
+    { "tiles",          benchmarkTileScheduler }
+};
+
+bool benchmarkByName(const std::string& name, std::ostream& out)
+{
+
+    bool found = false;
+    for (const auto& benchmark : namedBenchmarks)
+    {
+        if (name != "all" && name != benchmark.name)
+            continue;
+        if (found)
+            out << "\n";
+        benchmark.run(out);
+        found = true;
+    }
+
+    if (!found)
+    {
+        std::cerr << "Unknown benchmark " << name << ", expected all";
+        for (const auto& benchmark : namedBenchmarks)
+            std::cerr << ", " << benchmark.name;
+        std::cerr << std::endl;
+    }
+
+    return found;
+
+}
+
+void benchmarkTraversalOrder(std::ostream& out)
+{
+
+    const BenchmarkBuilder builders[] =
+    {
+        { "tree",           BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE, 16, 4, 1.0f, 1.0f, false) },
+        { "tree-ordered",   BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE, 16, 4, 1.0f, 1.0f, true) },
+        { "linear",         BVHBuildParams(SAH_BINNED, BVH_LINEAR, 16, 4, 1.0f, 1.0f, false) },
+        { "linear-ordered", BVHBuildParams(SAH_BINNED, BVH_LINEAR, 16, 4, 1.0f, 1.0f, true) }
+    };
+
+    out << std::left << std::setw(20) << "randomScene"
+        << std::right << std::setw(12) << "Mrays/s"
+        << std::setw(14) << "visits/ray" << "\n";
+
+    for (const auto& builder : builders)
+    {
+        std::unique_ptr<SceneArena> arena(new SceneArena());
+        Hitable* world;
+        {
+            SceneArena::Scope scope(arena.get());
+            world = randomScene(builder.params);
+        }
+        TraceResult result = traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs);
+
+        out << std::left << std::setw(20) << builder.name
+            << std::right << std::fixed << std::setprecision(2)
+            << std::setw(12) << result.raysPerSecond() / 1.0e6;
+        #ifdef STATS_ENABLED
+            out << std::setw(14) << double(result.nodeVisits) / double(result.rays);
+        #else
+            out << std::setw(14) << "n/a";
+        #endif // STATS_ENABLED
+        out << "\n";
+    }
+
+}
+
+void benchmarkBuildScaling(std::ostream& out)
+{
+
+    const int sizes[] = { 10000, 1000000, 10000000 };
+
+    int maxThreads = omp_get_max_threads();
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    out << std::left << std::setw(12) << "primitives"
+        << std::right << std::setw(8) << "threads"
+        << std::setw(10) << "setup"
+        << std::setw(10) << "top"
+        << std::setw(10) << "subtrees"
+        << std::setw(10) << "flatten"
+        << std::setw(10) << "total ms"
+        << std::setw(10) << "speedup" << "\n";
+
+    for (int n : sizes)
+    {
+        Hitable** list = sphereField(n);
+
+        double baseline = 0.0;
+        for (int threads : threadCounts)
+        {
+            omp_set_num_threads(threads);
+            LinearBVH* bvh = new LinearBVH(list, n, 0.0f, 1.0f, BVHBuildParams());
+            BVHBuildStats stats = bvh->buildStats;
+            delete bvh;
+
+            if (baseline == 0.0)
+                baseline = stats.totalMs;
+
+            out << std::left << std::setw(12) << n
+                << std::right << std::setw(8) << threads
+                << std::fixed << std::setprecision(1)
+                << std::setw(10) << stats.setupMs
+                << std::setw(10) << stats.topMs
+                << std::setw(10) << stats.subtreeMs
+                << std::setw(10) << stats.flattenMs
+                << std::setw(10) << stats.totalMs
+                << std::setprecision(2)
+                << std::setw(10) << baseline / stats.totalMs << "\n";
+        }
+        omp_set_num_threads(maxThreads);
+
+        for (int i = 0; i < n; i++)
+            delete list[i];
+        delete[] list;
+    }
+
+}
+
+void benchmarkBuildVsTrace(std::ostream& out)
+{
+
+    const int sizes[] = { 100000, 1000000 };
+
+    const BenchmarkBuilder builders[] =
+    {
+        { "sah",     BVHBuildParams(SAH_BINNED, BVH_LINEAR) },
+        { "lbvh",    BVHBuildParams(MORTON_LBVH, BVH_LINEAR) },
+        { "lbvh-tl", BVHBuildParams(MORTON_LBVH, BVH_LINEAR, 16, 4, 1.0f, 1.0f, true, 30, true) }
+    };
+
+    out << std::left << std::setw(12) << "primitives"
+        << std::setw(10) << "builder"
+        << std::right << std::setw(12) << "build ms"
+        << std::setw(12) << "trace ms"
+        << std::setw(12) << "frame ms"
+        << std::setw(12) << "SAH cost" << "\n";
+
+    for (int n : sizes)
+    {
+        Hitable** list = sphereField(n);
+
+        for (const auto& builder : builders)
+        {
+            LinearBVH* bvh = new LinearBVH(list, n, 0.0f, 1.0f, builder.params);
+            double buildMs = bvh->buildStats.totalMs;
+            TraceResult result = traceBenchmark(bvh, benchmarkNx, benchmarkNy, 1);
+
+            out << std::left << std::setw(12) << n
+                << std::setw(10) << builder.name
+                << std::right << std::fixed << std::setprecision(1)
+                << std::setw(12) << buildMs
+                << std::setw(12) << result.seconds * 1000.0
+                << std::setw(12) << buildMs + result.seconds * 1000.0
+                << std::setprecision(2)
+                << std::setw(12) << bvh->sahCost() << "\n";
+
+            delete bvh;
+        }
+
+        for (int i = 0; i < n; i++)
+            delete list[i];
+        delete[] list;
+    }
+
+}
+
+// Bytes the heap has handed out, -1 where the allocator can't tell.
+static long long heapBytes()
+{
+
+    #if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+        struct mallinfo2 info = mallinfo2();
+        return static_cast<long long>(info.uordblks + info.hblkhd);
+    #else
+        return -1;
+    #endif
+
+}
+
+void benchmarkRefit(std::ostream& out)
+{
+
+    const int n = 100000;
+    const int frames = 16;
+
+    std::vector<KeyframeTrack> tracks;
+    Hitable** list = animatedSpheres(n, tracks);
+    setKeyframe(list, tracks, 0.0f);
+    DynamicAccelerator dynamic(list, n, 0.0f, 1.0f);
+
+    out << std::left << std::setw(8) << "frame"
+        << std::right << std::setw(12) << "rebuild ms"
+        << std::setw(12) << "trace ms"
+        << std::setw(12) << "update ms"
+        << std::setw(12) << "trace ms"
+        << std::setw(12) << "SAH growth"
+        << std::setw(10) << "rebuilt" << "\n";
+
+    double rebuildTotal = 0.0;
+    double updateTotal = 0.0;
+    for (int frame = 1; frame <= frames; frame++)
+    {
+        setKeyframe(list, tracks, float(frame));
+
+        LinearBVH* rebuilt = new LinearBVH(list, n, 0.0f, 1.0f);
+        double rebuildMs = rebuilt->buildStats.totalMs;
+        TraceResult rebuiltTrace = traceBenchmark(rebuilt, benchmarkNx, benchmarkNy, 1);
+        delete rebuilt;
+
+        bool rebuiltDynamic = dynamic.update(0.0f, 1.0f);
+        float growth = dynamic.sahGrowth();
+        TraceResult dynamicTrace = traceBenchmark(&dynamic, benchmarkNx, benchmarkNy, 1);
+
+        rebuildTotal += rebuildMs;
+        updateTotal += dynamic.lastUpdateMs;
+
+        out << std::left << std::setw(8) << frame
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << rebuildMs
+            << std::setw(12) << rebuiltTrace.seconds * 1000.0
+            << std::setw(12) << dynamic.lastUpdateMs
+            << std::setw(12) << dynamicTrace.seconds * 1000.0
+            << std::setprecision(2)
+            << std::setw(12) << growth
+            << std::setw(10) << (rebuiltDynamic ? "yes" : "no") << "\n";
+    }
+
+    out << std::fixed << std::setprecision(1)
+        << "total rebuild ms " << rebuildTotal
+        << ", total update ms " << updateTotal
+        << ", builds " << dynamic.buildCount << "\n";
+
+    // A rebuild has to free the whole previous tree, so rebuilding on every
+    // update must not grow the heap.
+    struct RebuildLayout
+    {
+        const char* name;
+        BVHBuildParams params;
+    };
+    const RebuildLayout rebuildLayouts[] =
+    {
+        { "tree",   BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE) },
+        { "packed", BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE, 16, 4, 1.0f, 1.0f, true, 30, false,
+                                   4.0f, false, 0.5f, BVH_ORDER_DEPTH_FIRST) },
+        { "linear", BVHBuildParams(SAH_BINNED, BVH_LINEAR) }
+    };
+    const int rebuilds = 4;
+    for (const auto& layout : rebuildLayouts)
+    {
+        DynamicAccelerator alwaysRebuilt(list, n, 0.0f, 1.0f, layout.params, -1.0f);
+        alwaysRebuilt.update(0.0f, 1.0f);
+        long long heapBefore = heapBytes();
+        for (int i = 0; i < rebuilds; i++)
+            alwaysRebuilt.update(0.0f, 1.0f);
+        long long heapAfter = heapBytes();
+
+        out << std::left << std::setw(8) << layout.name << "heap growth over " << rebuilds << " rebuilds ";
+        if (heapBefore < 0)
+            out << "-\n";
+        else
+            out << std::fixed << std::setprecision(1) << (heapAfter - heapBefore) / 1024.0 << " KB\n";
+    }
+
+    for (int i = 0; i < n; i++)
+        delete list[i];
+    delete[] list;
+
+}
+
+void benchmarkMotionBlur(std::ostream& out)
+{
+
+    const int n = 100000;
+    const float displacements[] = { 0.0f, 0.5f, 2.0f, 8.0f };
+
+    out << std::left << std::setw(14) << "displacement"
+        << std::setw(10) << "builder"
+        << std::right << std::setw(12) << "build ms"
+        << std::setw(12) << "trace ms"
+        << std::setw(14) << "visits/ray"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(10) << "speedup" << "\n";
+
+    for (float displacement : displacements)
+    {
+        Hitable** list = movingSphereField(n, displacement);
+
+        const BenchmarkBuilder builders[] =
+        {
+            { "linear", BVHBuildParams(SAH_BINNED, BVH_LINEAR) },
+            { "motion", BVHBuildParams(SAH_BINNED, BVH_MOTION) }
+        };
+
+        double baseline = 0.0;
+        for (const auto& builder : builders)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            Hitable* bvh = buildAccelerator(list, n, 0.0f, 1.0f, builder.params);
+            auto finish = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double, std::milli> buildTime = finish - start;
+
+            TraceResult result = traceBenchmark(bvh, benchmarkNx, benchmarkNy, 1);
+            if (baseline == 0.0)
+                baseline = result.raysPerSecond();
+
+            out << std::left << std::fixed << std::setprecision(2)
+                << std::setw(14) << displacement
+                << std::setw(10) << builder.name
+                << std::right << std::setprecision(1)
+                << std::setw(12) << buildTime.count()
+                << std::setw(12) << result.seconds * 1000.0
+                << std::setw(14) << (result.rays > 0 ? double(result.nodeVisits) / result.rays : 0.0)
+                << std::setprecision(2)
+                << std::setw(12) << result.raysPerSecond() / 1.0e6
+                << std::setw(10) << result.raysPerSecond() / baseline << "\n";
+
+            delete bvh;
+        }
+
+        for (int i = 0; i < n; i++)
+            delete list[i];
+        delete[] list;
+    }
+
+}
+
+void benchmarkAccelerators(std::ostream& out)
+{
+
+    const BenchmarkBuilder builders[] =
+    {
+        { "bvh",      BVHBuildParams(SAH_BINNED, BVH_LINEAR) },
+        { "grid",     BVHBuildParams(SAH_BINNED, UNIFORM_GRID) },
+        { "hashgrid", BVHBuildParams(SAH_BINNED, UNIFORM_GRID, 16, 4, 1.0f, 1.0f, true, 30, false, 4.0f, true) },
+        { "kdtree",   BVHBuildParams(SAH_BINNED, KD_TREE) }
+    };
+
+    out << std::left << std::setw(20) << "scene"
+        << std::setw(10) << "accel"
+        << std::right << std::setw(12) << "build ms"
+        << std::setw(12) << "memory KB"
+        << std::setw(12) << "trace ms"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(10) << "speedup" << "\n";
+
+    for (const auto& scene : scenes)
+    {
+        double baseline = 0.0;
+        for (const auto& builder : builders)
+        {
+            std::unique_ptr<SceneArena> arena(new SceneArena());
+            auto start = std::chrono::high_resolution_clock::now();
+            Hitable* world;
+            {
+                SceneArena::Scope scope(arena.get());
+                world = scene.create(builder.params);
+            }
+            auto finish = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double, std::milli> buildTime = finish - start;
+
+            TraceResult result = traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs);
+            if (baseline == 0.0)
+                baseline = result.raysPerSecond();
+
+            size_t memory = acceleratorMemory(world);
+            out << std::left << std::setw(20) << scene.name
+                << std::setw(10) << builder.name
+                << std::right << std::fixed << std::setprecision(2)
+                << std::setw(12) << buildTime.count();
+            if (memory > 0)
+                out << std::setw(12) << memory / 1024.0;
+            else
+                out << std::setw(12) << "-";
+            out << std::setw(12) << result.seconds * 1000.0
+                << std::setw(12) << result.raysPerSecond() / 1.0e6
+                << std::setw(10) << result.raysPerSecond() / baseline << "\n";
+        }
+    }
+
+}
+
+void benchmarkCompressedBVH(std::ostream& out)
+{
+
+    const int n = 1000000;
+
+    struct CompressedBuilder
+    {
+        const char* name;
+        BVHBuildParams params;
+        size_t nodeBytes;
+    };
+
+    const CompressedBuilder builders[] =
+    {
+        { "tree",    BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE), sizeof(BVHNode) },
+        { "linear",  BVHBuildParams(SAH_BINNED, BVH_LINEAR), sizeof(LinearBVHNode) },
+        { "quant16", BVHBuildParams(SAH_BINNED, BVH_COMPRESSED16), sizeof(CompressedBVHNode<uint16_t>) },
+        { "quant8",  BVHBuildParams(SAH_BINNED, BVH_COMPRESSED8), sizeof(CompressedBVHNode<uint8_t>) }
+    };
+
+    out << std::left << std::setw(10) << "layout"
+        << std::right << std::setw(10) << "node B"
+        << std::setw(12) << "memory MB"
+        << std::setw(10) << "B/prim"
+        << std::setw(12) << "trace ms"
+        << std::setw(14) << "visits/ray"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(10) << "speedup" << "\n";
+
+    Hitable** list = sphereField(n);
+
+    double baseline = 0.0;
+    for (const auto& builder : builders)
+    {
+        Hitable* bvh = buildAccelerator(list, n, 0.0f, 1.0f, builder.params);
+        size_t memory = acceleratorMemory(bvh);
+        TraceResult result = traceBenchmark(bvh, benchmarkNx, benchmarkNy, 1);
+        if (baseline == 0.0)
+            baseline = result.raysPerSecond();
+
+        out << std::left << std::setw(10) << builder.name
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(10) << builder.nodeBytes
+            << std::setw(12) << memory / (1024.0 * 1024.0)
+            << std::setw(10) << double(memory) / n
+            << std::setw(12) << result.seconds * 1000.0
+            << std::setw(14) << (result.rays > 0 ? double(result.nodeVisits) / result.rays : 0.0)
+            << std::setprecision(2)
+            << std::setw(12) << result.raysPerSecond() / 1.0e6
+            << std::setw(10) << result.raysPerSecond() / baseline << "\n";
+
+        // The pointer tree owns its nodes but not the primitives.
+        if (BVHNode* node = dynamic_cast<BVHNode*>(bvh))
+            deleteBVHNodes(node);
+        else
+            delete bvh;
+    }
+
+    for (int i = 0; i < n; i++)
+        delete list[i];
+    delete[] list;
+
+}
+
+void benchmarkNodeOrder(std::ostream& out)
+{
+
+    const int n = 1000000;
+
+    const BenchmarkBuilder builders[] =
+    {
+        { "allocation",  BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE) },
+        { "depth-first", BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE, 16, 4, 1.0f, 1.0f, true, 30, false,
+                                        4.0f, false, 0.5f, BVH_ORDER_DEPTH_FIRST) },
+        { "treelet",     BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE, 16, 4, 1.0f, 1.0f, true, 30, false,
+                                        4.0f, false, 0.5f, BVH_ORDER_TREELET) },
+        { "veb",         BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE, 16, 4, 1.0f, 1.0f, true, 30, false,
+                                        4.0f, false, 0.5f, BVH_ORDER_VAN_EMDE_BOAS) }
+    };
+
+    out << std::left << std::setw(14) << "order"
+        << std::right << std::setw(12) << "build ms"
+        << std::setw(12) << "trace ms"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(10) << "speedup"
+        << std::setw(16) << "sim miss/ray"
+        << std::setw(16) << "LLC miss/ray" << "\n";
+
+    Hitable** list = sphereField(n);
+
+    double baseline = 0.0;
+    for (const auto& builder : builders)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        Hitable* bvh = buildAccelerator(list, n, 0.0f, 1.0f, builder.params);
+        auto finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> buildTime = finish - start;
+
+        TraceResult result = traceBenchmark(bvh, benchmarkNx, benchmarkNy, 1);
+        if (baseline == 0.0)
+            baseline = result.raysPerSecond();
+
+        out << std::left << std::setw(14) << builder.name
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << buildTime.count()
+            << std::setw(12) << result.seconds * 1000.0
+            << std::setprecision(2)
+            << std::setw(12) << result.raysPerSecond() / 1.0e6
+            << std::setw(10) << result.raysPerSecond() / baseline
+            << std::setw(16) << (result.rays > 0 ? double(result.simulatedMisses) / result.rays : 0.0);
+        if (result.cacheMisses >= 0)
+            out << std::setw(16) << double(result.cacheMisses) / result.rays << "\n";
+        else
+            out << std::setw(16) << "n/a" << "\n";
+
+        if (BVHNode* node = dynamic_cast<BVHNode*>(bvh))
+            deleteBVHNodes(node);
+        else
+            delete bvh;
+    }
+
+    for (int i = 0; i < n; i++)
+        delete list[i];
+    delete[] list;
+
+}
+
+void benchmarkAmbientOcclusion(std::ostream& out)
+{
+
+    const BVHBuildParams params(SAH_BINNED, BVH_LINEAR);
+
+    out << std::left << std::setw(20) << "scene"
+        << std::right << std::setw(12) << "path ms"
+        << std::setw(12) << "AO ms"
+        << std::setw(12) << "path Mray/s"
+        << std::setw(12) << "AO Mray/s"
+        << std::setw(10) << "speedup" << "\n";
+
+    for (const auto& scene : scenes)
+    {
+        std::unique_ptr<SceneArena> arena(new SceneArena());
+        Hitable* world;
+        {
+            SceneArena::Scope scope(arena.get());
+            world = scene.create(params);
+        }
+
+        TraceResult path = traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs);
+        TraceResult ao = traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs, AMBIENT_OCCLUSION);
+
+        out << std::left << std::setw(20) << scene.name
+            << std::right << std::fixed << std::setprecision(2)
+            << std::setw(12) << path.seconds * 1000.0
+            << std::setw(12) << ao.seconds * 1000.0
+            << std::setw(12) << path.raysPerSecond() / 1.0e6
+            << std::setw(12) << ao.raysPerSecond() / 1.0e6
+            << std::setw(10) << path.seconds / ao.seconds << "\n";
+    }
+
+    // Short rays from random points of the scene, the case of shadow and AO
+    // rays. occluded() may stop at any primitive, hit() has to find the
+    // closest one and fill the record.
+    const int rayCount = 1 << 20;
+    const BenchmarkBuilder builders[] =
+    {
+        { "tree",   BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE) },
+        { "linear", BVHBuildParams(SAH_BINNED, BVH_LINEAR) }
+    };
+
+    out << "\n" << std::left << std::setw(20) << "randomScene"
+        << std::setw(10) << "layout"
+        << std::right << std::setw(12) << "hit ms"
+        << std::setw(12) << "occluded ms"
+        << std::setw(10) << "speedup" << "\n";
+
+    for (const auto& builder : builders)
+    {
+        std::unique_ptr<SceneArena> arena(new SceneArena());
+        Hitable* world;
+        {
+            SceneArena::Scope scope(arena.get());
+            world = randomScene(builder.params);
+        }
+
+        // Origins in the slab above the ground that holds the small spheres.
+        std::vector<Ray> rays(rayCount);
+        for (int i = 0; i < rayCount; i++)
+        {
+            RandomGenerator rng(i, 0);
+            Vec3 origin(22.0f*rng.get1f() - 11.0f, 2.0f*rng.get1f(), 22.0f*rng.get1f() - 11.0f);
+            rays[i] = Ray(origin, unitVector(rng.randomInUnitSphere()));
+        }
+
+        const float tMax = 2.0f;
+        int hits = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        #pragma omp parallel for reduction(+:hits)
+        for (int i = 0; i < rayCount; i++)
+        {
+            HitRecord rec;
+            hits += world->hit(rays[i], 0.001f, tMax, rec) ? 1 : 0;
+        }
+        auto finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> hitTime = finish - start;
+
+        int occluded = 0;
+        start = std::chrono::high_resolution_clock::now();
+        #pragma omp parallel for reduction(+:occluded)
+        for (int i = 0; i < rayCount; i++)
+            occluded += world->occluded(rays[i], 0.001f, tMax) ? 1 : 0;
+        finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> occludedTime = finish - start;
+
+        out << std::left << std::setw(20) << ""
+            << std::setw(10) << builder.name
+            << std::right << std::fixed << std::setprecision(2)
+            << std::setw(12) << hitTime.count()
+            << std::setw(12) << occludedTime.count()
+            << std::setw(10) << hitTime.count() / occludedTime.count();
+        if (hits != occluded)
+            out << "  mismatch: " << hits << " hits, " << occluded << " occluded";
+        out << "\n";
+    }
+
+}
+
+void benchmarkSphereBatch(std::ostream& out)
+{
+
+    const int sizes[] = { 10000, 100000, 1000000 };
+
+    out << std::left << std::setw(10) << "spheres"
+        << std::setw(10) << "layout"
+        << std::right << std::setw(12) << "build ms"
+        << std::setw(12) << "memory MB"
+        << std::setw(12) << "leaves"
+        << std::setw(12) << "fill"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(10) << "speedup" << "\n";
+
+    for (int n : sizes)
+    {
+        const BenchmarkBuilder builders[] =
+        {
+            { "linear", BVHBuildParams(SAH_BINNED, BVH_LINEAR) },
+            { "batch",  BVHBuildParams(SAH_BINNED, BVH_BATCHED) }
+        };
+
+        Hitable** list = sphereField(n);
+
+        double baseline = 0.0;
+        for (const auto& builder : builders)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            LinearBVH* bvh = static_cast<LinearBVH*>(buildAccelerator(list, n, 0.0f, 1.0f, builder.params));
+            auto finish = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double, std::milli> buildTime = finish - start;
+
+            int leaves = 0;
+            for (const auto& node : bvh->nodes)
+                if (node.primitiveCount > 0)
+                    leaves++;
+
+            TraceResult result = traceBenchmark(bvh, benchmarkNx, benchmarkNy, 1);
+            if (baseline == 0.0)
+                baseline = result.raysPerSecond();
+
+            out << std::left << std::setw(10) << n
+                << std::setw(10) << builder.name
+                << std::right << std::fixed << std::setprecision(1)
+                << std::setw(12) << buildTime.count()
+                << std::setw(12) << bvh->memoryBytes() / (1024.0 * 1024.0)
+                << std::setw(12) << leaves
+                << std::setprecision(2)
+                << std::setw(12) << double(n) / leaves
+                << std::setw(12) << result.raysPerSecond() / 1.0e6
+                << std::setw(10) << result.raysPerSecond() / baseline << "\n";
+
+            delete bvh;
+        }
+
+        for (int i = 0; i < n; i++)
+            delete list[i];
+        delete[] list;
+    }
+
+}
+
+// Writes the mesh as OBJ with 1-based v/vt/vn indices. Returns the file size.
+static long writeOBJ(const char* fileName, const TriangleMesh& mesh)
+{
+
+    FILE* file = fopen(fileName, "w");
+    if (!file)
+        return 0;
+
+    for (const Vec3& p : mesh.positions)
+        fprintf(file, "v %f %f %f\n", p.x(), p.y(), p.z());
+    for (size_t i = 0; i < mesh.uvs.size(); i += 2)
+        fprintf(file, "vt %f %f\n", mesh.uvs[i], mesh.uvs[i+1]);
+    for (const Vec3& n : mesh.normals)
+        fprintf(file, "vn %f %f %f\n", n.x(), n.y(), n.z());
+    for (size_t i = 0; i < mesh.corners.size(); i += 3)
+    {
+        const MeshCorner* c = &mesh.corners[i];
+        fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                c[0].position + 1, c[0].uv + 1, c[0].normal + 1,
+                c[1].position + 1, c[1].uv + 1, c[1].normal + 1,
+                c[2].position + 1, c[2].uv + 1, c[2].normal + 1);
+    }
+
+    long size = ftell(file);
+    fclose(file);
+    return size;
+
+}
+
+void benchmarkTriangleMesh(std::ostream& out)
+{
+
+    const char* fileName = "bvhBenchmarkMesh.obj";
+    Material* material = new Lambertian(new ConstantTexture(Vec3(0.5f, 0.5f, 0.5f)));
+
+    TriangleMesh* generated = sphereMesh(Vec3(0.0f, 0.0f, 0.0f), 2.0f, 512, 1024, material);
+    int triangleCount = generated->triangleCount();
+    long fileSize = writeOBJ(fileName, *generated);
+    delete generated;
+
+    out << "OBJ with " << triangleCount << " triangles, "
+        << std::fixed << std::setprecision(1) << fileSize / (1024.0 * 1024.0) << " MB\n";
+    out << std::left << std::setw(10) << "threads"
+        << std::right << std::setw(12) << "load ms"
+        << std::setw(12) << "MB/s"
+        << std::setw(10) << "speedup" << "\n";
+
+    TriangleMesh* mesh = nullptr;
+    double baseline = 0.0;
+    for (int threads = 1; ; threads = std::min(2 * threads, omp_get_max_threads()))
+    {
+        delete mesh;
+        auto start = std::chrono::high_resolution_clock::now();
+        mesh = loadOBJ(fileName, material, threads);
+        auto finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> loadTime = finish - start;
+        if (!mesh)
+            break;
+        if (baseline == 0.0)
+            baseline = loadTime.count();
+
+        out << std::left << std::setw(10) << threads
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << loadTime.count()
+            << std::setw(12) << fileSize / (1024.0 * 1024.0) / (loadTime.count() / 1000.0)
+            << std::setprecision(2)
+            << std::setw(10) << baseline / loadTime.count() << "\n";
+
+        if (threads == omp_get_max_threads())
+            break;
+    }
+    std::remove(fileName);
+
+    if (!mesh)
+        return;
+
+    const BenchmarkBuilder builders[] =
+    {
+        { "linear", BVHBuildParams(SAH_BINNED, BVH_LINEAR) },
+        { "batch",  BVHBuildParams(SAH_BINNED, BVH_BATCHED) }
+    };
+
+    out << "\n" << std::left << std::setw(10) << "layout"
+        << std::right << std::setw(12) << "build ms"
+        << std::setw(12) << "memory MB"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(10) << "speedup" << "\n";
+
+    Hitable** list = mesh->createTriangles();
+    int n = mesh->triangleCount();
+
+    baseline = 0.0;
+    for (const auto& builder : builders)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        LinearBVH* bvh = static_cast<LinearBVH*>(buildAccelerator(list, n, 0.0f, 1.0f, builder.params));
+        auto finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> buildTime = finish - start;
+
+        TraceResult result = traceBenchmark(bvh, benchmarkNx, benchmarkNy, benchmarkNs);
+        if (baseline == 0.0)
+            baseline = result.raysPerSecond();
+
+        out << std::left << std::setw(10) << builder.name
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << buildTime.count()
+            << std::setw(12) << (bvh->memoryBytes() + mesh->memoryBytes()) / (1024.0 * 1024.0)
+            << std::setprecision(2)
+            << std::setw(12) << result.raysPerSecond() / 1.0e6
+            << std::setw(10) << result.raysPerSecond() / baseline << "\n";
+
+        delete bvh;
+    }
+
+    delete[] list;
+    delete mesh;
+
+}
+
+void benchmarkSceneCache(std::ostream& out)
+{
+
+    const char* fileName = "bvhBenchmarkScene.cache";
+    Material* material = new Lambertian(new ConstantTexture(Vec3(0.5f, 0.5f, 0.5f)));
+
+    struct CacheScene
+    {
+
+        const char* name;
+        Hitable* (*create)(Material* material);
+
+    };
+
+    const CacheScene cacheScenes[] =
+    {
+        { "randomScene", [](Material*) {
+              return randomScene(BVHBuildParams(SAH_BINNED, BVH_LINEAR)); } },
+        { "spheres 1M",  [](Material*) {
+              return buildAccelerator(sphereField(1000000), 1000000, 0.0f, 1.0f,
+                                      BVHBuildParams(SAH_BINNED, BVH_LINEAR)); } },
+        { "mesh 1M",     [](Material* m) {
+              TriangleMesh* mesh = sphereMesh(Vec3(0.0f, 0.0f, 0.0f), 2.0f, 512, 1024, m);
+              int n = mesh->triangleCount();
+              Hitable** triangles = mesh->createTriangles();
+              Hitable** list = sceneNewArray<Hitable*>(n);
+              std::copy(triangles, triangles + n, list);
+              delete[] triangles;
+              return buildAccelerator(list, n, 0.0f, 1.0f, BVHBuildParams(SAH_BINNED, BVH_BATCHED)); } }
+    };
+
+    // The file is read back right after it was written, so the load times
+    // are with a warm page cache.
+    out << std::left << std::setw(14) << "scene"
+        << std::right << std::setw(12) << "build ms"
+        << std::setw(12) << "save ms"
+        << std::setw(12) << "file MB"
+        << std::setw(12) << "load ms"
+        << std::setw(10) << "speedup"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(12) << "cached" << "\n";
+
+    for (const auto& scene : cacheScenes)
+    {
+        std::unique_ptr<SceneArena> arena(new SceneArena());
+        auto start = std::chrono::high_resolution_clock::now();
+        Hitable* world;
+        {
+            SceneArena::Scope scope(arena.get());
+            world = scene.create(material);
+        }
+        auto built = std::chrono::high_resolution_clock::now();
+        bool saved = saveSceneCache(fileName, world);
+        auto finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> buildTime = built - start;
+        std::chrono::duration<double, std::milli> saveTime = finish - built;
+        if (!saved)
+            continue;
+
+        start = std::chrono::high_resolution_clock::now();
+        SceneCache* cache = loadSceneCache(fileName);
+        finish = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> loadTime = finish - start;
+        if (!cache)
+            continue;
+
+        TraceResult original = traceBenchmark(world, benchmarkNx, benchmarkNy, 1);
+        TraceResult cached = traceBenchmark(cache, benchmarkNx, benchmarkNy, 1);
+
+        out << std::left << std::setw(14) << scene.name
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << buildTime.count()
+            << std::setw(12) << saveTime.count()
+            << std::setw(12) << cache->fileBytes() / (1024.0 * 1024.0)
+            << std::setw(12) << loadTime.count()
+            << std::setw(10) << buildTime.count() / loadTime.count()
+            << std::setprecision(2)
+            << std::setw(12) << original.raysPerSecond() / 1.0e6
+            << std::setw(12) << cached.raysPerSecond() / 1.0e6 << "\n";
+
+        delete cache;
+    }
+    std::remove(fileName);
+
+}
+
+// Closest hit queries per second for a fixed ray set, without shading.
+static double hitRaysPerSecond(Hitable* world, const std::vector<Ray>& rays)
+{
+
+    int rayCount = static_cast<int>(rays.size());
+    int hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    #pragma omp parallel for reduction(+:hits)
+    for (int i = 0; i < rayCount; i++)
+    {
+        HitRecord rec;
+        hits += world->hit(rays[i], 0.001f, FLT_MAX, rec) ? 1 : 0;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    return rayCount / elapsed.count();
+
+}
+
+void benchmarkDispatch(std::ostream& out)
+{
+
+    const BenchmarkBuilder builders[] =
+    {
+        { "sah",    BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE) },
+        { "linear", BVHBuildParams(SAH_BINNED, BVH_LINEAR) },
+        { "batch",  BVHBuildParams(SAH_BINNED, BVH_BATCHED) }
+    };
+
+    const BenchmarkScene dispatchScenes[] =
+    {
+        { "randomScene",       randomScene },
+        { "randomSceneMoving", randomSceneWithMovingSpheres },
+        { "meshScene",         meshScene }
+    };
+
+    const int rayCount = 1 << 20;
+
+    // Path traced frames include the shading, the hit column only the
+    // closest hit queries of random rays through the scene.
+    out << std::left << std::setw(20) << "scene"
+        << std::setw(10) << "builder"
+        << std::right << std::setw(12) << "frame virt"
+        << std::setw(12) << "direct"
+        << std::setw(10) << "speedup"
+        << std::setw(12) << "hit virt"
+        << std::setw(12) << "direct"
+        << std::setw(10) << "speedup" << "\n";
+
+    for (const auto& scene : dispatchScenes)
+    {
+        for (const auto& builder : builders)
+        {
+            // Built twice with the same seed, so both trace the same tree.
+            std::unique_ptr<SceneArena> arena(new SceneArena());
+            Hitable* virtualWorld, *directWorld;
+            {
+                SceneArena::Scope scope(arena.get());
+                virtualWorld = scene.create(builder.params);
+                directWorld = scene.create(builder.params);
+            }
+            forceVirtualDispatch(virtualWorld);
+
+            AABB box;
+            directWorld->boundingBox(0.0f, 1.0f, box);
+            std::vector<Ray> rays(rayCount);
+            for (int i = 0; i < rayCount; i++)
+            {
+                RandomGenerator rng(i, 0);
+                Vec3 origin = box.min() + Vec3(rng.get1f(), rng.get1f(), rng.get1f()) * (box.max() - box.min());
+                rays[i] = Ray(origin, unitVector(rng.randomInUnitSphere()), rng.get1f());
+            }
+
+            TraceResult virtualResult = traceBenchmark(virtualWorld, benchmarkNx, benchmarkNy, benchmarkNs);
+            TraceResult directResult = traceBenchmark(directWorld, benchmarkNx, benchmarkNy, benchmarkNs);
+            // Best of three, alternating, the difference is small.
+            double virtualHits = 0.0, directHits = 0.0;
+            for (int k = 0; k < 3; k++)
+            {
+                virtualHits = std::max(virtualHits, hitRaysPerSecond(virtualWorld, rays));
+                directHits = std::max(directHits, hitRaysPerSecond(directWorld, rays));
+            }
+
+            out << std::left << std::setw(20) << scene.name
+                << std::setw(10) << builder.name
+                << std::right << std::fixed << std::setprecision(2)
+                << std::setw(12) << virtualResult.raysPerSecond() / 1.0e6
+                << std::setw(12) << directResult.raysPerSecond() / 1.0e6
+                << std::setw(10) << directResult.raysPerSecond() / virtualResult.raysPerSecond()
+                << std::setw(12) << virtualHits / 1.0e6
+                << std::setw(12) << directHits / 1.0e6
+                << std::setw(10) << directHits / virtualHits << "\n";
+        }
+    }
+
+}
+
+void benchmarkDeferredHits(std::ostream& out)
+{
+
+    const BenchmarkBuilder builders[] =
+    {
+        { "sah",            BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE) },
+        { "sah-unord.",     BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE, 16, 4, 1.0f, 1.0f, false) },
+        { "linear",         BVHBuildParams(SAH_BINNED, BVH_LINEAR) },
+        { "linear-unord.",  BVHBuildParams(SAH_BINNED, BVH_LINEAR, 16, 4, 1.0f, 1.0f, false) },
+        { "batch",          BVHBuildParams(SAH_BINNED, BVH_BATCHED) },
+        { "wide8",          BVHBuildParams(SAH_BINNED, BVH_WIDE8) },
+        { "grid",           BVHBuildParams(SAH_BINNED, UNIFORM_GRID) }
+    };
+
+    // Shading every candidate took one atan2 and one asin each, now only
+    // the closest hit of a ray is shaded.
+    out << std::left << std::setw(20) << "randomScene"
+        << std::right << std::setw(12) << "Mrays/s"
+        << std::setw(14) << "cand/ray"
+        << std::setw(14) << "uv/ray"
+        << std::setw(14) << "trig saved"
+        << std::setw(10) << "saved %" << "\n";
+
+    for (const auto& builder : builders)
+    {
+        std::unique_ptr<SceneArena> arena(new SceneArena());
+        Hitable* world;
+        {
+            SceneArena::Scope scope(arena.get());
+            world = randomScene(builder.params);
+        }
+        TraceResult result = traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs);
+
+        out << std::left << std::setw(20) << builder.name
+            << std::right << std::fixed << std::setprecision(2)
+            << std::setw(12) << result.raysPerSecond() / 1.0e6;
+        #ifdef STATS_ENABLED
+            long long saved = 2 * (result.sphereHitCandidates - result.sphereUVEvaluations);
+            out << std::setw(14) << double(result.sphereHitCandidates) / result.rays
+                << std::setw(14) << double(result.sphereUVEvaluations) / result.rays
+                << std::setw(14) << saved
+                << std::setw(10) << (result.sphereHitCandidates > 0 ?
+                                     50.0 * saved / result.sphereHitCandidates : 0.0);
+        #else
+            out << std::setw(14) << "n/a"
+                << std::setw(14) << "n/a"
+                << std::setw(14) << "n/a"
+                << std::setw(10) << "n/a";
+        #endif // STATS_ENABLED
+        out << "\n";
+    }
+
+}
+
+// Scatters hits [begin, end) of one material type with its kernel, returns a
+// sum of the results so the work isn't optimized away.
+template <typename Kernel>
+static float scatterWithKernel(const MaterialTable& table, const std::vector<Ray>& rays,
+                               const std::vector<HitRecord>& hits, int round, int begin, int end)
+{
+
+    float sum = 0.0f;
+    for (int k = begin; k < end; k++)
+    {
+        RandomGenerator rng(k, round);
+        Vec3 attenuation;
+        Ray scattered;
+        if (Kernel::scatter(table, hits[k].materialId, rng, rays[k], hits[k], attenuation, scattered))
+            sum += attenuation.x() + scattered.direction().x();
+    }
+    return sum;
+
+}
+
+// Best of three runs of work doing count operations, in operations per second.
+template <typename Work>
+static double perSecond(long long count, Work work)
+{
+
+    static volatile float sink;
+    double best = 0.0;
+    for (int round = 0; round < 3; round++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        sink = work();
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        best = std::max(best, count / elapsed.count());
+    }
+    return best;
+
+}
+
+void benchmarkMaterials(std::ostream& out)
+{
+
+    const BVHBuildParams params(SAH_BINNED, BVH_LINEAR);
+    const int repeats = 16;     // passes over the primary hits per measurement
+
+    // The frames trace the same paths, the table only changes how a hit is
+    // shaded. The scatter columns shade the primary hits of a frame on one
+    // thread, diff counts hits where the table disagrees with the vtable.
+    out << std::left << std::setw(20) << "scene"
+        << std::right << std::setw(6) << "mats"
+        << std::setw(6) << "texs"
+        << std::setw(12) << "frame virt"
+        << std::setw(10) << "table"
+        << std::setw(10) << "speedup"
+        << std::setw(12) << "Mscat virt"
+        << std::setw(10) << "switch"
+        << std::setw(10) << "sorted"
+        << std::setw(8) << "diff" << "\n";
+
+    for (const auto& scene : scenes)
+    {
+        std::unique_ptr<SceneArena> arena(new SceneArena());
+        Hitable* world;
+        {
+            SceneArena::Scope scope(arena.get());
+            world = scene.create(params);
+        }
+        MaterialTable table;
+        world->bindMaterials(table);
+
+        // Best of three, alternating, the difference is small.
+        double virtualRays = 0.0, tableRays = 0.0;
+        for (int k = 0; k < 3; k++)
+        {
+            virtualRays = std::max(virtualRays, traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs).raysPerSecond());
+            tableRays = std::max(tableRays, traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs,
+                                                           PATH_TRACING, &table).raysPerSecond());
+        }
+
+        // The bound primary hits in image order, and sorted by material type
+        // for the kernels.
+        Camera cam(lookFrom, lookAt, vup, 20.0f, float(benchmarkNx)/float(benchmarkNy),
+                   distToFocus, aperture);
+        std::vector<Ray> rays;
+        std::vector<HitRecord> hits;
+        for (int j = 0; j < benchmarkNy; j++)
+        {
+            for (int i = 0; i < benchmarkNx; i++)
+            {
+                RandomGenerator rng(0, j*benchmarkNx + i);
+                Ray r = cam.getRay(rng, float(i + rng.get1f()) / float(benchmarkNx),
+                                   float(j + rng.get1f()) / float(benchmarkNy));
+                HitRecord rec;
+                if (world->hit(r, 0.001f, FLT_MAX, rec) && rec.materialId != invalidMaterialId)
+                {
+                    rays.push_back(r);
+                    hits.push_back(rec);
+                }
+            }
+        }
+        int count = static_cast<int>(hits.size());
+
+        std::vector<Ray> sortedRays;
+        std::vector<HitRecord> sortedHits;
+        int typeEnd[3];
+        for (uint32_t type = 0; type < 3; type++)
+        {
+            for (int k = 0; k < count; k++)
+            {
+                if (table.material(hits[k].materialId).type == type)
+                {
+                    sortedRays.push_back(rays[k]);
+                    sortedHits.push_back(hits[k]);
+                }
+            }
+            typeEnd[type] = static_cast<int>(sortedHits.size());
+        }
+
+        int diff = 0;
+        for (int k = 0; k < count; k++)
+        {
+            const HitRecord& rec = hits[k];
+            RandomGenerator rngVirtual(k, 0), rngTable(k, 0);
+            Vec3 attenuationVirtual, attenuationTable;
+            Ray scatteredVirtual, scatteredTable;
+            bool scattersVirtual = rec.matPtr->scatter(rngVirtual, rays[k], rec, attenuationVirtual, scatteredVirtual);
+            bool scattersTable = table.scatter(rec.materialId, rngTable, rays[k], rec, attenuationTable, scatteredTable);
+            if (scattersVirtual != scattersTable ||
+                (attenuationVirtual - attenuationTable).squaredLength() != 0.0f ||
+                (scatteredVirtual.direction() - scatteredTable.direction()).squaredLength() != 0.0f)
+                diff++;
+        }
+
+        double virtualScatters = perSecond(repeats * count, [&]()
+        {
+            float sum = 0.0f;
+            for (int round = 0; round < repeats; round++)
+            {
+                for (int k = 0; k < count; k++)
+                {
+                    RandomGenerator rng(k, round);
+                    Vec3 attenuation;
+                    Ray scattered;
+                    if (hits[k].matPtr->scatter(rng, rays[k], hits[k], attenuation, scattered))
+                        sum += attenuation.x() + scattered.direction().x();
+                }
+            }
+            return sum;
+        });
+        double switchScatters = perSecond(repeats * count, [&]()
+        {
+            float sum = 0.0f;
+            for (int round = 0; round < repeats; round++)
+            {
+                for (int k = 0; k < count; k++)
+                {
+                    RandomGenerator rng(k, round);
+                    Vec3 attenuation;
+                    Ray scattered;
+                    if (table.scatter(hits[k].materialId, rng, rays[k], hits[k], attenuation, scattered))
+                        sum += attenuation.x() + scattered.direction().x();
+                }
+            }
+            return sum;
+        });
+        double sortedScatters = perSecond(repeats * count, [&]()
+        {
+            float sum = 0.0f;
+            for (int round = 0; round < repeats; round++)
+            {
+                sum += scatterWithKernel<LambertianKernel>(table, sortedRays, sortedHits, round,
+                                                           0, typeEnd[MATERIAL_LAMBERTIAN]);
+                sum += scatterWithKernel<MetalKernel>(table, sortedRays, sortedHits, round,
+                                                      typeEnd[MATERIAL_LAMBERTIAN], typeEnd[MATERIAL_METAL]);
+                sum += scatterWithKernel<DielectricKernel>(table, sortedRays, sortedHits, round,
+                                                           typeEnd[MATERIAL_METAL], typeEnd[MATERIAL_DIELECTRIC]);
+            }
+            return sum;
+        });
+
+        out << std::left << std::setw(20) << scene.name
+            << std::right << std::setw(6) << table.materialCount()
+            << std::setw(6) << table.textureCount()
+            << std::fixed << std::setprecision(2)
+            << std::setw(12) << virtualRays / 1.0e6
+            << std::setw(10) << tableRays / 1.0e6
+            << std::setw(10) << tableRays / virtualRays
+            << std::setw(12) << virtualScatters / 1.0e6
+            << std::setw(10) << switchScatters / 1.0e6
+            << std::setw(10) << sortedScatters / 1.0e6
+            << std::setw(8) << diff << "\n";
+    }
+
+}
+
+// The slab test of AABB::hit before Vec4, one axis at a time.
+static bool slabTestPerAxis(const Vec3& lo, const Vec3& hi, const Ray& r, float tMin, float tMax)
+{
+
+    for (int a = 0; a < 3; a++)
+    {
+        float invD = 1.0f / r.direction()[a];
+        float t0 = (lo[a] - r.origin()[a]) * invD;
+        float t1 = (hi[a] - r.origin()[a]) * invD;
+
+        if (invD < 0.0f)
+        {
+            float aux = t0;
+            t0 = t1;
+            t1 = aux;
+        }
+
+        tMin = t0 > tMin ? t0 : tMin;
+        tMax = t1 < tMax ? t1 : tMax;
+
+        if (tMax <= tMin)
+            return false;
+    }
+
+    return true;
+
+}
+
+void benchmarkVec4(std::ostream& out)
+{
+
+    #ifdef VEC4_SSE
+        const char* backend = "sse";
+    #else
+        const char* backend = "scalar";
+    #endif // VEC4_SSE
+
+    const int count = 4096;     // vectors, rays and boxes
+    const int repeats = 64;     // passes over the vectors per measurement
+    const int boxRays = 256;    // rays tested against every box
+
+    RandomGenerator rng(0, 0);
+    auto randomVec3 = [&rng]() { return Vec3(rng.get1f() - 0.5f, rng.get1f() - 0.5f, rng.get1f() - 0.5f); };
+
+    std::vector<Vec3> a3(count), b3(count), c3(count);
+    std::vector<Vec4> a4(count), b4(count), c4(count);
+    for (int k = 0; k < count; k++)
+    {
+        a3[k] = randomVec3();
+        b3[k] = randomVec3();
+        c3[k] = randomVec3();
+        a4[k] = Vec4(a3[k]);
+        b4[k] = Vec4(b3[k]);
+        c4[k] = Vec4(c3[k]);
+    }
+
+    // Dot, cross, multiply add, reciprocal and min of each vector triple.
+    double vec3Ops = perSecond((long long)repeats * count, [&]()
+    {
+        float sum = 0.0f;
+        for (int round = 0; round < repeats; round++)
+        {
+            for (int k = 0; k < count; k++)
+            {
+                Vec3 m = a3[k]*b3[k] + c3[k];
+                Vec3 c = cross(a3[k], m);
+                Vec3 r = Vec3(1.0f, 1.0f, 1.0f) / c3[k];
+                Vec3 lo(std::min(c[0], r[0]), std::min(c[1], r[1]), std::min(c[2], r[2]));
+                sum += dot(lo, b3[k]);
+            }
+        }
+        return sum;
+    });
+    double vec4Ops = perSecond((long long)repeats * count, [&]()
+    {
+        float sum = 0.0f;
+        for (int round = 0; round < repeats; round++)
+        {
+            for (int k = 0; k < count; k++)
+            {
+                Vec4 m = madd(a4[k], b4[k], c4[k]);
+                Vec4 c = cross3(a4[k], m);
+                Vec4 r = rcp(c4[k]);
+                sum += dot3(vmin(c, r), b4[k]);
+            }
+        }
+        return sum;
+    });
+
+    // Boxes around random points and rays from the origin region, about
+    // half of the tests hit.
+    std::vector<Vec3> lo3(count), hi3(count);
+    std::vector<Vec4> lo4(count), hi4(count);
+    for (int k = 0; k < count; k++)
+    {
+        Vec3 center = 4.0f * randomVec3();
+        Vec3 extent = 0.5f * (randomVec3() + Vec3(0.5f, 0.5f, 0.5f)) + Vec3(0.1f, 0.1f, 0.1f);
+        lo3[k] = center - extent;
+        hi3[k] = center + extent;
+        lo4[k] = Vec4(lo3[k]);
+        hi4[k] = Vec4(hi3[k]);
+    }
+    std::vector<Ray> rays;
+    for (int k = 0; k < boxRays; k++)
+        rays.push_back(Ray(0.2f * randomVec3(), randomVec3()));
+
+    int diff = 0;
+    for (const Ray& r : rays)
+    {
+        SlabRay slabRay(r);
+        for (int k = 0; k < count; k++)
+            diff += slabTestPerAxis(lo3[k], hi3[k], r, 0.001f, FLT_MAX) !=
+                    slabTest(lo4[k], hi4[k], slabRay, 0.001f, FLT_MAX);
+    }
+
+    const long long boxTests = (long long)boxRays * count;
+    double perAxisTests = perSecond(boxTests, [&]()
+    {
+        float hits = 0.0f;
+        for (const Ray& r : rays)
+            for (int k = 0; k < count; k++)
+                hits += slabTestPerAxis(lo3[k], hi3[k], r, 0.001f, FLT_MAX);
+        return hits;
+    });
+    double aabbTests = perSecond(boxTests, [&]()
+    {
+        float hits = 0.0f;
+        for (const Ray& r : rays)
+            for (int k = 0; k < count; k++)
+                hits += AABB(lo3[k], hi3[k]).hit(r, 0.001f, FLT_MAX);
+        return hits;
+    });
+    double slabTests = perSecond(boxTests, [&]()
+    {
+        float hits = 0.0f;
+        for (const Ray& r : rays)
+        {
+            SlabRay slabRay(r);
+            for (int k = 0; k < count; k++)
+                hits += slabTest(lo4[k], hi4[k], slabRay, 0.001f, FLT_MAX);
+        }
+        return hits;
+    });
+
+    // AABB::hit sets up the SlabRay per box, the linear BVH once per ray.
+    out << "Vec4 backend: " << backend << "\n"
+        << std::fixed << std::setprecision(2)
+        << std::left << std::setw(20) << "Mops/s"
+        << std::right << std::setw(12) << "vec3"
+        << std::setw(12) << "vec4"
+        << std::setw(10) << "speedup" << "\n"
+        << std::left << std::setw(20) << "vector math"
+        << std::right << std::setw(12) << vec3Ops / 1.0e6
+        << std::setw(12) << vec4Ops / 1.0e6
+        << std::setw(10) << vec4Ops / vec3Ops << "\n\n"
+        << std::left << std::setw(20) << "Mtests/s"
+        << std::right << std::setw(12) << "per axis"
+        << std::setw(12) << "AABB::hit"
+        << std::setw(12) << "slab ray"
+        << std::setw(10) << "speedup"
+        << std::setw(8) << "diff" << "\n"
+        << std::left << std::setw(20) << "slab test"
+        << std::right << std::setw(12) << perAxisTests / 1.0e6
+        << std::setw(12) << aabbTests / 1.0e6
+        << std::setw(12) << slabTests / 1.0e6
+        << std::setw(10) << slabTests / perAxisTests
+        << std::setw(8) << diff << "\n\n";
+
+    // Renderer::color end to end, compare against a build with the other
+    // SIMD_SUPPORT setting.
+    const BenchmarkBuilder builders[] =
+    {
+        { "sah",    BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE) },
+        { "linear", BVHBuildParams(SAH_BINNED, BVH_LINEAR) },
+        { "wide4",  BVHBuildParams(SAH_BINNED, BVH_WIDE4) }
+    };
+
+    out << std::left << std::setw(20) << "Mrays/s"
+        << std::right;
+    for (const auto& builder : builders)
+        out << std::setw(12) << builder.name;
+    out << "\n";
+
+    for (const BenchmarkScene& scene : { scenes[2], scenes[7] })    // randomScene and meshScene
+    {
+        out << std::left << std::setw(20) << scene.name << std::right;
+        for (const auto& builder : builders)
+        {
+            std::unique_ptr<SceneArena> arena(new SceneArena());
+            Hitable* world;
+            {
+                SceneArena::Scope scope(arena.get());
+                world = scene.create(builder.params);
+            }
+            double raysPerSecond = 0.0;
+            for (int k = 0; k < 3; k++)
+                raysPerSecond = std::max(raysPerSecond, traceBenchmark(world, benchmarkNx, benchmarkNy,
+                                                                       benchmarkNs).raysPerSecond());
+            out << std::setw(12) << raysPerSecond / 1.0e6;
+        }
+        out << "\n";
+    }
+
+}
+
+void benchmarkPackets(std::ostream& out)
+{
+
+    const BenchmarkBuilder builders[] =
+    {
+        { "linear", BVHBuildParams(SAH_BINNED, BVH_LINEAR) },
+        { "batch",  BVHBuildParams(SAH_BINNED, BVH_BATCHED) }
+    };
+
+    // The primary columns trace the primary rays of all samples of a frame
+    // on one thread. util is the share of the packet lanes that hit the
+    // bounds of the nodes the packets visit, diff counts rays whose packet
+    // hit differs from the single ray hit.
+    out << std::left << std::setw(20) << "scene"
+        << std::setw(10) << "builder"
+        << std::right << std::setw(12) << "Mprim/s"
+        << std::setw(10) << "packet"
+        << std::setw(10) << "speedup"
+        << std::setw(8) << "util %"
+        << std::setw(12) << "frame"
+        << std::setw(10) << "packet"
+        << std::setw(10) << "speedup"
+        << std::setw(8) << "diff" << "\n";
+
+    Camera cam(lookFrom, lookAt, vup, 20.0f, float(benchmarkNx)/float(benchmarkNy),
+               distToFocus, aperture);
+    std::vector<RayPacket> packets;
+    for (int s = 0; s < benchmarkNs; s++)
+    {
+        for (int j = 0; j < benchmarkNy; j += packetTileHeight)
+        {
+            for (int i = 0; i < benchmarkNx; i += packetTileWidth)
+            {
+                RayPacket packet;
+                for (int k = 0; k < rayPacketSize; k++)
+                {
+                    int x = i + k % packetTileWidth;
+                    int y = j + k / packetTileWidth;
+                    if (x >= benchmarkNx || y >= benchmarkNy)
+                        continue;
+                    RandomGenerator rng(s, y*benchmarkNx + x);
+                    float u = float(x + rng.get1f()) / float(benchmarkNx);
+                    float v = float(y + rng.get1f()) / float(benchmarkNy);
+                    packet.set(k, cam.getRay(rng, u, v));
+                }
+                packets.push_back(packet);
+            }
+        }
+    }
+    long long rayCount = 0;
+    for (const RayPacket& packet : packets)
+        rayCount += __builtin_popcount(packet.active);
+
+    for (const BenchmarkScene& scene : { scenes[2], scenes[3], scenes[7] })    // randomScene, randomSceneTexture and meshScene
+    {
+        for (const auto& builder : builders)
+        {
+            std::unique_ptr<SceneArena> arena(new SceneArena());
+            Hitable* world;
+            {
+                SceneArena::Scope scope(arena.get());
+                world = scene.create(builder.params);
+            }
+
+            int diff = 0;
+            packetNodeVisits.reset();
+            packetActiveLanes.reset();
+            for (const RayPacket& packet : packets)
+            {
+                HitRecord recs[rayPacketSize];
+                int hits = world->hitPacket(packet, 0.001f, FLT_MAX, recs);
+                for (int k = 0; k < rayPacketSize; k++)
+                {
+                    if (!(packet.active >> k & 1))
+                        continue;
+                    HitRecord rec;
+                    bool single = world->hit(packet.rays[k], 0.001f, FLT_MAX, rec);
+                    if (single != bool(hits >> k & 1) ||
+                        (single && (rec.time != recs[k].time || rec.matPtr != recs[k].matPtr)))
+                        diff++;
+                }
+            }
+            long long visits = packetNodeVisits.total();
+            long long lanes = packetActiveLanes.total();
+
+            double singleRays = perSecond(rayCount, [&]()
+            {
+                float sum = 0.0f;
+                for (const RayPacket& packet : packets)
+                {
+                    for (int k = 0; k < rayPacketSize; k++)
+                    {
+                        HitRecord rec;
+                        if ((packet.active >> k & 1) && world->hit(packet.rays[k], 0.001f, FLT_MAX, rec))
+                            sum += rec.time;
+                    }
+                }
+                return sum;
+            });
+            double packetRays = perSecond(rayCount, [&]()
+            {
+                float sum = 0.0f;
+                for (const RayPacket& packet : packets)
+                {
+                    HitRecord recs[rayPacketSize];
+                    int hits = world->hitPacket(packet, 0.001f, FLT_MAX, recs);
+                    for (; hits; hits &= hits - 1)
+                        sum += recs[__builtin_ctz(hits)].time;
+                }
+                return sum;
+            });
+
+            double frameRays = 0.0, packetFrameRays = 0.0;
+            for (int k = 0; k < 3; k++)
+            {
+                frameRays = std::max(frameRays, traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs).raysPerSecond());
+                packetFrameRays = std::max(packetFrameRays, traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs,
+                                                                           PATH_TRACING, nullptr, true).raysPerSecond());
+            }
+
+            out << std::left << std::setw(20) << scene.name
+                << std::setw(10) << builder.name
+                << std::right << std::fixed << std::setprecision(2)
+                << std::setw(12) << singleRays / 1.0e6
+                << std::setw(10) << packetRays / 1.0e6
+                << std::setw(10) << packetRays / singleRays;
+            if (visits > 0)
+                out << std::setw(8) << 100.0 * lanes / (rayPacketSize * visits);
+            else
+                out << std::setw(8) << "n/a";
+            out << std::setw(12) << frameRays / 1.0e6
+                << std::setw(10) << packetFrameRays / 1.0e6
+                << std::setw(10) << packetFrameRays / frameRays
+                << std::setw(8) << diff << "\n";
+        }
+    }
+
+}
+
+// traceBenchmark() with the samples of every tile*tile pixels traced as one
+// Wavefront batch. Adds the stage statistics of all batches to stats.
+static TraceResult traceWavefront(Hitable* world, const MaterialTable* materials,
+                                  int tile, WavefrontStats& stats, int reorderBatch = 0)
+{
+
+    Camera cam(lookFrom, lookAt, vup, 20.0f, float(benchmarkNx)/float(benchmarkNy),
+               distToFocus, aperture);
+    Renderer renderer(false, false, false);
+    renderer.materials = materials;
+    RayCounter counter(world);
+    bvhNodeVisits.reset();
+    bvhNodeCache.reset();
+    PerfCounter cacheMisses(PerfCounter::CACHE_MISSES);
+    cacheMisses.start();
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    #pragma omp parallel
+    {
+        Wavefront batch;
+        batch.reorderBatch = reorderBatch;
+        std::vector<Vec3> colors(static_cast<size_t>(benchmarkNs * tile * tile));
+
+        #pragma omp for collapse(2) schedule(dynamic)
+        for (int j = 0; j < benchmarkNy; j += tile)
+        {
+            for (int i = 0; i < benchmarkNx; i += tile)
+            {
+                for (int s = 0; s < benchmarkNs; s++)
+                {
+                    for (int y = j; y < std::min(j + tile, benchmarkNy); y++)
+                    {
+                        for (int x = i; x < std::min(i + tile, benchmarkNx); x++)
+                        {
+                            RandomGenerator rng(s, y*benchmarkNx + x);
+                            float u = float(x + rng.get1f()) / float(benchmarkNx);
+                            float v = float(y + rng.get1f()) / float(benchmarkNy);
+                            batch.add(cam.getRay(rng, u, v), rng, (s * tile + y - j) * tile + x - i);
+                        }
+                    }
+                }
+                batch.trace(renderer, &counter, colors.data());
+            }
+        }
+
+        #pragma omp critical
+        {
+            stats.paths += batch.stats.paths;
+            stats.rays += batch.stats.rays;
+            for (int b = 0; b < wavefrontBins; b++)
+                stats.shaded[b] += batch.stats.shaded[b];
+            stats.bounces = std::max(stats.bounces, batch.stats.bounces);
+            stats.reordered += batch.stats.reordered;
+            stats.reorderSeconds += batch.stats.reorderSeconds;
+            stats.intersectSeconds += batch.stats.intersectSeconds;
+            stats.shadeSeconds += batch.stats.shadeSeconds;
+            stats.compactSeconds += batch.stats.compactSeconds;
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    cacheMisses.stop();
+
+    TraceResult result = TraceResult();
+    result.rays = counter.total();
+    result.nodeVisits = bvhNodeVisits.total();
+    result.simulatedMisses = bvhNodeCache.misses();
+    result.cacheMisses = cacheMisses.available() ? cacheMisses.value() : -1;
+    result.seconds = elapsed.count();
+    return result;
+
+}
+
+void benchmarkWavefront(std::ostream& out)
+{
+
+    const BVHBuildParams params(SAH_BINNED, BVH_LINEAR);
+    const int tiles[] = { 8, 16, 32 };
+
+    // The batch is tile*tile pixels times the samples. The stage columns
+    // split the wavefront time, rays/path is the mean path length.
+    out << std::left << std::setw(20) << "scene"
+        << std::right << std::setw(8) << "tile"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(12) << "wavefront"
+        << std::setw(10) << "speedup"
+        << std::setw(10) << "isect %"
+        << std::setw(10) << "shade %"
+        << std::setw(10) << "compact %"
+        << std::setw(12) << "rays/path"
+        << std::setw(10) << "bounces" << "\n";
+
+    for (const auto& scene : scenes)
+    {
+        std::unique_ptr<SceneArena> arena(new SceneArena());
+        Hitable* world;
+        {
+            SceneArena::Scope scope(arena.get());
+            world = scene.create(params);
+        }
+        MaterialTable table;
+        world->bindMaterials(table);
+
+        for (int tile : tiles)
+        {
+            double pathRays = 0.0, wavefrontRays = 0.0;
+            WavefrontStats stats = WavefrontStats();
+            for (int k = 0; k < 3; k++)
+            {
+                pathRays = std::max(pathRays, traceBenchmark(world, benchmarkNx, benchmarkNy, benchmarkNs,
+                                                             PATH_TRACING, &table).raysPerSecond());
+                stats = WavefrontStats();
+                wavefrontRays = std::max(wavefrontRays, traceWavefront(world, &table, tile, stats).raysPerSecond());
+            }
+            double stageSeconds = stats.intersectSeconds + stats.shadeSeconds + stats.compactSeconds;
+
+            out << std::left << std::setw(20) << scene.name
+                << std::right << std::setw(8) << tile
+                << std::fixed << std::setprecision(2)
+                << std::setw(12) << pathRays / 1.0e6
+                << std::setw(12) << wavefrontRays / 1.0e6
+                << std::setw(10) << wavefrontRays / pathRays
+                << std::setw(10) << 100.0 * stats.intersectSeconds / stageSeconds
+                << std::setw(10) << 100.0 * stats.shadeSeconds / stageSeconds
+                << std::setw(10) << 100.0 * stats.compactSeconds / stageSeconds
+                << std::setw(12) << double(stats.rays) / stats.paths
+                << std::setw(10) << stats.bounces << "\n";
+        }
+    }
+
+}
+
+void benchmarkReorder(std::ostream& out)
+{
+
+    const BVHBuildParams params(SAH_BINNED, BVH_LINEAR);
+    const int tile = 32;            // 8192 paths per batch with the 8 samples
+    const int batches[] = { 0, 256, 2048, 8192 };
+    const int fieldSize = 1000000;
+
+    struct ReorderScene
+    {
+        const char* name;
+        Hitable* (*create)(const BVHBuildParams& params);
+    };
+
+    const ReorderScene reorderScenes[] =
+    {
+        { "randomScene",    [](const BVHBuildParams& sceneParams) { return randomScene(sceneParams); } },
+        { "meshScene",      [](const BVHBuildParams& sceneParams) { return meshScene(sceneParams); } },
+        { "sphereField 1M", [](const BVHBuildParams& sceneParams) {
+              return buildAccelerator(sphereField(fieldSize), fieldSize, 0.0f, 1.0f, sceneParams); } }
+    };
+
+    // Batch 0 traces the paths in path order. The miss columns are per
+    // ray, simulated node misses need STATS_SUPPORT and the hardware last
+    // level misses readable perf counters.
+    out << std::left << std::setw(20) << "scene"
+        << std::right << std::setw(8) << "batch"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(10) << "speedup"
+        << std::setw(12) << "reorder %"
+        << std::setw(14) << "node miss"
+        << std::setw(12) << "LLC miss" << "\n";
+
+    for (const auto& scene : reorderScenes)
+    {
+        std::unique_ptr<SceneArena> arena(new SceneArena());
+        Hitable* world;
+        {
+            SceneArena::Scope scope(arena.get());
+            world = scene.create(params);
+        }
+        MaterialTable table;
+        world->bindMaterials(table);
+
+        double baseline = 0.0;
+        for (int batch : batches)
+        {
+            TraceResult best = TraceResult();
+            WavefrontStats bestStats = WavefrontStats();
+            for (int k = 0; k < 3; k++)
+            {
+                WavefrontStats stats = WavefrontStats();
+                TraceResult result = traceWavefront(world, &table, tile, stats, batch);
+                if (result.raysPerSecond() > best.raysPerSecond())
+                {
+                    best = result;
+                    bestStats = stats;
+                }
+            }
+            if (batch == 0)
+                baseline = best.raysPerSecond();
+            double stageSeconds = bestStats.reorderSeconds + bestStats.intersectSeconds +
+                                  bestStats.shadeSeconds + bestStats.compactSeconds;
+
+            out << std::left << std::setw(20) << scene.name
+                << std::right << std::setw(8) << batch
+                << std::fixed << std::setprecision(2)
+                << std::setw(12) << best.raysPerSecond() / 1.0e6
+                << std::setw(10) << best.raysPerSecond() / baseline
+                << std::setw(12) << 100.0 * bestStats.reorderSeconds / stageSeconds;
+            #ifdef STATS_ENABLED
+                out << std::setw(14) << double(best.simulatedMisses) / best.rays;
+            #else
+                out << std::setw(14) << "n/a";
+            #endif // STATS_ENABLED
+            if (best.cacheMisses >= 0)
+                out << std::setw(12) << double(best.cacheMisses) / best.rays << "\n";
+            else
+                out << std::setw(12) << "n/a" << "\n";
+        }
+    }
+
+}
+
+void benchmarkSceneArena(std::ostream& out)
+{
+
+    const int fieldSize = 1000000;
+
+    struct ArenaScene
+    {
+        const char* name;
+        Hitable* (*create)();
+    };
+
+    const ArenaScene arenaScenes[] =
+    {
+        { "randomScene",      []() { return randomScene(BVHBuildParams(SAH_BINNED, BVH_LINEAR)); } },
+        { "randomScene tree", []() { return randomScene(BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE)); } },
+        { "meshScene",        []() { return meshScene(BVHBuildParams(SAH_BINNED, BVH_LINEAR)); } },
+        { "spheres 1M tree",  []() {
+              return buildAccelerator(sphereField(fieldSize), fieldSize, 0.0f, 1.0f,
+                                      BVHBuildParams(SAH_BINNED, BVH_POINTER_TREE)); } }
+    };
+
+    // The memory is what the build took from the heap, the arena blocks
+    // included. Nothing owns the objects of a heap scene, so it can't be
+    // torn down and leaks like the other benchmark scenes.
+    out << std::left << std::setw(20) << "scene"
+        << std::setw(8) << "alloc"
+        << std::right << std::setw(12) << "build ms"
+        << std::setw(12) << "memory MB"
+        << std::setw(12) << "Mrays/s"
+        << std::setw(12) << "LLC miss"
+        << std::setw(14) << "teardown ms" << "\n";
+
+    for (const auto& scene : arenaScenes)
+    {
+        for (int useArena = 0; useArena < 2; useArena++)
+        {
+            std::unique_ptr<SceneArena> arena(useArena ? new SceneArena() : nullptr);
+            long long heapBefore = heapBytes();
+            auto start = std::chrono::high_resolution_clock::now();
+            Hitable* world;
+            {
+                SceneArena::Scope scope(arena.get());
+                world = scene.create();
+            }
+            std::chrono::duration<double, std::milli> buildTime = std::chrono::high_resolution_clock::now() - start;
+            long long heapAfter = heapBytes();
+
+            TraceResult best = TraceResult();
+            for (int k = 0; k < 3; k++)
+            {
+                TraceResult result = traceBenchmark(world, benchmarkNx, benchmarkNy, 1);
+                if (result.raysPerSecond() > best.raysPerSecond())
+                    best = result;
+            }
+
+            out << std::left << std::setw(20) << scene.name
+                << std::setw(8) << (arena ? "arena" : "heap")
+                << std::right << std::fixed << std::setprecision(2)
+                << std::setw(12) << buildTime.count();
+            if (heapBefore >= 0)
+                out << std::setw(12) << (heapAfter - heapBefore) / (1024.0 * 1024.0);
+            else
+                out << std::setw(12) << "n/a";
+            out << std::setw(12) << best.raysPerSecond() / 1.0e6;
+            if (best.cacheMisses >= 0)
+                out << std::setw(12) << double(best.cacheMisses) / best.rays;
+            else
+                out << std::setw(12) << "n/a";
+
+            if (arena)
+            {
+                start = std::chrono::high_resolution_clock::now();
+                arena.reset();
+                std::chrono::duration<double, std::milli> teardownTime = std::chrono::high_resolution_clock::now() - start;
+                out << std::setw(14) << teardownTime.count() << "\n";
+            }
+            else
+                out << std::setw(14) << "leaked" << "\n";
+        }
+    }
+
+}
+
+void benchmarkTileScheduler(std::ostream& out)
+{
+
+    const int passes = 4;
+
+    struct Schedule
+    {
+        const char* name;
+        bool tiles;
+        TileOrder order;
+        int tileSize;
+    };
+
+    const Schedule schedules[] =
+    {
+        { "omp pixels",  false, TILE_ORDER_SCANLINE, 1 },
+        { "scanline 16", true,  TILE_ORDER_SCANLINE, 16 },
+        { "hilbert 8",   true,  TILE_ORDER_HILBERT,  8 },
+        { "hilbert 16",  true,  TILE_ORDER_HILBERT,  16 },
+        { "hilbert 32",  true,  TILE_ORDER_HILBERT,  32 },
+        { "spiral 16",   true,  TILE_ORDER_SPIRAL,   16 }
+    };
+    const int scheduleCount = sizeof(schedules) / sizeof(schedules[0]);
+
+    // Up to the threads OpenMP uses by default, OMP_NUM_THREADS raises them.
+    int maxThreads = omp_get_max_threads();
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    // The full frame of the renderer, since render() indexes the pixels by nx.
+    RParams rParams;
+    rParams.image.reset(new Image(false, false, nx, ny, tx, ty));
+    rParams.cam.reset(new Camera(lookFrom, lookAt, vup, 20.0f, float(nx)/float(ny),
+                                 distToFocus, aperture));
+    rParams.renderer.reset(new Renderer(false, false, false));
+    rParams.arena.reset(new SceneArena());
+    {
+        SceneArena::Scope scope(rParams.arena.get());
+        rParams.world.reset(randomScene(BVHBuildParams(SAH_BINNED, BVH_LINEAR)));
+    }
+    Renderer& renderer = *rParams.renderer;
+
+    // The omp loop is the one of Renderer::traceRays without tiles, one
+    // parallel region per pass. The tiles render all passes of a tile in a
+    // single region. Neither includes display().
+    out << std::left << std::setw(14) << "schedule"
+        << std::right << std::setw(8) << "threads"
+        << std::setw(12) << "pass ms"
+        << std::setw(12) << "Mpaths/s"
+        << std::setw(10) << "speedup"
+        << std::setw(10) << "vs omp"
+        << std::setw(10) << "steals" << "\n";
+
+    std::vector<double> baselines(scheduleCount, 0.0);
+    for (int threads : threadCounts)
+    {
+        omp_set_num_threads(threads);
+        double ompRate = 0.0;
+        for (int k = 0; k < scheduleCount; k++)
+        {
+            const Schedule& schedule = schedules[k];
+            rParams.image->resetImage();
+            long long steals = 0;
+
+            auto start = std::chrono::high_resolution_clock::now();
+            if (schedule.tiles)
+            {
+                TileScheduler scheduler(nx, ny, schedule.tileSize, schedule.tileSize, schedule.order);
+                scheduler.run([&](const Tile& tile)
+                {
+                    renderer.renderTile(tile, rParams, 1, passes);
+                });
+                steals = scheduler.stats.steals;
+            }
+            else
+            {
+                for (int pass = 1; pass <= passes; pass++)
+                {
+                    #pragma omp parallel for collapse(2)
+                    for (int j = 0; j < ny; j++)
+                    {
+                        for (int i = 0; i < nx; i++)
+                        {
+                            renderer.render(i, j, rParams, pass);
+                        }
+                    }
+                }
+            }
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            double rate = double(nx) * ny * passes / elapsed.count();
+            if (baselines[k] == 0.0)
+                baselines[k] = rate;
+            if (!schedule.tiles)
+                ompRate = rate;
+
+            out << std::left << std::setw(14) << schedule.name
+                << std::right << std::setw(8) << threads
+                << std::fixed << std::setprecision(1)
+                << std::setw(12) << elapsed.count() * 1000.0 / passes
+                << std::setprecision(2)
+                << std::setw(12) << rate / 1.0e6
+                << std::setw(10) << rate / baselines[k]
+                << std::setw(10) << rate / ompRate;
+            if (schedule.tiles)
+                out << std::setw(10) << steals << "\n";
+            else
+                out << std::setw(10) << "-" << "\n";
+        }
+    }
+    omp_set_num_threads(maxThreads);
+
+}
+
+#endif // CUDA_ENABLED
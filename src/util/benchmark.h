@@ -0,0 +1,192 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <ostream>
+#include <string>
+
+#include "hitables/hitable.h"
+#include "util/renderer.h"
+#include "util/stats.h"
+
+// Wraps a world and counts the rays shot into it.
+class RayCounter : public Hitable
+{
+
+    Hitable* world;
+    mutable StatCounter rays;
+
+    public:
+
+        RayCounter(Hitable* world) : world(world)
+        {
+
+        }
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override
+        {
+            rays.add(1);
+            return world->hit(r, tMin, tMax, rec);
+        }
+
+        bool occluded(const Ray& r, float tMin, float tMax) const override
+        {
+            rays.add(1);
+            return world->occluded(r, tMin, tMax);
+        }
+
+        bool boundingBox(float t0, float t1, AABB& box) const override
+        {
+            return world->boundingBox(t0, t1, box);
+        }
+
+        int hitPacket(const RayPacket& packet, float tMin, float tMax, HitRecord* recs) const override
+        {
+            rays.add(__builtin_popcount(packet.active));
+            return world->hitPacket(packet, tMin, tMax, recs);
+        }
+
+        long long total() const
+        {
+            return rays.total();
+        }
+
+};
+
+struct TraceResult
+{
+
+    long long rays;
+    long long nodeVisits;       // only counted with STATS_SUPPORT
+    long long simulatedMisses;  // node cache line misses in CacheSimulator, only with STATS_SUPPORT
+    long long cacheMisses;      // hardware last level cache misses, -1 if not readable
+    long long sphereHitCandidates;  // only counted with STATS_SUPPORT
+    long long sphereUVEvaluations;
+    long long packetNodeVisits;     // only counted with STATS_SUPPORT
+    long long packetActiveLanes;
+    double seconds;
+
+    double raysPerSecond() const
+    {
+        return seconds > 0.0 ? rays / seconds : 0.0;
+    }
+
+};
+
+// Path traces width*height*samples paths through world with the default
+// camera, shading the bound materials from materials if given. With packets
+// the primary rays of every tile are traced as one packet.
+TraceResult traceBenchmark(Hitable* world, int width, int height, int samples,
+                           RenderMode mode = PATH_TRACING,
+                           const MaterialTable* materials = nullptr,
+                           bool packets = false);
+
+// Runs the benchmark called name, "bvh" for benchmarkBVH, "refit" for
+// benchmarkRefit and so on, see namedBenchmarks in benchmark.cpp, or all of
+// them for "all". Returns false for an unknown name.
+bool benchmarkByName(const std::string& name, std::ostream& out);
+
+// Compares the BVH builders on every CPU scene and writes a report to out.
+void benchmarkBVH(std::ostream& out);
+
+// Compares unordered and front-to-back BVH traversal on randomScene.
+void benchmarkTraversalOrder(std::ostream& out);
+
+// Builds the linear BVH over growing sphere fields with 1..max threads.
+void benchmarkBuildScaling(std::ostream& out);
+
+// Build time against the time of tracing one frame for the SAH and Morton
+// builders, for picking a builder for scenes rebuilt every frame.
+void benchmarkBuildVsTrace(std::ostream& out);
+
+// Renders a frame sequence of moving spheres, rebuilding the BVH every frame
+// against refitting it with DynamicAccelerator.
+void benchmarkRefit(std::ostream& out);
+
+// Traces sphere fields moving by growing distances over the shutter with the
+// linear BVH over swept boxes and with the motion BVH.
+void benchmarkMotionBlur(std::ostream& out);
+
+// Compares the BVH with the uniform grid, the hashed grid and the kd-tree on
+// every CPU scene: build time, memory and rays per second.
+void benchmarkAccelerators(std::ostream& out);
+
+// Memory and traversal speed of the pointer, linear and quantized BVH
+// layouts over a million spheres.
+void benchmarkCompressedBVH(std::ostream& out);
+
+// Traversal speed and cache misses of the pointer tree nodes in allocation,
+// depth-first, treelet and van Emde Boas order over a million spheres.
+void benchmarkNodeOrder(std::ostream& out);
+
+// Frame time of the ambient occlusion preview against path tracing on every
+// CPU scene, and of occluded() against hit() for short shadow rays.
+void benchmarkAmbientOcclusion(std::ostream& out);
+
+// Linear BVH with single sphere leaves against leaves packed into 8 wide
+// SphereBatches over growing sphere fields.
+void benchmarkSphereBatch(std::ostream& out);
+
+// Writes a tessellated sphere of a million triangles as OBJ, loads it with
+// 1..max threads and traces it with the linear and the batched BVH.
+void benchmarkTriangleMesh(std::ostream& out);
+
+// Startup time of generating and building a scene against mapping it from a
+// scene cache, and the trace speed of both.
+void benchmarkSceneCache(std::ostream& out);
+
+// Rays per second of the BVHs calling the primitives through the vtable
+// against calling the common primitive types directly.
+void benchmarkDispatch(std::ostream& out);
+
+// Sphere hit candidates found during traversal against the uvs computed for
+// the closest hits, and the atan2/asin calls saved by deferring them.
+void benchmarkDeferredHits(std::ostream& out);
+
+// Path tracing and shading alone with Material::scatter against the switch
+// of a MaterialTable and its kernels on hits sorted by material type.
+void benchmarkMaterials(std::ostream& out);
+
+// Vector math and slab tests with Vec3 against Vec4, and the trace speed
+// of the BVHs with the Vec4 backend of this build.
+void benchmarkVec4(std::ostream& out);
+
+// Primary rays per second traced one by one against traced in packets of
+// 8, the lane utilization of the packets, and the frame rate of the path
+// tracer with packets for the primary rays.
+void benchmarkPackets(std::ostream& out);
+
+// Frame rate of the path tracer tracing one path after another against
+// Wavefront batches of growing tiles, and the time of the wavefront stages.
+void benchmarkWavefront(std::ostream& out);
+
+// Wavefront frames with the secondary rays in path order against sorted by
+// origin cell and direction octant per growing batches, with the cache misses
+// of the traversal, on small scenes and a million spheres.
+void benchmarkReorder(std::ostream& out);
+
+// Build time, memory, trace speed and teardown time of scenes allocated
+// from the heap against allocated from a SceneArena.
+void benchmarkSceneArena(std::ostream& out);
+
+// Frame rate of the full frame rendered pixel by pixel in one omp loop per
+// pass against in tiles of several sizes and orders on the TileScheduler,
+// which renders every tile for all passes, from one thread to all of them.
+void benchmarkTileScheduler(std::ostream& out);
@@ -38,6 +38,9 @@ const std::string fileName = "raytracer";
 const int tx = 16;                      // block size
 const int ty = 16;
 const int benchmarkCount = 100;
+const int benchmarkNx = 320;            // resolution and sample size of the BVH benchmark
+const int benchmarkNy = 180;
+const int benchmarkNs = 8;
 const float thetaInit = 1.34888f;
 const float phiInit = 1.32596f;
 const float zoomScale = 0.5f;
@@ -0,0 +1,289 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <omp.h>
+
+#include "util/objloader.h"
+
+// Face corner as written in the file. Negative indices count back from
+// the last vertex read before the face, they are stored relative to the
+// start of the chunk until the chunk offsets are known.
+struct ObjCorner
+{
+
+    int index[3];           // position, uv, normal, -1 if missing
+    bool relative[3];
+
+};
+
+// Everything parsed from one range of lines.
+struct ObjChunk
+{
+
+    std::vector<Vec3> positions;
+    std::vector<Vec3> normals;
+    std::vector<float> uvs;
+    std::vector<ObjCorner> corners;     // three per triangle
+
+};
+
+static const char* skipSpaces(const char* p, const char* end)
+{
+
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+
+}
+
+static const char* nextLine(const char* p, const char* end)
+{
+
+    while (p < end && *p != '\n')
+        p++;
+    return p < end ? p + 1 : end;
+
+}
+
+static const char* parseFloats(const char* p, const char* end, float* out, int count)
+{
+
+    for (int i = 0; i < count; i++)
+    {
+        p = skipSpaces(p, end);
+        char* next;
+        out[i] = strtof(p, &next);
+        p = next;
+    }
+    return p;
+
+}
+
+// Reads one "v", "v/t", "v//n" or "v/t/n" corner. Returns nullptr at the
+// end of the line.
+static const char* parseCorner(const char* p, const char* end, const int* counts, ObjCorner& corner)
+{
+
+    p = skipSpaces(p, end);
+    if (p == end || *p == '\n' || *p == '\r' || *p == '#')
+        return nullptr;
+
+    for (int a = 0; a < 3; a++)
+    {
+        corner.index[a] = -1;
+        corner.relative[a] = false;
+    }
+
+    for (int a = 0; a < 3; a++)
+    {
+        if (a > 0)
+        {
+            if (p == end || *p != '/')
+                break;
+            p++;
+        }
+        if (p < end && (*p == '-' || (*p >= '0' && *p <= '9')))
+        {
+            char* next;
+            long index = strtol(p, &next, 10);
+            p = next;
+            if (index < 0)
+            {
+                corner.index[a] = counts[a] + static_cast<int>(index);
+                corner.relative[a] = true;
+            }
+            else
+                corner.index[a] = static_cast<int>(index) - 1;
+        }
+    }
+
+    // Skip anything unexpected up to the next separator.
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+        p++;
+
+    return p;
+
+}
+
+static void parseChunk(const char* p, const char* end, ObjChunk& chunk)
+{
+
+    std::vector<ObjCorner> polygon;
+
+    while (p < end)
+    {
+        const char* line = skipSpaces(p, end);
+        if (line == end)
+            break;
+        p = nextLine(line, end);
+
+        if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t'))
+        {
+            float xyz[3];
+            parseFloats(line + 1, p, xyz, 3);
+            chunk.positions.push_back(Vec3(xyz[0], xyz[1], xyz[2]));
+        }
+        else if (line[0] == 'v' && line[1] == 'n')
+        {
+            float xyz[3];
+            parseFloats(line + 2, p, xyz, 3);
+            chunk.normals.push_back(Vec3(xyz[0], xyz[1], xyz[2]));
+        }
+        else if (line[0] == 'v' && line[1] == 't')
+        {
+            float uv[2];
+            parseFloats(line + 2, p, uv, 2);
+            chunk.uvs.push_back(uv[0]);
+            chunk.uvs.push_back(uv[1]);
+        }
+        else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t'))
+        {
+            int counts[3] =
+            {
+                static_cast<int>(chunk.positions.size()),
+                static_cast<int>(chunk.uvs.size() / 2),
+                static_cast<int>(chunk.normals.size())
+            };
+
+            polygon.clear();
+            ObjCorner corner;
+            const char* c = line + 1;
+            while ((c = parseCorner(c, p, counts, corner)) != nullptr)
+                polygon.push_back(corner);
+
+            for (size_t i = 2; i < polygon.size(); i++)
+            {
+                chunk.corners.push_back(polygon[0]);
+                chunk.corners.push_back(polygon[i-1]);
+                chunk.corners.push_back(polygon[i]);
+            }
+        }
+    }
+
+}
+
+TriangleMesh* loadOBJ(const std::string& fileName, Material* material, int threadCount)
+{
+
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        std::cerr << "Unable to open " << fileName << std::endl;
+        return nullptr;
+    }
+
+    // The extra newline lets the parser look one character past every line,
+    // the terminating zero stops strtof() and strtol(), which skip newlines
+    // and don't know the end of the buffer.
+    size_t size = static_cast<size_t>(file.tellg());
+    std::vector<char> text(size + 2, '\n');
+    text[size + 1] = '\0';
+    file.seekg(0);
+    file.read(text.data(), static_cast<std::streamsize>(size));
+    file.close();
+
+    if (threadCount <= 0)
+        threadCount = omp_get_max_threads();
+
+    // A few chunks per thread, each starting at a line.
+    const char* begin = text.data();
+    size_t length = size + 1;
+    const char* end = begin + length;
+    size_t minChunkSize = 1 << 16;
+    int chunkCount = static_cast<int>(std::min(static_cast<size_t>(4 * threadCount),
+                                               length / minChunkSize + 1));
+    std::vector<const char*> bounds(static_cast<size_t>(chunkCount + 1));
+    bounds[0] = begin;
+    for (int i = 1; i < chunkCount; i++)
+    {
+        const char* p = begin + length * i / chunkCount;
+        bounds[i] = std::max(bounds[i-1], p > begin ? nextLine(p - 1, end) : p);
+    }
+    bounds[chunkCount] = end;
+
+    std::vector<ObjChunk> chunks(static_cast<size_t>(chunkCount));
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(threadCount)
+    for (int i = 0; i < chunkCount; i++)
+        parseChunk(bounds[i], bounds[i+1], chunks[i]);
+
+    // Offsets of every chunk in the merged buffers.
+    std::vector<int> positionStart(static_cast<size_t>(chunkCount + 1), 0);
+    std::vector<int> uvStart(static_cast<size_t>(chunkCount + 1), 0);
+    std::vector<int> normalStart(static_cast<size_t>(chunkCount + 1), 0);
+    std::vector<size_t> cornerStart(static_cast<size_t>(chunkCount + 1), 0);
+    for (int i = 0; i < chunkCount; i++)
+    {
+        positionStart[i+1] = positionStart[i] + static_cast<int>(chunks[i].positions.size());
+        uvStart[i+1] = uvStart[i] + static_cast<int>(chunks[i].uvs.size() / 2);
+        normalStart[i+1] = normalStart[i] + static_cast<int>(chunks[i].normals.size());
+        cornerStart[i+1] = cornerStart[i] + chunks[i].corners.size();
+    }
+
+    TriangleMesh* mesh = new TriangleMesh(material);
+    mesh->positions.resize(static_cast<size_t>(positionStart[chunkCount]));
+    mesh->uvs.resize(2 * static_cast<size_t>(uvStart[chunkCount]));
+    mesh->normals.resize(static_cast<size_t>(normalStart[chunkCount]));
+    mesh->corners.resize(cornerStart[chunkCount]);
+
+    const int counts[3] = { positionStart[chunkCount], uvStart[chunkCount], normalStart[chunkCount] };
+    int invalid = 0;
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(threadCount) reduction(+:invalid)
+    for (int i = 0; i < chunkCount; i++)
+    {
+        const ObjChunk& chunk = chunks[i];
+        std::copy(chunk.positions.begin(), chunk.positions.end(), mesh->positions.begin() + positionStart[i]);
+        std::copy(chunk.uvs.begin(), chunk.uvs.end(), mesh->uvs.begin() + 2 * uvStart[i]);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), mesh->normals.begin() + normalStart[i]);
+
+        const int starts[3] = { positionStart[i], uvStart[i], normalStart[i] };
+        for (size_t k = 0; k < chunk.corners.size(); k++)
+        {
+            const ObjCorner& c = chunk.corners[k];
+            int index[3];
+            for (int a = 0; a < 3; a++)
+            {
+                index[a] = c.relative[a] ? starts[a] + c.index[a] : c.index[a];
+                if (index[a] >= counts[a] || (index[a] < 0 && (a == 0 || c.relative[a])))
+                    invalid++;
+            }
+
+            MeshCorner& corner = mesh->corners[cornerStart[i] + k];
+            corner.position = index[0];
+            corner.uv = index[1] < 0 ? -1 : index[1];
+            corner.normal = index[2] < 0 ? -1 : index[2];
+        }
+    }
+
+    if (invalid > 0)
+    {
+        std::cerr << fileName << ": " << invalid << " face indices out of range" << std::endl;
+        delete mesh;
+        return nullptr;
+    }
+
+    return mesh;
+
+}
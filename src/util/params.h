@@ -20,6 +20,8 @@ SOFTWARE.
 #pragma once
 
 #include <memory>
+#include <string>
+#include "util/arena.h"
 #include "util/window.h"
 
 // Rendering parameters.
@@ -32,16 +34,26 @@ class RParams
         std::unique_ptr<Image> image;
         std::unique_ptr<Camera> cam;
         std::unique_ptr<Renderer> renderer;
+        std::unique_ptr<SceneArena> arena;          // owns a generated world
         std::unique_ptr<Hitable> world;
+        std::unique_ptr<MaterialTable> materials;   // of world, used by renderer
 
         Hitable** list;
 
         ~RParams()
         {
-            image.release();
-            cam.release();
-            renderer.release();
-            world.release();
+            #ifdef CUDA_ENABLED
+                // Freed by destroyWorldCuda.
+                image.release();
+                cam.release();
+                renderer.release();
+                world.release();
+            #else
+                // A generated world goes away with the arena in one go,
+                // only a scene cache is deleted.
+                if (arena)
+                    world.release();
+            #endif // CUDA_ENABLED
         }
 
 };
@@ -57,17 +69,41 @@ class LParams
         bool writeImagePNG;
         bool writeEveryImageToFile;
         bool moveCamera;
+        RenderMode renderMode;
+        std::string sceneCache;         // scene snapshot to load, or to write if missing
+        bool packetTracing;             // primary rays in packets, see Renderer::packets
+        bool wavefront;                 // paths in wavefront batches, see Renderer::wavefront
+        int reorderBatch;               // sorted secondary rays per chunk, see Wavefront::reorderBatch
+        bool tiles;                     // render in tiles with a TileScheduler, see Renderer::tiles
+        int tileSize;                   // width and height of the tiles in pixels
+        TileOrder tileOrder;
 
         LParams(bool showWindow,
                 bool writeImagePPM,
                 bool writeImagePNG,
                 bool writeEveryImageToFile,
-                bool moveCamera) :
+                bool moveCamera,
+                RenderMode renderMode = PATH_TRACING,
+                const std::string& sceneCache = "",
+                bool packetTracing = false,
+                bool wavefront = false,
+                int reorderBatch = 0,
+                bool tiles = true,
+                int tileSize = 16,
+                TileOrder tileOrder = TILE_ORDER_HILBERT) :
                 showWindow(showWindow),
                 writeImagePPM(writeImagePPM),
                 writeImagePNG(writeImagePNG),
                 writeEveryImageToFile(writeEveryImageToFile),
-                moveCamera(moveCamera)
+                moveCamera(moveCamera),
+                renderMode(renderMode),
+                sceneCache(sceneCache),
+                packetTracing(packetTracing),
+                wavefront(wavefront),
+                reorderBatch(reorderBatch),
+                tiles(tiles),
+                tileSize(tileSize),
+                tileOrder(tileOrder)
         {
 
         }
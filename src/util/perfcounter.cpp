@@ -0,0 +1,132 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <omp.h>
+
+#include "util/perfcounter.h"
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #include <string.h>
+
+    // Counts event for the calling thread, returns -1 if that's not allowed.
+    static int openCounter(PerfCounter::Event event)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        if (event == PerfCounter::CACHE_MISSES)
+        {
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        }
+        else
+        {
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        }
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif // __linux__
+
+PerfCounter::PerfCounter(Event event) : event(event), isAvailable(false), count(0)
+{
+
+}
+
+PerfCounter::~PerfCounter()
+{
+
+    close();
+
+}
+
+void PerfCounter::close()
+{
+
+#ifdef __linux__
+    for (int fd : descriptors)
+        if (fd >= 0)
+            ::close(fd);
+#endif // __linux__
+    descriptors.clear();
+
+}
+
+void PerfCounter::start()
+{
+
+    close();
+    count = 0;
+    isAvailable = false;
+
+#ifdef __linux__
+    descriptors.assign(static_cast<size_t>(omp_get_max_threads()), -1);
+
+    // The counters follow the thread that opens them, so every thread of
+    // the team opens its own.
+    #pragma omp parallel
+    {
+        int thread = omp_get_thread_num();
+        if (thread < static_cast<int>(descriptors.size()))
+            descriptors[thread] = openCounter(event);
+    }
+
+    isAvailable = true;
+    for (int fd : descriptors)
+        isAvailable = isAvailable && fd >= 0;
+    if (!isAvailable)
+    {
+        close();
+        return;
+    }
+
+    for (int fd : descriptors)
+    {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif // __linux__
+
+}
+
+void PerfCounter::stop()
+{
+
+#ifdef __linux__
+    for (int fd : descriptors)
+    {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long value = 0;
+        if (read(fd, &value, sizeof(value)) == sizeof(value))
+            count += value;
+    }
+#endif // __linux__
+    close();
+
+}
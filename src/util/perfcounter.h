@@ -0,0 +1,65 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+// Hardware event counter read through perf_event_open on Linux. start()
+// opens one counter per OpenMP thread so the misses of a parallel loop are
+// all counted. available() is false where the counters can't be opened,
+// like on other systems, in most virtual machines or with a restrictive
+// perf_event_paranoid setting.
+class PerfCounter
+{
+
+    public:
+
+        enum Event
+        {
+            CACHE_MISSES,       // last level cache misses
+            L1D_READ_MISSES
+        };
+
+        PerfCounter(Event event);
+        ~PerfCounter();
+
+        void start();
+        void stop();
+
+        bool available() const
+        {
+            return isAvailable;
+        }
+
+        long long value() const
+        {
+            return count;
+        }
+
+    private:
+
+        void close();
+
+        Event event;
+        std::vector<int> descriptors;
+        bool isAvailable;
+        long long count;
+
+};
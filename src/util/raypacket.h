@@ -0,0 +1,73 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "util/ray.h"
+
+// Rays per packet, one AVX2 register of floats.
+const int rayPacketSize = 8;
+
+// Up to rayPacketSize coherent rays, e.g. the primary rays of neighboring
+// pixels, traced through the acceleration structures together. The rays are
+// kept as given and as structure of arrays for the SIMD kernels. Lanes not
+// set in active are ignored, their arrays hold a harmless dummy ray. The
+// arrays are aligned on the stack, but the kernels load them unaligned since
+// std::vector doesn't keep the alignment before C++17.
+struct RayPacket
+{
+
+    RayPacket() : active(0)
+    {
+        for (int k = 0; k < rayPacketSize; k++)
+        {
+            originX[k] = originY[k] = originZ[k] = 0.0f;
+            directionX[k] = directionY[k] = directionZ[k] = 1.0f;
+            invDirX[k] = invDirY[k] = invDirZ[k] = 1.0f;
+        }
+    }
+
+    void set(int lane, const Ray& r)
+    {
+        rays[lane] = r;
+        originX[lane] = r.origin().x();
+        originY[lane] = r.origin().y();
+        originZ[lane] = r.origin().z();
+        directionX[lane] = r.direction().x();
+        directionY[lane] = r.direction().y();
+        directionZ[lane] = r.direction().z();
+        invDirX[lane] = 1.0f / directionX[lane];
+        invDirY[lane] = 1.0f / directionY[lane];
+        invDirZ[lane] = 1.0f / directionZ[lane];
+        active |= 1 << lane;
+    }
+
+    Ray rays[rayPacketSize];
+    alignas(32) float originX[rayPacketSize];
+    alignas(32) float originY[rayPacketSize];
+    alignas(32) float originZ[rayPacketSize];
+    alignas(32) float directionX[rayPacketSize];
+    alignas(32) float directionY[rayPacketSize];
+    alignas(32) float directionZ[rayPacketSize];
+    alignas(32) float invDirX[rayPacketSize];
+    alignas(32) float invDirY[rayPacketSize];
+    alignas(32) float invDirZ[rayPacketSize];
+    int active;         // bit k is set if lane k holds a ray
+
+};
@@ -21,6 +21,7 @@ SOFTWARE.
 #include "util/params.h"
 #include "util/globals.h"
 #include "util/scene.h"
+#include "util/wavefront.h"
 
 #ifdef CUDA_ENABLED
 
@@ -41,7 +42,7 @@ SOFTWARE.
             float v = float(j + rng.get1f()) / float(rParams.image->ny); // bottom to top
             Ray r = rParams.cam->getRay(rng, u, v);
 
-            rParams.image->pixels[pixelIndex] += color(rng, r, rParams.world.get(), 0);
+            rParams.image->pixels[pixelIndex] += shade(rng, r, rParams.world.get());
         }
 
         Vec3 col = rParams.image->pixels[pixelIndex] / sampleCount;
@@ -50,6 +51,130 @@ SOFTWARE.
 
     }
 
+    void Renderer::renderPacket(int i, int j,
+                                RParams& rParams,
+                                int sampleCount)
+    {
+
+        const int width = rParams.image->nx;
+        const int height = rParams.image->ny;
+
+        // The same samples as render() of each pixel, only the primary rays
+        // are traced together.
+        for (int s = 0; s < nsBatch; s++)
+        {
+            RayPacket packet;
+            RandomGenerator rngs[rayPacketSize];
+            int pixelIndices[rayPacketSize];
+            for (int k = 0; k < rayPacketSize; k++)
+            {
+                int x = i + k % packetTileWidth;
+                int y = j + k / packetTileWidth;
+                if (x >= width || y >= height)
+                    continue;
+
+                pixelIndices[k] = y*nx + x;
+                rngs[k] = RandomGenerator(sampleCount * nsBatch + s, pixelIndices[k]);
+                float u = float(x + rngs[k].get1f()) / float(width);
+                float v = float(y + rngs[k].get1f()) / float(height);
+                packet.set(k, rParams.cam->getRay(rngs[k], u, v));
+            }
+
+            Vec3 colors[rayPacketSize];
+            shadePacket(rngs, packet, rParams.world.get(), colors);
+            for (int k = 0; k < rayPacketSize; k++)
+                if (packet.active >> k & 1)
+                    rParams.image->pixels[pixelIndices[k]] += colors[k];
+        }
+
+        for (int k = 0; k < rayPacketSize; k++)
+        {
+            int x = i + k % packetTileWidth;
+            int y = j + k / packetTileWidth;
+            if (x < width && y < height)
+                rParams.image->pixels2[y*nx + x] = rParams.image->pixels[y*nx + x] / sampleCount;
+        }
+
+    }
+
+    void Renderer::renderWavefront(int i, int j,
+                                   RParams& rParams,
+                                   int sampleCount)
+    {
+
+        const int width = rParams.image->nx;
+        const int height = rParams.image->ny;
+        const int iEnd = std::min(i + tx, width);
+        const int jEnd = std::min(j + ty, height);
+
+        // Slot (s, pixel of the tile) of every path, the colors are added in
+        // sample order like in render().
+        Wavefront batch;
+        batch.reorderBatch = reorderBatch;
+        for (int s = 0; s < nsBatch; s++)
+        {
+            for (int y = j; y < jEnd; y++)
+            {
+                for (int x = i; x < iEnd; x++)
+                {
+                    RandomGenerator rng(sampleCount * nsBatch + s, y*nx + x);
+                    float u = float(x + rng.get1f()) / float(width);
+                    float v = float(y + rng.get1f()) / float(height);
+                    Ray r = rParams.cam->getRay(rng, u, v);
+                    batch.add(r, rng, (s * ty + y - j) * tx + x - i);
+                }
+            }
+        }
+
+        Vec3 colors[nsBatch * tx * ty];
+        batch.trace(*this, rParams.world.get(), colors);
+
+        for (int y = j; y < jEnd; y++)
+        {
+            for (int x = i; x < iEnd; x++)
+            {
+                int pixelIndex = y*nx + x;
+                for (int s = 0; s < nsBatch; s++)
+                    rParams.image->pixels[pixelIndex] += colors[(s * ty + y - j) * tx + x - i];
+                rParams.image->pixels2[pixelIndex] = rParams.image->pixels[pixelIndex] / sampleCount;
+            }
+        }
+
+    }
+
+    void Renderer::renderTile(const Tile& tile,
+                              RParams& rParams,
+                              int firstPass,
+                              int lastPass)
+    {
+
+        // The samples of each pixel are added in the order of render().
+        for (int pass = firstPass; pass <= lastPass; pass++)
+        {
+            for (int s = 0; s < nsBatch; s++)
+            {
+                for (int y = tile.y0; y < tile.y1; y++)
+                {
+                    for (int x = tile.x0; x < tile.x1; x++)
+                    {
+                        int pixelIndex = y*nx + x;
+                        RandomGenerator rng(pass * nsBatch + s, pixelIndex);
+                        float u = float(x + rng.get1f()) / float(rParams.image->nx);
+                        float v = float(y + rng.get1f()) / float(rParams.image->ny);
+                        Ray r = rParams.cam->getRay(rng, u, v);
+
+                        rParams.image->pixels[pixelIndex] += shade(rng, r, rParams.world.get());
+                    }
+                }
+            }
+        }
+
+        for (int y = tile.y0; y < tile.y1; y++)
+            for (int x = tile.x0; x < tile.x1; x++)
+                rParams.image->pixels2[y*nx + x] = rParams.image->pixels[y*nx + x] / lastPass;
+
+    }
+
     CUDA_HOSTDEV void Renderer::display(int i, int j, std::unique_ptr<Image>& image)
     {
 
@@ -88,22 +213,69 @@ SOFTWARE.
 #endif // CUDA_ENABLED
 
 CUDA_HOSTDEV bool Renderer::traceRays(RParams& rParams,
-                                      int sampleCount)
+                                      int sampleCount,
+                                      int passes)
 
 {
 
+    int lastPass = sampleCount + passes - 1;
+
     #ifdef CUDA_ENABLED
-        traceRaysCuda(rParams, sampleCount);
+        for (int pass = sampleCount; pass <= lastPass; pass++)
+            traceRaysCuda(rParams, pass);
     #else
-        // collapses the two nested fors into the same parallel for
-        #pragma omp parallel for collapse(2)
-        // j track rows - from top to bottom
-        for (int j = 0; j < rParams.image->ny; j++)
+        if (wavefront && mode == PATH_TRACING)
         {
-            // i tracks columns - left to right
-            for (int i = 0; i < rParams.image->nx; i++)
+            for (int pass = sampleCount; pass <= lastPass; pass++)
+            {
+                #pragma omp parallel for collapse(2) schedule(dynamic)
+                for (int j = 0; j < rParams.image->ny; j += ty)
+                {
+                    for (int i = 0; i < rParams.image->nx; i += tx)
+                    {
+                        renderWavefront(i, j, rParams, pass);
+                    }
+                }
+            }
+        }
+        else if (packets)
+        {
+            for (int pass = sampleCount; pass <= lastPass; pass++)
+            {
+                #pragma omp parallel for collapse(2)
+                for (int j = 0; j < rParams.image->ny; j += packetTileHeight)
+                {
+                    for (int i = 0; i < rParams.image->nx; i += packetTileWidth)
+                    {
+                        renderPacket(i, j, rParams, pass);
+                    }
+                }
+            }
+        }
+        else if (tiles)
+        {
+            // One parallel region for all passes instead of one per pass.
+            TileScheduler scheduler(rParams.image->nx, rParams.image->ny, tileWidth, tileHeight, tileOrder);
+            scheduler.run([&](const Tile& tile)
+            {
+                renderTile(tile, rParams, sampleCount, lastPass);
+            });
+        }
+        else
+        {
+            for (int pass = sampleCount; pass <= lastPass; pass++)
             {
-                render(i, j, rParams, sampleCount);
+                // collapses the two nested fors into the same parallel for
+                #pragma omp parallel for collapse(2)
+                // j track rows - from top to bottom
+                for (int j = 0; j < rParams.image->ny; j++)
+                {
+                    // i tracks columns - left to right
+                    for (int i = 0; i < rParams.image->nx; i++)
+                    {
+                        render(i, j, rParams, pass);
+                    }
+                }
             }
         }
 
@@ -115,7 +115,8 @@ CUDA_DEV int numHitables = 0;
         checkCudaErrors(cudaMallocManaged(&rendererPointer, sizeof(Renderer)));
         new (rendererPointer) Renderer(lParams.showWindow,
                                        lParams.writeImagePPM,
-                                       lParams.writeImagePNG);
+                                       lParams.writeImagePNG,
+                                       lParams.renderMode);
         rParams.renderer.reset(rendererPointer);
 
         // Image
@@ -192,7 +193,7 @@ CUDA_DEV int numHitables = 0;
             float v = float(j + rng.get1f()) / float(image->ny); // bottom to top
             Ray r = cam->getRay(rng, u, v);
 
-            image->pixels[pixelIndex] += renderer->color(rng, r, world, 0);
+            image->pixels[pixelIndex] += renderer->shade(rng, r, world);
         }
 
         Vec3 col = image->pixels[pixelIndex] / (sampleCount * nsBatch);
@@ -29,11 +29,24 @@ SOFTWARE.
 #include "util/camera.h"
 #include "util/image.h"
 #include "util/randomgenerator.h"
+#include "util/tilescheduler.h"
 #include "materials/material.h"
+#include "materials/materialtable.h"
 #include "hitables/sphere.h"
 
 class RParams;
 
+// Pixels of the tiles whose primary rays are traced as one packet.
+const int packetTileWidth = 4;
+const int packetTileHeight = 2;
+static_assert(packetTileWidth * packetTileHeight == rayPacketSize, "a tile should fill a packet");
+
+enum RenderMode
+{
+    PATH_TRACING,
+    AMBIENT_OCCLUSION   // one primary hit and a few occlusion rays per sample
+};
+
 class Renderer
 {
     bool showWindow;
@@ -41,14 +54,39 @@ class Renderer
     bool writeImagePNG;
 
     public:
+        RenderMode mode;
+        int aoSamples = 1;          // occlusion rays per sample, the frames average them
+        float aoDistance = 2.0f;    // occluders further away are ignored
+        const MaterialTable* materials = nullptr;   // shades the bound hits if set
+        bool packets = false;       // trace the primary rays of the tiles in packets
+        bool wavefront = false;     // trace the paths of tx*ty tiles with a Wavefront, PATH_TRACING only
+        int reorderBatch = 0;       // Wavefront::reorderBatch of the wavefront tiles
+        bool tiles = true;          // render tileWidth*tileHeight tiles with a TileScheduler
+        int tileWidth = 16;
+        int tileHeight = 16;
+        TileOrder tileOrder = TILE_ORDER_HILBERT;
+
         CUDA_HOSTDEV Renderer(bool showWindow,
                               bool writeImagePPM,
-                              bool writeImagePNG) :
+                              bool writeImagePNG,
+                              RenderMode mode = PATH_TRACING) :
                               showWindow(showWindow),
                               writeImagePPM(writeImagePPM),
-                              writeImagePNG(writeImagePNG)
+                              writeImagePNG(writeImagePNG),
+                              mode(mode)
+        {
+
+        }
+
+        CUDA_DEV Vec3 shade(RandomGenerator& rng,
+                            const Ray& r,
+                            Hitable* world)
         {
 
+            if (mode == AMBIENT_OCCLUSION)
+                return ambientOcclusion(rng, r, world);
+            return color(rng, r, world, 0);
+
         }
 
         CUDA_DEV Vec3 color(RandomGenerator& rng,
@@ -57,37 +95,125 @@ class Renderer
                             int depth)
         {
 
+            HitRecord rec;
+            if (!world->hit(r, 0.001f, FLT_MAX, rec))
+                return background(r);
+            return colorFromHit(rng, r, rec, world);
+
+        }
+
+        // color() from the first hit rec of r on.
+        CUDA_DEV Vec3 colorFromHit(RandomGenerator& rng,
+                                   const Ray& r,
+                                   HitRecord& rec,
+                                   Hitable* world)
+        {
+
             Ray curRay = r;
             Vec3 curAttenuation = Vec3(1.0f, 1.0f, 1.0f);
             for (int i = 0; i < 50; i++)
             {
-                HitRecord rec;
-                if (world->hit(curRay, 0.001f, FLT_MAX, rec))
+                if (i > 0 && !world->hit(curRay, 0.001f, FLT_MAX, rec))
+                    return curAttenuation * background(curRay);
+
+                Ray scattered;
+                Vec3 attenuation;
+                bool scatters = materials && rec.materialId != invalidMaterialId ?
+                                materials->scatter(rec.materialId, rng, curRay, rec, attenuation, scattered) :
+                                rec.matPtr->scatter(rng, curRay, rec, attenuation, scattered);
+                if (scatters)
                 {
-                    Ray scattered;
-                    Vec3 attenuation;
-                    if (rec.matPtr->scatter(rng, curRay, rec, attenuation, scattered))
-                    {
-                        curAttenuation *= attenuation;
-                        curRay = scattered;
-                    }
-                    else
-                        return Vec3(0.0f, 0.0f, 0.0f);
+                    curAttenuation *= attenuation;
+                    curRay = scattered;
                 }
                 else
-                {
-                    Vec3 unit_direction = unitVector(curRay.direction());
-                    float t = 0.5f * (unit_direction.y() + 1.0f);
-                    Vec3 c = (1.0f-t) * Vec3(1.0f, 1.0f, 1.0f) + t*Vec3(0.5f, 0.7f, 1.0f);
-                    return curAttenuation * c;
-                }
+                    return Vec3(0.0f, 0.0f, 0.0f);
             }
             return Vec3(0.0f, 0.0f, 0.0f); // Exceeded recursion
 
         }
 
+        // Sky color of the rays leaving the scene.
+        CUDA_DEV Vec3 background(const Ray& r) const
+        {
+
+            Vec3 unit_direction = unitVector(r.direction());
+            float t = 0.5f * (unit_direction.y() + 1.0f);
+            return (1.0f-t) * Vec3(1.0f, 1.0f, 1.0f) + t*Vec3(0.5f, 0.7f, 1.0f);
+
+        }
+
+        // Fraction of cosine distributed rays leaving the primary hit point
+        // that escape within aoDistance. Only the primary ray needs a full
+        // HitRecord, the rest are any-hit queries.
+        CUDA_DEV Vec3 ambientOcclusion(RandomGenerator& rng,
+                                       const Ray& r,
+                                       Hitable* world)
+        {
+
+            HitRecord rec;
+            if (!world->hit(r, 0.001f, FLT_MAX, rec))
+                return background(r);
+            return ambientOcclusionFromHit(rng, r, rec, world);
+
+        }
+
+        CUDA_DEV Vec3 ambientOcclusionFromHit(RandomGenerator& rng,
+                                              const Ray& r,
+                                              const HitRecord& rec,
+                                              Hitable* world)
+        {
+
+            // Face the normal towards the ray, the spheres of the
+            // dielectrics are hit from the inside too.
+            Vec3 normal = dot(rec.normal, r.direction()) > 0.0f ? -rec.normal : rec.normal;
+
+            int unoccluded = 0;
+            for (int i = 0; i < aoSamples; i++)
+            {
+                Vec3 direction = normal + rng.randomInUnitSphere();
+                if (!world->occluded(Ray(rec.point, direction, r.time()), 0.001f, aoDistance))
+                    unoccluded++;
+            }
+
+            float visibility = float(unoccluded) / float(aoSamples);
+            return Vec3(visibility, visibility, visibility);
+
+        }
+
+        #ifndef CUDA_ENABLED
+            // shade() for the active rays of a packet, writes colors[lane]. The
+            // primary hits are traced together, the bounces after them are not
+            // coherent any more and are traced one ray at a time.
+            void shadePacket(RandomGenerator* rngs,
+                             const RayPacket& packet,
+                             Hitable* world,
+                             Vec3* colors)
+            {
+
+                HitRecord recs[rayPacketSize];
+                int hits = world->hitPacket(packet, 0.001f, FLT_MAX, recs);
+                for (int k = 0; k < rayPacketSize; k++)
+                {
+                    if (!(packet.active >> k & 1))
+                        continue;
+                    if (!(hits >> k & 1))
+                        colors[k] = background(packet.rays[k]);
+                    else if (mode == AMBIENT_OCCLUSION)
+                        colors[k] = ambientOcclusionFromHit(rngs[k], packet.rays[k], recs[k], world);
+                    else
+                        colors[k] = colorFromHit(rngs[k], packet.rays[k], recs[k], world);
+                }
+
+            }
+        #endif // CUDA_ENABLED
+
+        // Renders the sample passes sampleCount to sampleCount + passes - 1
+        // and displays the image. In tiles every tile renders all its passes
+        // before the next tile.
         CUDA_HOSTDEV bool traceRays(RParams& RParams,
-                                    int sampleCount);
+                                    int sampleCount,
+                                    int passes = 1);
 
         #ifdef CUDA_ENABLED
             void traceRaysCuda(RParams& RParams,
@@ -96,6 +222,21 @@ class Renderer
             CUDA_HOSTDEV void render(int i, int j,
                                      RParams& rParams,
                                      int sampleCount);
+            // render() of the packet tile with its lower left pixel at i, j.
+            void renderPacket(int i, int j,
+                              RParams& rParams,
+                              int sampleCount);
+            // render() of the tx*ty tile with its lower left pixel at i, j,
+            // all its samples traced as one Wavefront batch.
+            void renderWavefront(int i, int j,
+                                 RParams& rParams,
+                                 int sampleCount);
+            // render() of every pixel of tile for the passes firstPass to
+            // lastPass, one pass over the whole tile after the other.
+            void renderTile(const Tile& tile,
+                            RParams& rParams,
+                            int firstPass,
+                            int lastPass);
             CUDA_HOSTDEV void display(int i, int j,
                                       std::unique_ptr<Image>& image);
         #endif // CUDA_ENABLED
@@ -20,43 +20,53 @@ SOFTWARE.
 #pragma once
 
 #include <float.h>
+#include <algorithm>
+#include <vector>
 
-#include "hitables/bvh.h"
+#include "hitables/accelerator.h"
 #include "hitables/hitablelist.h"
+#include "hitables/instance.h"
+#include "hitables/movingsphere.h"
 #include "hitables/sphere.h"
+#include "hitables/trianglemesh.h"
 #include "materials/material.h"
 #include "materials/texture.h"
+#include "util/arena.h"
 #include "util/randomgenerator.h"
 #include "util/common.h"
 
 #include "stb_image.h"
 #include "stb_image_write.h"
 
-CUDA_HOSTDEV inline Hitable* simpleScene()
+// The scenes make their objects with sceneNew(), so a SceneArena::Scope
+// around a call puts the whole scene, acceleration structure included,
+// into that arena.
+
+CUDA_HOSTDEV inline Hitable* simpleScene(const BVHBuildParams& params = BVHBuildParams())
 {
 
-    Hitable** list = new Hitable*[4];
-    list[0] = new Sphere(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, new Lambertian(new ConstantTexture(Vec3(0.5f, 0.5f, 0.5f))));
-    list[1] = new Sphere(Vec3(0.0f, 1.0f, 0.0f), 1.0f, new Dielectric(1.5f));
-    list[2] = new Sphere(Vec3(-4.0f, 1.0f, 0.0f), 1.0f, new Lambertian(new ConstantTexture(Vec3(0.4f, 0.2f, 0.1f))));
-    list[3] = new Sphere(Vec3(4.0f, 1.0f, 0.0f), 1.0f, new Metal(Vec3(0.7f, 0.6f, 0.5f), 0.0f));
+    Hitable** list = sceneNewArray<Hitable*>(4);
+    list[0] = sceneNew<Sphere>(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.5f, 0.5f, 0.5f))));
+    list[1] = sceneNew<Sphere>(Vec3(0.0f, 1.0f, 0.0f), 1.0f, sceneNew<Dielectric>(1.5f));
+    list[2] = sceneNew<Sphere>(Vec3(-4.0f, 1.0f, 0.0f), 1.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.4f, 0.2f, 0.1f))));
+    list[3] = sceneNew<Sphere>(Vec3(4.0f, 1.0f, 0.0f), 1.0f, sceneNew<Metal>(Vec3(0.7f, 0.6f, 0.5f), 0.0f));
 
     //return new hitableList(list, 4);
-    return new BVHNode(list, 4, 0.0, 1.0);
+    return buildAccelerator(list, 4, 0.0f, 1.0f, params);
 
 }
 
-CUDA_HOSTDEV inline Hitable* simpleScene2()
+CUDA_HOSTDEV inline Hitable* simpleScene2(const BVHBuildParams& params = BVHBuildParams())
 {
 
     RandomGenerator rng;
 
     int n = 20;
-    Hitable** list = new Hitable*[n];
-    list[0] = new Sphere(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, new Lambertian(new ConstantTexture(Vec3(0.5f, 0.5f, 0.5f))));
-    list[1] = new Sphere(Vec3(0.0f, 1.0f, 0.0f), 1.0f, new Dielectric(1.5f));
-    list[2] = new Sphere(Vec3(-4.0f, 1.0f, 0.0f), 1.0f, new Lambertian(new ConstantTexture(Vec3(0.4f, 0.2f, 0.1f))));
-    list[3] = new Sphere(Vec3(4.0f, 1.0f, 0.0f), 1.0f, new Metal(Vec3(0.7f, 0.6f, 0.5f), 0.0f));
+    Hitable** list = sceneNewArray<Hitable*>(n);
+    list[0] = sceneNew<Sphere>(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.5f, 0.5f, 0.5f))));
+    list[1] = sceneNew<Sphere>(Vec3(0.0f, 1.0f, 0.0f), 1.0f, sceneNew<Dielectric>(1.5f));
+    list[2] = sceneNew<Sphere>(Vec3(-4.0f, 1.0f, 0.0f), 1.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.4f, 0.2f, 0.1f))));
+    list[3] = sceneNew<Sphere>(Vec3(4.0f, 1.0f, 0.0f), 1.0f, sceneNew<Metal>(Vec3(0.7f, 0.6f, 0.5f), 0.0f));
     int i = 4;
 
     for (int a = -2; a < 2; a++)
@@ -69,33 +79,33 @@ CUDA_HOSTDEV inline Hitable* simpleScene2()
             {
                 if (chooseMat < 0.5f)            // diffuse
                 {
-                    list[i++] = new Sphere(center, 0.2f, new Lambertian(new ConstantTexture(Vec3(rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f()))));
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f()))));
                 }
                 else if (chooseMat < 0.75f)      // metal
                 {
-                    list[i++] = new Sphere(center, 0.2f, new Metal(Vec3(0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()))));
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Metal>(Vec3(0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()))));
                 }
                 else                            // glass
                 {
-                    list[i++] = new Sphere(center, 0.2f, new Dielectric(1.5f));
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Dielectric>(1.5f));
                 }
             }
         }
     }
 
     //return new hitableList(list, count);
-    return new BVHNode(list, i, 0.0, 1.0);
+    return buildAccelerator(list, i, 0.0f, 1.0f, params);
 
 }
 
-inline Hitable* randomScene()
+inline Hitable* randomScene(const BVHBuildParams& params = BVHBuildParams())
 {
 
     RandomGenerator rng;
 
     int n = 1000;
-    Hitable** list = new Hitable*[n];
-    list[0] = new Sphere(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, new Lambertian(new ConstantTexture(Vec3(0.5f, 0.5f, 0.5f))));
+    Hitable** list = sceneNewArray<Hitable*>(n);
+    list[0] = sceneNew<Sphere>(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.5f, 0.5f, 0.5f))));
     int i = 1;
     for (int a = -15; a < 15; a++)
     {
@@ -107,42 +117,255 @@ inline Hitable* randomScene()
             {
                 if (chooseMat < 0.5f)            // diffuse
                 {
-                    list[i++] = new Sphere(center, 0.2f, new Lambertian(new ConstantTexture(Vec3(rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f()))));
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f()))));
                 }
                 else if (chooseMat < 0.75f)      // metal
                 {
-                    list[i++] = new Sphere(center, 0.2f, new Metal(Vec3(0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()))));
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Metal>(Vec3(0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()))));
                 }
                 else                            // glass
                 {
-                    list[i++] = new Sphere(center, 0.2f, new Dielectric(1.5f));
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Dielectric>(1.5f));
                 }
             }
         }
     }
 
-    list[i++] = new Sphere(Vec3(0.0f, 1.0f, 0.0f), 1.0f, new Dielectric(1.5f));
-    list[i++] = new Sphere(Vec3(-4.0f, 1.0f, 0.0f), 1.0f, new Lambertian(new ConstantTexture(Vec3(0.4f, 0.2f, 0.1f))));
-    list[i++] = new Sphere(Vec3(4.0f, 1.0f, 0.0f), 1.0f, new Metal(Vec3(0.7f, 0.6f, 0.5f), 0.0f));
+    list[i++] = sceneNew<Sphere>(Vec3(0.0f, 1.0f, 0.0f), 1.0f, sceneNew<Dielectric>(1.5f));
+    list[i++] = sceneNew<Sphere>(Vec3(-4.0f, 1.0f, 0.0f), 1.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.4f, 0.2f, 0.1f))));
+    list[i++] = sceneNew<Sphere>(Vec3(4.0f, 1.0f, 0.0f), 1.0f, sceneNew<Metal>(Vec3(0.7f, 0.6f, 0.5f), 0.0f));
 
     //return new hitableList(list, i);
-    return new BVHNode(list, i, 0.0, 1.0);
+    return buildAccelerator(list, i, 0.0f, 1.0f, params);
 
 }
 
+inline Hitable* randomSceneWithMovingSpheres(const BVHBuildParams& params = BVHBuildParams())
+{
+
+    RandomGenerator rng;
+
+    int n = 200;
+    Hitable** list = sceneNewArray<Hitable*>(n);
+    list[0] = sceneNew<Sphere>(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.5f, 0.5f, 0.5f))));
+    list[1] = sceneNew<Sphere>(Vec3(0.0f, 1.0f, 0.0f), 1.0f, sceneNew<Dielectric>(1.5f));
+    list[2] = sceneNew<Sphere>(Vec3(-4.0f, 1.0f, 0.0f), 1.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.3f, 0.0f, 0.0f))));
+    list[3] = sceneNew<Sphere>(Vec3(4.0f, 1.0f, 0.0f), 1.0f, sceneNew<Metal>(Vec3(0.4f, 0.5f, 0.6f), 0.0f));
+
+    int i = 4;
+    for (int a = -7; a < 7; a++)
+    {
+        for (int b = -7; b < 7; b++)
+        {
+            float chooseMat = rng.get1f();
+            Vec3 center(a+0.9f*rng.get1f(), 0.2f, b+0.9f*rng.get1f());
+            if ((center-Vec3(4.0f, 0.2f, 0.0f)).length() > 0.9f)
+            {
+                if (chooseMat < 0.33f)            // diffuse
+                {
+                    list[i++] = sceneNew<MovingSphere>(center, center+Vec3(0.0f, 0.5f*rng.get1f(), 0.0f), 0.0f, 1.0f,
+                                    0.2f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f()))));
+                }
+                else if (chooseMat < 0.88f)      // metal
+                {
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Metal>(Vec3(0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()))));
+                }
+                else                            // glass
+                {
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Dielectric>(1.5f));
+                }
+            }
+        }
+    }
+
+    return buildAccelerator(list, i, 0.0f, 1.0f, params);
+
+}
 
-inline Hitable* randomSceneTexture()
+// n small spheres scattered in a cube, all sharing one material. Used to
+// measure acceleration structure builds at large primitive counts.
+inline Hitable** sphereField(int n)
+{
+
+    RandomGenerator rng;
+
+    Material* material = sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.5f, 0.5f, 0.5f)));
+    float extent = cbrtf(float(n));
+    Hitable** list = sceneNewArray<Hitable*>(n);
+    for (int i = 0; i < n; i++)
+    {
+        Vec3 center(extent*rng.get1f(), extent*rng.get1f(), extent*rng.get1f());
+        list[i] = sceneNew<Sphere>(center, 0.1f + 0.3f*rng.get1f(), material);
+    }
+
+    return list;
+
+}
+
+// Like sphereField, but every sphere moves by displacement in a random
+// direction over the shutter interval. Used to measure motion blur.
+inline Hitable** movingSphereField(int n, float displacement)
+{
+
+    RandomGenerator rng;
+
+    Material* material = sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.5f, 0.5f, 0.5f)));
+    float extent = cbrtf(float(n));
+    Hitable** list = sceneNewArray<Hitable*>(n);
+    for (int i = 0; i < n; i++)
+    {
+        Vec3 center(extent*rng.get1f(), extent*rng.get1f(), extent*rng.get1f());
+        Vec3 motion = displacement * unitVector(rng.randomInUnitSphere());
+        list[i] = sceneNew<MovingSphere>(center, center + motion, 0.0f, 1.0f, 0.1f + 0.3f*rng.get1f(), material);
+    }
+
+    return list;
+
+}
+
+// A field of trees and rocks placed as instances of two shared assets.
+// Memory grows with the number of unique spheres, not with the instances.
+inline Hitable* instancedScene(const BVHBuildParams& params = BVHBuildParams())
+{
+
+    RandomGenerator rng;
+
+    InstancedScene* scene = sceneNew<InstancedScene>(params);
+
+    Hitable** ground = sceneNewArray<Hitable*>(1);
+    ground[0] = sceneNew<Sphere>(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.5f, 0.5f, 0.5f))));
+    scene->addInstance(scene->addGeometry(ground, 1, 0.0f, 1.0f), Transform());
+
+    // A trunk of stacked spheres and a canopy around its top.
+    int treeSize = 24;
+    Hitable** tree = sceneNewArray<Hitable*>(treeSize);
+    Material* bark = sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.4f, 0.25f, 0.1f)));
+    Material* leaves = sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.1f, 0.5f, 0.1f)));
+    for (int i = 0; i < 6; i++)
+        tree[i] = sceneNew<Sphere>(Vec3(0.0f, 0.15f + 0.3f*i, 0.0f), 0.15f, bark);
+    for (int i = 6; i < treeSize; i++)
+    {
+        Vec3 offset = rng.randomInUnitSphere();
+        tree[i] = sceneNew<Sphere>(Vec3(0.0f, 2.0f, 0.0f) + 0.6f*offset, 0.25f + 0.15f*rng.get1f(), leaves);
+    }
+    int treeGeometry = scene->addGeometry(tree, treeSize, 0.0f, 1.0f);
+
+    int rockSize = 8;
+    Hitable** rock = sceneNewArray<Hitable*>(rockSize);
+    Material* stone = sceneNew<Metal>(Vec3(0.5f, 0.5f, 0.55f), 0.3f);
+    for (int i = 0; i < rockSize; i++)
+    {
+        Vec3 offset = rng.randomInUnitSphere();
+        rock[i] = sceneNew<Sphere>(Vec3(0.4f*offset.x(), 0.2f, 0.4f*offset.z()), 0.15f + 0.1f*rng.get1f(), stone);
+    }
+    int rockGeometry = scene->addGeometry(rock, rockSize, 0.0f, 1.0f);
+
+    for (int a = -50; a < 50; a++)
+    {
+        for (int b = -50; b < 50; b++)
+        {
+            Vec3 position(a + 0.8f*rng.get1f(), 0.0f, b + 0.8f*rng.get1f());
+            if ((position - Vec3(4.0f, 0.0f, 0.0f)).length() < 1.5f)
+                continue;
+
+            float s = 0.2f + 0.2f*rng.get1f();
+            Transform t = Transform::translate(position) *
+                          Transform::rotate(Vec3(0.0f, 1.0f, 0.0f), 360.0f*rng.get1f()) *
+                          Transform::scale(Vec3(s, s, s));
+
+            // Some trees get another leaf color, the rocks keep their material.
+            if (rng.get1f() < 0.7f)
+            {
+                Material* color = nullptr;
+                if (rng.get1f() < 0.3f)
+                    color = sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.6f, 0.3f + 0.3f*rng.get1f(), 0.1f)));
+                scene->addInstance(treeGeometry, t, color);
+            }
+            else
+                scene->addInstance(rockGeometry, t);
+        }
+    }
+
+    scene->build(0.0f, 1.0f);
+
+    return scene;
+
+}
+
+// Positions of an animated object at evenly spaced frames, played in a loop.
+struct KeyframeTrack
+{
+
+    std::vector<Vec3> keys;
+
+    Vec3 at(float frame) const
+    {
+        int count = static_cast<int>(keys.size());
+        float loops = floorf(frame / count);
+        float f = frame - loops * count;
+        int k = static_cast<int>(f) % count;
+        float s = f - floorf(f);
+        return (1.0f - s) * keys[k] + s * keys[(k + 1) % count];
+    }
+
+};
+
+// n moving spheres, each following its own random keyframe track, used to
+// render frame sequences. The tracks are returned in tracks.
+inline Hitable** animatedSpheres(int n, std::vector<KeyframeTrack>& tracks, int keyCount = 8)
+{
+
+    RandomGenerator rng;
+
+    Material* material = sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.5f, 0.5f, 0.5f)));
+    float extent = 2.0f * cbrtf(float(n));
+    Hitable** list = sceneNewArray<Hitable*>(n);
+    tracks.assign(static_cast<size_t>(n), KeyframeTrack());
+    for (int i = 0; i < n; i++)
+    {
+        // Drift away from the start and come back at the end of the loop.
+        Vec3 start(extent*(rng.get1f() - 0.5f), extent*(rng.get1f() - 0.5f), extent*(rng.get1f() - 0.5f));
+        Vec3 velocity = 0.25f * rng.randomInUnitSphere();
+        for (int k = 0; k < keyCount; k++)
+        {
+            float phase = float(k < keyCount/2 ? k : keyCount - k);
+            tracks[i].keys.push_back(start + phase * velocity);
+        }
+        list[i] = sceneNew<MovingSphere>(start, start, 0.0f, 1.0f, 0.1f + 0.3f*rng.get1f(), material);
+    }
+
+    return list;
+
+}
+
+// Moves the spheres of animatedSpheres() to frame, with motion blur over
+// the shutter interval [0, 1] up to the next frame.
+inline void setKeyframe(Hitable** list, const std::vector<KeyframeTrack>& tracks, float frame)
+{
+
+    int n = static_cast<int>(tracks.size());
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++)
+    {
+        MovingSphere* sphere = static_cast<MovingSphere*>(list[i]);
+        sphere->center0 = tracks[i].at(frame);
+        sphere->center1 = tracks[i].at(frame + 1.0f);
+    }
+
+}
+
+inline Hitable* randomSceneTexture(const BVHBuildParams& params = BVHBuildParams())
 {
 
     RandomGenerator rng;
 
     int n = 104;
-    Hitable** list = new Hitable*[n];
-    Texture *checker = new CheckerTexture(
-        new ConstantTexture(Vec3(0.9, 0.05, 0.08)),
-        new ConstantTexture(Vec3(0.9, 0.9, 0.9))
+    Hitable** list = sceneNewArray<Hitable*>(n);
+    Texture *checker = sceneNew<CheckerTexture>(
+        sceneNew<ConstantTexture>(Vec3(0.9, 0.05, 0.08)),
+        sceneNew<ConstantTexture>(Vec3(0.9, 0.9, 0.9))
     );
-    list[0] = new Sphere(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, new Lambertian(checker));
+    list[0] = sceneNew<Sphere>(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, sceneNew<Lambertian>(checker));
     int i = 1;
     for (int a = -5; a < 5; a++)
     {
@@ -154,44 +377,137 @@ inline Hitable* randomSceneTexture()
             {
                 if (chooseMat < 0.5f)            // diffuse
                 {
-                    list[i++] = new Sphere(center, 0.2f, new Lambertian(new ConstantTexture(Vec3(rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f()))));
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f(), rng.get1f()*rng.get1f()))));
                 }
                 else if (chooseMat < 0.75f)      // metal
                 {
-                    list[i++] = new Sphere(center, 0.2f, new Metal(Vec3(0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()))));
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Metal>(Vec3(0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()), 0.5f*(1.0f+rng.get1f()))));
                 }
                 else                            // glass
                 {
-                    list[i++] = new Sphere(center, 0.2f, new Dielectric(1.5f));
+                    list[i++] = sceneNew<Sphere>(center, 0.2f, sceneNew<Dielectric>(1.5f));
                 }
             }
         }
     }
 
-    list[i++] = new Sphere(Vec3(0.0f, 1.0f, 0.0f), 1.0f, new Dielectric(1.5f));
-    list[i++] = new Sphere(Vec3(-4.0f, 1.0f, 0.0f), 1.0f, new Lambertian(new ConstantTexture(Vec3(0.4f, 0.2f, 0.1f))));
-    list[i++] = new Sphere(Vec3(4.0f, 1.0f, 0.0f), 1.0f, new Metal(Vec3(0.7f, 0.6f, 0.5f), 0.0f));
+    list[i++] = sceneNew<Sphere>(Vec3(0.0f, 1.0f, 0.0f), 1.0f, sceneNew<Dielectric>(1.5f));
+    list[i++] = sceneNew<Sphere>(Vec3(-4.0f, 1.0f, 0.0f), 1.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.4f, 0.2f, 0.1f))));
+    list[i++] = sceneNew<Sphere>(Vec3(4.0f, 1.0f, 0.0f), 1.0f, sceneNew<Metal>(Vec3(0.7f, 0.6f, 0.5f), 0.0f));
 
     //return new hitableList(list, i);
-    return new BVHNode(list, i, 0.0, 1.0);
+    return buildAccelerator(list, i, 0.0f, 1.0f, params);
+
+}
+
+inline Hitable* twoPerlinSpheres(const BVHBuildParams& params = BVHBuildParams())
+{
+    Texture* pertext = sceneNew<NoiseTexture>(1);
+    Hitable** list = sceneNewArray<Hitable*>(2);
+    list[0] = sceneNew<Sphere>(Vec3(0.0f,-1000.0f, 0.0f), 1000.0f, sceneNew<Lambertian>(pertext));
+    list[1] = sceneNew<Sphere>(Vec3(0.0f, 2.0f, 0.0f), 2.0f, sceneNew<Lambertian>(pertext));
 
+    return buildAccelerator(list, 2, 0.0f, 1.0f, params);
 }
 
-inline Hitable* twoPerlinSpheres()
+// Sphere tessellated into stacks*slices quads with vertex normals and uvs,
+// 2*stacks*slices - 2*slices triangles since the pole rows are fans.
+inline TriangleMesh* sphereMesh(const Vec3& center, float radius, int stacks, int slices,
+                                Material* material)
 {
-    Texture* pertext = new NoiseTexture(1);
-    Hitable** list = new Hitable*[2];
-    list[0] = new Sphere(Vec3(0.0f,-1000.0f, 0.0f), 1000.0f, new Lambertian(pertext));
-    list[1] = new Sphere(Vec3(0.0f, 2.0f, 0.0f), 2.0f, new Lambertian(pertext));
 
-    return new BVHNode(list, 2.0f, 0.0f, 1.0f);
+    TriangleMesh* mesh = sceneNew<TriangleMesh>(material);
+    int columns = slices + 1;
+    for (int i = 0; i <= stacks; i++)
+    {
+        float theta = float(M_PI) * float(i) / float(stacks);
+        for (int j = 0; j <= slices; j++)
+        {
+            float phi = 2.0f * float(M_PI) * float(j) / float(slices);
+            Vec3 normal(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+            mesh->positions.push_back(center + radius * normal);
+            mesh->normals.push_back(normal);
+            mesh->uvs.push_back(float(j) / float(slices));
+            mesh->uvs.push_back(1.0f - float(i) / float(stacks));
+        }
+    }
+
+    auto corner = [columns](int i, int j)
+    {
+        int index = i * columns + j;
+        MeshCorner c = { index, index, index };
+        return c;
+    };
+
+    // Wound counterclockwise seen from outside, so the face normals point out.
+    for (int i = 0; i < stacks; i++)
+    {
+        for (int j = 0; j < slices; j++)
+        {
+            if (i > 0)
+            {
+                mesh->corners.push_back(corner(i, j));
+                mesh->corners.push_back(corner(i, j + 1));
+                mesh->corners.push_back(corner(i + 1, j));
+            }
+            if (i < stacks - 1)
+            {
+                mesh->corners.push_back(corner(i, j + 1));
+                mesh->corners.push_back(corner(i + 1, j + 1));
+                mesh->corners.push_back(corner(i + 1, j));
+            }
+        }
+    }
+
+    return mesh;
+
+}
+
+// simpleScene with the three spheres replaced by triangle meshes.
+inline Hitable* meshScene(const BVHBuildParams& params = BVHBuildParams())
+{
+
+    TriangleMesh* meshes[3] =
+    {
+        sphereMesh(Vec3(0.0f, 1.0f, 0.0f), 1.0f, 64, 128, sceneNew<Dielectric>(1.5f)),
+        sphereMesh(Vec3(-4.0f, 1.0f, 0.0f), 1.0f, 64, 128, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.4f, 0.2f, 0.1f)))),
+        sphereMesh(Vec3(4.0f, 1.0f, 0.0f), 1.0f, 64, 128, sceneNew<Metal>(Vec3(0.7f, 0.6f, 0.5f), 0.0f))
+    };
+
+    int n = 1;
+    for (TriangleMesh* mesh : meshes)
+        n += mesh->triangleCount();
+
+    Hitable** list = sceneNewArray<Hitable*>(n);
+    list[0] = sceneNew<Sphere>(Vec3(0.0f, -1000.0f, 0.0f), 1000.0f, sceneNew<Lambertian>(sceneNew<ConstantTexture>(Vec3(0.5f, 0.5f, 0.5f))));
+    int i = 1;
+    for (TriangleMesh* mesh : meshes)
+    {
+        Hitable** triangles = mesh->createTriangles();
+        for (int k = 0; k < mesh->triangleCount(); k++)
+            list[i++] = triangles[k];
+        delete[] triangles;
+    }
+
+    return buildAccelerator(list, n, 0.0f, 1.0f, params);
+
 }
 
 inline Hitable* surfaceTexture()
 {
     int nx, ny, nn;
     unsigned char *texData = stbi_load("../cat.jpg", &nx, &ny, &nn, 0);
-    Material *mat = new Lambertian(new ImageTexture(texData, nx, ny));
 
-    return new Sphere(Vec3(0.0f,0.0f, 0.0f), 2.0f, mat);
+    // Copied into the scene, so the pixels are freed with its arena.
+    unsigned char *pixels = nullptr;
+    if (texData)
+    {
+        size_t bytes = static_cast<size_t>(nx) * ny * nn;
+        pixels = sceneNewArray<unsigned char>(bytes);
+        std::copy(texData, texData + bytes, pixels);
+        stbi_image_free(texData);
+    }
+    Material *mat = sceneNew<Lambertian>(sceneNew<ImageTexture>(pixels, nx, ny, "../cat.jpg"));
+
+    return sceneNew<Sphere>(Vec3(0.0f,0.0f, 0.0f), 2.0f, mat);
 }
@@ -0,0 +1,807 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <limits.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <stdlib.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include "stb_image.h"
+
+#include "util/scenecache.h"
+
+const uint64_t sceneCacheAlignment = 64;
+
+static uint64_t alignUp(uint64_t offset, uint64_t alignment)
+{
+
+    return (offset + alignment - 1) / alignment * alignment;
+
+}
+
+static void storeVec3(float* out, const Vec3& v)
+{
+
+    out[0] = v.x();
+    out[1] = v.y();
+    out[2] = v.z();
+
+}
+
+static Vec3 loadVec3(const float* in)
+{
+
+    return Vec3(in[0], in[1], in[2]);
+
+}
+
+// Turns a scene into the record arrays of the file. Friend of the materials
+// to read their parameters.
+class SceneCacheWriter
+{
+
+    public:
+
+        bool add(const Hitable* world);
+        bool write(const std::string& fileName) const;
+
+    private:
+
+        bool addPrimitive(const Hitable* object, std::vector<CachedPrimitive>& list);
+        int addMaterial(const Material* material);
+        int addTexture(const Texture* texture);
+        int addMesh(const TriangleMesh* mesh);
+        uint64_t addData(const void* source, size_t bytes);
+
+        std::vector<CachedTexture> textures;
+        std::vector<CachedMaterial> materials;
+        std::vector<CachedSphere> spheres;
+        std::vector<CachedMovingSphere> movingSpheres;
+        std::vector<CachedMesh> meshes;
+        std::vector<CachedPrimitive> primitives;
+        std::vector<CachedPrimitive> batchMembers;
+        std::vector<LinearBVHNode> nodes;
+        std::vector<char> data;
+        bool ordered = true;
+
+        std::unordered_map<const Texture*, int> textureIndex;
+        std::unordered_map<const Material*, int> materialIndex;
+        std::unordered_map<const TriangleMesh*, int> meshIndex;
+
+};
+
+uint64_t SceneCacheWriter::addData(const void* source, size_t bytes)
+{
+
+    uint64_t offset = alignUp(data.size(), 16);
+    data.resize(offset + bytes);
+    if (bytes > 0)
+        memcpy(&data[offset], source, bytes);
+    return offset;
+
+}
+
+int SceneCacheWriter::addTexture(const Texture* texture)
+{
+
+    auto found = textureIndex.find(texture);
+    if (found != textureIndex.end())
+        return found->second;
+
+    CachedTexture record = {};
+    if (const ConstantTexture* constant = dynamic_cast<const ConstantTexture*>(texture))
+    {
+        record.type = CACHED_CONSTANT;
+        storeVec3(record.color, constant->color);
+    }
+    else if (const CheckerTexture* checker = dynamic_cast<const CheckerTexture*>(texture))
+    {
+        record.type = CACHED_CHECKER;
+        record.odd = addTexture(checker->odd);
+        record.even = addTexture(checker->even);
+        if (record.odd < 0 || record.even < 0)
+            return -1;
+    }
+    else if (const NoiseTexture* noise = dynamic_cast<const NoiseTexture*>(texture))
+    {
+        record.type = CACHED_NOISE;
+        record.scale = noise->scale;
+    }
+    else if (const ImageTexture* image = dynamic_cast<const ImageTexture*>(texture))
+    {
+        record.type = CACHED_IMAGE;
+        record.nx = image->nx;
+        record.ny = image->ny;
+        record.external = image->fileName ? 1 : 0;
+        if (image->fileName)
+            record.fileName = addData(image->fileName, strlen(image->fileName) + 1);
+        else
+            record.pixels = addData(image->data, 3*static_cast<size_t>(image->nx)*image->ny);
+    }
+    else
+    {
+        std::cerr << "Scene cache: unsupported texture" << std::endl;
+        return -1;
+    }
+
+    int index = static_cast<int>(textures.size());
+    textures.push_back(record);
+    textureIndex[texture] = index;
+    return index;
+
+}
+
+int SceneCacheWriter::addMaterial(const Material* material)
+{
+
+    auto found = materialIndex.find(material);
+    if (found != materialIndex.end())
+        return found->second;
+
+    CachedMaterial record = {};
+    if (const Lambertian* lambertian = dynamic_cast<const Lambertian*>(material))
+    {
+        record.type = CACHED_LAMBERTIAN;
+        record.texture = addTexture(lambertian->albedo);
+        if (record.texture < 0)
+            return -1;
+    }
+    else if (const Metal* metal = dynamic_cast<const Metal*>(material))
+    {
+        record.type = CACHED_METAL;
+        storeVec3(record.albedo, metal->albedo);
+        record.fuzz = metal->fuzz;
+    }
+    else if (const Dielectric* dielectric = dynamic_cast<const Dielectric*>(material))
+    {
+        record.type = CACHED_DIELECTRIC;
+        record.refIndex = dielectric->refIndex;
+    }
+    else
+    {
+        std::cerr << "Scene cache: unsupported material" << std::endl;
+        return -1;
+    }
+
+    int index = static_cast<int>(materials.size());
+    materials.push_back(record);
+    materialIndex[material] = index;
+    return index;
+
+}
+
+int SceneCacheWriter::addMesh(const TriangleMesh* mesh)
+{
+
+    auto found = meshIndex.find(mesh);
+    if (found != meshIndex.end())
+        return found->second;
+
+    CachedMesh record = {};
+    record.material = addMaterial(mesh->material);
+    if (record.material < 0)
+        return -1;
+
+    // The buffers may be borrowed, their sizes follow from the corners.
+    record.triangleCount = mesh->triangleCount();
+    const MeshCorner* corners = mesh->cornerData;
+    int positionCount = 0;
+    int normalCount = 0;
+    int uvCount = 0;
+    for (int i = 0; i < 3*record.triangleCount; i++)
+    {
+        positionCount = std::max(positionCount, corners[i].position + 1);
+        normalCount = std::max(normalCount, corners[i].normal + 1);
+        uvCount = std::max(uvCount, corners[i].uv + 1);
+    }
+    record.positionCount = positionCount;
+    record.normalCount = normalCount;
+    record.uvCount = uvCount;
+    record.positions = addData(mesh->positionData, positionCount*sizeof(Vec3));
+    record.normals = addData(mesh->normalData, normalCount*sizeof(Vec3));
+    record.uvs = addData(mesh->uvData, 2*uvCount*sizeof(float));
+    record.corners = addData(corners, 3*static_cast<size_t>(record.triangleCount)*sizeof(MeshCorner));
+
+    int index = static_cast<int>(meshes.size());
+    meshes.push_back(record);
+    meshIndex[mesh] = index;
+    return index;
+
+}
+
+bool SceneCacheWriter::addPrimitive(const Hitable* object, std::vector<CachedPrimitive>& list)
+{
+
+    CachedPrimitive record = {};
+    if (const SphereBatch* batch = dynamic_cast<const SphereBatch*>(object))
+    {
+        record.type = CACHED_SPHERE_BATCH;
+        record.object = static_cast<int>(batchMembers.size());
+        record.index = batch->count;
+        for (int k = 0; k < batch->count; k++)
+            if (!addPrimitive(batch->spheres[k], batchMembers))
+                return false;
+    }
+    else if (const TriangleBatch* batch = dynamic_cast<const TriangleBatch*>(object))
+    {
+        record.type = CACHED_TRIANGLE_BATCH;
+        record.object = static_cast<int>(batchMembers.size());
+        record.index = batch->count;
+        for (int k = 0; k < batch->count; k++)
+            if (!addPrimitive(batch->triangles[k], batchMembers))
+                return false;
+    }
+    else if (const Sphere* sphere = dynamic_cast<const Sphere*>(object))
+    {
+        CachedSphere s = {};
+        storeVec3(s.center, sphere->center);
+        s.radius = sphere->radius;
+        s.material = addMaterial(sphere->matPtr);
+        if (s.material < 0)
+            return false;
+        record.type = CACHED_SPHERE;
+        record.object = static_cast<int>(spheres.size());
+        spheres.push_back(s);
+    }
+    else if (const MovingSphere* moving = dynamic_cast<const MovingSphere*>(object))
+    {
+        CachedMovingSphere s = {};
+        storeVec3(s.center0, moving->center0);
+        storeVec3(s.center1, moving->center1);
+        s.time0 = moving->time0;
+        s.time1 = moving->time1;
+        s.radius = moving->radius;
+        s.material = addMaterial(moving->matPtr);
+        if (s.material < 0)
+            return false;
+        record.type = CACHED_MOVING_SPHERE;
+        record.object = static_cast<int>(movingSpheres.size());
+        movingSpheres.push_back(s);
+    }
+    else if (const Triangle* triangle = dynamic_cast<const Triangle*>(object))
+    {
+        record.type = CACHED_TRIANGLE;
+        record.object = addMesh(triangle->mesh);
+        record.index = triangle->index;
+        if (record.object < 0)
+            return false;
+    }
+    else
+    {
+        std::cerr << "Scene cache: unsupported hitable" << std::endl;
+        return false;
+    }
+
+    list.push_back(record);
+    return true;
+
+}
+
+bool SceneCacheWriter::add(const Hitable* world)
+{
+
+    const LinearBVH* bvh = dynamic_cast<const LinearBVH*>(world);
+    if (!bvh)
+    {
+        // A single primitive becomes a one leaf tree.
+        LinearBVHNode root = {};
+        AABB box;
+        if (!world->boundingBox(0.0f, 1.0f, box))
+        {
+            std::cerr << "Scene cache: the world has no bounding box" << std::endl;
+            return false;
+        }
+        root.boundsMin = box.min();
+        root.boundsMax = box.max();
+        root.primitiveCount = 1;
+        root.leafType = static_cast<uint8_t>(world->hitableType());
+        nodes.push_back(root);
+        return addPrimitive(world, primitives);
+    }
+
+    // The records follow the primitive list one to one, so the nodes are
+    // written unchanged.
+    ordered = bvh->orderedTraversal();
+    nodes = bvh->nodes;
+    for (const Hitable* object : bvh->primitives)
+        if (!addPrimitive(object, primitives))
+            return false;
+    return true;
+
+}
+
+bool SceneCacheWriter::write(const std::string& fileName) const
+{
+
+    SceneCacheHeader header = {};
+    memcpy(header.magic, sceneCacheMagic, sizeof(header.magic));
+    header.version = sceneCacheVersion;
+    header.vec3Size = sizeof(Vec3);
+    header.nodeSize = sizeof(LinearBVHNode);
+    header.orderedTraversal = ordered ? 1 : 0;
+
+    const void* sources[CACHE_SECTION_COUNT] = {
+        textures.data(), materials.data(), spheres.data(), movingSpheres.data(),
+        meshes.data(), primitives.data(), batchMembers.data(), nodes.data(), data.data()
+    };
+    const size_t counts[CACHE_SECTION_COUNT] = {
+        textures.size(), materials.size(), spheres.size(), movingSpheres.size(),
+        meshes.size(), primitives.size(), batchMembers.size(), nodes.size(), data.size()
+    };
+    const size_t recordBytes[CACHE_SECTION_COUNT] = {
+        sizeof(CachedTexture), sizeof(CachedMaterial), sizeof(CachedSphere), sizeof(CachedMovingSphere),
+        sizeof(CachedMesh), sizeof(CachedPrimitive), sizeof(CachedPrimitive), sizeof(LinearBVHNode), 1
+    };
+
+    uint64_t offset = alignUp(sizeof(SceneCacheHeader), sceneCacheAlignment);
+    for (int i = 0; i < CACHE_SECTION_COUNT; i++)
+    {
+        header.sections[i].offset = offset;
+        header.sections[i].count = counts[i];
+        offset = alignUp(offset + counts[i]*recordBytes[i], sceneCacheAlignment);
+    }
+    header.fileSize = offset;
+
+    std::ofstream file(fileName, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Scene cache: can't write " << fileName << std::endl;
+        return false;
+    }
+
+    const char zeros[sceneCacheAlignment] = {};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t written = sizeof(header);
+    for (int i = 0; i < CACHE_SECTION_COUNT; i++)
+    {
+        file.write(zeros, static_cast<std::streamsize>(header.sections[i].offset - written));
+        file.write(static_cast<const char*>(sources[i]), static_cast<std::streamsize>(counts[i]*recordBytes[i]));
+        written = header.sections[i].offset + counts[i]*recordBytes[i];
+    }
+    file.write(zeros, static_cast<std::streamsize>(header.fileSize - written));
+
+    return static_cast<bool>(file);
+
+}
+
+bool saveSceneCache(const std::string& fileName, const Hitable* world)
+{
+
+    SceneCacheWriter writer;
+    return writer.add(world) && writer.write(fileName);
+
+}
+
+SceneCache::SceneCache() : mapping(nullptr), mappingBytes(0), nodes(nullptr), nodeCount(0), ordered(true)
+{
+
+}
+
+SceneCache::~SceneCache()
+{
+
+    for (TriangleMesh* mesh : meshes)
+        delete mesh;
+    for (Material* material : materials)
+        delete material;
+    for (Texture* texture : textures)
+        delete texture;
+    for (unsigned char* pixels : images)
+        stbi_image_free(pixels);
+
+    if (mapping)
+    {
+#ifdef _WIN32
+        free(mapping);
+#else
+        munmap(mapping, mappingBytes);
+#endif
+    }
+
+}
+
+bool SceneCache::hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const
+{
+
+    if (!intersectLinearBVH(nodes, primitives.data(), ordered, r, tMin, tMax, rec))
+        return false;
+    finalizeHitRecord(r, rec);
+    return true;
+
+}
+
+bool SceneCache::occluded(const Ray& r, float tMin, float tMax) const
+{
+
+    return occludedLinearBVH(nodes, primitives.data(), r, tMin, tMax);
+
+}
+
+int SceneCache::hitPacket(const RayPacket& packet, float tMin, float tMax, HitRecord* recs) const
+{
+
+    int hits = intersectLinearBVHPacket(nodes, primitives.data(), ordered, packet, tMin, tMax, recs);
+    finalizePacketHits(packet, hits, recs);
+    return hits;
+
+}
+
+bool SceneCache::boundingBox(float t0, float t1, AABB& box) const
+{
+
+    box = AABB(nodes[0].boundsMin, nodes[0].boundsMax);
+    return true;
+
+}
+
+static bool mapFile(const std::string& fileName, void*& mapping, size_t& bytes)
+{
+
+#ifdef _WIN32
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    bytes = static_cast<size_t>(file.tellg());
+    mapping = malloc(bytes);
+    file.seekg(0);
+    if (!mapping || !file.read(static_cast<char*>(mapping), static_cast<std::streamsize>(bytes)))
+    {
+        free(mapping);
+        mapping = nullptr;
+        return false;
+    }
+    return true;
+#else
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    bytes = static_cast<size_t>(info.st_size);
+    void* address = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED)
+        return false;
+    mapping = address;
+    return true;
+#endif
+
+}
+
+bool SceneCache::load(const std::string& fileName)
+{
+
+    if (!mapFile(fileName, mapping, mappingBytes))
+        return false;
+
+    const char* base = static_cast<const char*>(mapping);
+    if (mappingBytes < sizeof(SceneCacheHeader))
+        return false;
+
+    const SceneCacheHeader& header = *reinterpret_cast<const SceneCacheHeader*>(base);
+    if (memcmp(header.magic, sceneCacheMagic, sizeof(header.magic)) != 0 ||
+        header.version != sceneCacheVersion ||
+        header.vec3Size != sizeof(Vec3) ||
+        header.nodeSize != sizeof(LinearBVHNode) ||
+        header.fileSize != mappingBytes)
+        return false;
+
+    const size_t recordBytes[CACHE_SECTION_COUNT] = {
+        sizeof(CachedTexture), sizeof(CachedMaterial), sizeof(CachedSphere), sizeof(CachedMovingSphere),
+        sizeof(CachedMesh), sizeof(CachedPrimitive), sizeof(CachedPrimitive), sizeof(LinearBVHNode), 1
+    };
+    for (int i = 0; i < CACHE_SECTION_COUNT; i++)
+    {
+        const SceneCacheSectionInfo& section = header.sections[i];
+        if (section.offset % sceneCacheAlignment != 0 || section.offset > mappingBytes ||
+            section.count > (mappingBytes - section.offset) / recordBytes[i])
+            return false;
+    }
+
+    const CachedTexture* cachedTextures = reinterpret_cast<const CachedTexture*>(base + header.sections[CACHE_TEXTURES].offset);
+    const CachedMaterial* cachedMaterials = reinterpret_cast<const CachedMaterial*>(base + header.sections[CACHE_MATERIALS].offset);
+    const CachedSphere* cachedSpheres = reinterpret_cast<const CachedSphere*>(base + header.sections[CACHE_SPHERES].offset);
+    const CachedMovingSphere* cachedMovingSpheres = reinterpret_cast<const CachedMovingSphere*>(base + header.sections[CACHE_MOVING_SPHERES].offset);
+    const CachedMesh* cachedMeshes = reinterpret_cast<const CachedMesh*>(base + header.sections[CACHE_MESHES].offset);
+    const CachedPrimitive* cachedPrimitives = reinterpret_cast<const CachedPrimitive*>(base + header.sections[CACHE_PRIMITIVES].offset);
+    const char* data = base + header.sections[CACHE_DATA].offset;
+    uint64_t dataBytes = header.sections[CACHE_DATA].count;
+
+    // Data offsets must leave room for what is read there.
+    auto inData = [dataBytes](uint64_t offset, uint64_t bytes) {
+        return offset <= dataBytes && bytes <= dataBytes - offset;
+    };
+
+    size_t textureCount = header.sections[CACHE_TEXTURES].count;
+    for (size_t i = 0; i < textureCount; i++)
+    {
+        const CachedTexture& t = cachedTextures[i];
+        Texture* texture = nullptr;
+        switch (t.type)
+        {
+            case CACHED_CONSTANT:
+                texture = new ConstantTexture(loadVec3(t.color));
+                break;
+            case CACHED_CHECKER:
+                if (t.odd < 0 || t.even < 0 || static_cast<size_t>(t.odd) >= i || static_cast<size_t>(t.even) >= i)
+                    return false;
+                texture = new CheckerTexture(textures[static_cast<size_t>(t.even)], textures[static_cast<size_t>(t.odd)]);
+                break;
+            case CACHED_NOISE:
+                texture = new NoiseTexture(t.scale);
+                break;
+            case CACHED_IMAGE:
+            {
+                if (t.nx <= 0 || t.ny <= 0)
+                    return false;
+                if (t.external)
+                {
+                    // The name is zero terminated within the data section.
+                    if (!inData(t.fileName, 1) || !memchr(data + t.fileName, '\0', dataBytes - t.fileName))
+                        return false;
+                    const char* name = data + t.fileName;
+                    int nx, ny, nn;
+                    unsigned char* pixels = stbi_load(name, &nx, &ny, &nn, 3);
+                    if (!pixels)
+                    {
+                        std::cerr << "Scene cache: can't load " << name << std::endl;
+                        return false;
+                    }
+                    images.push_back(pixels);
+                    texture = new ImageTexture(pixels, nx, ny, name);
+                }
+                else
+                {
+                    if (!inData(t.pixels, 3*static_cast<uint64_t>(t.nx)*static_cast<uint64_t>(t.ny)))
+                        return false;
+                    unsigned char* pixels = reinterpret_cast<unsigned char*>(const_cast<char*>(data + t.pixels));
+                    texture = new ImageTexture(pixels, t.nx, t.ny);
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+        textures.push_back(texture);
+    }
+
+    size_t materialCount = header.sections[CACHE_MATERIALS].count;
+    for (size_t i = 0; i < materialCount; i++)
+    {
+        const CachedMaterial& m = cachedMaterials[i];
+        Material* material = nullptr;
+        switch (m.type)
+        {
+            case CACHED_LAMBERTIAN:
+                if (m.texture < 0 || static_cast<size_t>(m.texture) >= textureCount)
+                    return false;
+                material = new Lambertian(textures[static_cast<size_t>(m.texture)]);
+                break;
+            case CACHED_METAL:
+                material = new Metal(loadVec3(m.albedo), m.fuzz);
+                break;
+            case CACHED_DIELECTRIC:
+                material = new Dielectric(m.refIndex);
+                break;
+            default:
+                return false;
+        }
+        materials.push_back(material);
+    }
+
+    auto validMaterial = [materialCount](int32_t index) {
+        return index >= 0 && static_cast<size_t>(index) < materialCount;
+    };
+
+    // Reserved up front, the primitive list points into the vectors.
+    size_t sphereCount = header.sections[CACHE_SPHERES].count;
+    spheres.reserve(sphereCount);
+    for (size_t i = 0; i < sphereCount; i++)
+    {
+        const CachedSphere& s = cachedSpheres[i];
+        if (!validMaterial(s.material))
+            return false;
+        spheres.emplace_back(loadVec3(s.center), s.radius, materials[static_cast<size_t>(s.material)]);
+    }
+
+    size_t movingSphereCount = header.sections[CACHE_MOVING_SPHERES].count;
+    movingSpheres.reserve(movingSphereCount);
+    for (size_t i = 0; i < movingSphereCount; i++)
+    {
+        const CachedMovingSphere& s = cachedMovingSpheres[i];
+        if (!validMaterial(s.material))
+            return false;
+        movingSpheres.emplace_back(loadVec3(s.center0), loadVec3(s.center1), s.time0, s.time1,
+                                   s.radius, materials[static_cast<size_t>(s.material)]);
+    }
+
+    size_t meshCount = header.sections[CACHE_MESHES].count;
+    for (size_t i = 0; i < meshCount; i++)
+    {
+        const CachedMesh& m = cachedMeshes[i];
+        if (!validMaterial(m.material) || m.positionCount < 0 || m.normalCount < 0 ||
+            m.uvCount < 0 || m.triangleCount < 0 ||
+            m.positions % alignof(Vec3) != 0 || m.normals % alignof(Vec3) != 0 ||
+            m.uvs % alignof(float) != 0 || m.corners % alignof(MeshCorner) != 0 ||
+            !inData(m.positions, m.positionCount*sizeof(Vec3)) ||
+            !inData(m.normals, m.normalCount*sizeof(Vec3)) ||
+            !inData(m.uvs, 2*m.uvCount*sizeof(float)) ||
+            !inData(m.corners, 3*static_cast<uint64_t>(m.triangleCount)*sizeof(MeshCorner)))
+            return false;
+
+        const MeshCorner* corners = reinterpret_cast<const MeshCorner*>(data + m.corners);
+        for (int c = 0; c < 3*m.triangleCount; c++)
+        {
+            if (corners[c].position < 0 || corners[c].position >= m.positionCount ||
+                corners[c].normal >= m.normalCount || corners[c].uv >= m.uvCount)
+                return false;
+        }
+
+        TriangleMesh* mesh = new TriangleMesh(materials[static_cast<size_t>(m.material)]);
+        meshes.push_back(mesh);
+        mesh->setBuffers(reinterpret_cast<const Vec3*>(data + m.positions),
+                         reinterpret_cast<const Vec3*>(data + m.normals),
+                         reinterpret_cast<const float*>(data + m.uvs),
+                         corners, m.triangleCount);
+        delete [] mesh->createTriangles();
+    }
+
+    // Resolves a sphere, moving sphere or triangle record, nullptr if it is
+    // out of range or of another type.
+    auto resolve = [&](const CachedPrimitive& p) -> Hitable* {
+        if (p.object < 0)
+            return nullptr;
+        size_t object = static_cast<size_t>(p.object);
+        switch (p.type)
+        {
+            case CACHED_SPHERE:
+                return object < sphereCount ? &spheres[object] : nullptr;
+            case CACHED_MOVING_SPHERE:
+                return object < movingSphereCount ? &movingSpheres[object] : nullptr;
+            case CACHED_TRIANGLE:
+                if (object >= meshCount || p.index < 0 || p.index >= meshes[object]->triangleCount())
+                    return nullptr;
+                return &meshes[object]->triangles[static_cast<size_t>(p.index)];
+            default:
+                return nullptr;
+        }
+    };
+
+    const CachedPrimitive* cachedMembers = reinterpret_cast<const CachedPrimitive*>(base + header.sections[CACHE_BATCH_MEMBERS].offset);
+    size_t memberCount = header.sections[CACHE_BATCH_MEMBERS].count;
+    batchMembers.reserve(memberCount);
+    for (size_t i = 0; i < memberCount; i++)
+    {
+        Hitable* member = resolve(cachedMembers[i]);
+        if (!member)
+            return false;
+        batchMembers.push_back(member);
+    }
+
+    size_t primitiveCount = header.sections[CACHE_PRIMITIVES].count;
+    size_t sphereBatchCount = 0, triangleBatchCount = 0;
+    for (size_t i = 0; i < primitiveCount; i++)
+    {
+        sphereBatchCount += cachedPrimitives[i].type == CACHED_SPHERE_BATCH;
+        triangleBatchCount += cachedPrimitives[i].type == CACHED_TRIANGLE_BATCH;
+    }
+    sphereBatches.reserve(sphereBatchCount);
+    triangleBatches.reserve(triangleBatchCount);
+
+    primitives.reserve(primitiveCount);
+    for (size_t i = 0; i < primitiveCount; i++)
+    {
+        const CachedPrimitive& p = cachedPrimitives[i];
+        if (p.type != CACHED_SPHERE_BATCH && p.type != CACHED_TRIANGLE_BATCH)
+        {
+            Hitable* primitive = resolve(p);
+            if (!primitive)
+                return false;
+            primitives.push_back(primitive);
+            continue;
+        }
+
+        // The batches cast their members, so every one must have the
+        // batch's type.
+        int32_t memberType = p.type == CACHED_SPHERE_BATCH ? CACHED_SPHERE : CACHED_TRIANGLE;
+        if (p.object < 0 || p.index < 1 || p.index > leafBatchWidth ||
+            static_cast<size_t>(p.object) + static_cast<size_t>(p.index) > memberCount)
+            return false;
+        for (int k = 0; k < p.index; k++)
+            if (cachedMembers[p.object + k].type != memberType)
+                return false;
+
+        Hitable* const* members = &batchMembers[static_cast<size_t>(p.object)];
+        if (p.type == CACHED_SPHERE_BATCH)
+        {
+            sphereBatches.emplace_back(members, p.index);
+            primitives.push_back(&sphereBatches.back());
+        }
+        else
+        {
+            triangleBatches.emplace_back(members, p.index);
+            primitives.push_back(&triangleBatches.back());
+        }
+    }
+
+    // Interior nodes point forward to their second child, leaves into the
+    // primitive list, and no node is deeper than the traversal stack, so
+    // traversal can't leave the file. The leaf types decide the casts of the
+    // traversal, they must match the primitives.
+    nodes = reinterpret_cast<const LinearBVHNode*>(base + header.sections[CACHE_NODES].offset);
+    nodeCount = static_cast<int>(header.sections[CACHE_NODES].count);
+    if (nodeCount == 0 || header.sections[CACHE_NODES].count > static_cast<uint64_t>(INT_MAX))
+        return false;
+    std::vector<int> depth(static_cast<size_t>(nodeCount), 0);
+    for (int i = 0; i < nodeCount; i++)
+    {
+        const LinearBVHNode& node = nodes[i];
+        if (node.primitiveCount > 0)
+        {
+            if (node.offset < 0 || static_cast<size_t>(node.offset) + node.primitiveCount > primitiveCount)
+                return false;
+            if (node.leafType != HITABLE_VIRTUAL &&
+                node.leafType != leafHitableType(&primitives[static_cast<size_t>(node.offset)], node.primitiveCount))
+                return false;
+        }
+        else
+        {
+            if (i + 1 >= nodeCount || node.offset <= i + 1 || node.offset >= nodeCount ||
+                node.axis > 2 || depth[i] + 1 >= linearBVHStackSize)
+                return false;
+            depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+            depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
+        }
+    }
+    ordered = header.orderedTraversal != 0;
+
+    return true;
+
+}
+
+SceneCache* loadSceneCache(const std::string& fileName)
+{
+
+    SceneCache* scene = new SceneCache();
+    if (!scene->load(fileName))
+    {
+        delete scene;
+        return nullptr;
+    }
+    return scene;
+
+}
@@ -0,0 +1,242 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "hitables/linearbvh.h"
+#include "hitables/movingsphere.h"
+#include "hitables/sphere.h"
+#include "hitables/spherebatch.h"
+#include "hitables/trianglemesh.h"
+#include "materials/material.h"
+
+// Binary snapshot of a scene and its linear BVH, so large scenes start
+// without parsing or building anything. The file is a SceneCacheHeader
+// followed by 64 byte aligned sections of fixed size records. Records refer
+// to each other by index and to the data section by offsets relative to its
+// start, so the file can be mapped anywhere. The BVH nodes and the mesh
+// buffers are used in place from the mapping. Textures, materials and the
+// primitives are small records turned back into objects on load, since they
+// need their vtables. Batched leaves are stored as a range of member
+// primitives and packed again on load. Image textures loaded from a file are
+// stored as a reference to it, others embed their pixels.
+//
+// The records hold Vec3 and LinearBVHNode as laid out in memory, the header
+// stores their sizes and files written with another layout are rejected.
+// Bump sceneCacheVersion whenever a record changes.
+
+const char sceneCacheMagic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+const uint32_t sceneCacheVersion = 1;
+
+enum SceneCacheSection
+{
+    CACHE_TEXTURES,
+    CACHE_MATERIALS,
+    CACHE_SPHERES,
+    CACHE_MOVING_SPHERES,
+    CACHE_MESHES,
+    CACHE_PRIMITIVES,       // leaf order of the BVH
+    CACHE_BATCH_MEMBERS,    // primitives of the batched leaves
+    CACHE_NODES,
+    CACHE_DATA,             // mesh buffers, embedded pixels and file names
+    CACHE_SECTION_COUNT
+};
+
+struct SceneCacheSectionInfo
+{
+
+    uint64_t offset;        // from the start of the file
+    uint64_t count;         // records, bytes for CACHE_DATA
+
+};
+
+struct SceneCacheHeader
+{
+
+    char magic[8];
+    uint32_t version;
+    uint32_t vec3Size;
+    uint32_t nodeSize;
+    uint32_t orderedTraversal;
+    uint64_t fileSize;
+    SceneCacheSectionInfo sections[CACHE_SECTION_COUNT];
+
+};
+
+enum CachedTextureType
+{
+    CACHED_CONSTANT,
+    CACHED_CHECKER,
+    CACHED_NOISE,
+    CACHED_IMAGE
+};
+
+struct CachedTexture
+{
+
+    int32_t type;
+    int32_t odd;            // checker children, always earlier textures
+    int32_t even;
+    int32_t nx;
+    int32_t ny;
+    float scale;
+    float color[3];
+    int32_t external;       // 1 if the image is referenced by fileName
+    uint64_t pixels;        // data offset of nx*ny*3 bytes
+    uint64_t fileName;      // data offset of the image file name
+
+};
+
+enum CachedMaterialType
+{
+    CACHED_LAMBERTIAN,
+    CACHED_METAL,
+    CACHED_DIELECTRIC
+};
+
+struct CachedMaterial
+{
+
+    int32_t type;
+    int32_t texture;
+    float albedo[3];
+    float fuzz;
+    float refIndex;
+
+};
+
+struct CachedSphere
+{
+
+    float center[3];
+    float radius;
+    int32_t material;
+
+};
+
+struct CachedMovingSphere
+{
+
+    float center0[3];
+    float center1[3];
+    float time0;
+    float time1;
+    float radius;
+    int32_t material;
+
+};
+
+struct CachedMesh
+{
+
+    uint64_t positions;     // data offsets of the buffers
+    uint64_t normals;
+    uint64_t uvs;
+    uint64_t corners;
+    int32_t positionCount;
+    int32_t normalCount;
+    int32_t uvCount;
+    int32_t triangleCount;
+    int32_t material;
+    int32_t pad;
+
+};
+
+enum CachedPrimitiveType
+{
+    CACHED_SPHERE,
+    CACHED_MOVING_SPHERE,
+    CACHED_TRIANGLE,
+    CACHED_SPHERE_BATCH,
+    CACHED_TRIANGLE_BATCH
+};
+
+struct CachedPrimitive
+{
+
+    int32_t type;
+    int32_t object;         // sphere, moving sphere or mesh, first batch member
+    int32_t index;          // triangle of the mesh, batch member count
+
+};
+
+// Scene mapped from a cache file. Traverses the BVH nodes of the file in
+// place and owns the objects made from the records.
+class SceneCache : public Hitable
+{
+
+    public:
+
+        ~SceneCache();
+
+        bool hit(const Ray& r, float tMin, float tMax, HitRecord& rec) const override;
+        bool occluded(const Ray& r, float tMin, float tMax) const override;
+        bool boundingBox(float t0, float t1, AABB& box) const override;
+        int hitPacket(const RayPacket& packet, float tMin, float tMax, HitRecord* recs) const override;
+
+        void bindMaterials(MaterialTable& table) override
+        {
+            for (Hitable* primitive : primitives)
+                primitive->bindMaterials(table);
+        }
+
+        size_t fileBytes() const
+        {
+            return mappingBytes;
+        }
+
+    private:
+
+        SceneCache();
+        bool load(const std::string& fileName);
+
+        friend SceneCache* loadSceneCache(const std::string& fileName);
+
+        void* mapping;
+        size_t mappingBytes;
+        const LinearBVHNode* nodes;
+        int nodeCount;
+        bool ordered;
+        std::vector<Hitable*> primitives;
+        std::vector<Hitable*> batchMembers;
+        std::vector<SphereBatch> sphereBatches;
+        std::vector<TriangleBatch> triangleBatches;
+        std::vector<Sphere> spheres;
+        std::vector<MovingSphere> movingSpheres;
+        std::vector<TriangleMesh*> meshes;
+        std::vector<Material*> materials;
+        std::vector<Texture*> textures;
+        std::vector<unsigned char*> images;     // loaded from referenced files
+
+};
+
+// Writes world to fileName. world must be a LinearBVH, batched or not, or a
+// single primitive, over Spheres, MovingSpheres and mesh Triangles with the
+// materials and textures of material.h and texture.h. Returns false and
+// reports the reason on std::cerr otherwise.
+bool saveSceneCache(const std::string& fileName, const Hitable* world);
+
+// Maps a file written by saveSceneCache. Returns nullptr if it can't be read,
+// was written by another version or layout, or fails the range checks.
+SceneCache* loadSceneCache(const std::string& fileName);
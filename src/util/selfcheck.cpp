@@ -0,0 +1,109 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <float.h>
+#include <stdio.h>
+
+#include "hitables/accelerator.h"
+#include "util/objloader.h"
+#include "util/selfcheck.h"
+
+bool checkEmptyScenes(std::ostream& out)
+{
+
+    const char* builderNames[] = { "median", "sah", "lbvh" };
+    const char* layoutNames[] =
+    {
+        "tree", "linear", "batched", "wide4", "wide8", "motion", "quant8", "quant16", "grid", "kdtree"
+    };
+    const char* orderNames[] = { "allocation", "depth-first", "treelet", "van-emde-boas" };
+    const Ray rays[] = { Ray(Vec3(0, 0, 0), Vec3(0, 0, -1), 0.5f), Ray(Vec3(1, 2, 3), Vec3(-1, 1, 1), 0.5f) };
+
+    bool passed = true;
+    for (int builder = MEDIAN_SPLIT; builder <= MORTON_LBVH; builder++)
+    {
+        for (int layout = BVH_POINTER_TREE; layout <= KD_TREE; layout++)
+        {
+            for (int order = BVH_ORDER_ALLOCATION; order <= BVH_ORDER_VAN_EMDE_BOAS; order++)
+            {
+                if (order != BVH_ORDER_ALLOCATION && layout != BVH_POINTER_TREE)
+                    continue;
+
+                BVHBuildParams params(static_cast<BVHBuilder>(builder), static_cast<BVHLayout>(layout));
+                params.nodeOrder = static_cast<BVHNodeOrder>(order);
+                Hitable* empty = buildAccelerator(nullptr, 0, 0.0f, 1.0f, params);
+
+                AABB box;
+                bool failed = empty->boundingBox(0.0f, 1.0f, box);
+                for (const Ray& r : rays)
+                {
+                    HitRecord rec;
+                    failed = failed || empty->hit(r, 0.001f, FLT_MAX, rec) || empty->occluded(r, 0.001f, FLT_MAX);
+                }
+                if (failed)
+                {
+                    out << "empty scene: " << builderNames[builder] << " " << layoutNames[layout]
+                        << " " << orderNames[order] << " failed\n";
+                    passed = false;
+                }
+                delete empty;
+            }
+        }
+    }
+
+    return passed;
+
+}
+
+bool checkUnterminatedOBJ(std::ostream& out)
+{
+
+    const char* fileName = "selfCheckUnterminated.obj";
+    FILE* file = fopen(fileName, "w");
+    if (!file)
+    {
+        out << "unterminated OBJ: can't write " << fileName << "\n";
+        return false;
+    }
+    fputs("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\nv 1 1", file);
+    fclose(file);
+
+    TriangleMesh* mesh = loadOBJ(fileName, nullptr, 1);
+    remove(fileName);
+
+    bool passed = mesh && mesh->triangleCount() == 1 && mesh->positions.size() == 4;
+    if (!passed)
+        out << "unterminated OBJ: failed\n";
+    delete mesh;
+
+    return passed;
+
+}
+
+bool selfCheck(std::ostream& out)
+{
+
+    bool passed = checkEmptyScenes(out);
+    passed = checkUnterminatedOBJ(out) && passed;
+
+    out << (passed ? "all checks passed" : "checks failed") << "\n";
+    return passed;
+
+}
@@ -0,0 +1,38 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <ostream>
+
+// Small regression checks of edge cases that no scene or benchmark reaches.
+// Each check writes one line per failed case to out and returns false if
+// any case failed.
+
+// Every builder and layout accepts an empty primitive list, has no bounding
+// box and lets all rays pass.
+bool checkEmptyScenes(std::ostream& out);
+
+// loadOBJ() reads a file whose last line is a truncated vertex without a
+// newline, without reading past the end of the text.
+bool checkUnterminatedOBJ(std::ostream& out);
+
+// Runs every check and writes a summary line, returns false if one failed.
+bool selfCheck(std::ostream& out);
@@ -0,0 +1,175 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <omp.h>
+
+// Event counter with one slot per OpenMP thread. The slots are padded to a
+// cache line so the threads don't invalidate each other's counters.
+class StatCounter
+{
+
+    static const int maxSlots = 256;
+
+    struct Slot
+    {
+        long long value;
+        char padding[64 - sizeof(long long)];
+    };
+
+    Slot slots[maxSlots];
+
+    public:
+
+        StatCounter()
+        {
+            reset();
+        }
+
+        void add(long long n)
+        {
+            slots[omp_get_thread_num() % maxSlots].value += n;
+        }
+
+        void reset()
+        {
+            for (int i = 0; i < maxSlots; i++)
+                slots[i].value = 0;
+        }
+
+        long long total() const
+        {
+            long long sum = 0;
+            for (int i = 0; i < maxSlots; i++)
+                sum += slots[i].value;
+            return sum;
+        }
+
+};
+
+// Simulated data cache with one private cache per OpenMP thread, fed with
+// the addresses of the nodes a traversal touches. It gives the miss count
+// of a node layout on machines where the hardware counters are not
+// readable. 8-way set associative with LRU replacement, 32 KB of 64 byte
+// lines like a typical L1.
+class CacheSimulator
+{
+
+    static const int maxSlots = 64;
+    static const int sets = 64;
+    static const int ways = 8;
+
+    struct Slot
+    {
+        unsigned long long tags[sets][ways];    // most recently used first
+        long long accesses;
+        long long misses;
+    };
+
+    Slot slots[maxSlots];
+
+    public:
+
+        CacheSimulator()
+        {
+            reset();
+        }
+
+        // Touches every line of the bytes starting at address.
+        void access(const void* address, size_t bytes)
+        {
+            Slot& slot = slots[omp_get_thread_num() % maxSlots];
+            unsigned long long first = reinterpret_cast<unsigned long long>(address) >> 6;
+            unsigned long long last = (reinterpret_cast<unsigned long long>(address) + bytes - 1) >> 6;
+            for (unsigned long long line = first; line <= last; line++)
+            {
+                unsigned long long* set = slot.tags[line % sets];
+                slot.accesses++;
+
+                // Tag 0 marks an empty way, so lines are stored off by one.
+                unsigned long long tag = line + 1;
+                int way = 0;
+                while (way < ways - 1 && set[way] != tag)
+                    way++;
+                if (set[way] != tag)
+                    slot.misses++;
+                for (; way > 0; way--)
+                    set[way] = set[way - 1];
+                set[0] = tag;
+            }
+        }
+
+        void reset()
+        {
+            for (int i = 0; i < maxSlots; i++)
+            {
+                for (int s = 0; s < sets; s++)
+                    for (int w = 0; w < ways; w++)
+                        slots[i].tags[s][w] = 0;
+                slots[i].accesses = 0;
+                slots[i].misses = 0;
+            }
+        }
+
+        long long accesses() const
+        {
+            long long sum = 0;
+            for (int i = 0; i < maxSlots; i++)
+                sum += slots[i].accesses;
+            return sum;
+        }
+
+        long long misses() const
+        {
+            long long sum = 0;
+            for (int i = 0; i < maxSlots; i++)
+                sum += slots[i].misses;
+            return sum;
+        }
+
+};
+
+// BVH nodes whose bounds were tested during traversal.
+extern StatCounter bvhNodeVisits;
+
+// Cache lines of the BVH nodes touched during traversal.
+extern CacheSimulator bvhNodeCache;
+
+// Sphere hits found by intersect() that were closer than the best so far.
+// Shading each of them right away took an atan2 and an asin for the uv.
+extern StatCounter sphereHitCandidates;
+
+// Sphere uvs computed by finalizeHit(), once per closest hit.
+extern StatCounter sphereUVEvaluations;
+
+// Nodes visited by the ray packets, and the lanes that hit their bounds.
+// Their ratio over the packet size is the utilization of the SIMD lanes.
+extern StatCounter packetNodeVisits;
+extern StatCounter packetActiveLanes;
+
+// The counters in the traversal loops are only compiled in with STATS_SUPPORT.
+#ifdef STATS_ENABLED
+    #define STATS_ADD(counter, n) (counter).add(n)
+    #define STATS_TOUCH(cache, object) (cache).access(object, sizeof(*(object)))
+#else
+    #define STATS_ADD(counter, n)
+    #define STATS_TOUCH(cache, object)
+#endif // STATS_ENABLED
@@ -0,0 +1,165 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <algorithm>
+#include <math.h>
+
+#include "util/tilescheduler.h"
+
+// Distance of x, y along the Hilbert curve through an n*n grid, n a power
+// of two.
+static uint32_t hilbertIndex(uint32_t n, uint32_t x, uint32_t y)
+{
+
+    uint32_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2)
+    {
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t ry = (y & s) ? 1 : 0;
+        d += s * s * ((3 * rx) ^ ry);
+
+        // Rotate the quadrant so that the curve inside it starts at its origin.
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+
+    return d;
+
+}
+
+TileScheduler::TileScheduler(int width, int height, int tileWidth, int tileHeight, TileOrder order)
+{
+
+    stats = TileSchedulerStats();
+
+    int columns = (width + tileWidth - 1) / tileWidth;
+    int rows = (height + tileHeight - 1) / tileHeight;
+    struct Key
+    {
+        float key;
+        float angle;
+        Tile tile;
+    };
+    std::vector<Key> keys;
+    keys.reserve(static_cast<size_t>(columns * rows));
+
+    uint32_t n = 1;
+    while (n < static_cast<uint32_t>(std::max(columns, rows)))
+        n *= 2;
+    float centerX = 0.5f * (columns - 1);
+    float centerY = 0.5f * (rows - 1);
+
+    for (int row = 0; row < rows; row++)
+    {
+        for (int column = 0; column < columns; column++)
+        {
+            Key k;
+            k.tile.x0 = column * tileWidth;
+            k.tile.y0 = row * tileHeight;
+            k.tile.x1 = std::min(k.tile.x0 + tileWidth, width);
+            k.tile.y1 = std::min(k.tile.y0 + tileHeight, height);
+            k.angle = 0.0f;
+            switch (order)
+            {
+                case TILE_ORDER_HILBERT:
+                    k.key = float(hilbertIndex(n, column, row));
+                    break;
+                case TILE_ORDER_SPIRAL:
+                {
+                    // Square rings, each walked around counterclockwise.
+                    float dx = column - centerX;
+                    float dy = row - centerY;
+                    k.key = floorf(std::max(fabsf(dx), fabsf(dy)));
+                    k.angle = atan2f(dy, dx);
+                    break;
+                }
+                case TILE_ORDER_SCANLINE:
+                default:
+                    k.key = float(row * columns + column);
+                    break;
+            }
+            keys.push_back(k);
+        }
+    }
+
+    std::stable_sort(keys.begin(), keys.end(), [](const Key& a, const Key& b)
+    {
+        return a.key < b.key || (a.key == b.key && a.angle < b.angle);
+    });
+    ordered.reserve(keys.size());
+    for (const Key& k : keys)
+        ordered.push_back(k.tile);
+
+}
+
+bool TileScheduler::pop(Range& range, int& tile)
+{
+
+    uint64_t bounds = range.bounds.load();
+    for (;;)
+    {
+        uint32_t begin = static_cast<uint32_t>(bounds);
+        uint32_t end = static_cast<uint32_t>(bounds >> 32);
+        if (begin >= end)
+            return false;
+        if (range.bounds.compare_exchange_weak(bounds, pack(begin + 1, end)))
+        {
+            tile = static_cast<int>(begin);
+            return true;
+        }
+    }
+
+}
+
+// Only the owner of an empty range stores into it, a thief never touches
+// an empty range, so the store after a steal can't lose tiles.
+bool TileScheduler::steal(Range* ranges, int thread, int threadCount, int& tile)
+{
+
+    for (int k = 1; k < threadCount; k++)
+    {
+        Range& victim = ranges[(thread + k) % threadCount];
+        uint64_t bounds = victim.bounds.load();
+        for (;;)
+        {
+            uint32_t begin = static_cast<uint32_t>(bounds);
+            uint32_t end = static_cast<uint32_t>(bounds >> 32);
+            if (begin >= end)
+                break;
+            uint32_t middle = begin + (end - begin) / 2;
+            if (victim.bounds.compare_exchange_weak(bounds, pack(begin, middle)))
+            {
+                tile = static_cast<int>(middle);
+                ranges[thread].bounds.store(pack(middle + 1, end));
+                return true;
+            }
+        }
+    }
+
+    return false;
+
+}
@@ -0,0 +1,135 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+#include <omp.h>
+
+// Order in which a TileScheduler deals out the tiles of a frame.
+enum TileOrder
+{
+    TILE_ORDER_SCANLINE,    // row after row from the bottom
+    TILE_ORDER_HILBERT,     // along a Hilbert curve, consecutive tiles are neighbours
+    TILE_ORDER_SPIRAL       // in rings from the center out, the center shows up first
+};
+
+// Pixels [x0, x1) x [y0, y1) of a frame.
+struct Tile
+{
+
+    int x0, y0;
+    int x1, y1;
+
+};
+
+struct TileSchedulerStats
+{
+
+    long long tiles;            // rendered
+    long long steals;           // tile ranges taken over from another thread
+
+};
+
+// Renders the tiles of a frame on the OpenMP threads in one parallel
+// region. The tiles in order are split into one contiguous range per
+// thread, so that every thread works through a compact part of the frame.
+// A thread that runs out steals the upper half of the range of another
+// thread. Each range is [begin, end) packed into one atomic word, which its
+// owner advances from the front and thieves cut from the back, both with a
+// compare and swap.
+class TileScheduler
+{
+
+    public:
+
+        TileScheduler(int width, int height, int tileWidth, int tileHeight,
+                      TileOrder order = TILE_ORDER_HILBERT);
+
+        // Calls renderTile(tile) once for every tile.
+        template <typename RenderTile>
+        void run(RenderTile renderTile);
+
+        const std::vector<Tile>& tiles() const
+        {
+            return ordered;
+        }
+
+        TileSchedulerStats stats;
+
+    private:
+
+        // Padded to a cache line, the ranges are written by different threads.
+        struct Range
+        {
+            std::atomic<uint64_t> bounds;
+            char padding[64 - sizeof(std::atomic<uint64_t>)];
+        };
+
+        static uint64_t pack(uint32_t begin, uint32_t end)
+        {
+            return static_cast<uint64_t>(end) << 32 | begin;
+        }
+
+        static bool pop(Range& range, int& tile);
+        static bool steal(Range* ranges, int thread, int threadCount, int& tile);
+
+        std::vector<Tile> ordered;
+
+};
+
+template <typename RenderTile>
+void TileScheduler::run(RenderTile renderTile)
+{
+
+    int tileCount = static_cast<int>(ordered.size());
+    std::vector<Range> ranges(static_cast<size_t>(omp_get_max_threads()));
+    long long steals = 0;
+
+    #pragma omp parallel reduction(+:steals)
+    {
+        int threadCount = omp_get_num_threads();
+        int thread = omp_get_thread_num();
+        uint32_t begin = static_cast<uint32_t>(static_cast<long long>(tileCount) * thread / threadCount);
+        uint32_t end = static_cast<uint32_t>(static_cast<long long>(tileCount) * (thread + 1) / threadCount);
+        ranges[thread].bounds.store(pack(begin, end));
+        #pragma omp barrier
+
+        int tile;
+        for (;;)
+        {
+            if (pop(ranges[thread], tile))
+                renderTile(ordered[tile]);
+            else if (steal(ranges.data(), thread, threadCount, tile))
+            {
+                steals++;
+                renderTile(ordered[tile]);
+            }
+            else
+                break;
+        }
+    }
+
+    stats.tiles += tileCount;
+    stats.steals += steals;
+
+}
@@ -0,0 +1,143 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "util/vec3.h"
+
+// Affine transform stored as the upper 3x4 part of a 4x4 matrix.
+class Transform
+{
+
+    public:
+
+        float m[3][4];
+
+        CUDA_HOSTDEV Transform()
+        {
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 4; j++)
+                    m[i][j] = i == j ? 1.0f : 0.0f;
+        }
+
+        CUDA_HOSTDEV static Transform translate(const Vec3& t)
+        {
+            Transform r;
+            r.m[0][3] = t.x();
+            r.m[1][3] = t.y();
+            r.m[2][3] = t.z();
+            return r;
+        }
+
+        CUDA_HOSTDEV static Transform scale(const Vec3& s)
+        {
+            Transform r;
+            r.m[0][0] = s.x();
+            r.m[1][1] = s.y();
+            r.m[2][2] = s.z();
+            return r;
+        }
+
+        // Rotation by angle degrees around axis.
+        CUDA_HOSTDEV static Transform rotate(const Vec3& axis, float angle)
+        {
+            Vec3 a = unitVector(axis);
+            float radians = angle * float(M_PI) / 180.0f;
+            float s = sinf(radians);
+            float c = cosf(radians);
+
+            Transform r;
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    r.m[i][j] = a[i] * a[j] * (1.0f - c) + (i == j ? c : 0.0f);
+            r.m[0][1] -= a.z() * s;
+            r.m[0][2] += a.y() * s;
+            r.m[1][0] += a.z() * s;
+            r.m[1][2] -= a.x() * s;
+            r.m[2][0] -= a.y() * s;
+            r.m[2][1] += a.x() * s;
+            return r;
+        }
+
+        // Applies t first, then this transform.
+        CUDA_HOSTDEV Transform operator*(const Transform& t) const
+        {
+            Transform r;
+            for (int i = 0; i < 3; i++)
+            {
+                for (int j = 0; j < 4; j++)
+                {
+                    r.m[i][j] = m[i][0] * t.m[0][j] + m[i][1] * t.m[1][j] + m[i][2] * t.m[2][j];
+                    if (j == 3)
+                        r.m[i][j] += m[i][3];
+                }
+            }
+            return r;
+        }
+
+        CUDA_HOSTDEV Transform inverse() const
+        {
+            // Inverse of the linear part from its cofactors.
+            Transform r;
+            r.m[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+            r.m[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+            r.m[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+            r.m[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+            r.m[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+            r.m[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+            r.m[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+            r.m[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+            r.m[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+            float det = m[0][0] * r.m[0][0] + m[0][1] * r.m[1][0] + m[0][2] * r.m[2][0];
+            float invDet = 1.0f / det;
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    r.m[i][j] *= invDet;
+
+            for (int i = 0; i < 3; i++)
+                r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] + r.m[i][2] * m[2][3]);
+
+            return r;
+        }
+
+        CUDA_HOSTDEV Vec3 point(const Vec3& p) const
+        {
+            return Vec3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                        m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                        m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+        }
+
+        CUDA_HOSTDEV Vec3 vector(const Vec3& v) const
+        {
+            return Vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                        m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                        m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+        }
+
+        // Transforms a normal by the transpose of this matrix, so called on
+        // the inverse transform it maps object space normals to world space.
+        CUDA_HOSTDEV Vec3 normal(const Vec3& n) const
+        {
+            return Vec3(m[0][0] * n.x() + m[1][0] * n.y() + m[2][0] * n.z(),
+                        m[0][1] * n.x() + m[1][1] * n.y() + m[2][1] * n.z(),
+                        m[0][2] * n.x() + m[1][2] * n.y() + m[2][2] * n.z());
+        }
+
+};
@@ -0,0 +1,326 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <string.h>
+
+#include "util/vec3.h"
+
+// The SSE backend is used on the CPU with SIMD_SUPPORT, four plain floats
+// without it and in device code. Both round the same way, only madd() may
+// differ in the last bit where the CPU fuses it.
+#if defined(SIMD_ENABLED) && !defined(__CUDA_ARCH__)
+    #define VEC4_SSE
+    #include <immintrin.h>
+#endif // SIMD_ENABLED
+
+// Four float lanes on a 16 byte boundary for the hot math of the CPU path,
+// e.g. the slab tests of the boxes. Vec3 stays three packed floats, the node
+// and mesh layouts depend on it, so Vec4 values are loaded from Vec3 and
+// float arrays where they are needed. Comparisons return masks with all bits
+// of a lane set or clear, for select() and signMask().
+class alignas(16) Vec4
+{
+
+    public:
+
+        CUDA_HOSTDEV Vec4() {}
+        CUDA_HOSTDEV Vec4(float x, float y, float z, float w);
+        CUDA_HOSTDEV explicit Vec4(float s);
+        CUDA_HOSTDEV explicit Vec4(const Vec3& v, float w = 0.0f);
+
+        // Four floats from any address.
+        CUDA_HOSTDEV static Vec4 load(const float* p);
+        // x, y and z with w cleared, p must have four readable floats. Other
+        // members loaded as w could be denormals, which are slow to compute.
+        CUDA_HOSTDEV static Vec4 load3(const float* p);
+        CUDA_HOSTDEV void store(float* p) const;
+
+        CUDA_HOSTDEV float x() const { return (*this)[0]; }
+        CUDA_HOSTDEV float y() const { return (*this)[1]; }
+        CUDA_HOSTDEV float z() const { return (*this)[2]; }
+        CUDA_HOSTDEV float w() const { return (*this)[3]; }
+        CUDA_HOSTDEV float operator[](int i) const;
+
+        CUDA_HOSTDEV Vec3 xyz() const
+        {
+            return Vec3(x(), y(), z());
+        }
+
+#ifdef VEC4_SSE
+        explicit Vec4(__m128 v) : v(v) {}
+
+        __m128 v;
+#else
+        float e[4];
+#endif // VEC4_SSE
+
+};
+
+#ifdef VEC4_SSE
+
+inline Vec4::Vec4(float x, float y, float z, float w) : v(_mm_set_ps(w, z, y, x)) {}
+inline Vec4::Vec4(float s) : v(_mm_set1_ps(s)) {}
+inline Vec4::Vec4(const Vec3& a, float w) : v(_mm_set_ps(w, a.z(), a.y(), a.x())) {}
+
+inline Vec4 Vec4::load(const float* p)
+{
+    return Vec4(_mm_loadu_ps(p));
+}
+
+inline Vec4 Vec4::load3(const float* p)
+{
+    return Vec4(_mm_and_ps(_mm_loadu_ps(p), _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1))));
+}
+
+inline void Vec4::store(float* p) const
+{
+    _mm_storeu_ps(p, v);
+}
+
+inline float Vec4::operator[](int i) const
+{
+    alignas(16) float e[4];
+    _mm_store_ps(e, v);
+    return e[i];
+}
+
+inline Vec4 operator+(const Vec4& a, const Vec4& b) { return Vec4(_mm_add_ps(a.v, b.v)); }
+inline Vec4 operator-(const Vec4& a, const Vec4& b) { return Vec4(_mm_sub_ps(a.v, b.v)); }
+inline Vec4 operator*(const Vec4& a, const Vec4& b) { return Vec4(_mm_mul_ps(a.v, b.v)); }
+inline Vec4 operator/(const Vec4& a, const Vec4& b) { return Vec4(_mm_div_ps(a.v, b.v)); }
+inline Vec4 operator*(const Vec4& a, float t) { return Vec4(_mm_mul_ps(a.v, _mm_set1_ps(t))); }
+inline Vec4 operator*(float t, const Vec4& a) { return Vec4(_mm_mul_ps(_mm_set1_ps(t), a.v)); }
+
+// a < b ? a : b per lane, b where a is NaN.
+inline Vec4 vmin(const Vec4& a, const Vec4& b) { return Vec4(_mm_min_ps(a.v, b.v)); }
+inline Vec4 vmax(const Vec4& a, const Vec4& b) { return Vec4(_mm_max_ps(a.v, b.v)); }
+
+inline Vec4 sqrt(const Vec4& a) { return Vec4(_mm_sqrt_ps(a.v)); }
+
+// 1/a, exactly rounded.
+inline Vec4 rcp(const Vec4& a) { return Vec4(_mm_div_ps(_mm_set1_ps(1.0f), a.v)); }
+
+// a*b + c
+inline Vec4 madd(const Vec4& a, const Vec4& b, const Vec4& c)
+{
+#ifdef __FMA__
+    return Vec4(_mm_fmadd_ps(a.v, b.v, c.v));
+#else
+    return Vec4(_mm_add_ps(_mm_mul_ps(a.v, b.v), c.v));
+#endif // __FMA__
+}
+
+inline Vec4 lessThan(const Vec4& a, const Vec4& b) { return Vec4(_mm_cmplt_ps(a.v, b.v)); }
+
+// mask ? a : b per lane
+inline Vec4 select(const Vec4& mask, const Vec4& a, const Vec4& b)
+{
+#ifdef __SSE4_1__
+    return Vec4(_mm_blendv_ps(b.v, a.v, mask.v));
+#else
+    return Vec4(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)));
+#endif // __SSE4_1__
+}
+
+// Bit i is the sign of lane i.
+inline int signMask(const Vec4& a) { return _mm_movemask_ps(a.v); }
+
+// Sums of the x, y and z lanes, w is ignored.
+inline float dot3(const Vec4& a, const Vec4& b)
+{
+    __m128 p = _mm_mul_ps(a.v, b.v);
+    __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(p, y), z));
+}
+
+// w of the result is 0.
+inline Vec4 cross3(const Vec4& a, const Vec4& b)
+{
+    __m128 aYZX = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYZX = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a.v, bYZX), _mm_mul_ps(aYZX, b.v));
+    return Vec4(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+// Largest of init and the x, y and z lanes in this order, skipping NaN lanes
+// like the scalar "t > tMin ? t : tMin" of a slab test.
+inline float hmax3(const Vec4& a, float init)
+{
+    __m128 m = _mm_max_ss(a.v, _mm_set_ss(init));
+    m = _mm_max_ss(_mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 1, 1, 1)), m);
+    m = _mm_max_ss(_mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 2, 2, 2)), m);
+    return _mm_cvtss_f32(m);
+}
+
+inline float hmin3(const Vec4& a, float init)
+{
+    __m128 m = _mm_min_ss(a.v, _mm_set_ss(init));
+    m = _mm_min_ss(_mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 1, 1, 1)), m);
+    m = _mm_min_ss(_mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 2, 2, 2)), m);
+    return _mm_cvtss_f32(m);
+}
+
+#else
+
+inline CUDA_HOSTDEV Vec4::Vec4(float x, float y, float z, float w)
+{
+    e[0] = x;
+    e[1] = y;
+    e[2] = z;
+    e[3] = w;
+}
+
+inline CUDA_HOSTDEV Vec4::Vec4(float s)
+{
+    e[0] = e[1] = e[2] = e[3] = s;
+}
+
+inline CUDA_HOSTDEV Vec4::Vec4(const Vec3& a, float w)
+{
+    e[0] = a.x();
+    e[1] = a.y();
+    e[2] = a.z();
+    e[3] = w;
+}
+
+// Copied like _mm_loadu_ps, the lanes may overlap other members, e.g. the
+// offset after the bounds of a LinearBVHNode.
+inline CUDA_HOSTDEV Vec4 Vec4::load(const float* p)
+{
+    Vec4 a;
+    memcpy(a.e, p, sizeof(a.e));
+    return a;
+}
+
+inline CUDA_HOSTDEV Vec4 Vec4::load3(const float* p)
+{
+    return Vec4(p[0], p[1], p[2], 0.0f);
+}
+
+inline CUDA_HOSTDEV void Vec4::store(float* p) const
+{
+    memcpy(p, e, sizeof(e));
+}
+
+inline CUDA_HOSTDEV float Vec4::operator[](int i) const
+{
+    return e[i];
+}
+
+inline CUDA_HOSTDEV Vec4 operator+(const Vec4& a, const Vec4& b) { return Vec4(a.e[0] + b.e[0], a.e[1] + b.e[1], a.e[2] + b.e[2], a.e[3] + b.e[3]); }
+inline CUDA_HOSTDEV Vec4 operator-(const Vec4& a, const Vec4& b) { return Vec4(a.e[0] - b.e[0], a.e[1] - b.e[1], a.e[2] - b.e[2], a.e[3] - b.e[3]); }
+inline CUDA_HOSTDEV Vec4 operator*(const Vec4& a, const Vec4& b) { return Vec4(a.e[0] * b.e[0], a.e[1] * b.e[1], a.e[2] * b.e[2], a.e[3] * b.e[3]); }
+inline CUDA_HOSTDEV Vec4 operator/(const Vec4& a, const Vec4& b) { return Vec4(a.e[0] / b.e[0], a.e[1] / b.e[1], a.e[2] / b.e[2], a.e[3] / b.e[3]); }
+inline CUDA_HOSTDEV Vec4 operator*(const Vec4& a, float t) { return a * Vec4(t); }
+inline CUDA_HOSTDEV Vec4 operator*(float t, const Vec4& a) { return Vec4(t) * a; }
+
+// a < b ? a : b per lane, b where a is NaN.
+inline CUDA_HOSTDEV Vec4 vmin(const Vec4& a, const Vec4& b)
+{
+    return Vec4(a.e[0] < b.e[0] ? a.e[0] : b.e[0], a.e[1] < b.e[1] ? a.e[1] : b.e[1],
+                a.e[2] < b.e[2] ? a.e[2] : b.e[2], a.e[3] < b.e[3] ? a.e[3] : b.e[3]);
+}
+
+inline CUDA_HOSTDEV Vec4 vmax(const Vec4& a, const Vec4& b)
+{
+    return Vec4(a.e[0] > b.e[0] ? a.e[0] : b.e[0], a.e[1] > b.e[1] ? a.e[1] : b.e[1],
+                a.e[2] > b.e[2] ? a.e[2] : b.e[2], a.e[3] > b.e[3] ? a.e[3] : b.e[3]);
+}
+
+inline CUDA_HOSTDEV Vec4 sqrt(const Vec4& a)
+{
+    return Vec4(sqrtf(a.e[0]), sqrtf(a.e[1]), sqrtf(a.e[2]), sqrtf(a.e[3]));
+}
+
+// 1/a, exactly rounded.
+inline CUDA_HOSTDEV Vec4 rcp(const Vec4& a) { return Vec4(1.0f) / a; }
+
+// a*b + c
+inline CUDA_HOSTDEV Vec4 madd(const Vec4& a, const Vec4& b, const Vec4& c) { return a*b + c; }
+
+// Lanes with all bits set, as the SSE compares return them.
+inline CUDA_HOSTDEV float maskLane(bool set)
+{
+    unsigned int bits = set ? 0xffffffffu : 0u;
+    float lane;
+    memcpy(&lane, &bits, sizeof(lane));
+    return lane;
+}
+
+inline CUDA_HOSTDEV bool laneSign(float lane)
+{
+    unsigned int bits;
+    memcpy(&bits, &lane, sizeof(bits));
+    return (bits >> 31) != 0;
+}
+
+inline CUDA_HOSTDEV Vec4 lessThan(const Vec4& a, const Vec4& b)
+{
+    return Vec4(maskLane(a.e[0] < b.e[0]), maskLane(a.e[1] < b.e[1]),
+                maskLane(a.e[2] < b.e[2]), maskLane(a.e[3] < b.e[3]));
+}
+
+// mask ? a : b per lane
+inline CUDA_HOSTDEV Vec4 select(const Vec4& mask, const Vec4& a, const Vec4& b)
+{
+    return Vec4(laneSign(mask.e[0]) ? a.e[0] : b.e[0], laneSign(mask.e[1]) ? a.e[1] : b.e[1],
+                laneSign(mask.e[2]) ? a.e[2] : b.e[2], laneSign(mask.e[3]) ? a.e[3] : b.e[3]);
+}
+
+// Bit i is the sign of lane i.
+inline CUDA_HOSTDEV int signMask(const Vec4& a)
+{
+    return (laneSign(a.e[0]) ? 1 : 0) | (laneSign(a.e[1]) ? 2 : 0) |
+           (laneSign(a.e[2]) ? 4 : 0) | (laneSign(a.e[3]) ? 8 : 0);
+}
+
+// Sums of the x, y and z lanes, w is ignored.
+inline CUDA_HOSTDEV float dot3(const Vec4& a, const Vec4& b)
+{
+    return a.e[0]*b.e[0] + a.e[1]*b.e[1] + a.e[2]*b.e[2];
+}
+
+// w of the result is 0.
+inline CUDA_HOSTDEV Vec4 cross3(const Vec4& a, const Vec4& b)
+{
+    return Vec4(a.e[1]*b.e[2] - a.e[2]*b.e[1],
+                a.e[2]*b.e[0] - a.e[0]*b.e[2],
+                a.e[0]*b.e[1] - a.e[1]*b.e[0], 0.0f);
+}
+
+// Largest of init and the x, y and z lanes in this order, skipping NaN lanes
+// like the scalar "t > tMin ? t : tMin" of a slab test.
+inline CUDA_HOSTDEV float hmax3(const Vec4& a, float init)
+{
+    float m = a.e[0] > init ? a.e[0] : init;
+    m = a.e[1] > m ? a.e[1] : m;
+    return a.e[2] > m ? a.e[2] : m;
+}
+
+inline CUDA_HOSTDEV float hmin3(const Vec4& a, float init)
+{
+    float m = a.e[0] < init ? a.e[0] : init;
+    m = a.e[1] < m ? a.e[1] : m;
+    return a.e[2] < m ? a.e[2] : m;
+}
+
+#endif // VEC4_SSE
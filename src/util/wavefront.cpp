@@ -0,0 +1,237 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+
+#include "util/renderer.h"
+#include "util/wavefront.h"
+
+#ifndef CUDA_ENABLED
+
+void Wavefront::add(const Ray& r, const RandomGenerator& rng, int slot)
+{
+
+    Path path;
+    path.ray = r;
+    path.attenuation = Vec3(1.0f, 1.0f, 1.0f);
+    path.rng = rng;
+    path.slot = slot;
+    paths.push_back(path);
+
+}
+
+void Wavefront::resetStats()
+{
+
+    stats.paths = 0;
+    stats.rays = 0;
+    for (int b = 0; b < wavefrontBins; b++)
+        stats.shaded[b] = 0;
+    stats.bounces = 0;
+    stats.reordered = 0;
+    stats.reorderSeconds = 0.0;
+    stats.intersectSeconds = 0.0;
+    stats.shadeSeconds = 0.0;
+    stats.compactSeconds = 0.0;
+
+}
+
+// Scatters the paths order[begin, end) whose hits are all of Kernel::type.
+template <typename Kernel>
+void Wavefront::shadeBin(const MaterialTable& table, int begin, int end, Vec3* colors)
+{
+
+    for (int i = begin; i < end; i++)
+    {
+        int k = order[i];
+        Path& path = paths[k];
+        Vec3 attenuation;
+        Ray scattered;
+        if (Kernel::scatter(table, hits[k].materialId, path.rng, path.ray, hits[k], attenuation, scattered))
+        {
+            path.attenuation *= attenuation;
+            path.ray = scattered;
+        }
+        else
+        {
+            colors[path.slot] = Vec3(0.0f, 0.0f, 0.0f);
+            bin[k] = -1;
+        }
+    }
+
+}
+
+void Wavefront::shadeVirtual(int begin, int end, Vec3* colors)
+{
+
+    for (int i = begin; i < end; i++)
+    {
+        int k = order[i];
+        Path& path = paths[k];
+        Vec3 attenuation;
+        Ray scattered;
+        if (hits[k].matPtr->scatter(path.rng, path.ray, hits[k], attenuation, scattered))
+        {
+            path.attenuation *= attenuation;
+            path.ray = scattered;
+        }
+        else
+        {
+            colors[path.slot] = Vec3(0.0f, 0.0f, 0.0f);
+            bin[k] = -1;
+        }
+    }
+
+}
+
+// Bits of the origin cell in the reorder key, 9 per axis. The direction
+// octant goes above them, so rays are grouped by octant first.
+const int reorderCellBits = 27;
+
+// Sorts every reorderBatch paths by the cell of their origin in bounds and
+// the octant of their direction.
+void Wavefront::reorder(const AABB& bounds)
+{
+
+    int n = static_cast<int>(paths.size());
+    Vec3 extent = bounds.max() - bounds.min();
+    Vec3 scale(extent.x() > 0.0f ? 1.0f / extent.x() : 0.0f,
+               extent.y() > 0.0f ? 1.0f / extent.y() : 0.0f,
+               extent.z() > 0.0f ? 1.0f / extent.z() : 0.0f);
+
+    sorted.resize(n);
+    for (int begin = 0; begin < n; begin += reorderBatch)
+    {
+        int end = std::min(begin + reorderBatch, n);
+        keys.resize(end - begin);
+        for (int k = begin; k < end; k++)
+        {
+            const Ray& r = paths[k].ray;
+            uint64_t octant = (r.direction().x() < 0.0f ? 4 : 0) |
+                              (r.direction().y() < 0.0f ? 2 : 0) |
+                              (r.direction().z() < 0.0f ? 1 : 0);
+            keys[k - begin].code = octant << reorderCellBits |
+                                   mortonCode((r.origin() - bounds.min()) * scale, reorderCellBits);
+            keys[k - begin].index = k;
+        }
+        std::sort(keys.begin(), keys.end(), [](const MortonPrimitive& a, const MortonPrimitive& b) { return a.code < b.code; });
+        for (int k = begin; k < end; k++)
+            sorted[k] = paths[keys[k - begin].index];
+    }
+    paths.swap(sorted);
+
+}
+
+void Wavefront::trace(const Renderer& renderer, Hitable* world, Vec3* colors)
+{
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    const MaterialTable* table = renderer.materials;
+    stats.paths += static_cast<long long>(paths.size());
+
+    AABB bounds;
+    bool reordering = reorderBatch > 1 && world->boundingBox(0.0f, 1.0f, bounds);
+
+    // The paths still alive after the last bounce are black like in color().
+    for (const Path& path : paths)
+        colors[path.slot] = Vec3(0.0f, 0.0f, 0.0f);
+
+    for (int depth = 0; depth < 50 && !paths.empty(); depth++)
+    {
+        int n = static_cast<int>(paths.size());
+        stats.rays += n;
+        stats.bounces = std::max(stats.bounces, depth + 1);
+
+        // The primary rays are coherent in image order already.
+        auto start = Clock::now();
+        if (reordering && depth > 0)
+        {
+            reorder(bounds);
+            stats.reordered += n;
+        }
+        auto reordered = Clock::now();
+
+        // Intersect, the paths that leave the scene end with the sky.
+        hits.resize(n);
+        bin.resize(n);
+        int binCount[wavefrontBins] = { 0 };
+        for (int k = 0; k < n; k++)
+        {
+            Path& path = paths[k];
+            HitRecord& rec = hits[k];
+            if (!world->hit(path.ray, 0.001f, FLT_MAX, rec))
+            {
+                colors[path.slot] = path.attenuation * renderer.background(path.ray);
+                bin[k] = -1;
+                continue;
+            }
+            bin[k] = table && rec.materialId != invalidMaterialId ? static_cast<int>(table->material(rec.materialId).type)
+                                                                   : wavefrontVirtualBin;
+            binCount[bin[k]]++;
+        }
+        auto intersected = Clock::now();
+
+        // Bin the hits by material with a counting sort, then shade every
+        // bin with its kernel.
+        int binStart[wavefrontBins + 1];
+        binStart[0] = 0;
+        for (int b = 0; b < wavefrontBins; b++)
+        {
+            binStart[b + 1] = binStart[b] + binCount[b];
+            stats.shaded[b] += binCount[b];
+        }
+        int next[wavefrontBins];
+        for (int b = 0; b < wavefrontBins; b++)
+            next[b] = binStart[b];
+        order.resize(binStart[wavefrontBins]);
+        for (int k = 0; k < n; k++)
+            if (bin[k] >= 0)
+                order[next[bin[k]]++] = k;
+
+        if (table)
+        {
+            shadeBin<LambertianKernel>(*table, binStart[MATERIAL_LAMBERTIAN], binStart[MATERIAL_LAMBERTIAN + 1], colors);
+            shadeBin<MetalKernel>(*table, binStart[MATERIAL_METAL], binStart[MATERIAL_METAL + 1], colors);
+            shadeBin<DielectricKernel>(*table, binStart[MATERIAL_DIELECTRIC], binStart[MATERIAL_DIELECTRIC + 1], colors);
+        }
+        shadeVirtual(binStart[wavefrontVirtualBin], binStart[wavefrontVirtualBin + 1], colors);
+        auto shaded = Clock::now();
+
+        // Compact the live paths to the front, keeping their order.
+        int alive = 0;
+        for (int k = 0; k < n; k++)
+            if (bin[k] >= 0)
+                paths[alive++] = paths[k];
+        paths.resize(alive);
+        auto compacted = Clock::now();
+
+        stats.reorderSeconds += std::chrono::duration<double>(reordered - start).count();
+        stats.intersectSeconds += std::chrono::duration<double>(intersected - reordered).count();
+        stats.shadeSeconds += std::chrono::duration<double>(shaded - intersected).count();
+        stats.compactSeconds += std::chrono::duration<double>(compacted - shaded).count();
+    }
+
+    paths.clear();
+
+}
+
+#endif // CUDA_ENABLED
@@ -0,0 +1,106 @@
+/* MIT License
+Copyright (c) 2018 Biro Eniko
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "hitables/hitable.h"
+#include "hitables/morton.h"
+#include "materials/materialtable.h"
+#include "util/randomgenerator.h"
+
+class Renderer;
+
+// Bins of the shade stage, the MaterialTypes and the hits without a bound
+// material, which are shaded through the vtable.
+const int wavefrontBins = 4;
+const int wavefrontVirtualBin = 3;
+
+struct WavefrontStats
+{
+
+    long long paths;                        // started
+    long long rays;                         // intersected, one per path and bounce
+    long long shaded[wavefrontBins];        // hits shaded per bin
+    int bounces;                            // stage rounds until every path ended
+    long long reordered;                    // secondary rays sorted before intersecting
+    double reorderSeconds;
+    double intersectSeconds;
+    double shadeSeconds;                    // binning and shading
+    double compactSeconds;
+
+};
+
+// Path tracer that moves a batch of paths through stages instead of tracing
+// one path after another. Every bounce of all live paths is intersected
+// first, then the hits are binned by material type and each bin is shaded
+// with its MaterialKernel, and the ended paths are compacted away. Each stage
+// runs one kind of code over contiguous arrays. Every path keeps its own
+// random generator, so the colors are the ones of Renderer::color().
+class Wavefront
+{
+
+    public:
+
+        Wavefront()
+        {
+            resetStats();
+        }
+
+        // Queues a path starting with r, its color goes to colors[slot] of
+        // trace().
+        void add(const Ray& r, const RandomGenerator& rng, int slot);
+
+        // Traces the queued paths to their end and writes their colors.
+        void trace(const Renderer& renderer, Hitable* world, Vec3* colors);
+
+        void resetStats();
+
+        // Secondary rays sorted per chunk of this many paths before they are
+        // intersected, 0 keeps the path order. Rays of a chunk then leave
+        // from nearby points in the same direction octant and walk the same
+        // BVH nodes. Larger chunks sort better but cost more to sort.
+        int reorderBatch = 0;
+
+        WavefrontStats stats;
+
+    private:
+
+        struct Path
+        {
+            Ray ray;
+            Vec3 attenuation;
+            RandomGenerator rng;
+            int slot;
+        };
+
+        template <typename Kernel>
+        void shadeBin(const MaterialTable& table, int begin, int end, Vec3* colors);
+        void shadeVirtual(int begin, int end, Vec3* colors);
+        void reorder(const AABB& bounds);
+
+        std::vector<Path> paths;
+        std::vector<HitRecord> hits;        // of paths[k]
+        std::vector<int> bin;               // of paths[k], -1 once it ended
+        std::vector<int> order;             // indices of the live paths grouped by bin
+        std::vector<MortonPrimitive> keys;  // of reorder()
+        std::vector<Path> sorted;
+
+};
@@ -192,6 +192,12 @@ struct Window
                                 windowCamera->translate(RIGHT, stepScale);
                             break;
 
+                            // Switch between the path tracer and the AO preview.
+                            case SDLK_o:
+                                windowRenderer->mode = windowRenderer->mode == PATH_TRACING ?
+                                                       AMBIENT_OCCLUSION : PATH_TRACING;
+                            break;
+
                             default:
                                 return;
                         }